@@ -0,0 +1,266 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Block device layer and RAM disks, see blk.h.
+   Requests come from a pool in boot_arena, so does the bounce buffer for
+   merged runs whose buffers don't line up. Without blk_init only the
+   synchronous calls work.
+*/
+#include <common.h>
+#include <blk.h>
+#include <log.h>
+#include <mem.h>
+#include <trace.h>
+
+#define BLK_WORDS (SD_BLOCK_SIZE / 4)
+
+static struct blk_dev* blk_devs[BLK_MAX_DEVS];
+static u32_t blk_num_devs = 0;
+static struct pool blk_req_pool;
+static u32_t* blk_bounce = NULL;
+
+static void blk_copy(u32_t* dst, const u32_t* src, u32_t words) {
+  u32_t i;
+
+  for (i = 0; i < words; i++) {
+    dst[i] = src[i];
+  }
+}
+
+/* set up the request pool and bounce buffer, after mem_init. returns 0 on
+   success */
+int blk_init(void) {
+  void* mem;
+
+  mem = arena_alloc(&boot_arena, BLK_MAX_REQS * sizeof(struct blk_req), 4);
+  blk_bounce = arena_alloc(&boot_arena, BLK_BOUNCE_BLOCKS * SD_BLOCK_SIZE, 32);
+  if (mem == NULL || blk_bounce == NULL) {
+    blk_bounce = NULL;
+    return 1;
+  }
+  return pool_init(&blk_req_pool, "blk_req", sizeof(struct blk_req), mem,
+                   BLK_MAX_REQS * sizeof(struct blk_req));
+}
+
+/* make a device known to blk_find, returns 1 when the table is full */
+int blk_register(struct blk_dev* dev) {
+  if (blk_num_devs == BLK_MAX_DEVS) {
+    return 1;
+  }
+  if (dev->max_blocks == 0) {
+    dev->max_blocks = BLK_BOUNCE_BLOCKS;
+  }
+  dev->queue = NULL;
+  blk_devs[blk_num_devs++] = dev;
+  return 0;
+}
+
+struct blk_dev* blk_find(const char* name) {
+  u32_t i, j;
+
+  for (i = 0; i < blk_num_devs; i++) {
+    for (j = 0; name[j] != '\0' && name[j] == blk_devs[i]->name[j]; j++) {}
+    if (name[j] == blk_devs[i]->name[j]) {
+      return blk_devs[i];
+    }
+  }
+  return NULL;
+}
+
+static int blk_in_range(struct blk_dev* dev, u32_t lba, u32_t count) {
+  return dev->blocks == 0 || (lba < dev->blocks && count <= dev->blocks - lba);
+}
+
+/* one transfer per max_blocks */
+static int blk_xfer(struct blk_dev* dev, u32_t dir, u32_t lba, u32_t count, u32_t* buf) {
+  u32_t n;
+  int err;
+
+  while (count != 0) {
+    n = count > dev->max_blocks ? dev->max_blocks : count;
+    if (dir == BLK_READ) {
+      trace_event(TRACE_BLK_XFER_READ, lba, n);
+      err = dev->ops->read(dev, lba, n, buf);
+    } else {
+      trace_event(TRACE_BLK_XFER_WRITE, lba, n);
+      err = dev->ops->write(dev, lba, n, buf);
+    }
+    dev->transfers++;
+    if (err) {
+      dev->errors++;
+      return 1;
+    }
+    lba += n;
+    count -= n;
+    buf += n * BLK_WORDS;
+  }
+  return 0;
+}
+
+/* queue a transfer of count blocks at lba, buf is word aligned and has to
+   stay valid until blk_run. returns 0 on success, 1 if the request is out of
+   range or a run it forced failed */
+int blk_submit(struct blk_dev* dev, u32_t dir, u32_t lba, u32_t count, u32_t* buf) {
+  struct blk_req *r, **p;
+  int err = 0;
+
+  if (count == 0) {
+    return 0;
+  }
+  if (!blk_in_range(dev, lba, count)) {
+    return 1;
+  }
+  /* ordering only matters where a write is involved */
+  for (r = dev->queue; r != NULL; r = r->next) {
+    if ((dir == BLK_WRITE || r->dir == BLK_WRITE) && r->lba < lba + count &&
+        lba < r->lba + r->count) {
+      err = blk_run(dev);
+      break;
+    }
+  }
+  r = pool_alloc(&blk_req_pool);
+  if (r == NULL) {
+    err |= blk_run(dev);
+    r = pool_alloc(&blk_req_pool);
+  }
+  if (r == NULL) {
+    /* no pool, do it now */
+    return err | blk_xfer(dev, dir, lba, count, buf);
+  }
+  r->dir = dir;
+  r->lba = lba;
+  r->count = count;
+  r->buf = buf;
+  /* behind any with the same lba */
+  for (p = &dev->queue; *p != NULL && (*p)->lba <= lba; p = &(*p)->next) {}
+  r->next = *p;
+  *p = r;
+  dev->reqs++;
+  return err;
+}
+
+/* dispatch everything queued in block order, merged where possible.
+   returns 0 if every transfer succeeded */
+int blk_run(struct blk_dev* dev) {
+  struct blk_req *first, *last, *r, *next;
+  u32_t start, end, new_end, direct, aligned, merged;
+  u32_t* buf;
+  int err = 0;
+
+  while (dev->queue != NULL) {
+    /* grow a run from the lowest request, as long as the next one of the
+       same direction starts inside it or right after it */
+    first = last = dev->queue;
+    start = first->lba;
+    end = first->lba + first->count;
+    direct = 1;
+    merged = 0;
+    for (r = first->next; r != NULL && r->dir == first->dir && r->lba <= end; r = r->next) {
+      new_end = r->lba + r->count > end ? r->lba + r->count : end;
+      aligned = direct && r->buf == first->buf + (r->lba - start) * BLK_WORDS;
+      if (new_end - start > dev->max_blocks ||
+          (!aligned && (blk_bounce == NULL || new_end - start > BLK_BOUNCE_BLOCKS))) {
+        break;
+      }
+      direct = aligned;
+      end = new_end;
+      last = r;
+      merged++;
+    }
+
+    buf = direct ? first->buf : blk_bounce;
+    if (!direct && first->dir == BLK_WRITE) {
+      for (r = first; r != last->next; r = r->next) {
+        blk_copy(blk_bounce + (r->lba - start) * BLK_WORDS, r->buf, r->count * BLK_WORDS);
+      }
+    }
+    if (blk_xfer(dev, first->dir, start, end - start, buf)) {
+      err = 1;
+    } else if (!direct && first->dir == BLK_READ) {
+      for (r = first; r != last->next; r = r->next) {
+        blk_copy(r->buf, blk_bounce + (r->lba - start) * BLK_WORDS, r->count * BLK_WORDS);
+      }
+    }
+    dev->merged += merged;
+    dev->bounced += !direct;
+
+    dev->queue = last->next;
+    for (r = first; r != dev->queue; r = next) {
+      next = r->next;
+      pool_free(&blk_req_pool, r);
+    }
+  }
+  return err;
+}
+
+/* read count blocks now, after anything queued. returns 0 on success */
+int blk_read(struct blk_dev* dev, u32_t lba, u32_t count, u32_t* buf) {
+  int err;
+
+  if (!blk_in_range(dev, lba, count)) {
+    return 1;
+  }
+  err = blk_run(dev);
+  dev->reqs++;
+  return blk_xfer(dev, BLK_READ, lba, count, buf) | err;
+}
+
+int blk_write(struct blk_dev* dev, u32_t lba, u32_t count, const u32_t* buf) {
+  int err;
+
+  if (!blk_in_range(dev, lba, count)) {
+    return 1;
+  }
+  err = blk_run(dev);
+  dev->reqs++;
+  return blk_xfer(dev, BLK_WRITE, lba, count, (u32_t*)buf) | err;
+}
+
+/* run the queue and have the device make it all persistent */
+int blk_flush(struct blk_dev* dev) {
+  int err;
+
+  err = blk_run(dev);
+  if (dev->ops->flush != NULL) {
+    err |= dev->ops->flush(dev);
+  }
+  return err;
+}
+
+void blk_print(void) {
+  struct blk_dev* dev;
+  u32_t i;
+
+  for (i = 0; i < blk_num_devs; i++) {
+    dev = blk_devs[i];
+    log_str(dev->name);
+    LOG2(": %u blocks, at most %u per transfer\r\n", dev->blocks, dev->max_blocks);
+    LOG3("  %u requests, %u transfers, %u merged", dev->reqs, dev->transfers, dev->merged);
+    LOG2(", %u bounced, %u errors\r\n", dev->bounced, dev->errors);
+  }
+}
+
+/* RAM disk, priv is the memory */
+static int ramdisk_read(struct blk_dev* dev, u32_t lba, u32_t count, u32_t* buf) {
+  blk_copy(buf, (u32_t*)dev->priv + lba * BLK_WORDS, count * BLK_WORDS);
+  return 0;
+}
+
+static int ramdisk_write(struct blk_dev* dev, u32_t lba, u32_t count, const u32_t* buf) {
+  blk_copy((u32_t*)dev->priv + lba * BLK_WORDS, buf, count * BLK_WORDS);
+  return 0;
+}
+
+static const struct blk_ops ramdisk_ops = {ramdisk_read, ramdisk_write, NULL};
+
+/* fill in and register dev as a RAM disk. returns 0 on success */
+int ramdisk_init(struct blk_dev* dev, const char* name, void* mem, u32_t blocks) {
+  if (mem == NULL || ((u32_t)mem & 0x3) || blocks == 0) {
+    return 1;
+  }
+  dev->name = name;
+  dev->ops = &ramdisk_ops;
+  dev->blocks = blocks;
+  dev->max_blocks = blocks;
+  dev->priv = mem;
+  dev->reqs = dev->transfers = dev->merged = dev->bounced = dev->errors = 0;
+  return blk_register(dev);
+}
@@ -0,0 +1,251 @@
+/* Copyright (c) 2023  Hunter Whyte
+  Host side self tests for the block layer (blk.c) on a RAM disk. Requests
+  are queued with blk_submit and dispatched with blk_run the way the loader
+  does, and after each test the data read back and the disk contents are
+  compared with a copy of the disk updated in submission order. The device
+  counters show whether requests were merged into one transfer, went through
+  the bounce buffer or forced an early run.
+  blk.c and mem.c are built for the host the same way boot_sim builds them,
+  buffers are static so their addresses fit a u32_t.
+
+  usage: ./blk_sim
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <blk.h>
+#include <common.h>
+#include <cpu.h>
+#include <mem.h>
+
+#define TEST_BLOCKS 64
+#define TEST_WORDS  (SD_BLOCK_SIZE / 4)
+
+/* what mem.c and trace.h expect from the rest of the loader */
+asm(".globl _ddr_load_start, _stack_limit\n"
+    ".set _ddr_load_start, 0\n"
+    ".set _stack_limit, 0\n");
+volatile u32_t trace_enabled = 0;
+volatile u32_t trace_head = 0;
+volatile u32_t irq_nesting = 0;
+
+u32_t sim_cycles(void) {
+  return 0;
+}
+
+u32_t sim_irq_save(void) {
+  return CPU_MODE_SYS;
+}
+
+void sim_irq_restore(u32_t cpsr) {
+  (void)cpsr;
+}
+
+void sim_wfi(void) {}
+
+u32_t sim_thread_frame(u32_t stack_top, void (*fn)(u32_t), u32_t arg, void (*ret)(void)) {
+  (void)fn;
+  (void)arg;
+  (void)ret;
+  return stack_top;
+}
+
+void log_emit(const char* fmt, u32_t nargs, u32_t a0, u32_t a1, u32_t a2) {
+  (void)nargs;
+  printf(fmt, a0, a1, a2);
+}
+
+void log_str(const char* s) {
+  fputs(s, stdout);
+}
+
+static u32_t disk[TEST_BLOCKS * TEST_WORDS];
+static u32_t shadow[TEST_BLOCKS * TEST_WORDS];
+static u32_t bufs[4][16 * TEST_WORDS];
+static u8_t arena_mem[BLK_BOUNCE_BLOCKS * SD_BLOCK_SIZE + 0x1000] __attribute__((aligned(32)));
+static struct blk_dev dev;
+static u32_t gen;
+static int failures;
+
+static void check(const char* name, u32_t got, u32_t expect) {
+  if (got != expect) {
+    printf("FAIL %s: got %u expected %u\n", name, got, expect);
+    failures++;
+  }
+}
+
+/* counters since the last call */
+static void check_counts(const char* name, u32_t transfers, u32_t merged, u32_t bounced) {
+  static u32_t t0, m0, b0;
+  char what[64];
+
+  snprintf(what, sizeof(what), "%s transfers", name);
+  check(what, dev.transfers - t0, transfers);
+  snprintf(what, sizeof(what), "%s merged", name);
+  check(what, dev.merged - m0, merged);
+  snprintf(what, sizeof(what), "%s bounced", name);
+  check(what, dev.bounced - b0, bounced);
+  check("errors", dev.errors, 0);
+  t0 = dev.transfers;
+  m0 = dev.merged;
+  b0 = dev.bounced;
+}
+
+static void check_disk(const char* name) {
+  if (memcmp(disk, shadow, sizeof(disk)) != 0) {
+    printf("FAIL %s: disk contents\n", name);
+    failures++;
+  }
+}
+
+/* compare count blocks of buf with the disk at lba as it was at submission */
+static void check_buf(const char* name, const u32_t* buf, const u32_t* expect, u32_t count) {
+  if (memcmp(buf, expect, count * SD_BLOCK_SIZE) != 0) {
+    printf("FAIL %s: data read\n", name);
+    failures++;
+  }
+}
+
+/* fresh contents for count blocks of buf, different each call */
+static void fill(u32_t* buf, u32_t count) {
+  u32_t i;
+
+  gen++;
+  for (i = 0; i < count * TEST_WORDS; i++) {
+    buf[i] = (gen << 24) ^ (i * 0x9E3779B9);
+  }
+}
+
+static void submit_write(u32_t lba, u32_t count, u32_t* buf) {
+  memcpy(&shadow[lba * TEST_WORDS], buf, count * SD_BLOCK_SIZE);
+  check("submit write", blk_submit(&dev, BLK_WRITE, lba, count, buf), 0);
+}
+
+static void submit_read(u32_t lba, u32_t count, u32_t* buf) {
+  memset(buf, 0, count * SD_BLOCK_SIZE);
+  check("submit read", blk_submit(&dev, BLK_READ, lba, count, buf), 0);
+}
+
+static void run(void) {
+  check("blk_run", blk_run(&dev), 0);
+}
+
+int main(void) {
+  static u32_t expect[16 * TEST_WORDS];
+  u32_t i;
+
+  arena_init(&boot_arena, "boot", arena_mem, sizeof(arena_mem));
+  check("blk_init", blk_init(), 0);
+  fill(disk, TEST_BLOCKS);
+  memcpy(shadow, disk, sizeof(disk));
+  check("ramdisk_init", ramdisk_init(&dev, "ram0", disk, TEST_BLOCKS), 0);
+  check("blk_find", blk_find("ram0") == &dev, 1);
+  check_counts("init", 0, 0, 0);
+
+  /* adjacent reads into one buffer, submitted backwards: sorted, merged and
+     read straight into place */
+  for (i = 4; i > 0; i--) {
+    submit_read(i - 1, 1, bufs[0] + (i - 1) * TEST_WORDS);
+  }
+  run();
+  check_buf("adjacent", bufs[0], &shadow[0], 4);
+  check_counts("adjacent", 1, 3, 0);
+
+  /* adjacent reads into separate buffers go through the bounce buffer */
+  for (i = 0; i < 3; i++) {
+    submit_read(8 + i, 1, bufs[i]);
+  }
+  run();
+  for (i = 0; i < 3; i++) {
+    check_buf("misaligned", bufs[i], &shadow[(8 + i) * TEST_WORDS], 1);
+  }
+  check_counts("misaligned", 1, 2, 1);
+
+  /* overlapping reads are one transfer of the union */
+  submit_read(12, 4, bufs[0]);
+  submit_read(14, 4, bufs[1]);
+  run();
+  check_buf("overlap read", bufs[0], &shadow[12 * TEST_WORDS], 4);
+  check_buf("overlap read", bufs[1], &shadow[14 * TEST_WORDS], 4);
+  check_counts("overlap read", 1, 1, 1);
+
+  /* adjacent writes from one buffer */
+  fill(bufs[0], 4);
+  for (i = 0; i < 4; i++) {
+    submit_write(20 + i, 1, bufs[0] + i * TEST_WORDS);
+  }
+  run();
+  check_disk("adjacent write");
+  check_counts("adjacent write", 1, 3, 0);
+
+  /* adjacent writes from separate buffers, copied into the bounce buffer */
+  fill(bufs[0], 1);
+  fill(bufs[1], 2);
+  submit_write(25, 2, bufs[1]);
+  submit_write(24, 1, bufs[0]);
+  run();
+  check_disk("misaligned write");
+  check_counts("misaligned write", 1, 1, 1);
+
+  /* overlapping writes keep their order: the second forces a run */
+  fill(bufs[0], 2);
+  fill(bufs[1], 2);
+  submit_write(30, 2, bufs[0]);
+  submit_write(31, 2, bufs[1]);
+  check_counts("overlap write queued", 1, 0, 0);
+  run();
+  check_disk("overlap write");
+  check_counts("overlap write", 1, 0, 0);
+
+  /* a read after a write to the same blocks sees the new data */
+  fill(bufs[0], 2);
+  submit_write(40, 2, bufs[0]);
+  memcpy(expect, &shadow[40 * TEST_WORDS], 2 * SD_BLOCK_SIZE);
+  submit_read(40, 2, bufs[1]);
+  check_counts("read after write queued", 1, 0, 0);
+  /* and a write after a read to the same blocks doesn't change what it got */
+  fill(bufs[2], 1);
+  submit_write(41, 1, bufs[2]);
+  check_counts("write after read queued", 1, 0, 0);
+  run();
+  check_buf("read after write", bufs[1], expect, 2);
+  check_disk("write after read");
+  check_counts("write after read", 1, 0, 0);
+
+  /* reads and writes next to each other aren't merged or ordered */
+  fill(bufs[0], 1);
+  submit_read(50, 1, bufs[1]);
+  submit_write(51, 1, bufs[0]);
+  submit_read(52, 1, bufs[1] + TEST_WORDS);
+  check_counts("mixed queued", 0, 0, 0);
+  run();
+  check_buf("mixed", bufs[1], &shadow[50 * TEST_WORDS], 1);
+  check_buf("mixed", bufs[1] + TEST_WORDS, &shadow[52 * TEST_WORDS], 1);
+  check_disk("mixed");
+  check_counts("mixed", 3, 0, 0);
+
+  /* runs are cut at max_blocks */
+  dev.max_blocks = 8;
+  for (i = 0; i < 12; i++) {
+    submit_read(i, 1, bufs[0] + i * TEST_WORDS);
+  }
+  run();
+  check_buf("max_blocks", bufs[0], &shadow[0], 12);
+  check_counts("max_blocks", 2, 10, 0);
+  dev.max_blocks = TEST_BLOCKS;
+
+  /* synchronous calls run the queue first */
+  fill(bufs[0], 1);
+  submit_write(60, 1, bufs[0]);
+  check("blk_read", blk_read(&dev, 60, 1, bufs[1]), 0);
+  check_buf("blk_read", bufs[1], &shadow[60 * TEST_WORDS], 1);
+  check_counts("blk_read", 2, 0, 0);
+
+  check("out of range", blk_submit(&dev, BLK_READ, TEST_BLOCKS - 1, 2, bufs[0]), 1);
+  check("queue empty", dev.queue == NULL, 1);
+  check_disk("end");
+
+  printf("%s, %d failures\n", failures ? "FAIL" : "PASS", failures);
+  return failures != 0;
+}
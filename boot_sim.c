@@ -0,0 +1,1495 @@
+/* Copyright (c) 2023  Hunter Whyte
+  Host simulation of the loader. main.c and the drivers are built natively
+  for the host with HOST_SIM (see include/sim.h) and run from reloc_main to
+  the kernel handoff against models of what the boot path touches:
+    PRCM, control module, EMIF  PLL lock, VTP and DDR status
+    INTC                        masks, priorities, threshold, software IRQs
+    DMTIMER0/2/3/4              counters, overflow and match IRQs
+    UART0                       TX to stdout or a pty, RX from stdin or the
+                                pty, FIFO timing from the programmed divisor,
+                                optional bit errors
+    MMC0                        SD card backed by an image file (gen_img),
+                                command and data timing from CLKD and the
+                                bus width
+  Peripheral pages are mapped without access. Each register access faults,
+  is answered by its model and the instruction is single stepped, SRAM and
+  DDR are plain memory at their real addresses. Interrupts are delivered
+  into the running code at register accesses and at the cpu.h calls, with a
+  saved context on the interrupted stack so sched_switch works unchanged.
+  Time is modelled, not measured: every register access costs its model's
+  latency and waiting (WFI, repeated status polls) skips to the next device
+  event. Code in between is free, so the result is the time the boot spends
+  on peripherals, a lower bound.
+  At the handoff it prints per boot phase (TRACE_BOOT_PHASE) the modelled
+  time, register accesses, IRQs, MMC commands and bytes and UART bytes.
+
+  usage: ./boot_sim [-c card.img] [-p] [-e n] [-l model=ns] [-r read_us]
+                    [-w powerup_ms] [-t limit_ms] [-s reset_status] [-d ddr.img]
+*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <common.h>
+#include <control.h>
+#include <cpu.h>
+#include <emif.h>
+#include <gpio.h>
+#include <interrupt.h>
+#include <memlayout.h>
+#include <mmc.h>
+#include <mmu.h>
+#include <prcm.h>
+#include <reloc.h>
+#include <sched.h>
+#include <sd_image.h>
+#include <timer.h>
+#include <trace.h>
+#include <uart.h>
+
+/* the Makefile renames the loader's main so it can live next to this one */
+#undef main
+
+#define SIM_PAGE      4096u
+#define SIM_IO_BASE   0x44000000u /* L4 and L3 peripherals up to EMIF0 */
+#define SIM_IO_SIZE   0x0C000000u
+#define SIM_SRAM_BASE 0x402F0000u /* SRAM and OCMC */
+#define SIM_SRAM_SIZE 0x00020000u
+#define SIM_LOAD_BASE 0x402F0400u /* where the ROM puts the MLO */
+#define SIM_STACK_END 0x4030F000u
+#define SIM_SPL_STACK 0x100000u
+
+#define SIM_NONE      UINT64_MAX
+#define SIM_SKIP_MAX  1000000ull /* longest skip when no event is pending */
+#define SIM_POLL_SKIP 2          /* identical reads before a poll is skipped */
+#define SIM_CYCLE_SKIP 64        /* cpu_cycles calls without an access */
+#define SIM_STALL_S   2          /* real seconds without progress */
+#define SIM_NUM_IRQS  128
+
+/* boot.ld symbols. nothing is copied on the host, the sram arena gets what
+   would be left of SRAM after a 60KB load image */
+uint32_t sim_empty[1];
+asm(".globl _ddr_start, _ddr_end, _begin_bss, _end_bss, _ddr_load_start, _stack_limit\n"
+    ".set _ddr_start, sim_empty\n"
+    ".set _ddr_end, sim_empty\n"
+    ".set _begin_bss, sim_empty\n"
+    ".set _end_bss, sim_empty\n"
+    ".set _ddr_load_start, 0x402FF400\n"
+    ".set _stack_limit, 0x4030E000\n");
+
+/* counters, one snapshot per boot phase */
+struct sim_count {
+  uint64_t ns;
+  uint64_t idle_ns;  /* in WFI */
+  uint64_t poll_ns;  /* skipped while polling a status register */
+  uint64_t reads, writes;
+  uint64_t irqs, switches;
+  uint64_t mmc_cmds, mmc_bytes;
+  uint64_t uart_tx, uart_rx;
+};
+
+enum { PHASE_BRINGUP, PHASE_INIT, PHASE_MMC, PHASE_KERNEL, PHASE_NUM };
+static const char* phase_names[PHASE_NUM] = {"bringup", "init", "mmc", "kernel"};
+
+struct model {
+  const char* name;
+  uint32_t base, size;
+  uint32_t (*read)(struct model* m, uint32_t off, uint32_t stored);
+  void (*write)(struct model* m, uint32_t off, uint32_t val);
+  void* dev;
+  uint32_t latency; /* ns per access */
+  uint64_t reads, writes, ns;
+};
+
+static struct {
+  uint64_t now; /* modelled time in ns, 1 core cycle each at 1GHz */
+  uint64_t limit;
+  int masked;   /* CPSR I bit */
+  struct sim_count cnt;
+  struct sim_count phase_start[PHASE_NUM];
+  int phase;
+  uint32_t trace_seen;
+  /* access being single stepped */
+  struct model* step_model;
+  uint32_t step_addr;
+  int step_write;
+  /* poll detection */
+  uint32_t poll_addr, poll_val, poll_repeat;
+  uint32_t cycle_calls;
+  uint64_t progress;
+  uint32_t irq_count[SIM_NUM_IRQS];
+} sim;
+
+static void sim_update(void);
+static void sim_finish(const char* why, int code);
+
+static uint64_t ticks_at(uint64_t ns, uint64_t hz) {
+  return (uint64_t)((unsigned __int128)ns * hz / 1000000000u);
+}
+
+/* first ns at which a clock of hz has counted ticks */
+static uint64_t ns_at(uint64_t ticks, uint64_t hz) {
+  return (uint64_t)(((unsigned __int128)ticks * 1000000000u + hz - 1) / hz);
+}
+
+static uint64_t min64(uint64_t a, uint64_t b) {
+  return a < b ? a : b;
+}
+
+/* ---- INTC ---- */
+
+static struct {
+  uint32_t mir[4], soft[4];
+  uint32_t ilr[SIM_NUM_IRQS];
+  uint32_t threshold;
+} intc;
+
+static uint32_t timer_line(uint32_t irq);
+static uint32_t uart_line(void);
+static uint32_t mmc_line(void);
+
+static void intc_reset(void) {
+  memset(&intc, 0, sizeof(intc));
+  memset(intc.mir, 0xFF, sizeof(intc.mir));
+  intc.threshold = INTC_THRESHOLD_OFF;
+}
+
+static uint32_t intc_raw(uint32_t irq) {
+  if (intc.soft[irq >> 5] & (1u << (irq & 0x1F))) {
+    return 1;
+  }
+  switch (irq) {
+    case IRQ_TINT0:
+    case IRQ_TINT2:
+    case IRQ_TINT3:
+    case IRQ_TINT4: return timer_line(irq);
+    case IRQ_UART0: return uart_line();
+    case IRQ_MMCSD0: return mmc_line();
+    default: return 0;
+  }
+}
+
+/* highest priority pending IRQ above the threshold, -1 if none. FIQ routing
+   isn't modelled, lines routed there never fire */
+static int intc_active(uint32_t* prio) {
+  int best = -1;
+  uint32_t irq, p, bestp = 0;
+
+  for (irq = 0; irq < SIM_NUM_IRQS; irq++) {
+    if ((intc.mir[irq >> 5] & (1u << (irq & 0x1F))) || (intc.ilr[irq] & INTC_ILR_FIQNIRQ) ||
+        !intc_raw(irq)) {
+      continue;
+    }
+    p = (intc.ilr[irq] >> 2) & 0x3F;
+    if (intc.threshold != INTC_THRESHOLD_OFF && p >= intc.threshold) {
+      continue;
+    }
+    if (best < 0 || p < bestp) {
+      best = irq;
+      bestp = p;
+    }
+  }
+  if (prio != NULL) {
+    *prio = bestp;
+  }
+  return best;
+}
+
+static uint32_t intc_read(struct model* m, uint32_t off, uint32_t stored) {
+  uint32_t prio;
+  int irq;
+
+  (void)m;
+  if (off == INTC_SYSSTATUS - INTC_BASE) {
+    return 0x1;
+  }
+  if (off == INTC_SIR_IRQ - INTC_BASE) {
+    irq = intc_active(NULL);
+    if (irq < 0) {
+      return INTC_SIR_SPURIOUS | 0x7F;
+    }
+    sim.irq_count[irq]++;
+    return irq;
+  }
+  if (off == INTC_IRQ_PRIORITY - INTC_BASE) {
+    return intc_active(&prio) < 0 ? 0x40 | 0x3F : prio;
+  }
+  if (off == INTC_THRESHOLD - INTC_BASE) {
+    return intc.threshold;
+  }
+  if (off >= 0x80 && off < 0x100) {
+    switch ((off - 0x80) & 0x1F) {
+      case 0x4: return intc.mir[(off - 0x80) >> 5];
+      case 0x10: return intc.soft[(off - 0x80) >> 5];
+      default: return 0;
+    }
+  }
+  if (off >= 0x100 && off < 0x100 + 4 * SIM_NUM_IRQS) {
+    return intc.ilr[(off - 0x100) / 4];
+  }
+  return stored;
+}
+
+static void intc_write(struct model* m, uint32_t off, uint32_t val) {
+  uint32_t n;
+
+  (void)m;
+  if (off == INTC_SYSCONFIG - INTC_BASE && (val & 0x2)) {
+    intc_reset();
+  } else if (off == INTC_THRESHOLD - INTC_BASE) {
+    intc.threshold = val & 0xFF;
+  } else if (off >= 0x80 && off < 0x100) {
+    n = (off - 0x80) >> 5;
+    switch ((off - 0x80) & 0x1F) {
+      case 0x4: intc.mir[n] = val; break;
+      case 0x8: intc.mir[n] &= ~val; break;
+      case 0xC: intc.mir[n] |= val; break;
+      case 0x10: intc.soft[n] |= val; break;
+      case 0x14: intc.soft[n] &= ~val; break;
+    }
+  } else if (off >= 0x100 && off < 0x100 + 4 * SIM_NUM_IRQS) {
+    intc.ilr[(off - 0x100) / 4] = val & 0xFD;
+  }
+}
+
+/* ---- DMTIMER ---- */
+
+#define TCLR_ST 0x1
+#define TCLR_AR 0x2
+#define TCLR_CE 0x40
+#define TIMER_MAT 0x1
+#define TIMER_OVF 0x2
+
+struct dmtimer {
+  uint32_t irq;
+  uint64_t hz;
+  uint32_t tclr, tldr, tmar, status, enable;
+  uint64_t count; /* at tick */
+  uint64_t tick;  /* clock ticks at the last update */
+};
+
+static struct dmtimer timers[] = {
+  {IRQ_TINT0, 32768, 0, 0, 0, 0, 0, 0, 0},
+  {IRQ_TINT2, TIMER_TICKS_PER_US * 1000000, 0, 0, 0, 0, 0, 0, 0},
+  {IRQ_TINT3, TIMER_TICKS_PER_US * 1000000, 0, 0, 0, 0, 0, 0, 0},
+  {IRQ_TINT4, TIMER_TICKS_PER_US * 1000000, 0, 0, 0, 0, 0, 0, 0},
+};
+
+#define NUM_TIMERS (sizeof(timers) / sizeof(timers[0]))
+
+/* bring the counter up to now, raising overflow and match */
+static void timer_advance(struct dmtimer* t) {
+  uint64_t cur = ticks_at(sim.now, t->hz);
+  uint64_t c, period;
+
+  if (!(t->tclr & TCLR_ST) || cur == t->tick) {
+    t->tick = cur;
+    return;
+  }
+  c = t->count + (cur - t->tick);
+  t->tick = cur;
+  if ((t->tclr & TCLR_CE) && t->tmar > t->count && t->tmar <= c) {
+    t->status |= TIMER_MAT;
+  }
+  if (c > 0xFFFFFFFFull) {
+    t->status |= TIMER_OVF;
+    if (t->tclr & TCLR_AR) {
+      period = 0x100000000ull - t->tldr;
+      c = t->tldr + (c - 0x100000000ull) % period;
+    } else {
+      c = 0;
+      t->tclr &= ~TCLR_ST;
+    }
+  }
+  t->count = c;
+}
+
+static uint64_t timer_next(struct dmtimer* t) {
+  uint64_t d;
+
+  if (!(t->tclr & TCLR_ST)) {
+    return SIM_NONE;
+  }
+  d = 0x100000000ull - t->count;
+  if ((t->tclr & TCLR_CE) && t->tmar > t->count && t->tmar - t->count < d) {
+    d = t->tmar - t->count;
+  }
+  return ns_at(t->tick + d, t->hz);
+}
+
+static uint32_t timer_line(uint32_t irq) {
+  uint32_t i;
+
+  for (i = 0; i < NUM_TIMERS; i++) {
+    if (timers[i].irq == irq) {
+      return (timers[i].status & timers[i].enable & 0x7) != 0;
+    }
+  }
+  return 0;
+}
+
+static uint32_t timer_read(struct model* m, uint32_t off, uint32_t stored) {
+  struct dmtimer* t = m->dev;
+
+  timer_advance(t);
+  switch (off) {
+    case IRQSTATUS_RAW_OFFSET:
+    case IRQSTATUS_OFFSET: return t->status;
+    case IRQENABLE_SET_OFFSET:
+    case IRQENABLE_CLEAR_OFFSET: return t->enable;
+    case TCLR_OFFSET: return t->tclr;
+    case TCRR_OFFSET: return (uint32_t)t->count;
+    case TLDR_OFFSET: return t->tldr;
+    case TMAR_OFFSET: return t->tmar;
+    case TWPS_OFFSET: return 0; /* writes post immediately */
+    default: return stored;
+  }
+}
+
+static void timer_write(struct model* m, uint32_t off, uint32_t val) {
+  struct dmtimer* t = m->dev;
+
+  timer_advance(t);
+  switch (off) {
+    case IRQSTATUS_RAW_OFFSET: t->status |= val & 0x7; break;
+    case IRQSTATUS_OFFSET: t->status &= ~val; break;
+    case IRQENABLE_SET_OFFSET: t->enable |= val & 0x7; break;
+    case IRQENABLE_CLEAR_OFFSET: t->enable &= ~val; break;
+    case TCLR_OFFSET: t->tclr = val; break;
+    case TCRR_OFFSET: t->count = val; break;
+    case TLDR_OFFSET: t->tldr = val; break;
+    case TTGR_OFFSET: t->count = t->tldr; break;
+    case TMAR_OFFSET: t->tmar = val; break;
+  }
+}
+
+/* ---- UART0 ---- */
+
+#define UART_FIFO 64
+
+static struct {
+  uint32_t lcr, dll, dlh, ier, efr, mdr1;
+  uint64_t tx_done; /* when everything written so far has been shifted out */
+  uint8_t rx[UART_FIFO];
+  uint32_t rx_head, rx_tail;
+  uint64_t rx_next; /* earliest time the next character can come in */
+  int in_fd, out_fd, in_eof;
+  uint32_t noise; /* one in this many characters gets a bit flipped, 0 none */
+} uart;
+
+/* time for one 8N1 character at the programmed rate */
+static uint64_t uart_char_ns(void) {
+  uint64_t div = uart.dll | (uart.dlh << 8);
+  uint64_t os = uart.mdr1 == 0x3 ? 13 : 16;
+
+  if (div == 0) {
+    div = 26; /* reset value would stop the clock, keep time moving */
+  }
+  return 10 * 1000000000ull * os * div / UART_FCLK;
+}
+
+/* characters in the TX FIFO and the shift register */
+static uint32_t uart_tx_level(void) {
+  uint64_t c = uart_char_ns();
+
+  if (uart.tx_done <= sim.now) {
+    return 0;
+  }
+  return (uart.tx_done - sim.now + c - 1) / c;
+}
+
+/* bit errors on the line, both ways */
+static char uart_noise(char c) {
+  if (uart.noise != 0 && rand() % uart.noise == 0) {
+    c ^= 1 << (rand() % 8);
+  }
+  return c;
+}
+
+static uint32_t uart_rx_level(void) {
+  return uart.rx_head - uart.rx_tail;
+}
+
+static uint32_t uart_iir(void) {
+  if ((uart.ier & 0x1) && uart_rx_level() != 0) {
+    return (uart_rx_level() >= 8 ? 0x2 : 0x6) << 1;
+  }
+  /* TX trigger at 32 spaces, see uart_init */
+  if ((uart.ier & 0x2) && uart_tx_level() <= UART_FIFO - 32) {
+    return 0x1 << 1;
+  }
+  return 0x1;
+}
+
+static uint32_t uart_line(void) {
+  return !(uart_iir() & 0x1);
+}
+
+static void uart_rx_poll(void) {
+  struct pollfd p;
+  char c;
+
+  if (uart.in_eof || sim.now < uart.rx_next || uart_rx_level() == UART_FIFO) {
+    return;
+  }
+  uart.rx_next = sim.now + uart_char_ns();
+  p.fd = uart.in_fd;
+  p.events = POLLIN;
+  if (poll(&p, 1, 0) != 1) {
+    return;
+  }
+  if (read(uart.in_fd, &c, 1) != 1) {
+    uart.in_eof = 1;
+    return;
+  }
+  uart.rx[uart.rx_head++ % UART_FIFO] = uart_noise(c);
+  sim.cnt.uart_rx++;
+}
+
+static uint64_t uart_next(void) {
+  uint64_t c = uart_char_ns(), t = SIM_NONE;
+  uint32_t level = uart_tx_level();
+
+  /* THR trigger, then empty */
+  if (level > UART_FIFO - 32) {
+    t = uart.tx_done - (uint64_t)(UART_FIFO - 32) * c;
+  } else if (level != 0) {
+    t = uart.tx_done;
+  }
+  if (!uart.in_eof) {
+    t = min64(t, sim.now < uart.rx_next ? uart.rx_next : sim.now + c);
+  }
+  return t;
+}
+
+static uint32_t uart_read(struct model* m, uint32_t off, uint32_t stored) {
+  int mode_a = (uart.lcr & 0x80) != 0;
+  uint32_t level;
+
+  (void)m;
+  switch (off) {
+    case RHR_OFFSET:
+      if (mode_a) {
+        return uart.dll;
+      }
+      if (uart_rx_level() == 0) {
+        return 0;
+      }
+      return uart.rx[uart.rx_tail++ % UART_FIFO];
+    case IER_UART_OFFSET: return mode_a ? uart.dlh : uart.ier;
+    case IIR_UART_OFFSET: return uart.lcr == 0xBF ? uart.efr : uart_iir() | 0xC0;
+    case LCR_OFFSET: return uart.lcr;
+    case LSR_UART_OFFSET:
+      level = uart_tx_level();
+      return (uart_rx_level() ? 0x1 : 0) | (level <= 1 ? 0x20 : 0) | (level == 0 ? 0x40 : 0);
+    case MDR1_OFFSET: return uart.mdr1;
+    case SSR_OFFSET: return uart_tx_level() > UART_FIFO ? 0x1 : 0;
+    case SYSS_OFFSET: return 0x1;
+    case RXFIFO_LVL_OFFSET: return uart_rx_level();
+    case TXFIFO_LVL_OFFSET:
+      level = uart_tx_level();
+      return level ? level - 1 : 0;
+    default: return stored;
+  }
+}
+
+static void uart_write(struct model* m, uint32_t off, uint32_t val) {
+  int mode_a = (uart.lcr & 0x80) != 0;
+  uint64_t c;
+  char ch;
+
+  (void)m;
+  switch (off) {
+    case THR_OFFSET:
+      if (mode_a) {
+        uart.dll = val & 0xFF;
+      } else if (uart_tx_level() <= UART_FIFO) {
+        c = uart_char_ns();
+        uart.tx_done = (uart.tx_done > sim.now ? uart.tx_done : sim.now) + c;
+        ch = uart_noise(val);
+        if (write(uart.out_fd, &ch, 1) != 1) {
+          uart.out_fd = -1;
+        }
+        sim.cnt.uart_tx++;
+      }
+      break;
+    case IER_UART_OFFSET:
+      if (mode_a) {
+        uart.dlh = val & 0x3F;
+      } else {
+        uart.ier = val & 0xFF;
+      }
+      break;
+    case EFR_OFFSET:
+      if (uart.lcr == 0xBF) {
+        uart.efr = val;
+      } else if (val & 0x2) {
+        uart.rx_tail = uart.rx_head; /* FCR RX FIFO clear */
+      }
+      break;
+    case LCR_OFFSET: uart.lcr = val & 0xFF; break;
+    case MDR1_OFFSET: uart.mdr1 = val & 0x7; break;
+    case SYSC_OFFSET:
+      if (val & 0x2) {
+        uart.lcr = uart.dll = uart.dlh = uart.ier = uart.efr = 0;
+        uart.mdr1 = 0x7;
+        uart.rx_tail = uart.rx_head;
+      }
+      break;
+  }
+}
+
+/* ---- MMC0 and the SD card ---- */
+
+#define STAT_CC   (0x1 << 0)
+#define STAT_TC   (0x1 << 1)
+#define STAT_BWR  (0x1 << 4)
+#define STAT_BRR  (0x1 << 5)
+#define STAT_ERRI (0x1 << 15)
+#define STAT_CTO  (0x1 << 16)
+#define STAT_DEB  (0x1 << 22)
+#define MMC_RCA   0x4567
+
+static struct {
+  int fd;           /* card image, -1 for no card */
+  uint64_t blocks;
+  uint64_t read_ns; /* card access time before a read block starts */
+  uint64_t write_ns;
+  uint64_t powerup_ns;
+  uint32_t sysctl, hctl, con, blk, arg;
+  uint32_t stat, ise;
+  uint32_t rsp[4];
+  /* pending events, SIM_NONE when idle */
+  uint64_t cc_at, tc_at, buf_at;
+  uint32_t cc_bits, tc_bits;
+  uint8_t buf[SD_BLOCK_SIZE];
+  uint32_t pos;
+  int buf_ready;         /* PSTATE BRE/BWE, STAT BRR/BWR are just the events */
+  int reading, writing;  /* data phase direction */
+  uint32_t block;        /* card block of the buffer */
+  uint32_t left;         /* blocks still to go, multi-block */
+  int app;
+  uint64_t first_acmd41;
+  uint32_t cmd_count[64], acmd_count[64];
+} mmc;
+
+static uint64_t mmc_bit_ns(void) {
+  uint32_t clkd = (mmc.sysctl >> 6) & 0x3FF;
+
+  return 1000000000ull * (clkd ? clkd : 1) / 96000000;
+}
+
+/* data lines in use */
+static uint32_t mmc_width(void) {
+  if (mmc.con & (0x1 << 5)) {
+    return 8;
+  }
+  return (mmc.hctl & 0x2) ? 4 : 1;
+}
+
+/* one block on the data lines: start bit, data, CRC16 per line, end bit */
+static uint64_t mmc_block_ns(void) {
+  return (SD_BLOCK_SIZE * 8 / mmc_width() + 18) * mmc_bit_ns();
+}
+
+static void mmc_events(void) {
+  if (mmc.cc_at <= sim.now) {
+    mmc.stat |= mmc.cc_bits;
+    mmc.cc_at = SIM_NONE;
+  }
+  if (mmc.tc_at <= sim.now) {
+    mmc.stat |= mmc.tc_bits;
+    mmc.tc_at = SIM_NONE;
+  }
+  if (mmc.buf_at <= sim.now) {
+    mmc.stat |= mmc.reading ? STAT_BRR : STAT_BWR;
+    mmc.buf_ready = 1;
+    mmc.buf_at = SIM_NONE;
+  }
+}
+
+/* SD_ISE enables the interrupt for events in SD_STAT, ERRI has none */
+static uint32_t mmc_line(void) {
+  mmc_events();
+  return (mmc.stat & mmc.ise & ~STAT_ERRI) != 0;
+}
+
+static uint64_t mmc_next(void) {
+  return min64(mmc.cc_at, min64(mmc.tc_at, mmc.buf_at));
+}
+
+static int mmc_load(uint32_t block) {
+  if (block >= mmc.blocks ||
+      pread(mmc.fd, mmc.buf, SD_BLOCK_SIZE, (off_t)block * SD_BLOCK_SIZE) != SD_BLOCK_SIZE) {
+    return 1;
+  }
+  mmc.block = block;
+  mmc.pos = 0;
+  return 0;
+}
+
+static void mmc_command(uint32_t val) {
+  uint32_t idx = val >> 24, rsp = (val >> 16) & 0x3, app = mmc.app;
+  uint64_t t;
+
+  /* initialization stream, 80 clocks and no card involved */
+  if (mmc.con & 0x2) {
+    mmc.cc_at = sim.now + 80 * mmc_bit_ns();
+    mmc.cc_bits = STAT_CC;
+    return;
+  }
+  sim.cnt.mmc_cmds++;
+  mmc.app = 0;
+  if (app) {
+    mmc.acmd_count[idx]++;
+  } else {
+    mmc.cmd_count[idx]++;
+  }
+  /* command, Ncr and the response */
+  t = sim.now + (48 + 8 + (rsp == MMC_RSP_136 ? 136 : rsp ? 48 : 0)) * mmc_bit_ns();
+  mmc.cc_at = t;
+  mmc.cc_bits = STAT_CC;
+  if (mmc.fd < 0) {
+    mmc.cc_bits = STAT_ERRI | STAT_CTO;
+    return;
+  }
+  memset(mmc.rsp, 0, sizeof(mmc.rsp));
+  mmc.rsp[0] = 0x900; /* ready for data, transfer state */
+  switch (app ? idx + 64 : idx) {
+    case 0: mmc.rsp[0] = 0; break;
+    case 2: mmc.rsp[3] = 0x00400E00; break;
+    case 9:
+      /* CSD 2.0 without the CRC byte, C_SIZE in bits 69:48 rounded up so the
+         card covers the whole image */
+      mmc.rsp[3] = 0x00400E00;
+      mmc.rsp[1] = (uint32_t)(((mmc.blocks + 1023) / 1024 - 1) & 0x3FFFFF) << 8;
+      break;
+    case 3: mmc.rsp[0] = (MMC_RCA << 16) | 0x0500; break;
+    case 8: mmc.rsp[0] = mmc.arg & 0xFFF; break;
+    case 55: mmc.rsp[0] = 0x920; mmc.app = 1; break;
+    case 64 + 41:
+      if (mmc.first_acmd41 == SIM_NONE) {
+        mmc.first_acmd41 = sim.now;
+      }
+      mmc.rsp[0] = 0x40FF8000 | (sim.now - mmc.first_acmd41 >= mmc.powerup_ns ? 0x80000000 : 0);
+      break;
+    case 17:
+    case 18:
+    case 24:
+    case 25:
+      mmc.left = idx == 17 || idx == 24 ? 1 : (mmc.blk >> 16);
+      if (((val >> 1) & 0x1) == 0 && (idx == 18 || idx == 25)) {
+        mmc.left = 0xFFFFFFFF; /* until CMD12 */
+      }
+      mmc.reading = idx < 24;
+      mmc.writing = !mmc.reading;
+      if (mmc.arg >= mmc.blocks || (mmc.reading && mmc_load(mmc.arg))) {
+        mmc.rsp[0] = 0x80000900; /* OUT_OF_RANGE */
+        mmc.cc_bits = STAT_ERRI | STAT_DEB;
+        mmc.reading = mmc.writing = 0;
+        break;
+      }
+      mmc.block = mmc.arg;
+      mmc.pos = 0;
+      mmc.buf_at = mmc.reading ? t + mmc.read_ns + mmc_block_ns() : t;
+      break;
+    case 12:
+      mmc.reading = mmc.writing = mmc.buf_ready = 0;
+      mmc.buf_at = SIM_NONE;
+      break;
+  }
+  if (rsp == MMC_RSP_48_BUSY && !mmc.reading && !mmc.writing) {
+    mmc.tc_at = t;
+    mmc.tc_bits = STAT_TC;
+  }
+}
+
+/* a block went through the buffer, start the next one or finish */
+static void mmc_block_done(void) {
+  sim.cnt.mmc_bytes += SD_BLOCK_SIZE;
+  mmc.buf_ready = 0;
+  if (mmc.writing) {
+    if (pwrite(mmc.fd, mmc.buf, SD_BLOCK_SIZE, (off_t)mmc.block * SD_BLOCK_SIZE) !=
+        SD_BLOCK_SIZE) {
+      perror("card image");
+    }
+  }
+  if (--mmc.left == 0 || mmc.block + 1 >= mmc.blocks) {
+    mmc.tc_at = sim.now + (mmc.writing ? mmc_block_ns() + mmc.write_ns : 0);
+    mmc.tc_bits = STAT_TC;
+    mmc.reading = mmc.writing = 0;
+    return;
+  }
+  if (mmc.reading) {
+    mmc_load(mmc.block + 1);
+    mmc.buf_at = sim.now + mmc_block_ns();
+  } else {
+    mmc.block++;
+    mmc.pos = 0;
+    mmc.buf_at = sim.now + mmc_block_ns() + mmc.write_ns;
+  }
+}
+
+static uint32_t mmc_read(struct model* m, uint32_t off, uint32_t stored) {
+  uint32_t v;
+
+  (void)m;
+  mmc_events();
+  switch (off) {
+    case 0x114: return 0x1; /* SYSSTATUS */
+    case 0x210:
+    case 0x214:
+    case 0x218:
+    case 0x21C: return mmc.rsp[(off - 0x210) / 4];
+    case 0x220:
+      /* the same word twice from the data port is data, not a poll */
+      sim.poll_addr = 0;
+      if (!mmc.reading || !mmc.buf_ready) {
+        return 0;
+      }
+      memcpy(&v, &mmc.buf[mmc.pos], 4);
+      mmc.pos += 4;
+      if (mmc.pos == SD_BLOCK_SIZE) {
+        mmc_block_done();
+      }
+      return v;
+    case 0x224: /* PSTATE: CINS, BRE, BWE */
+      return (mmc.fd >= 0 ? (0x1 << 16) : 0) |
+             ((mmc.buf_ready && mmc.reading) ? (0x1 << 11) : 0) |
+             ((mmc.buf_ready && mmc.writing) ? (0x1 << 10) : 0);
+    case 0x228: return mmc.hctl;
+    case 0x22C: return (mmc.sysctl & ~0x07000000) | ((mmc.sysctl & 0x1) << 1);
+    case 0x230: return mmc.stat;
+    case 0x238: return mmc.ise;
+    default: return stored;
+  }
+}
+
+static void mmc_write(struct model* m, uint32_t off, uint32_t val) {
+  (void)m;
+  mmc_events();
+  switch (off) {
+    case 0x110:
+      if (val & 0x2) {
+        mmc.stat = mmc.ise = mmc.hctl = mmc.sysctl = mmc.con = 0;
+        mmc.cc_at = mmc.tc_at = mmc.buf_at = SIM_NONE;
+        mmc.reading = mmc.writing = mmc.buf_ready = 0;
+      }
+      break;
+    case 0x12C: mmc.con = val; break;
+    case 0x204: mmc.blk = val; break;
+    case 0x208: mmc.arg = val; break;
+    case 0x20C: mmc_command(val); break;
+    case 0x220:
+      if (mmc.writing && mmc.buf_ready) {
+        memcpy(&mmc.buf[mmc.pos], &val, 4);
+        mmc.pos += 4;
+        if (mmc.pos == SD_BLOCK_SIZE) {
+          mmc_block_done();
+        }
+      }
+      break;
+    case 0x228: mmc.hctl = val; break;
+    case 0x22C: mmc.sysctl = val; break;
+    case 0x230: mmc.stat &= ~val; break;
+    case 0x238: mmc.ise = val; break;
+  }
+}
+
+/* ---- PRCM, control module, EMIF, GPIO ---- */
+
+/* PRM_RSTST, what the last reset was */
+static uint32_t prm_rstst = PRM_RSTST_GLOBAL_COLD_RST;
+
+static uint32_t prcm_read(struct model* m, uint32_t off, uint32_t stored) {
+  uint32_t addr = m->base + off;
+
+  if (addr == CM_IDLEST_DPLL_MPU || addr == CM_IDLEST_DPLL_CORE || addr == CM_IDLEST_DPLL_PER ||
+      addr == CM_IDLEST_DPLL_DDR) {
+    return 0x101; /* locked, or in bypass while being programmed */
+  }
+  if (addr == CM_PER_L3_CLKSTCTRL) {
+    return stored | 0x1C; /* L3 clocks active */
+  }
+  if (addr == PRM_RSTST) {
+    return prm_rstst;
+  }
+  return stored; /* CLKCTRL IDLEST reads back 0, module functional */
+}
+
+static void prcm_write(struct model* m, uint32_t off, uint32_t val) {
+  if (m->base + off == PRM_RSTST) {
+    prm_rstst &= ~val;
+  }
+}
+
+static uint32_t control_read(struct model* m, uint32_t off, uint32_t stored) {
+  if (m->base + off == CONTROL_MODULE_VTP_CTRL) {
+    return stored | 0x20; /* VTP ready */
+  }
+  return stored;
+}
+
+static uint32_t emif_read(struct model* m, uint32_t off, uint32_t stored) {
+  if (m->base + off == EMIF0_STATUS) {
+    return stored | 0x4; /* PHY ready */
+  }
+  return stored;
+}
+
+/* outputs loop back to DATAIN, inputs read 0. DATAOUT is the register's
+   own word, which SET/CLEARDATAOUT change */
+static uint32_t* gpio_model_reg(struct model* m, uint32_t off) {
+  return (uint32_t*)(uintptr_t)(m->base + off);
+}
+
+static uint32_t gpio_model_read(struct model* m, uint32_t off, uint32_t stored) {
+  switch (off) {
+    case GPIO_SYSSTATUS_OFFSET: return 0x1;
+    case GPIO_DATAIN_OFFSET:
+      return *gpio_model_reg(m, GPIO_DATAOUT_OFFSET) & ~*gpio_model_reg(m, GPIO_OE_OFFSET);
+    default: return stored;
+  }
+}
+
+static void gpio_model_write(struct model* m, uint32_t off, uint32_t val) {
+  if (off == GPIO_SETDATAOUT_OFFSET) {
+    *gpio_model_reg(m, GPIO_DATAOUT_OFFSET) |= val;
+  } else if (off == GPIO_CLEARDATAOUT_OFFSET) {
+    *gpio_model_reg(m, GPIO_DATAOUT_OFFSET) &= ~val;
+  }
+}
+
+static uint32_t plain_read(struct model* m, uint32_t off, uint32_t stored) {
+  (void)m;
+  (void)off;
+  return stored;
+}
+
+static void plain_write(struct model* m, uint32_t off, uint32_t val) {
+  (void)m;
+  (void)off;
+  (void)val;
+}
+
+/* latencies are rough numbers for an uncached access from the A8: the INTC
+   sits next to the core, L4 peripherals are behind two interconnects */
+static struct model models[] = {
+  {"prcm", CM_PER_BASE, 0x4000, prcm_read, prcm_write, NULL, 150, 0, 0, 0},
+  {"control", 0x44E10000, 0x4000, control_read, plain_write, NULL, 150, 0, 0, 0},
+  {"emif", EMIF0_BASE, 0x1000, emif_read, plain_write, NULL, 100, 0, 0, 0},
+  {"intc", INTC_BASE, 0x1000, intc_read, intc_write, NULL, 30, 0, 0, 0},
+  {"timer", DMTIMER0_BASE, 0x1000, timer_read, timer_write, &timers[0], 150, 0, 0, 0},
+  {"timer", DMTIMER2_BASE, 0x1000, timer_read, timer_write, &timers[1], 150, 0, 0, 0},
+  {"timer", DMTIMER3_BASE, 0x1000, timer_read, timer_write, &timers[2], 150, 0, 0, 0},
+  {"timer", DMTIMER4_BASE, 0x1000, timer_read, timer_write, &timers[3], 150, 0, 0, 0},
+  {"uart", UART0_BASE, 0x1000, uart_read, uart_write, NULL, 150, 0, 0, 0},
+  {"mmc", MMC0_BASE, 0x1000, mmc_read, mmc_write, NULL, 150, 0, 0, 0},
+  {"gpio", GPIO0_BASE, 0x1000, gpio_model_read, gpio_model_write, NULL, 150, 0, 0, 0},
+  {"gpio", GPIO1_BASE, 0x1000, gpio_model_read, gpio_model_write, NULL, 150, 0, 0, 0},
+  {"gpio", GPIO2_BASE, 0x1000, gpio_model_read, gpio_model_write, NULL, 150, 0, 0, 0},
+  {"gpio", GPIO3_BASE, 0x1000, gpio_model_read, gpio_model_write, NULL, 150, 0, 0, 0},
+  /* anything else behaves like memory */
+  {"other", SIM_IO_BASE, SIM_IO_SIZE, plain_read, plain_write, NULL, 150, 0, 0, 0},
+};
+
+#define NUM_MODELS (sizeof(models) / sizeof(models[0]))
+
+static struct model* model_find(uint32_t addr) {
+  uint32_t i;
+
+  for (i = 0; i < NUM_MODELS; i++) {
+    if (addr - models[i].base < models[i].size) {
+      return &models[i];
+    }
+  }
+  return NULL;
+}
+
+/* ---- time ---- */
+
+static uint64_t sim_next_event(void) {
+  uint64_t t = min64(uart_next(), mmc_next());
+  uint32_t i;
+
+  for (i = 0; i < NUM_TIMERS; i++) {
+    t = min64(t, timer_next(&timers[i]));
+  }
+  return t;
+}
+
+/* jump to the next device event, at most SIM_SKIP_MAX ahead */
+static uint64_t sim_skip(void) {
+  uint64_t next = sim_next_event(), from = sim.now;
+
+  if (next <= sim.now) {
+    return 0;
+  }
+  if (next - sim.now > SIM_SKIP_MAX) {
+    next = sim.now + SIM_SKIP_MAX;
+  }
+  sim.now = next;
+  sim.cnt.ns = sim.now;
+  sim_update();
+  return sim.now - from;
+}
+
+static void phase_enter(int phase) {
+  int i;
+
+  if (phase <= sim.phase || phase >= PHASE_NUM) {
+    return;
+  }
+  /* phases that were skipped get no time */
+  for (i = sim.phase + 1; i <= phase; i++) {
+    sim.phase_start[i] = sim.cnt;
+  }
+  sim.phase = phase;
+}
+
+/* boot phases from the trace ring, main.c records them */
+static void phase_scan(void) {
+  struct trace_rec* rec;
+
+  if (!trace_enabled) {
+    return;
+  }
+  phase_enter(PHASE_INIT);
+  while (sim.trace_seen != trace_head) {
+    rec = (struct trace_rec*)TRACE_BUF_BASE + (sim.trace_seen & (TRACE_NUM_RECS - 1));
+    if ((rec->tag & 0xFFFF) == TRACE_BOOT_PHASE) {
+      phase_enter(PHASE_MMC + rec->arg0);
+    }
+    sim.trace_seen++;
+  }
+}
+
+static void sim_update(void) {
+  uint32_t i;
+
+  for (i = 0; i < NUM_TIMERS; i++) {
+    timer_advance(&timers[i]);
+  }
+  mmc_events();
+  uart_rx_poll();
+  phase_scan();
+  sim.progress++;
+  if (sim.now > sim.limit) {
+    sim_finish("modelled time limit", 1);
+  }
+}
+
+/* ---- CPU ---- */
+
+/* context saved on the interrupted stack, popped by sim_irq_entry */
+struct sim_frame {
+  uint8_t fx[512];
+  uint64_t r15, r14, r13, r12, r11, r10, r9, r8, rbp, rdi, rsi, rdx, rcx, rbx, rax;
+  uint64_t rflags, rsp, rip, pad[2];
+};
+
+#define SIM_FRAME_RIP 648
+
+uint64_t sim_resume_rip;
+void sim_irq_entry(void);
+uint64_t sim_irq_enter(struct sim_frame* f);
+
+/* the IRQ exception: sim_irq_enter runs the loader's irq_dispatch on the
+   interrupted stack, then the frame it returns is resumed, another thread's
+   if sched_switch picked one */
+asm(".text\n"
+    ".globl sim_irq_entry\n"
+    "sim_irq_entry:\n"
+    "  mov %rsp, %rdi\n"
+    "  call sim_irq_enter\n"
+    "  mov %rax, %rsp\n"
+    "  fxrstor (%rsp)\n"
+    "  mov 648(%rsp), %rax\n"
+    "  mov %rax, sim_resume_rip(%rip)\n"
+    "  add $512, %rsp\n"
+    "  pop %r15\n"
+    "  pop %r14\n"
+    "  pop %r13\n"
+    "  pop %r12\n"
+    "  pop %r11\n"
+    "  pop %r10\n"
+    "  pop %r9\n"
+    "  pop %r8\n"
+    "  pop %rbp\n"
+    "  pop %rdi\n"
+    "  pop %rsi\n"
+    "  pop %rdx\n"
+    "  pop %rcx\n"
+    "  pop %rbx\n"
+    "  pop %rax\n"
+    "  popfq\n"
+    "  mov (%rsp), %rsp\n"
+    "  jmp *sim_resume_rip(%rip)\n");
+
+_Static_assert(__builtin_offsetof(struct sim_frame, rip) == SIM_FRAME_RIP, "frame layout");
+_Static_assert(sizeof(struct sim_frame) % 16 == 0, "frame alignment");
+
+uint64_t sim_irq_enter(struct sim_frame* f) {
+  uint32_t sp;
+
+  sim.cnt.irqs++;
+  if (irq_dispatch((uint32_t)sim.now)) {
+    sp = sched_switch((uint32_t)(uintptr_t)f);
+    if (sp != (uint32_t)(uintptr_t)f) {
+      sim.cnt.switches++;
+    }
+    f = (struct sim_frame*)(uintptr_t)sp;
+  }
+  sim.masked = 0;
+  return (uintptr_t)f;
+}
+
+/* take the IRQ: save the interrupted context below its stack pointer (past
+   the red zone) and continue in sim_irq_entry with IRQs masked */
+static void sim_irq_take(ucontext_t* uc) {
+  greg_t* g = uc->uc_mcontext.gregs;
+  struct sim_frame* f;
+
+  f = (struct sim_frame*)(((uint64_t)g[REG_RSP] - 128 - sizeof(*f)) & ~0xFull);
+  memcpy(f->fx, uc->uc_mcontext.fpregs, sizeof(f->fx));
+  f->r15 = g[REG_R15];
+  f->r14 = g[REG_R14];
+  f->r13 = g[REG_R13];
+  f->r12 = g[REG_R12];
+  f->r11 = g[REG_R11];
+  f->r10 = g[REG_R10];
+  f->r9 = g[REG_R9];
+  f->r8 = g[REG_R8];
+  f->rbp = g[REG_RBP];
+  f->rdi = g[REG_RDI];
+  f->rsi = g[REG_RSI];
+  f->rdx = g[REG_RDX];
+  f->rcx = g[REG_RCX];
+  f->rbx = g[REG_RBX];
+  f->rax = g[REG_RAX];
+  f->rflags = g[REG_EFL] & ~0x100;
+  f->rsp = g[REG_RSP];
+  f->rip = g[REG_RIP];
+  g[REG_RSP] = (greg_t)f;
+  g[REG_RIP] = (greg_t)sim_irq_entry;
+  g[REG_EFL] = 0x202;
+  sim.masked = 1;
+}
+
+static int sim_irq_ready(void) {
+  return !sim.masked && intc_active(NULL) >= 0;
+}
+
+static void sim_irq_signal(int sig, siginfo_t* si, void* ctx) {
+  (void)sig;
+  (void)si;
+  if (sim_irq_ready()) {
+    sim_irq_take(ctx);
+  }
+}
+
+/* a register access. reads get the model's value put in place, then the
+   instruction is single stepped with the page accessible */
+static void sim_fault(int sig, siginfo_t* si, void* ctx) {
+  ucontext_t* uc = ctx;
+  uint32_t addr = (uint32_t)(uintptr_t)si->si_addr & ~0x3u;
+  struct model* m = model_find(addr);
+  uint32_t* reg = (uint32_t*)(uintptr_t)addr;
+  uint32_t val;
+
+  (void)sig;
+  if ((uintptr_t)si->si_addr > 0xFFFFFFFFu || m == NULL) {
+    fprintf(stderr, "boot_sim: fault at %p, pc %p\n", si->si_addr,
+            (void*)uc->uc_mcontext.gregs[REG_RIP]);
+    sim_finish("crash", 3);
+  }
+  sim.step_model = m;
+  sim.step_addr = addr;
+  sim.step_write = (uc->uc_mcontext.gregs[REG_ERR] & 0x2) != 0;
+  sim.now += m->latency;
+  m->ns += m->latency;
+  sim.cnt.ns = sim.now;
+  sim.cycle_calls = 0;
+  sim_update();
+  mprotect((void*)(uintptr_t)(addr & ~(SIM_PAGE - 1)), SIM_PAGE, PROT_READ | PROT_WRITE);
+  if (sim.step_write) {
+    m->writes++;
+    sim.cnt.writes++;
+    sim.poll_repeat = 0;
+    sim.poll_addr = 0;
+  } else {
+    m->reads++;
+    sim.cnt.reads++;
+    /* same value from the same register again, the code is waiting for
+       something, move on to when it could have changed */
+    if (addr == sim.poll_addr && sim.poll_repeat >= SIM_POLL_SKIP) {
+      sim.cnt.poll_ns += sim_skip();
+    }
+    val = m->read(m, addr - m->base, *reg);
+    if (addr == sim.poll_addr && val == sim.poll_val) {
+      sim.poll_repeat++;
+    } else {
+      sim.poll_addr = addr;
+      sim.poll_val = val;
+      sim.poll_repeat = 0;
+    }
+    *reg = val;
+  }
+  uc->uc_mcontext.gregs[REG_EFL] |= 0x100;
+}
+
+static void sim_step(int sig, siginfo_t* si, void* ctx) {
+  ucontext_t* uc = ctx;
+  struct model* m = sim.step_model;
+  uint32_t* reg = (uint32_t*)(uintptr_t)sim.step_addr;
+
+  (void)sig;
+  (void)si;
+  uc->uc_mcontext.gregs[REG_EFL] &= ~0x100;
+  if (m == NULL) {
+    return;
+  }
+  if (sim.step_write) {
+    m->write(m, sim.step_addr - m->base, *reg);
+  }
+  mprotect((void*)(uintptr_t)(sim.step_addr & ~(SIM_PAGE - 1)), SIM_PAGE, PROT_NONE);
+  sim.step_model = NULL;
+  if (sim_irq_ready()) {
+    sim_irq_take(uc);
+  }
+}
+
+static void sim_irq_check(void) {
+  if (sim_irq_ready()) {
+    raise(SIGUSR1);
+  }
+}
+
+u32_t sim_cycles(void) {
+  /* a loop that only watches the clock is waiting too */
+  if (++sim.cycle_calls >= SIM_CYCLE_SKIP) {
+    sim.cycle_calls = 0;
+    sim.cnt.poll_ns += sim_skip();
+    sim_irq_check();
+  }
+  sim.progress++;
+  return (uint32_t)sim.now;
+}
+
+u32_t sim_irq_save(void) {
+  u32_t cpsr = CPU_MODE_SYS | (sim.masked ? SIM_CPSR_I : 0);
+
+  sim.masked = 1;
+  return cpsr;
+}
+
+void sim_irq_restore(u32_t cpsr) {
+  sim.masked = (cpsr & SIM_CPSR_I) != 0;
+  sim_irq_check();
+}
+
+void sim_wfi(void) {
+  uint64_t from = sim.now;
+
+  if (intc_active(NULL) < 0) {
+    sim_skip();
+    sim.cnt.idle_ns += sim.now - from;
+  }
+  sim_irq_check();
+}
+
+u32_t sim_thread_frame(u32_t stack_top, void (*fn)(u32_t), u32_t arg, void (*ret)(void)) {
+  uint64_t sp = (stack_top & ~0xFu) - 8;
+  struct sim_frame* f;
+
+  /* fn is entered as if called, with ret as the return address */
+  *(uint64_t*)(uintptr_t)sp = (uintptr_t)ret;
+  f = (struct sim_frame*)(uintptr_t)((sp - 128 - sizeof(*f)) & ~0xFull);
+  memset(f, 0, sizeof(*f));
+  f->fx[0] = 0x7F; /* FCW 0x037F */
+  f->fx[1] = 0x03;
+  f->fx[24] = 0x80; /* MXCSR 0x1F80 */
+  f->fx[25] = 0x1F;
+  f->rdi = arg;
+  f->rflags = 0x202;
+  f->rsp = sp;
+  f->rip = (uintptr_t)fn;
+  return (uint32_t)(uintptr_t)f;
+}
+
+/* ---- the parts of the loader that can't run on the host ---- */
+
+void mmu_init(void) {}
+
+void dcache_clean_range(u32_t addr, u32_t len) {
+  (void)addr;
+  (void)len;
+}
+
+void dcache_invalidate_range(u32_t addr, u32_t len) {
+  (void)addr;
+  (void)len;
+}
+
+/* boot_kernel calls this right before jumping, which is where we stop */
+int mmu_disable(void) {
+  sim_finish("kernel handoff", 0);
+  return 0;
+}
+
+/* ---- report ---- */
+
+static void count_sub(struct sim_count* d, const struct sim_count* a,
+                      const struct sim_count* b) {
+  d->ns = a->ns - b->ns;
+  d->idle_ns = a->idle_ns - b->idle_ns;
+  d->poll_ns = a->poll_ns - b->poll_ns;
+  d->reads = a->reads - b->reads;
+  d->writes = a->writes - b->writes;
+  d->irqs = a->irqs - b->irqs;
+  d->switches = a->switches - b->switches;
+  d->mmc_cmds = a->mmc_cmds - b->mmc_cmds;
+  d->mmc_bytes = a->mmc_bytes - b->mmc_bytes;
+  d->uart_tx = a->uart_tx - b->uart_tx;
+  d->uart_rx = a->uart_rx - b->uart_rx;
+}
+
+static void count_print(const char* name, const struct sim_count* c) {
+  fprintf(stderr, "  %-8s %10.3f %9.3f %9.3f %9lu %9lu %7lu %6lu %6lu %10lu %7lu\n", name,
+          c->ns / 1e6, c->idle_ns / 1e6, c->poll_ns / 1e6, c->reads, c->writes, c->irqs,
+          c->switches, c->mmc_cmds, c->mmc_bytes, c->uart_tx);
+}
+
+static void sim_finish(const char* why, int code) {
+  struct sim_count d, zero;
+  uint32_t i, j, done[NUM_MODELS];
+  uint64_t r, w, ns;
+
+  memset(&zero, 0, sizeof(zero));
+  fprintf(stderr, "\nboot_sim: %s after %.3f ms modelled\n", why, sim.now / 1e6);
+  fprintf(stderr, "  %-8s %10s %9s %9s %9s %9s %7s %6s %6s %10s %7s\n", "phase", "ms", "idle",
+          "polling", "reads", "writes", "irqs", "switch", "mmc", "mmc bytes", "uart");
+  for (i = 0; i <= (uint32_t)sim.phase; i++) {
+    count_sub(&d, i == (uint32_t)sim.phase ? &sim.cnt : &sim.phase_start[i + 1],
+              &sim.phase_start[i]);
+    count_print(phase_names[i], &d);
+  }
+  count_sub(&d, &sim.cnt, &zero);
+  count_print("total", &d);
+
+  /* models of the same kind together */
+  fprintf(stderr, "  %-8s %9s %9s %10s\n", "model", "reads", "writes", "ms");
+  memset(done, 0, sizeof(done));
+  for (i = 0; i < NUM_MODELS; i++) {
+    r = w = ns = 0;
+    for (j = i; j < NUM_MODELS; j++) {
+      if (!done[j] && strcmp(models[i].name, models[j].name) == 0) {
+        r += models[j].reads;
+        w += models[j].writes;
+        ns += models[j].ns;
+        done[j] = 1;
+      }
+    }
+    if (r + w != 0) {
+      fprintf(stderr, "  %-8s %9lu %9lu %10.3f\n", models[i].name, r, w, ns / 1e6);
+    }
+  }
+
+  fprintf(stderr, "  irqs:");
+  for (i = 0; i < SIM_NUM_IRQS; i++) {
+    if (sim.irq_count[i] != 0) {
+      fprintf(stderr, " %u:%u", i, sim.irq_count[i]);
+    }
+  }
+  fprintf(stderr, "\n  mmc commands:");
+  for (i = 0; i < 64; i++) {
+    if (mmc.cmd_count[i] != 0) {
+      fprintf(stderr, " CMD%u:%u", i, mmc.cmd_count[i]);
+    }
+    if (mmc.acmd_count[i] != 0) {
+      fprintf(stderr, " ACMD%u:%u", i, mmc.acmd_count[i]);
+    }
+  }
+  fprintf(stderr, "\n");
+  _exit(code);
+}
+
+/* ---- setup ---- */
+
+static void sim_watchdog(int sig) {
+  static uint64_t last;
+
+  (void)sig;
+  if (sim.progress == last) {
+    sim_finish("stalled, main returned or the loader spins without touching hardware", 2);
+  }
+  last = sim.progress;
+}
+
+/* anonymous memory, or the contents of file when there is one */
+static void* map_at(uint32_t addr, uint32_t size, int prot, const char* file) {
+  int fd = -1, flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  void* p;
+
+  if (file != NULL) {
+    fd = open(file, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, size)) {
+      perror(file);
+      exit(1);
+    }
+    flags = MAP_SHARED;
+  }
+  p = mmap((void*)(uintptr_t)addr, size, prot, flags | MAP_FIXED_NOREPLACE | MAP_NORESERVE, fd,
+           0);
+
+  if (p != (void*)(uintptr_t)addr) {
+    fprintf(stderr, "can't map 0x%08x, build with -no-pie\n", addr);
+    exit(1);
+  }
+  return p;
+}
+
+static void on_signal(int sig, void (*fn)(int, siginfo_t*, void*)) {
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = fn;
+  sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  sigaddset(&sa.sa_mask, SIGALRM);
+  sigaddset(&sa.sa_mask, SIGUSR1);
+  sigaction(sig, &sa, NULL);
+}
+
+static void spl_entry(void) {
+  reloc_main();
+}
+
+static void usage(void) {
+  printf("usage: ./boot_sim [-c card.img] [-p] [-e n] [-l model=ns] [-r read_us]\n");
+  printf("                  [-w powerup_ms] [-t limit_ms] [-s reset_status] [-d ddr.img]\n");
+  printf("  -c  SD card image (gen_img), no card when left out\n");
+  printf("  -p  UART0 on a new pty instead of stdin/stdout\n");
+  printf("  -e  flip a random bit in about one in n UART0 characters, both ways\n");
+  printf("  -l  register access latency of a model: prcm, control, emif, intc, timer,\n");
+  printf("      uart, mmc, gpio, other\n");
+  printf("  -r  card access time before each read block, default 100 us\n");
+  printf("  -w  card power-up time (ACMD41 busy), default 20 ms\n");
+  printf("  -t  modelled time limit, default 30000 ms\n");
+  printf("  -s  PRM_RSTST at power up, default 0x1 (cold), e.g. 0x10 for a watchdog reset\n");
+  printf("  -d  keep DDR in a file (sparse, 512MB), what a run leaves there is what\n");
+  printf("      the next one finds, e.g. for a warm reset after a boot. empty otherwise\n");
+}
+
+int main(int argc, char** argv) {
+  static ucontext_t host_ctx, spl_ctx;
+  const char* card = NULL;
+  const char* ddr_file = NULL;
+  stack_t ss;
+  struct itimerval it;
+  struct termios tio;
+  char name[16];
+  uint32_t i, ns;
+  int opt, pty = 0, found;
+  off_t size;
+
+  mmc.read_ns = 100000;
+  mmc.write_ns = 500000;
+  mmc.powerup_ns = 20000000;
+  sim.limit = 30000000000ull;
+  while ((opt = getopt(argc, argv, "c:pe:l:r:w:t:s:d:")) != -1) {
+    switch (opt) {
+      case 'c': card = optarg; break;
+      case 'p': pty = 1; break;
+      case 'e': uart.noise = strtoul(optarg, NULL, 0); break;
+      case 'l':
+        if (sscanf(optarg, "%15[a-z]=%u", name, &ns) != 2) {
+          usage();
+          return 1;
+        }
+        found = 0;
+        for (i = 0; i < NUM_MODELS; i++) {
+          if (strcmp(models[i].name, name) == 0) {
+            models[i].latency = ns;
+            found = 1;
+          }
+        }
+        if (!found) {
+          usage();
+          return 1;
+        }
+        break;
+      case 'r': mmc.read_ns = strtoull(optarg, NULL, 0) * 1000; break;
+      case 'w': mmc.powerup_ns = strtoull(optarg, NULL, 0) * 1000000; break;
+      case 't': sim.limit = strtoull(optarg, NULL, 0) * 1000000; break;
+      case 's': prm_rstst = strtoul(optarg, NULL, 0); break;
+      case 'd': ddr_file = optarg; break;
+      default: usage(); return 1;
+    }
+  }
+
+  mmc.fd = -1;
+  if (card != NULL) {
+    mmc.fd = open(card, O_RDWR);
+    if (mmc.fd < 0) {
+      perror(card);
+      return 1;
+    }
+    size = lseek(mmc.fd, 0, SEEK_END);
+    mmc.blocks = size / SD_BLOCK_SIZE;
+  }
+  mmc.cc_at = mmc.tc_at = mmc.buf_at = SIM_NONE;
+  mmc.first_acmd41 = SIM_NONE;
+  intc_reset();
+  uart.mdr1 = 0x7;
+  uart.in_fd = 0;
+  uart.out_fd = 1;
+  if (pty) {
+    uart.in_fd = uart.out_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (uart.in_fd < 0 || grantpt(uart.in_fd) || unlockpt(uart.in_fd)) {
+      perror("pty");
+      return 1;
+    }
+    /* no echo of what the loader sends back into its own input */
+    tcgetattr(uart.in_fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(uart.in_fd, TCSANOW, &tio);
+    fprintf(stderr, "UART0 on %s\n", ptsname(uart.in_fd));
+  }
+
+  map_at(SIM_SRAM_BASE, SIM_SRAM_SIZE, PROT_READ | PROT_WRITE, NULL);
+  map_at(SIM_IO_BASE, SIM_IO_SIZE, PROT_NONE, NULL);
+  map_at(DDR_START, DDR_SIZE, PROT_READ | PROT_WRITE, ddr_file);
+
+  ss.ss_sp = malloc(SIGSTKSZ * 4);
+  ss.ss_size = SIGSTKSZ * 4;
+  ss.ss_flags = 0;
+  sigaltstack(&ss, NULL);
+  on_signal(SIGSEGV, sim_fault);
+  on_signal(SIGTRAP, sim_step);
+  on_signal(SIGUSR1, sim_irq_signal);
+  signal(SIGALRM, sim_watchdog);
+  it.it_interval.tv_sec = it.it_value.tv_sec = SIM_STALL_S;
+  it.it_interval.tv_usec = it.it_value.tv_usec = 0;
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  /* sched_switch keeps stack pointers in 32 bits */
+  getcontext(&spl_ctx);
+  spl_ctx.uc_stack.ss_sp = mmap(NULL, SIM_SPL_STACK, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+  spl_ctx.uc_stack.ss_size = SIM_SPL_STACK;
+  spl_ctx.uc_link = &host_ctx;
+  makecontext(&spl_ctx, spl_entry, 0);
+  swapcontext(&host_ctx, &spl_ctx);
+  sim_finish("reloc_main returned", 2);
+  return 2;
+}
@@ -0,0 +1,35 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* table driven CRC-32 (reflected polynomial 0xEDB88320) */
+#include <common.h>
+#include <crc32.h>
+
+u32_t crc32_table[256];
+static u32_t crc32_ready = 0;
+
+/* build the lookup table, 1KB of bss rather than 1KB of image */
+void crc32_init(void) {
+  u32_t i, j, c;
+
+  if (crc32_ready) {
+    return;
+  }
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (j = 0; j < 8; j++) {
+      c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+    }
+    crc32_table[i] = c;
+  }
+  crc32_ready = 1;
+}
+
+u32_t crc32_update(u32_t crc, const u8_t* buf, u32_t len) {
+  u32_t i;
+
+  crc32_init();
+  crc = ~crc;
+  for (i = 0; i < len; i++) {
+    crc = CRC32_BYTE(crc, buf[i]);
+  }
+  return ~crc;
+}
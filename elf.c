@@ -0,0 +1,131 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* ELF kernel loader. Segments are read from the card with as few commands
+   as possible: the block aligned middle of each segment is queued to go
+   straight to its destination, the block layer merges what is adjacent on
+   the card. Only the partial blocks at the ends go through a bounce buffer.
+   Zero filled parts never touch the card. */
+#include <blk.h>
+#include <common.h>
+#include <crc32.h>
+#include <elf.h>
+#include <log.h>
+#include <mem.h>
+#include <memlayout.h>
+#include <sd_image.h>
+#include <trace.h>
+#include <warm.h>
+
+static u32_t elf_block[SD_BLOCK_SIZE / 4];
+static struct elf32_phdr elf_phdrs[ELF_MAX_PHDRS];
+
+/* read len bytes from off in the file at block lba. whole blocks are only
+   queued, they are there after blk_run */
+static int elf_read(struct blk_dev* dev, u8_t* dst, u32_t lba, u32_t off, u32_t len) {
+  u32_t n, skip, i;
+
+  while (len != 0) {
+    skip = off % SD_BLOCK_SIZE;
+    if (skip == 0 && len >= SD_BLOCK_SIZE && ((u32_t)dst & 0x3) == 0) {
+      n = len / SD_BLOCK_SIZE;
+      if (blk_submit(dev, BLK_READ, lba + off / SD_BLOCK_SIZE, n, (u32_t*)dst)) {
+        return 1;
+      }
+      n *= SD_BLOCK_SIZE;
+    } else {
+      /* partial block, or a destination the card can't write words to */
+      if (blk_read(dev, lba + off / SD_BLOCK_SIZE, 1, elf_block)) {
+        return 1;
+      }
+      n = SD_BLOCK_SIZE - skip;
+      if (n > len) {
+        n = len;
+      }
+      for (i = 0; i < n; i++) {
+        dst[i] = ((u8_t*)elf_block)[skip + i];
+      }
+    }
+    dst += n;
+    off += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* does [addr, addr + len) fit in the kernel load area */
+static int elf_in_load_area(u32_t addr, u32_t len) {
+  return addr >= KERNEL_LOAD_ADDR && len <= KERNEL_MAX_SIZE &&
+         addr - KERNEL_LOAD_ADDR <= KERNEL_MAX_SIZE - len;
+}
+
+int elf_check(const struct elf32_ehdr* eh) {
+  if (*(const u32_t*)eh->e_ident != ELF_MAGIC || eh->e_ident[4] != ELFCLASS32 ||
+      eh->e_ident[5] != ELFDATA2LSB || eh->e_type != ET_EXEC || eh->e_machine != EM_ARM) {
+    return 1;
+  }
+  if (eh->e_phentsize != sizeof(struct elf32_phdr) || eh->e_phnum == 0 ||
+      eh->e_phnum > ELF_MAX_PHDRS) {
+    return 1;
+  }
+  return 0;
+}
+
+int elf_load_sd(struct blk_dev* dev, u32_t lba, u32_t size, u32_t* entry, u32_t* crc) {
+  struct elf32_ehdr eh;
+  struct elf32_phdr* ph;
+  u32_t i, phsize;
+
+  if (size < sizeof(eh) || elf_read(dev, (u8_t*)&eh, lba, 0, sizeof(eh)) || elf_check(&eh)) {
+    LOG0("not an ARM executable\n\r");
+    return 1;
+  }
+  phsize = eh.e_phnum * sizeof(struct elf32_phdr);
+  if (eh.e_phoff > size || size - eh.e_phoff < phsize ||
+      elf_read(dev, (u8_t*)elf_phdrs, lba, eh.e_phoff, phsize) || blk_run(dev)) {
+    LOG0("bad ELF program headers\n\r");
+    return 1;
+  }
+
+  /* check everything before writing anything */
+  for (i = 0; i < eh.e_phnum; i++) {
+    ph = &elf_phdrs[i];
+    if (ph->p_type != PT_LOAD || ph->p_memsz == 0) {
+      continue;
+    }
+    if (ph->p_filesz > ph->p_memsz || ph->p_offset > size ||
+        size - ph->p_offset < ph->p_filesz || !elf_in_load_area(ph->p_paddr, ph->p_memsz)) {
+      LOG3("segment %u at 0x%08x, 0x%08x bytes doesn't fit\n\r", i, ph->p_paddr, ph->p_memsz);
+      return 1;
+    }
+  }
+  if (!elf_in_load_area(eh.e_entry, 4)) {
+    LOG1("entry 0x%08x outside the load area\n\r", eh.e_entry);
+    return 1;
+  }
+
+  for (i = 0; i < eh.e_phnum; i++) {
+    ph = &elf_phdrs[i];
+    if (ph->p_type != PT_LOAD || ph->p_memsz == 0) {
+      continue;
+    }
+    trace_event(TRACE_ELF_SEGMENT, ph->p_paddr, ph->p_filesz);
+    LOG3("  0x%08x: 0x%08x file, 0x%08x zero\n\r", ph->p_paddr, ph->p_filesz,
+         ph->p_memsz - ph->p_filesz);
+    if (elf_read(dev, (u8_t*)ph->p_paddr, lba, ph->p_offset, ph->p_filesz)) {
+      return 1;
+    }
+    mem_zero((u8_t*)(ph->p_paddr + ph->p_filesz), ph->p_memsz - ph->p_filesz);
+    warm_add(ph->p_paddr, ph->p_filesz, ph->p_memsz - ph->p_filesz);
+  }
+  if (blk_run(dev)) {
+    return 1;
+  }
+  *crc = 0;
+  for (i = 0; i < eh.e_phnum; i++) {
+    ph = &elf_phdrs[i];
+    if (ph->p_type == PT_LOAD && ph->p_memsz != 0) {
+      *crc = crc32_update(*crc, (const u8_t*)ph->p_paddr, ph->p_filesz);
+    }
+  }
+  *entry = eh.e_entry;
+  return 0;
+}
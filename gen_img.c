@@ -0,0 +1,334 @@
+/* Copyright (c) 2023  Hunter Whyte
+  Builds a complete SD card image: MBR, layout manifest, TOC, GP header and
+  MLO, and optionally a kernel. The layout is in include/sd_image.h, the
+  loader finds the kernel through the manifest so nothing depends on the MLO
+  size. The kernel, the persistent log region (plog.h) and the partition start
+  on allocation unit boundaries.
+  The partition is only entered in the MBR, format it after writing the
+  image, e.g.
+    dd if=boot.img of=/dev/sdX && mkfs.vfat -F 32 /dev/sdX1
+*/
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "include/elf.h"
+#include "include/memlayout.h"
+#include "include/plog.h"
+#include "include/sd_image.h"
+
+/* ROM loads the MLO to the start of internal SRAM, see gen_mlo.c */
+#define MLO_LOAD_ADDR 0x402F0400
+/* FAT32 with LBA addressing */
+#define PART_TYPE_DEFAULT 0x0C
+
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int j = 0; j < 8; j++) {
+      c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+    }
+    crc_table[i] = c;
+  }
+}
+
+/* same as zlib crc32() and crc32_update() on the target */
+static uint32_t crc_update(uint32_t crc, const uint8_t* buf, size_t len) {
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc = crc_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static void put_word(uint8_t* p, uint32_t val) {
+  p[0] = val & 0xFF;
+  p[1] = (val >> 8) & 0xFF;
+  p[2] = (val >> 16) & 0xFF;
+  p[3] = (val >> 24) & 0xFF;
+}
+
+static uint32_t get_word(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t get_half(const uint8_t* p) {
+  return p[0] | (p[1] << 8);
+}
+
+#define EHDR(k, field) (k + offsetof(struct elf32_ehdr, field))
+#define PHDR(p, field) (p + offsetof(struct elf32_phdr, field))
+
+static int loadable(uint32_t addr, uint32_t len) {
+  return addr >= KERNEL_LOAD_ADDR && len <= KERNEL_MAX_SIZE &&
+         addr - KERNEL_LOAD_ADDR <= KERNEL_MAX_SIZE - len;
+}
+
+/* same checks as elf_load_sd() on the target. entry and the crc of the
+   PT_LOAD file bytes for the manifest, returns 0 if the kernel loads */
+static int elf_kernel(const uint8_t* k, long size, uint32_t* entry, uint32_t* crc) {
+  if (size < (long)sizeof(struct elf32_ehdr) || k[4] != ELFCLASS32 || k[5] != ELFDATA2LSB ||
+      get_half(EHDR(k, e_type)) != ET_EXEC || get_half(EHDR(k, e_machine)) != EM_ARM) {
+    printf("kernel is not a 32 bit little endian ARM executable\n");
+    return 1;
+  }
+  uint32_t phoff = get_word(EHDR(k, e_phoff));
+  uint32_t phnum = get_half(EHDR(k, e_phnum));
+  if (get_half(EHDR(k, e_phentsize)) != sizeof(struct elf32_phdr) || phnum == 0 ||
+      phnum > ELF_MAX_PHDRS || phoff > size ||
+      (uint32_t)size - phoff < phnum * sizeof(struct elf32_phdr)) {
+    printf("bad program headers, the loader takes up to %u\n", ELF_MAX_PHDRS);
+    return 1;
+  }
+  *crc = 0;
+  for (uint32_t i = 0; i < phnum; i++) {
+    const uint8_t* ph = k + phoff + i * sizeof(struct elf32_phdr);
+    uint32_t off = get_word(PHDR(ph, p_offset));
+    uint32_t paddr = get_word(PHDR(ph, p_paddr));
+    uint32_t filesz = get_word(PHDR(ph, p_filesz));
+    uint32_t memsz = get_word(PHDR(ph, p_memsz));
+    if (get_word(PHDR(ph, p_type)) != PT_LOAD || memsz == 0) {
+      continue;
+    }
+    if (filesz > memsz || off > size || size - off < filesz || !loadable(paddr, memsz)) {
+      printf("segment %u at 0x%08X, 0x%08X bytes doesn't fit 0x%08X-0x%08X\n", i, paddr, memsz,
+             KERNEL_LOAD_ADDR, KERNEL_LOAD_ADDR + KERNEL_MAX_SIZE);
+      return 1;
+    }
+    printf("  segment 0x%08X: 0x%08X file, 0x%08X zero\n", paddr, filesz, memsz - filesz);
+    *crc = crc_update(*crc, k + off, filesz);
+  }
+  *entry = get_word(EHDR(k, e_entry));
+  if (!loadable(*entry, 4)) {
+    printf("entry 0x%08X outside the load area\n", *entry);
+    return 1;
+  }
+  return 0;
+}
+
+static uint8_t* read_file(const char* name, long* size) {
+  FILE* fin = fopen(name, "rb");
+  if (fin == NULL) {
+    perror(name);
+    return NULL;
+  }
+  fseek(fin, 0L, SEEK_END);
+  *size = ftell(fin);
+  fseek(fin, 0, SEEK_SET);
+  uint8_t* data = (uint8_t*)malloc(*size + 1);
+  if (fread(data, 1, *size, fin) != (size_t)*size) {
+    printf("failed to read %s\n", name);
+    fclose(fin);
+    free(data);
+    return NULL;
+  }
+  fclose(fin);
+  return data;
+}
+
+static uint32_t align_up(uint32_t lba, uint32_t au) {
+  return (lba + au - 1) / au * au;
+}
+
+static uint32_t blocks(uint32_t bytes) {
+  return (bytes + SD_BLOCK_SIZE - 1) / SD_BLOCK_SIZE;
+}
+
+static int write_at(FILE* fout, uint32_t lba, const void* data, size_t len) {
+  if (fseek(fout, (long)lba * SD_BLOCK_SIZE, SEEK_SET) || fwrite(data, 1, len, fout) != len) {
+    perror("write");
+    return 1;
+  }
+  return 0;
+}
+
+/* one MBR partition entry, CHS fields set to "use LBA" */
+static void mbr_entry(uint8_t* e, uint8_t type, uint32_t lba, uint32_t count) {
+  e[0] = 0x00; /* not bootable, the ROM boots from the raw area */
+  e[1] = 0xFE;
+  e[2] = 0xFF;
+  e[3] = 0xFF;
+  e[4] = type;
+  e[5] = 0xFE;
+  e[6] = 0xFF;
+  e[7] = 0xFF;
+  put_word(&e[8], lba);
+  put_word(&e[12], count);
+}
+
+static void usage(void) {
+  printf("usage: ./gen_img [-a au_kb] [-g log_kb] [-p part_mb] [-t part_type]\n");
+  printf("                 [-l load_addr] <output.img> <boot.bin> [kernel.bin]\n");
+  printf("  -a  allocation unit to align to, default %u KB\n",
+         SD_AU_BLOCKS_DEFAULT * SD_BLOCK_SIZE / 1024);
+  printf("  -g  persistent log region, 0 for none, default one allocation unit\n");
+  printf("  -p  partition after the boot area, 0 for none, default 64 MB\n");
+  printf("  -t  MBR partition type, default 0x%02X (FAT32)\n", PART_TYPE_DEFAULT);
+  printf("  -l  raw kernel load and entry address, default 0x%08X\n", KERNEL_LOAD_ADDR);
+}
+
+int main(int argc, char** argv) {
+  uint32_t au = SD_AU_BLOCKS_DEFAULT;
+  uint32_t part_mb = 64;
+  long log_kb = -1;
+  uint32_t part_type = PART_TYPE_DEFAULT;
+  uint32_t load = KERNEL_LOAD_ADDR;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "a:g:p:t:l:")) != -1) {
+    switch (opt) {
+      case 'a': au = strtoul(optarg, NULL, 0) * 1024 / SD_BLOCK_SIZE; break;
+      case 'g': log_kb = strtoul(optarg, NULL, 0); break;
+      case 'p': part_mb = strtoul(optarg, NULL, 0); break;
+      case 't': part_type = strtoul(optarg, NULL, 0); break;
+      case 'l': load = strtoul(optarg, NULL, 0); break;
+      default: usage(); return 1;
+    }
+  }
+  if (argc - optind != 2 && argc - optind != 3) {
+    usage();
+    return 1;
+  }
+  /* has to be a power of 2 to be an erase boundary */
+  if (au == 0 || (au & (au - 1)) || part_type == 0 || part_type > 0xFF) {
+    printf("bad allocation unit or partition type\n");
+    return 1;
+  }
+
+  long mlo_size, kernel_size = 0;
+  uint8_t* mlo = read_file(argv[optind + 1], &mlo_size);
+  uint8_t* kernel = NULL;
+  if (mlo == NULL) {
+    return 1;
+  }
+  if (argc - optind == 3 && (kernel = read_file(argv[optind + 2], &kernel_size)) == NULL) {
+    return 1;
+  }
+  if (SD_RAW_BOOT_LBA + 1 + blocks(mlo_size + 8) > SD_RAW_BOOT_END) {
+    printf("MLO is %ld bytes, has to end before block %u\n", mlo_size, SD_RAW_BOOT_END);
+    return 1;
+  }
+  crc_init();
+
+  uint32_t kernel_crc = crc_update(0, kernel, kernel_size);
+  if (kernel_size >= 4 && get_word(kernel) == ELF_MAGIC) {
+    if (elf_kernel(kernel, kernel_size, &load, &kernel_crc)) {
+      return 1;
+    }
+  } else if (!loadable(load, kernel_size)) {
+    printf("kernel doesn't fit at 0x%08X, the loader takes up to 0x%08X\n", load,
+           KERNEL_LOAD_ADDR + KERNEL_MAX_SIZE);
+    return 1;
+  }
+
+  /* lay it out */
+  uint32_t log_blocks = log_kb < 0 ? au : (uint32_t)log_kb * 1024 / SD_BLOCK_SIZE;
+  if (log_blocks != 0 && log_blocks < 1 + PLOG_SLOT_BLOCKS) {
+    printf("log region needs at least %u blocks\n", 1 + PLOG_SLOT_BLOCKS);
+    return 1;
+  }
+  uint32_t kernel_lba = align_up(SD_RAW_BOOT_END, au);
+  uint32_t log_lba = align_up(kernel_lba + blocks(kernel_size), au);
+  uint32_t part_lba = align_up(log_lba + log_blocks, au);
+  uint32_t part_blocks = part_mb * (1024 * 1024 / SD_BLOCK_SIZE);
+
+  uint8_t block[SD_BLOCK_SIZE];
+  FILE* fout = fopen(argv[optind], "wb");
+  if (fout == NULL) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  /* MBR */
+  memset(block, 0, sizeof(block));
+  put_word(&block[440], crc_update(0, mlo, mlo_size)); /* disk signature */
+  if (part_blocks != 0) {
+    mbr_entry(&block[446], part_type, part_lba, part_blocks);
+  }
+  block[510] = 0x55;
+  block[511] = 0xAA;
+  if (write_at(fout, 0, block, sizeof(block))) {
+    return 1;
+  }
+
+  /* manifest */
+  memset(block, 0, sizeof(block));
+  put_word(&block[0], SD_MANIFEST_MAGIC);
+  put_word(&block[4], SD_MANIFEST_VERSION);
+  put_word(&block[8], au);
+  put_word(&block[12], SD_RAW_BOOT_LBA);
+  put_word(&block[16], mlo_size);
+  put_word(&block[20], kernel_lba);
+  put_word(&block[24], kernel_size);
+  put_word(&block[28], load);
+  put_word(&block[32], kernel_crc);
+  put_word(&block[36], part_lba);
+  put_word(&block[40], part_blocks);
+  put_word(&block[44], log_lba);
+  put_word(&block[48], log_blocks);
+  put_word(&block[52], crc_update(0, block, 52));
+  if (write_at(fout, SD_MANIFEST_LBA, block, sizeof(block))) {
+    return 1;
+  }
+
+  /* TOC, see gen_toc.c */
+  memset(block, 0, sizeof(block));
+  put_word(&block[0x00], 0x40);
+  put_word(&block[0x04], 0x0C);
+  memcpy(&block[0x14], "CHSETTINGS", 11);
+  memset(&block[0x20], 0xFF, 32);
+  put_word(&block[0x40], 0xC0C0C0C1);
+  put_word(&block[0x44], 0x00000100);
+  if (write_at(fout, SD_RAW_BOOT_LBA, block, sizeof(block))) {
+    return 1;
+  }
+
+  /* GP header and MLO right after it, see gen_mlo.c */
+  put_word(&block[0], mlo_size);
+  put_word(&block[4], MLO_LOAD_ADDR);
+  if (write_at(fout, SD_RAW_BOOT_LBA + 1, block, 8) ||
+      fwrite(mlo, 1, mlo_size, fout) != (size_t)mlo_size) {
+    perror("write");
+    return 1;
+  }
+
+  if (kernel_size != 0 && write_at(fout, kernel_lba, kernel, kernel_size)) {
+    return 1;
+  }
+  /* the whole log region zeroed, so the loader starts the log over and no
+     batches of an earlier image turn up in log_decode */
+  memset(block, 0, sizeof(block));
+  for (uint32_t i = 0; i < log_blocks; i++) {
+    if (write_at(fout, log_lba + i, block, sizeof(block))) {
+      return 1;
+    }
+  }
+  /* pad to a whole block, the partition is left to the card */
+  fseek(fout, 0L, SEEK_END);
+  long end = ftell(fout);
+  if (end % SD_BLOCK_SIZE) {
+    memset(block, 0, sizeof(block));
+    fwrite(block, 1, SD_BLOCK_SIZE - end % SD_BLOCK_SIZE, fout);
+  }
+  fclose(fout);
+
+  printf("allocation unit %u blocks\n", au);
+  printf("  %8s %10s %10s\n", "", "block", "bytes");
+  printf("  %8s %10u %10u\n", "MBR", 0, SD_BLOCK_SIZE);
+  printf("  %8s %10u %10u\n", "manifest", SD_MANIFEST_LBA, SD_BLOCK_SIZE);
+  printf("  %8s %10u %10ld\n", "MLO", SD_RAW_BOOT_LBA, SD_BLOCK_SIZE + 8 + mlo_size);
+  printf("  %8s %10u %10ld  at 0x%08X\n", "kernel", kernel_lba, kernel_size, load);
+  if (log_blocks != 0) {
+    printf("  %8s %10u %10u\n", "log", log_lba, log_blocks * SD_BLOCK_SIZE);
+  }
+  if (part_blocks != 0) {
+    printf("  %8s %10u %10u  type 0x%02X\n", "part", part_lba, part_blocks * SD_BLOCK_SIZE,
+           part_type);
+  }
+  return 0;
+}
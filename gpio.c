@@ -1,51 +1,287 @@
 /* Copyright (c) 2023  Hunter Whyte */
-/* Basic gpio utilities to control LEDs on Beaglebone Black.
-  Could be expanded upon in the future to support all 4 GPIO modules + much more
-  general functionality than just setting and clearing LED pins specifically.
+/* GPIO driver for all 4 GPIO modules, and the user LEDs on Beaglebone Black.
+   Outputs are only ever written through SETDATAOUT/CLEARDATAOUT, one store
+   per call for any number of pins. gpio_out keeps what was last written so
+   toggling needs no read of DATAOUT either, reads from the L4 bus cost far
+   more than the store.
+   Edges are caught on interrupt line A (IRQSTATUS_0) of each module. The ISR
+   takes the timestamp before anything else, acks the pins, records them in
+   the capture ring if asked to and calls the bank's callback.
 */
 #include <common.h>
+#include <cpu.h>
 #include <gpio.h>
+#include <interrupt.h>
 #include <prcm.h>
 
-/* enable GPIO1 to use user LEDs, doesn't enable GPIO 0, 2, or 3 */
-void gpio_led_init(void) {
-  /* GPIO1 clock and power config [AM335x TRM 1284] */
-  REG(CM_PER_GPIO1_CLKCTRL) &= ~0x3;      /* clear MODULEMODE */
-  REG(CM_PER_GPIO1_CLKCTRL) |= 0x2;       /* MODULEMODE = enable */
-  REG(CM_PER_GPIO1_CLKCTRL) |= (1 << 18); /* enable optional debounce clock */
+static const u32_t gpio_base[GPIO_BANKS] = {GPIO0_BASE, GPIO1_BASE, GPIO2_BASE, GPIO3_BASE};
+static const u32_t gpio_clkctrl[GPIO_BANKS] = {CM_WKUP_GPIO0_CLKCTRL, CM_PER_GPIO1_CLKCTRL,
+                                               CM_PER_GPIO2_CLKCTRL, CM_PER_GPIO3_CLKCTRL};
+static const u32_t gpio_irq[GPIO_BANKS] = {IRQ_GPIOINT0A, IRQ_GPIOINT1A, IRQ_GPIOINT2A,
+                                           IRQ_GPIOINT3A};
+static void (*const gpio_isrs[GPIO_BANKS])(void) = {gpio0_isr, gpio1_isr, gpio2_isr, gpio3_isr};
+
+#define GPIO_REG(bank, offset) REG(gpio_base[bank] + (offset))
+/* a module that isn't clocked aborts on access, calls on banks gpio_init
+   hasn't set up are ignored */
+#define GPIO_BANK_OK(bank) ((bank) < GPIO_BANKS && (gpio_enabled & (1 << (bank))))
+
+static u32_t gpio_enabled = 0;       /* banks set up by gpio_init */
+static u32_t gpio_out[GPIO_BANKS];   /* last value written to DATAOUT */
+static u32_t gpio_capture_pins[GPIO_BANKS];
+static gpio_callback_t gpio_callbacks[GPIO_BANKS];
+
+/* single producer (the ISRs, which share a priority so never nest) and single
+   consumer ring. head and tail are free running */
+static struct gpio_edge gpio_ring[GPIO_CAPTURE_SIZE];
+static volatile u32_t gpio_ring_head = 0;
+static volatile u32_t gpio_ring_tail = 0;
+static volatile u32_t gpio_ring_dropped = 0;
+
+/* enable a GPIO module, resets it the first time. all pins start as inputs
+   with no interrupts. doesn't need the INTC, gpio_irq_enable does */
+void gpio_init(u32_t bank) {
+  if (bank >= GPIO_BANKS || (gpio_enabled & (1 << bank))) {
+    return;
+  }
+  /* clock and power config, MODULEMODE = enable plus the optional debounce
+     clock [AM335x TRM 1284] */
+  REG(gpio_clkctrl[bank]) = (1 << 18) | 0x2;
   /* poll idle status waiting for fully enabled */
-  while (REG(CM_PER_GPIO1_CLKCTRL) & (0x3 << 16)) {}
+  while (REG(gpio_clkctrl[bank]) & (0x3 << 16)) {}
+
+  /* [AM335x TRM 4990] */
+  GPIO_REG(bank, GPIO_SYSCONFIG_OFFSET) |= 0x2;            /* trigger reset */
+  while (!(GPIO_REG(bank, GPIO_SYSSTATUS_OFFSET) & 0x1)) {} /* wait until reset */
+  GPIO_REG(bank, GPIO_CTRL_OFFSET) &= ~(0x1);              /* clear disable bit */
+  gpio_out[bank] = 0;
+  gpio_capture_pins[bank] = 0;
+  gpio_callbacks[bank] = NULL;
+  gpio_enabled |= 1 << bank;
+}
 
-  /* GPIO1 config [AM335x TRM 4990]*/
-  REG(GPIO1_SYSCONFIG) |= (0x2);           /* trigger reset of GPIO1 */
-  while (!(REG(GPIO1_SYSSTATUS) & 0x1)) {} /* wait until GPIO1 is reset.*/
-  REG(GPIO1_CTRL) &= ~(0x1);               /* clear disable bit, enabling GPIO1 */
+/* OE is the only register written read-modify-write, it's configuration */
+void gpio_output(u32_t bank, u32_t pins) {
+  u32_t flags;
 
-  /* set user LED pins to output mode */
-  REG(GPIO1_OE) &= ~((1 << USR0) | (1 << USR1) | (1 << USR2) | (1 << USR3));
+  if (GPIO_BANK_OK(bank)) {
+    flags = cpu_irq_save();
+    GPIO_REG(bank, GPIO_OE_OFFSET) &= ~pins;
+    cpu_irq_restore(flags);
+  }
 }
 
-/* set a pin hooked up to LED on bbb, gpio_init must be called first */
+void gpio_input(u32_t bank, u32_t pins) {
+  u32_t flags;
+
+  if (GPIO_BANK_OK(bank)) {
+    flags = cpu_irq_save();
+    GPIO_REG(bank, GPIO_OE_OFFSET) |= pins;
+    cpu_irq_restore(flags);
+  }
+}
+
+void gpio_set(u32_t bank, u32_t pins) {
+  u32_t flags;
+
+  if (GPIO_BANK_OK(bank)) {
+    flags = cpu_irq_save();
+    GPIO_REG(bank, GPIO_SETDATAOUT_OFFSET) = pins;
+    gpio_out[bank] |= pins;
+    cpu_irq_restore(flags);
+  }
+}
+
+void gpio_clear(u32_t bank, u32_t pins) {
+  u32_t flags;
+
+  if (GPIO_BANK_OK(bank)) {
+    flags = cpu_irq_save();
+    GPIO_REG(bank, GPIO_CLEARDATAOUT_OFFSET) = pins;
+    gpio_out[bank] &= ~pins;
+    cpu_irq_restore(flags);
+  }
+}
+
+/* drive pins to the matching bits of value, at most one store each to
+   SETDATAOUT and CLEARDATAOUT */
+void gpio_write(u32_t bank, u32_t pins, u32_t value) {
+  u32_t flags;
+
+  if (!GPIO_BANK_OK(bank)) {
+    return;
+  }
+  flags = cpu_irq_save();
+  if (pins & value) {
+    GPIO_REG(bank, GPIO_SETDATAOUT_OFFSET) = pins & value;
+  }
+  if (pins & ~value) {
+    GPIO_REG(bank, GPIO_CLEARDATAOUT_OFFSET) = pins & ~value;
+  }
+  gpio_out[bank] = (gpio_out[bank] & ~pins) | (pins & value);
+  cpu_irq_restore(flags);
+}
+
+void gpio_toggle(u32_t bank, u32_t pins) {
+  u32_t flags;
+
+  if (GPIO_BANK_OK(bank)) {
+    flags = cpu_irq_save();
+    gpio_write(bank, pins, ~gpio_out[bank]);
+    cpu_irq_restore(flags);
+  }
+}
+
+u32_t gpio_read(u32_t bank) {
+  return GPIO_BANK_OK(bank) ? GPIO_REG(bank, GPIO_DATAIN_OFFSET) : 0;
+}
+
+/* interrupt on the given edges of pins, which are made inputs. debounce_us of
+   0 turns debouncing off for them, otherwise it sets the debounce time of the
+   whole bank. a NULL callback keeps the current one. returns 0 on success */
+int gpio_irq_enable(u32_t bank, u32_t pins, u32_t flags, u32_t debounce_us,
+                    gpio_callback_t callback) {
+  u32_t irq_flags;
+
+  if (!GPIO_BANK_OK(bank) || debounce_us > GPIO_DEBOUNCE_MAX_US ||
+      !(flags & (GPIO_RISING | GPIO_FALLING))) {
+    return 1;
+  }
+  irq_flags = cpu_irq_save();
+  GPIO_REG(bank, GPIO_IRQSTATUS_CLR_0_OFFSET) = pins;
+  GPIO_REG(bank, GPIO_OE_OFFSET) |= pins;
+  if (debounce_us != 0) {
+    /* rounded up to the next step */
+    GPIO_REG(bank, GPIO_DEBOUNCINGTIME_OFFSET) =
+        (debounce_us + GPIO_DEBOUNCE_STEP_US - 1) / GPIO_DEBOUNCE_STEP_US - 1;
+    GPIO_REG(bank, GPIO_DEBOUNCENABLE_OFFSET) |= pins;
+  } else {
+    GPIO_REG(bank, GPIO_DEBOUNCENABLE_OFFSET) &= ~pins;
+  }
+  if (flags & GPIO_RISING) {
+    GPIO_REG(bank, GPIO_RISINGDETECT_OFFSET) |= pins;
+  } else {
+    GPIO_REG(bank, GPIO_RISINGDETECT_OFFSET) &= ~pins;
+  }
+  if (flags & GPIO_FALLING) {
+    GPIO_REG(bank, GPIO_FALLINGDETECT_OFFSET) |= pins;
+  } else {
+    GPIO_REG(bank, GPIO_FALLINGDETECT_OFFSET) &= ~pins;
+  }
+  if (flags & GPIO_CAPTURE) {
+    gpio_capture_pins[bank] |= pins;
+  } else {
+    gpio_capture_pins[bank] &= ~pins;
+  }
+  if (callback != NULL) {
+    gpio_callbacks[bank] = callback;
+  }
+  /* same priority for every bank keeps the capture ring single producer */
+  irq_register(gpio_irq[bank], gpio_isrs[bank]);
+  irq_set_priority(gpio_irq[bank], IRQ_PRIO_HIGH);
+  irq_unmask(gpio_irq[bank]);
+  /* drop edges seen while the detection was being changed */
+  GPIO_REG(bank, GPIO_IRQSTATUS_0_OFFSET) = pins;
+  GPIO_REG(bank, GPIO_IRQSTATUS_SET_0_OFFSET) = pins;
+  cpu_irq_restore(irq_flags);
+  return 0;
+}
+
+void gpio_irq_disable(u32_t bank, u32_t pins) {
+  u32_t flags;
+
+  if (!GPIO_BANK_OK(bank)) {
+    return;
+  }
+  flags = cpu_irq_save();
+  GPIO_REG(bank, GPIO_IRQSTATUS_CLR_0_OFFSET) = pins;
+  GPIO_REG(bank, GPIO_RISINGDETECT_OFFSET) &= ~pins;
+  GPIO_REG(bank, GPIO_FALLINGDETECT_OFFSET) &= ~pins;
+  GPIO_REG(bank, GPIO_IRQSTATUS_0_OFFSET) = pins;
+  gpio_capture_pins[bank] &= ~pins;
+  cpu_irq_restore(flags);
+}
+
+static void gpio_isr(u32_t bank) {
+  u32_t time, pins, capture;
+  struct gpio_edge* e;
+
+  time = cpu_cycles();
+  pins = GPIO_REG(bank, GPIO_IRQSTATUS_0_OFFSET);
+  GPIO_REG(bank, GPIO_IRQSTATUS_0_OFFSET) = pins;
+
+  capture = pins & gpio_capture_pins[bank];
+  if (capture) {
+    if (gpio_ring_head - gpio_ring_tail < GPIO_CAPTURE_SIZE) {
+      e = &gpio_ring[gpio_ring_head & (GPIO_CAPTURE_SIZE - 1)];
+      e->time = time;
+      e->bank = bank;
+      e->pins = capture;
+      e->level = GPIO_REG(bank, GPIO_DATAIN_OFFSET) & capture;
+      gpio_ring_head++;
+    } else {
+      gpio_ring_dropped++;
+    }
+  }
+  if (gpio_callbacks[bank] != NULL) {
+    gpio_callbacks[bank](bank, pins);
+  }
+}
+
+void gpio0_isr(void) {
+  gpio_isr(0);
+}
+
+void gpio1_isr(void) {
+  gpio_isr(1);
+}
+
+void gpio2_isr(void) {
+  gpio_isr(2);
+}
+
+void gpio3_isr(void) {
+  gpio_isr(3);
+}
+
+/* oldest captured edge, returns 1 if there is none */
+int gpio_capture_read(struct gpio_edge* edge) {
+  if (gpio_ring_head == gpio_ring_tail) {
+    return 1;
+  }
+  *edge = gpio_ring[gpio_ring_tail & (GPIO_CAPTURE_SIZE - 1)];
+  gpio_ring_tail++;
+  return 0;
+}
+
+/* edges lost to a full ring since boot */
+u32_t gpio_capture_dropped(void) {
+  return gpio_ring_dropped;
+}
+
+/* enable GPIO1 and make the user LED pins outputs */
+void gpio_led_init(void) {
+  gpio_init(1);
+  gpio_output(1, GPIO_USR_LEDS);
+}
+
+/* set a pin hooked up to LED on bbb, gpio_led_init must be called first */
 void gpio_led_on(s32_t led_number) {
   if (led_number >= 0 && led_number < 4) {
-    REG(GPIO1_SETDATAOUT) = (1 << (USR0 + led_number));
+    gpio_set(1, 1 << (USR0 + led_number));
   }
 }
 
-/* clear a pin hooked up to LED on bbb, gpio_init must be called first */
+/* clear a pin hooked up to LED on bbb, gpio_led_init must be called first */
 void gpio_led_off(s32_t led_number) {
   if (led_number >= 0 && led_number < 4) {
-    REG(GPIO1_CLEARDATAOUT) = (1 << (USR0 + led_number));
+    gpio_clear(1, 1 << (USR0 + led_number));
   }
 }
 
-/* toggle an LED on or off. gpio_init must be called first */
+/* toggle an LED on or off. gpio_led_init must be called first */
 void gpio_led_toggle(s32_t led_number) {
   if (led_number >= 0 && led_number < 4) {
-    if(REG(GPIO1_DATAOUT) & (1 << (USR0 + led_number))){
-      REG(GPIO1_CLEARDATAOUT) = (1 << (USR0 + led_number));
-    } else {
-      REG(GPIO1_SETDATAOUT) = (1 << (USR0 + led_number));
-    }
+    gpio_toggle(1, 1 << (USR0 + led_number));
   }
-}
\ No newline at end of file
+}
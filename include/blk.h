@@ -0,0 +1,74 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Block devices. Each device has an ops table doing the actual transfers in
+   SD_BLOCK_SIZE blocks, MMC0 (mmc.c) and RAM disks (blk.c) so far. Users
+   queue requests with blk_submit and dispatch them with blk_run:
+   the queue is kept sorted by block, and requests of the same direction
+   that are adjacent or overlap are merged into one transfer of up to
+   max_blocks. A merged run goes straight to or from the caller's memory when
+   the buffers line up the way the blocks do, otherwise through a bounce
+   buffer. blk_read and blk_write are the synchronous versions and split
+   long transfers into max_blocks pieces.
+   A request overlapping a queued one in a way merging can't keep in order
+   (a write with anything, a read with a write) runs the queue first.
+   Devices aren't locked, one user at a time and not from ISRs.
+*/
+#ifndef _BLK_H
+#define _BLK_H
+
+#include <common.h>
+#include <sd_image.h>
+
+#define BLK_READ  0
+#define BLK_WRITE 1
+
+#define BLK_MAX_DEVS     4
+#define BLK_MAX_REQS     32  /* queued over all devices */
+#define BLK_BOUNCE_BLOCKS 128 /* longest merged run that needs copying, 64KB */
+
+struct blk_dev;
+
+/* transfer count blocks starting at lba, buf is word aligned. returns 0 on
+   success. flush makes written data persistent, NULL if nothing to do */
+struct blk_ops {
+  int (*read)(struct blk_dev* dev, u32_t lba, u32_t count, u32_t* buf);
+  int (*write)(struct blk_dev* dev, u32_t lba, u32_t count, const u32_t* buf);
+  int (*flush)(struct blk_dev* dev);
+};
+
+struct blk_req {
+  struct blk_req* next;
+  u32_t dir;
+  u32_t lba;
+  u32_t count;
+  u32_t* buf;
+};
+
+struct blk_dev {
+  const char* name;
+  const struct blk_ops* ops;
+  u32_t blocks;      /* size, 0 if unknown */
+  u32_t max_blocks;  /* longest single transfer */
+  void* priv;
+  struct blk_req* queue; /* sorted by lba */
+  /* statistics */
+  u32_t reqs;
+  u32_t transfers;
+  u32_t merged;
+  u32_t bounced;
+  u32_t errors;
+};
+
+int blk_init(void);
+int blk_register(struct blk_dev* dev);
+struct blk_dev* blk_find(const char* name);
+int blk_submit(struct blk_dev* dev, u32_t dir, u32_t lba, u32_t count, u32_t* buf);
+int blk_run(struct blk_dev* dev);
+int blk_read(struct blk_dev* dev, u32_t lba, u32_t count, u32_t* buf);
+int blk_write(struct blk_dev* dev, u32_t lba, u32_t count, const u32_t* buf);
+int blk_flush(struct blk_dev* dev);
+void blk_print(void);
+
+/* RAM disk of blocks blocks at mem, word aligned */
+int ramdisk_init(struct blk_dev* dev, const char* name, void* mem, u32_t blocks);
+
+#endif /* _BLK_H */
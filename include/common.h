@@ -7,6 +7,10 @@ typedef unsigned short  u16_t;
 typedef signed short    s16_t;
 typedef unsigned int    u32_t;
 typedef signed int      s32_t;
+/* C90 has no long long, __extension__ keeps -pedantic quiet. 64 bit divides
+   come from libgcc */
+__extension__ typedef unsigned long long u64_t;
+__extension__ typedef signed long long   s64_t;
 
 #define true 1
 #define false 0
@@ -17,5 +21,11 @@ typedef signed int      s32_t;
 
 #define REG(addr) (*((volatile u32_t*)(addr)))
 
+/* keep code or initialised data in on-chip SRAM instead of the copy of the
+   loader that runs from DDR (see boot.ld and reloc.c). SRAM_TEXT is also
+   what makes a function callable before the relocation */
+#define SRAM_TEXT __attribute__((section(".sram.text")))
+#define SRAM_DATA __attribute__((section(".sram.data")))
+
 #endif /* _COMMON_H */
 
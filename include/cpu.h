@@ -0,0 +1,125 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Small Cortex-A8 helpers that need inline assembly. Kept in one place so the
+   rest of the drivers stay plain C.
+*/
+#ifndef _CPU_H
+#define _CPU_H
+
+#include <common.h>
+
+#define CPU_MODE_MASK 0x1F
+#define CPU_MODE_FIQ  0x11
+#define CPU_MODE_IRQ  0x12
+#define CPU_MODE_SYS  0x1F
+#define CPU_IRQ_MASKED 0x80 /* CPSR I bit */
+
+#define CPU_CYCLES_PER_US 1000 /* MPU clock is 1GHz, see mpu_pll_init */
+
+#ifdef HOST_SIM
+/* host build for boot_sim.c, same interface on top of the simulated CPU */
+#include <sim.h>
+#else
+
+/* enable the PMU cycle counter, counts every core clock [Cortex-A8 TRM 3.2.42] */
+static inline void cpu_cycles_init(void) {
+  /* PMCR: E (enable all counters), C (reset cycle counter) */
+  asm volatile(" mcr p15, 0, %0, c9, c12, 0\n\t" : : "r"(0x5));
+  /* PMCNTENSET: enable cycle counter */
+  asm volatile(" mcr p15, 0, %0, c9, c12, 1\n\t" : : "r"(0x80000000));
+}
+
+/* read the PMU cycle counter. 1GHz with MPU PLL configured, wraps every ~4.3s */
+static inline u32_t cpu_cycles(void) {
+  u32_t c;
+  asm volatile(" mrc p15, 0, %0, c9, c13, 0\n\t" : "=r"(c));
+  return c;
+}
+
+static inline u32_t cpu_mode(void) {
+  u32_t cpsr;
+  asm volatile(" mrs %0, cpsr\n\t" : "=r"(cpsr));
+  return cpsr & CPU_MODE_MASK;
+}
+
+/* mask IRQs and return the previous CPSR for cpu_irq_restore */
+static inline u32_t cpu_irq_save(void) {
+  u32_t cpsr;
+  asm volatile(" mrs %0, cpsr\n\t"
+               " cpsid i\n\t"
+               : "=r"(cpsr)
+               :
+               : "memory");
+  return cpsr;
+}
+
+/* restore the IRQ mask bit saved by cpu_irq_save */
+static inline void cpu_irq_restore(u32_t cpsr) {
+  asm volatile(" msr cpsr_c, %0\n\t" : : "r"(cpsr) : "memory");
+}
+
+static inline void cpu_irq_enable(void) {
+  asm volatile(" cpsie i\n\t" : : : "memory");
+}
+
+static inline void cpu_irq_disable(void) {
+  asm volatile(" cpsid i\n\t" : : : "memory");
+}
+
+/* IRQ and FIQ together, for handing the CPU over and for bring-up */
+static inline void cpu_irq_fiq_enable(void) {
+  asm volatile(" cpsie if\n\t" : : : "memory");
+}
+
+static inline void cpu_irq_fiq_disable(void) {
+  asm volatile(" cpsid if\n\t" : : : "memory");
+}
+
+/* sleep until an interrupt is pending, also wakes with IRQs masked */
+static inline void cpu_wfi(void) {
+  asm volatile(" wfi\n\t" : : : "memory");
+}
+
+/* wait for outstanding writes, e.g. to peripherals before unmasking IRQs */
+static inline void cpu_dsb(void) {
+  asm volatile(" dsb\n\t" : : : "memory");
+}
+
+/* atomically add to a word and return the previous value. an interrupt
+   between LDREX and STREX makes our STREX fail and retry, because
+   irq_return clears the local exclusive monitor. that relies on every
+   LDREX either ending in a STREX or a CLREX, an armed monitor left behind
+   would let a stale STREX of the interrupted context succeed */
+static inline u32_t cpu_atomic_add(volatile u32_t* addr, u32_t val) {
+  u32_t old, tmp, fail;
+  do {
+    asm volatile(" ldrex %0, [%3]\n\t"
+                 " add %1, %0, %4\n\t"
+                 " strex %2, %1, [%3]\n\t"
+                 : "=&r"(old), "=&r"(tmp), "=&r"(fail)
+                 : "r"(addr), "r"(val)
+                 : "memory");
+  } while (fail);
+  return old;
+}
+
+/* atomically replace *addr with new if it still holds old. returns the
+   value that was there, the swap happened if that equals old. CLREX
+   disarms the monitor when the compare fails and there is no STREX */
+static inline u32_t cpu_atomic_cas(volatile u32_t* addr, u32_t old, u32_t new) {
+  u32_t cur, fail;
+  do {
+    asm volatile(" ldrex %0, [%2]\n\t"
+                 " mov %1, #0\n\t"
+                 " teq %0, %3\n\t"
+                 " strexeq %1, %4, [%2]\n\t"
+                 " clrex\n\t"
+                 : "=&r"(cur), "=&r"(fail)
+                 : "r"(addr), "r"(old), "r"(new)
+                 : "cc", "memory");
+  } while (fail);
+  return cur;
+}
+
+#endif /* HOST_SIM */
+
+#endif /* _CPU_H */
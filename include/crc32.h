@@ -0,0 +1,18 @@
+/* Copyright (c) 2023  Hunter Whyte */
+#ifndef _CRC32_H
+#define _CRC32_H
+
+#include <common.h>
+
+/* IEEE 802.3 CRC-32, same as zlib crc32(): start with crc = 0 and feed the
+   previous result back in to continue over more data */
+u32_t crc32_update(u32_t crc, const u8_t* buf, u32_t len);
+
+/* byte at a time form for streaming, works on the raw (inverted) register:
+   start with CRC32_INIT, finish with ~reg */
+#define CRC32_INIT 0xFFFFFFFF
+extern u32_t crc32_table[256];
+void crc32_init(void);
+#define CRC32_BYTE(reg, b) (crc32_table[((reg) ^ (b)) & 0xFF] ^ ((reg) >> 8))
+
+#endif /* _CRC32_H */
@@ -0,0 +1,61 @@
+/* Copyright (c) 2023  Hunter Whyte */
+#ifndef _ELF_H
+#define _ELF_H
+
+#include <common.h>
+
+struct blk_dev;
+
+/* the parts of ELF32 (System V ABI, ARM ELF supplement) needed to load a
+   statically linked kernel. gen_img.c reads the same headers on the host */
+#define EI_NIDENT 16
+#define ELF_MAGIC 0x464C457F /* "\x7fELF" as a little endian word */
+#define ELFCLASS32 1
+#define ELFDATA2LSB 1
+#define ET_EXEC 2
+#define EM_ARM 40
+#define PT_LOAD 1
+
+/* most program headers a kernel may have, they are read in one go */
+#define ELF_MAX_PHDRS 16
+
+struct elf32_ehdr {
+  u8_t e_ident[EI_NIDENT];
+  u16_t e_type;
+  u16_t e_machine;
+  u32_t e_version;
+  u32_t e_entry;
+  u32_t e_phoff;
+  u32_t e_shoff;
+  u32_t e_flags;
+  u16_t e_ehsize;
+  u16_t e_phentsize;
+  u16_t e_phnum;
+  u16_t e_shentsize;
+  u16_t e_shnum;
+  u16_t e_shstrndx;
+};
+
+struct elf32_phdr {
+  u32_t p_type;
+  u32_t p_offset;
+  u32_t p_vaddr;
+  u32_t p_paddr;
+  u32_t p_filesz;
+  u32_t p_memsz;
+  u32_t p_flags;
+  u32_t p_align;
+};
+
+/* returns 0 if eh is the header of a little endian ARM executable we can
+   load */
+int elf_check(const struct elf32_ehdr* eh);
+/* load the PT_LOAD segments of the size byte ELF file at block lba of dev to
+   their physical addresses, which have to be in the kernel load area
+   (memlayout.h). Only the file backed bytes are read from the card, the rest
+   of each segment is zeroed. Each segment is added to the warm boot record (warm.h). crc is
+   the crc32 of the file bytes of the segments in program header order, what
+   gen_img puts in the manifest. returns 0 on success */
+int elf_load_sd(struct blk_dev* dev, u32_t lba, u32_t size, u32_t* entry, u32_t* crc);
+
+#endif /* _ELF_H */
@@ -2,6 +2,66 @@
 #ifndef _GPIO_H
 #define _GPIO_H
 
+#include <common.h>
+
+/* driver for the four GPIO modules, a bank is 0-3 and pins are given as a
+   mask of the bank's 32 pins. Outputs are written through SETDATAOUT and
+   CLEARDATAOUT only, so any number of pins change with one store and no
+   read. The driver keeps a copy of the output state for gpio_toggle, pins
+   driven behind its back (by the PRU, say) are only known to it as they were
+   last set through here.
+   A bank has to be set up with gpio_init first, calls on other banks (or
+   bank numbers past GPIO_BANKS) do nothing, gpio_read returns 0 and
+   gpio_irq_enable fails. */
+#define GPIO_BANKS 4
+
+void gpio_init(u32_t bank);
+void gpio_output(u32_t bank, u32_t pins);
+void gpio_input(u32_t bank, u32_t pins);
+void gpio_set(u32_t bank, u32_t pins);
+void gpio_clear(u32_t bank, u32_t pins);
+void gpio_write(u32_t bank, u32_t pins, u32_t value);
+void gpio_toggle(u32_t bank, u32_t pins);
+u32_t gpio_read(u32_t bank);
+
+/* edge interrupts, flags for gpio_irq_enable */
+#define GPIO_RISING  0x1
+#define GPIO_FALLING 0x2
+#define GPIO_CAPTURE 0x4 /* timestamp the edges into the capture ring */
+
+/* the debounce time is per bank, (DEBOUNCINGTIME + 1) * 31us */
+#define GPIO_DEBOUNCE_STEP_US 31
+#define GPIO_DEBOUNCE_MAX_US (256 * GPIO_DEBOUNCE_STEP_US)
+
+/* pins that had an edge since the last interrupt from the bank. callbacks
+   run in the ISR */
+typedef void (*gpio_callback_t)(u32_t bank, u32_t pins);
+
+int gpio_irq_enable(u32_t bank, u32_t pins, u32_t flags, u32_t debounce_us,
+                    gpio_callback_t callback);
+void gpio_irq_disable(u32_t bank, u32_t pins);
+void gpio0_isr(void);
+void gpio1_isr(void);
+void gpio2_isr(void);
+void gpio3_isr(void);
+
+/* capture ring, filled by the ISRs and emptied with gpio_capture_read. the
+   time is cpu_cycles() as the ISR started, so it includes the interrupt
+   latency and wraps like the cycle counter. edges on several pins of a bank
+   seen by one ISR share an entry */
+#define GPIO_CAPTURE_SIZE 256 /* entries, power of 2 */
+
+struct gpio_edge {
+  u32_t time;
+  u32_t bank;
+  u32_t pins;  /* pins with an edge */
+  u32_t level; /* DATAIN of those pins after it, 1 for a rising edge */
+};
+
+int gpio_capture_read(struct gpio_edge* edge);
+u32_t gpio_capture_dropped(void);
+
+/* USR LEDs on GPIO1 */
 void gpio_led_init(void);
 void gpio_led_on(s32_t led_number);
 void gpio_led_off(s32_t led_number);
@@ -17,6 +77,7 @@ void gpio_led_toggle(s32_t led_number);
 #define USR1 22 /* GPIO1_22 */
 #define USR2 23 /* GPIO1_23 */
 #define USR3 24 /* GPIO1_24 */
+#define GPIO_USR_LEDS ((1 << USR0) | (1 << USR1) | (1 << USR2) | (1 << USR3))
 
 #define GPIO_REVISION_OFFSET 0x00000000
 #define GPIO_SYSCONFIG_OFFSET 0x00000010
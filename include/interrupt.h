@@ -2,18 +2,102 @@
 #ifndef _INTERRUPT_H
 #define _INTERRUPT_H
 #include <common.h>
+#include <cpu.h>
 
 void irq_enable(void);
-void irq_isr(void);
 void irq_register(u32_t irq_number, void (*isr)(void));
+void irq_set_priority(u32_t irq_number, u32_t priority);
+void irq_set_fiq(u32_t irq_number, u32_t fiq);
+void irq_mask(u32_t irq_number);
+void irq_unmask(u32_t irq_number);
+u32_t irq_dispatch(u32_t entry);
+void exception_handler(u32_t type, u32_t address);
+
+/* interrupt numbers used so far [AM335x TRM table 6-1] */
+#define IRQ_PRU_EVTOUT0 20
+#define IRQ_PRU_EVTOUT1 21
+#define IRQ_GPIOINT2A 32
+#define IRQ_GPIOINT3A 62
+#define IRQ_MMCSD0 64
+#define IRQ_TINT0  66
+#define IRQ_TINT2  68
+#define IRQ_TINT3  69
+#define IRQ_UART0  72
+#define IRQ_TINT4  92
+#define IRQ_GPIOINT0A 96
+#define IRQ_GPIOINT1A 98
+
+/* INTC priorities, 0 is the highest. an ISR can only be interrupted by lines
+   with a higher priority. 0 is kept for FIQ sources so the threshold set while
+   an IRQ runs never holds back an FIQ */
+#define IRQ_PRIO_FIQ     0
+#define IRQ_PRIO_HIGH    8
+#define IRQ_PRIO_DEFAULT 32
+#define IRQ_PRIO_LOW     48
+#define IRQ_PRIO_LOWEST  63
+
+/* nesting depth of IRQ handlers, non zero while running in an ISR */
+extern volatile u32_t irq_nesting;
+
+/* true in any interrupt handler. ISRs run in system mode with IRQs enabled so
+   the CPU mode alone doesn't tell */
+static inline u32_t irq_context(void) {
+  return irq_nesting != 0 || cpu_mode() == CPU_MODE_FIQ;
+}
+
+/* per line interrupt statistics, on by default, build with IRQ_STATS=0 to
+   leave them out. times are in core cycles: latency is from the IRQ
+   exception to the ISR being called, duration is the ISR's own run time
+   without the ISRs that preempted it. histogram bucket n counts values
+   from 2^n to 2^(n+1)-1, the last one everything bigger.
+   the latency starts at the cycle count irq_handler reads on entry, so it
+   is the dispatch cost only: the time from the peripheral event through
+   the INTC and the pipeline to the exception isn't in it, most lines have
+   no timestamp of their event to measure that from. the monitor's irqlat
+   measures the whole path against a TIMER2 match */
+#ifndef IRQ_STATS
+#define IRQ_STATS 1
+#endif
+#define IRQ_STATS_SLOTS 8 /* lines that get statistics, first come first served */
+#define IRQ_STATS_BUCKETS 24
+
+struct irq_stats {
+  u32_t count;
+  u32_t lat_min;
+  u32_t lat_max;
+  u64_t lat_sum;
+  u32_t dur_min;
+  u32_t dur_max;
+  u64_t dur_sum;
+  u32_t lat_hist[IRQ_STATS_BUCKETS];
+  u32_t dur_hist[IRQ_STATS_BUCKETS];
+};
+
+int irq_stats_get(u32_t irq_number, struct irq_stats* stats);
+void irq_stats_reset(void);
+void irq_stats_print(void);
 
 #define INTC_BASE 0x48200000
 #define INTC_SYSCONFIG (INTC_BASE + 0x10)
 #define INTC_SYSSTATUS (INTC_BASE + 0x14)
-#define INTC_MIR_CLEAR2 (INTC_BASE + 0xC8)
+#define INTC_SIR_IRQ (INTC_BASE + 0x40)
+#define INTC_SIR_FIQ (INTC_BASE + 0x44)
 #define INTC_CONTROL (INTC_BASE + 0x48)
+#define INTC_IRQ_PRIORITY (INTC_BASE + 0x60)
+#define INTC_FIQ_PRIORITY (INTC_BASE + 0x64)
+#define INTC_THRESHOLD (INTC_BASE + 0x68)
+/* n = irq / 32 */
+#define INTC_MIR(n) (INTC_BASE + 0x84 + ((n) * 0x20))
+#define INTC_MIR_CLEAR(n) (INTC_BASE + 0x88 + ((n) * 0x20))
+#define INTC_MIR_SET(n) (INTC_BASE + 0x8C + ((n) * 0x20))
+#define INTC_ISR_SET(n) (INTC_BASE + 0x90 + ((n) * 0x20))
+#define INTC_ISR_CLEAR(n) (INTC_BASE + 0x94 + ((n) * 0x20))
+#define INTC_ILR(m) (INTC_BASE + 0x100 + ((m) * 0x4))
 
-#define INTC_ISR_CLEAR2 (INTC_BASE + 0xD4)
-#define INTC_SIR_IRQ (INTC_BASE + 0x40)
+#define INTC_CONTROL_NEWIRQAGR 0x1
+#define INTC_CONTROL_NEWFIQAGR 0x2
+#define INTC_SIR_SPURIOUS (0x1FFFFFF << 7)
+#define INTC_ILR_FIQNIRQ 0x1
+#define INTC_THRESHOLD_OFF 0xFF
 
 #endif /* _INTERRUPT_H */
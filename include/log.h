@@ -0,0 +1,78 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Deferred format logging. Call sites pass a printf style format string and
+   up to three u32 arguments:
+     LOG2("kernel block %u size 0x%08x\r\n", block, size);
+   With LOG_BINARY=1 (the default) each format string is placed in the
+   .logfmt section, which boot.ld leaves out of the image, and the target
+   only sends a small frame with the string's offset in that section and the
+   raw arguments. log_decode turns the frames back into text on the host
+   using the strings extracted from boot.elf (make boot.logfmt).
+   With LOG_BINARY=0 the strings stay in the image and are formatted on the
+   target, supporting %u %d %x %c and %% with optional zero pad and width.
+   There is no %s, arguments are only ever numbers: print names with
+   log_str and the rest of the line with LOGn. log_decode refuses formats
+   with anything else.
+*/
+#ifndef _LOG_H
+#define _LOG_H
+
+#include <common.h>
+
+#ifndef LOG_BINARY
+#define LOG_BINARY 1
+#endif
+
+/* frame: sync, argument count, 16 bit format offset, arguments. all little
+   endian. 0xA5 never shows up in the ASCII text the frames are mixed with.
+   the sync bytes share UART0 and log_decode with the other protocols and
+   have to stay distinct. taken: 0x16 SL_SYNC and 0xA6 SL_RESP
+   (serial_load.h), 0xA5, 0xA8, 0xA9 and 0xAA here, 0xA7 both as SL_SOF,
+   which only goes from the host to the target, and as PLOG_CRASH_SYNC,
+   which only goes to the persistent log (plog.h) */
+#define LOG_FRAME_SYNC 0xA5
+/* same with cpu_cycles() after the format offset, what the persistent log
+   keeps (plog.h). text mode logs go there unchanged */
+#define LOG_FRAME_SYNC_TIME 0xA8
+#define LOG_MAX_ARGS 3
+/* log_str frame: sync, length, that many characters. the same on the UART
+   and in the persistent log */
+#define LOG_FRAME_SYNC_STR 0xA9
+#define LOG_STR_MAX 32 /* longer strings are cut */
+/* a piece of a trace_dump stream: sync, length, that many bytes. UART only,
+   trace_decode puts the pieces back together */
+#define LOG_FRAME_SYNC_TRACE 0xAA
+
+#if LOG_BINARY
+#define LOG_FMT_ATTR __attribute__((section(".logfmt"), used))
+#else
+#define LOG_FMT_ATTR
+#endif
+
+#define LOG_SITE(fmt) static const char LOG_FMT_ATTR log_fmt[] = fmt
+
+#define LOG0(fmt)                  \
+  do {                             \
+    LOG_SITE(fmt);                 \
+    log_emit(log_fmt, 0, 0, 0, 0); \
+  } while (0)
+#define LOG1(fmt, a)                          \
+  do {                                        \
+    LOG_SITE(fmt);                            \
+    log_emit(log_fmt, 1, (u32_t)(a), 0, 0); \
+  } while (0)
+#define LOG2(fmt, a, b)                                  \
+  do {                                                   \
+    LOG_SITE(fmt);                                       \
+    log_emit(log_fmt, 2, (u32_t)(a), (u32_t)(b), 0); \
+  } while (0)
+#define LOG3(fmt, a, b, c)                                          \
+  do {                                                              \
+    LOG_SITE(fmt);                                                  \
+    log_emit(log_fmt, 3, (u32_t)(a), (u32_t)(b), (u32_t)(c)); \
+  } while (0)
+
+void log_emit(const char* fmt, u32_t nargs, u32_t a0, u32_t a1, u32_t a2);
+/* a name or other string from memory, for the part of a line LOGn can't do */
+void log_str(const char* s);
+
+#endif /* _LOG_H */
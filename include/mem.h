@@ -0,0 +1,85 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Memory allocators for DDR.
+   pages:  buddy allocator handing out 2^order contiguous 4KB pages. Free
+           blocks are kept on a list per order with a bitmap of the non empty
+           ones, so allocating is a find-first-set plus at most PAGE_ORDERS
+           splits, freeing at most PAGE_ORDERS merges.
+   pools:  fixed size objects carved out of memory given to pool_init, for
+           descriptors and requests. Allocation pops a free list.
+   arenas: bump allocators for data that lives until reset, like everything
+           the boot needs once. boot_arena is set up by mem_init, sram_arena
+           is the on-chip SRAM the loader left behind when it relocated.
+   All of them can be used from ISRs.
+*/
+#ifndef _MEM_H
+#define _MEM_H
+
+#include <common.h>
+#include <memlayout.h>
+
+/* 2^17 pages is all 512MB */
+#define PAGE_ORDERS 18
+
+void page_init(u32_t base, u32_t size);
+void page_add(u32_t addr, u32_t size);
+void* page_alloc(u32_t order);
+void page_free(void* addr);
+u32_t page_order(u32_t bytes);
+
+struct page_stats {
+  u32_t pages;     /* managed by page_add */
+  u32_t free;      /* pages free now */
+  u32_t min_free;  /* low water mark of free */
+  u32_t allocs;
+  u32_t frees;
+  u32_t fails;
+  u32_t blocks[PAGE_ORDERS]; /* free blocks per order */
+};
+void page_stats_get(struct page_stats* stats);
+
+struct pool {
+  const char* name;
+  u32_t size;  /* object size, rounded up to a word */
+  u32_t count;
+  u32_t base;
+  void* free;  /* free list, linked through the first word of each object */
+  u32_t used;
+  u32_t peak;
+  u32_t fails;
+};
+
+int pool_init(struct pool* p, const char* name, u32_t size, void* mem, u32_t bytes);
+void* pool_alloc(struct pool* p);
+void pool_free(struct pool* p, void* obj);
+
+/* pools pool_init keeps track of for mem_print */
+#define MEM_MAX_POOLS 8
+
+struct arena {
+  const char* name;
+  u32_t base;
+  u32_t size;
+  u32_t used;
+  u32_t peak;
+  u32_t allocs;
+  u32_t fails;
+};
+
+void arena_init(struct arena* a, const char* name, void* mem, u32_t size);
+void* arena_alloc(struct arena* a, u32_t size, u32_t align);
+void arena_reset(struct arena* a);
+
+/* boot_arena size as a page order, 256 pages is 1MB */
+#define BOOT_ARENA_ORDER 8
+extern struct arena boot_arena;
+/* mapped write-through (see mmu.c), DMA buffers there need no cache
+   maintenance */
+extern struct arena sram_arena;
+
+/* zero len bytes, 8 word stores for the aligned middle */
+void mem_zero(void* mem, u32_t len);
+
+int mem_init(void);
+void mem_print(void);
+
+#endif /* _MEM_H */
@@ -0,0 +1,31 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* DDR bandwidth and latency benchmarks for the boot monitor, all run in the
+   scratch area (memlayout.h) with the caches on and print a table over
+   UART0. Timed with the cycle counter, so with the MPU at 1GHz a cycle is a
+   nanosecond.
+   - stream: STREAM copy/scale/add/triad [McCalpin] on u32_t arrays, once
+     with ldm/stm and once with NEON. The scalar kernels are integer ones,
+     VFP on the A8 isn't pipelined and would be what gets measured.
+   - latency: dependent loads chasing a random cycle through every cache line
+     of working sets from 4KB up, so neither the L2 preloader nor open DRAM
+     rows help. L1 (32KB), L2 (256KB) and DDR show up as steps.
+   - stride: one load per stride bytes over a buffer that doesn't fit L2.
+*/
+#ifndef _MEMBENCH_H
+#define _MEMBENCH_H
+
+#include <common.h>
+
+#define MEMBENCH_REPS        5          /* STREAM reports the best run */
+#define MEMBENCH_CHASE_LOADS 0x100000   /* per working set */
+#define MEMBENCH_CHASE_MIN   0x1000
+#define MEMBENCH_STRIDE_MAX  0x1000
+
+/* bytes is per array, three of them. returns 1 if that doesn't fit */
+int membench_stream(u32_t bytes);
+/* working sets from MEMBENCH_CHASE_MIN doubling up to max_bytes */
+int membench_latency(u32_t max_bytes);
+/* strides from 4 to MEMBENCH_STRIDE_MAX bytes over bytes of scratch */
+int membench_stride(u32_t bytes);
+
+#endif /* _MEMBENCH_H */
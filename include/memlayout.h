@@ -12,4 +12,36 @@
 
 #define UART0 0x44E09000
 
+/* external memory mapped to EMIF0 SDRAM starting at 0x80000000 */
+#define DDR_START 0x80000000
+#define DDR_SIZE  0x20000000 /* 512MB D2516EC4BXGGB on BBB */
+
+/* kernel images are loaded to the start of DDR */
+#define KERNEL_LOAD_ADDR DDR_START
+#define KERNEL_MAX_SIZE  0x10000000
+
+/* DDR after the kernel load area, free for the boot monitor and tests */
+#define SCRATCH_BASE (KERNEL_LOAD_ADDR + KERNEL_MAX_SIZE)
+#define SCRATCH_SIZE 0x01000000
+
+/* page allocator (mem.h) metadata, a byte per page of DDR. pages from after
+   the warm boot record up to the relocated loader are what it hands out */
+#define PAGE_SHIFT 12
+#define PAGE_SIZE  (0x1u << PAGE_SHIFT)
+#define PAGE_META_BASE (SCRATCH_BASE + SCRATCH_SIZE)
+#define PAGE_META_SIZE (DDR_SIZE >> PAGE_SHIFT)
+
+/* warm boot record (warm.h), the page after the metadata. outside the
+   kernel load area so loading a kernel doesn't overwrite it */
+#define WARM_REC_BASE (PAGE_META_BASE + PAGE_META_SIZE)
+
+/* binary event trace ring buffer, last 1MB of DDR */
+#define TRACE_BUF_SIZE 0x00100000
+#define TRACE_BUF_BASE (DDR_START + DDR_SIZE - TRACE_BUF_SIZE)
+
+/* where the loader runs from after relocating itself, the MB below the trace
+   buffer. boot.ld has the same numbers */
+#define SPL_DDR_SIZE 0x00100000
+#define SPL_DDR_BASE (TRACE_BUF_BASE - SPL_DDR_SIZE)
+
 #endif /* _MEM_LAYOUT_H */
@@ -4,6 +4,11 @@
 
 int mmc_init(void);
 int mmc_read_block(u32_t* buf, u32_t block);
+int mmc_read_blocks(u32_t* buf, u32_t block, u32_t count);
+int mmc_write_blocks(const u32_t* buf, u32_t block, u32_t count);
+int mmc_set_bus(u32_t width, u32_t clkd);
+void mmc_get_bus(u32_t* width, u32_t* clkd);
+void mmc_isr(void);
 
 #define MMC0_BASE 0x48060000
 
@@ -37,6 +42,27 @@ int mmc_read_block(u32_t* buf, u32_t block);
 #define MMC0_SD_ADMASAH (MMC0_BASE + 0x25C)
 #define MMC0_SD_REV (MMC0_BASE + 0x2FC)
 
+/* fields for reg.h [AM335x TRM 18.4.1] */
+#define MMC_CON_DW8_SHIFT 5
+#define MMC_CON_DW8_WIDTH 1
+#define MMC_HCTL_DTW_SHIFT 1 /* 0 is 1 bit, 1 is 4 bit */
+#define MMC_HCTL_DTW_WIDTH 1
+#define MMC_HCTL_SDBP_SHIFT 8
+#define MMC_HCTL_SDBP_WIDTH 1
+#define MMC_HCTL_SDVS_SHIFT 9
+#define MMC_HCTL_SDVS_WIDTH 3
+#define MMC_HCTL_SDVS_3V0 0x6 /* the highest MMC0 does */
+#define MMC_HCTL_IWE_SHIFT 24
+#define MMC_HCTL_IWE_WIDTH 1
+#define MMC_SYSCTL_ICE_SHIFT 0
+#define MMC_SYSCTL_ICE_WIDTH 1
+#define MMC_SYSCTL_ICS_SHIFT 1
+#define MMC_SYSCTL_ICS_WIDTH 1
+#define MMC_SYSCTL_CEN_SHIFT 2
+#define MMC_SYSCTL_CEN_WIDTH 1
+#define MMC_SYSCTL_CLKD_SHIFT 6
+#define MMC_SYSCTL_CLKD_WIDTH 10
+
 #define MMC_CMD0_GO_IDLE_STATE 0
 #define MMC_CMD1_SEND_OP_COND 1
 #define MMC_CMD2_ALL_SEND_CID 2
@@ -76,6 +102,43 @@ int mmc_read_block(u32_t* buf, u32_t block);
 #define MMC_ACMD53_SECURE_RECEIVE 53
 #define MMC_ACMD54_SECURE_SEND 54
 
+/* most blocks one CMD18 or CMD25 can transfer, SD_BLK NBLK is 16 bits */
+#define MMC_MAX_BLOCKS 0xFFFF
+
+/* card status in R1 responses [1] 4.10.1 */
+#define MMC_R1_READY_FOR_DATA (0x1 << 8)
+#define MMC_R1_STATE(r1) (((r1) >> 9) & 0xF)
+#define MMC_R1_STATE_TRAN 4
+/* OUT_OF_RANGE to ERROR, without the reserved and CARD_IS_LOCKED bits */
+#define MMC_R1_ERRORS 0xFDF80000
+
+/* how long a card may stay busy programming after a write, the SD spec
+   allows 250ms for SDHC, with some margin */
+#define MMC_BUSY_TIMEOUT_MS 500
+
+/* SD_STAT events waited on, and the error bits that set ERRI, which are
+   also their SD_ISE enables [AM335x TRM 18.4.1.25] */
+#define MMC_STAT_CC (0x1 << 0)
+#define MMC_STAT_TC (0x1 << 1)
+#define MMC_STAT_BWR (0x1 << 4)
+#define MMC_STAT_BRR (0x1 << 5)
+#define MMC_STAT_ERRI (0x1 << 15)
+#define MMC_STAT_ERRORS 0x337F0000
+
+/* longest waits for a response and for each data block, the SD spec gives
+   a card 100ms to start sending a block and 250ms to take one [1] 4.6.2 */
+#define MMC_CMD_TIMEOUT_US 100000
+#define MMC_READ_TIMEOUT_US 100000
+#define MMC_WRITE_TIMEOUT_US 250000
+
+/* SD_SYSCTL CLKD, the card clock is the 96MHz functional clock divided by
+   it. identification has to run at 400kHz or less, in default speed mode a
+   card goes up to 25MHz [1] 4.2 */
+#define MMC_FCLK_HZ 96000000
+#define MMC_CLKD_INIT 0x240 /* ~167kHz */
+#define MMC_CLKD_12MHZ 8
+#define MMC_CLKD_24MHZ 4
+
 #define MMC_RSP_NONE 0
 #define MMC_RSP_136 1
 #define MMC_RSP_48 2
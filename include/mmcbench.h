@@ -0,0 +1,20 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* SD card read benchmark for the boot monitor. For each bus setup in
+   mmcbench.c it reads MMCBENCH_OPS requests of 1 block (CMD17) and of
+   several blocks (CMD18), sequentially and at random request aligned
+   blocks, into the scratch area. Every request is timed on TIMER2, the
+   table has KB/s, IOPS and latency percentiles per test. The bus setup the
+   card had before is restored at the end.
+*/
+#ifndef _MMCBENCH_H
+#define _MMCBENCH_H
+
+#include <common.h>
+
+#define MMCBENCH_OPS 128 /* per test */
+
+/* blocks at start up to start + span, span has to hold the largest request.
+   returns 0 when every read succeeded */
+int mmcbench_run(u32_t start, u32_t span);
+
+#endif /* _MMCBENCH_H */
@@ -0,0 +1,21 @@
+/* Copyright (c) 2023  Hunter Whyte */
+#ifndef _MMU_H
+#define _MMU_H
+
+#include <common.h>
+
+/* flat section mapping with caches: DDR write-back, on-chip RAM
+   write-through, everything else device memory */
+void mmu_init(void);
+/* clean everything out and turn the MMU and caches off again, for handing
+   over to a kernel. only from main (thread 0), whose stack is the one in
+   on-chip RAM, returns 1 and changes nothing from any other stack */
+int mmu_disable(void);
+
+/* for memory other masters look at (PRU, DMA) while it is cached */
+void dcache_clean_range(u32_t addr, u32_t len);
+void dcache_invalidate_range(u32_t addr, u32_t len);
+
+#define CACHE_LINE_SIZE 64 /* Cortex-A8 L1 and L2 */
+
+#endif /* _MMU_H */
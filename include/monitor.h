@@ -0,0 +1,12 @@
+/* Copyright (c) 2023  Hunter Whyte */
+#ifndef _MONITOR_H
+#define _MONITOR_H
+
+#include <common.h>
+
+/* key that enters the monitor during the boot window */
+#define MONITOR_KEY ' '
+
+void monitor_run(void);
+
+#endif /* _MONITOR_H */
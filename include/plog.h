@@ -0,0 +1,62 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Persistent log. Everything logged with LOGn() is also kept in a RAM batch
+   buffer, with a timestamp per message (LOG_FRAME_SYNC_TIME frames, log.h).
+   plog_flush writes the whole batch to the log region of the SD card
+   (sd_image.h) with one multi-block write, so the boot log survives for
+   post-mortem reading without the boot waiting on the card for every
+   message. main flushes before handing over to the kernel and
+   exception_handler after a crash, which also leaves a PLOG_CRASH_SYNC
+   record.
+   The region, in blocks from log_lba:
+     0                           struct plog_super, where the next batch goes
+     1 + n * PLOG_SLOT_BLOCKS    slot n, struct plog_batch then its data
+   Slots are reused round robin, each flush takes one. Copy the region off the
+   card and log_decode prints the batches oldest first:
+     dd if=/dev/sdX of=plog.bin skip=<log_lba> count=<log_blocks>
+   Shared with log_decode on the host, keep it to definitions. */
+#ifndef _PLOG_H
+#define _PLOG_H
+
+#include <common.h>
+
+struct blk_dev;
+
+#define PLOG_SLOT_BLOCKS 64 /* 32KB, also the size of the RAM buffer */
+#define PLOG_SUPER_MAGIC 0x474F4C50 /* "PLOG" */
+#define PLOG_BATCH_MAGIC 0x42474F4C /* "LOGB" */
+
+/* crash record: sync, exception type, address of the faulting instruction
+   and cpu_cycles(), all little endian words after the sync byte */
+#define PLOG_CRASH_SYNC 0xA7
+
+struct plog_super {
+  u32_t magic;
+  u32_t boots; /* boots that flushed a batch */
+  u32_t seq;   /* batches written */
+  u32_t next;  /* slot the next batch goes to */
+  u32_t crc;   /* crc32 of everything before it */
+};
+
+struct plog_batch {
+  u32_t magic;
+  u32_t seq;
+  u32_t boot;
+  u32_t len;     /* bytes of data after the header */
+  u32_t dropped; /* bytes that didn't fit in the buffer */
+  u32_t crc;     /* crc32 of the data */
+};
+
+#define PLOG_DATA_SIZE (PLOG_SLOT_BLOCKS * 512 - sizeof(struct plog_batch))
+
+/* append to the batch, from any context. bytes that don't fit are counted
+   and dropped */
+void plog_write(const u8_t* data, u32_t len);
+/* log region from the manifest on dev, before the first flush */
+int plog_init(struct blk_dev* dev, u32_t lba, u32_t blocks);
+/* write the batch to the card and start a new one. thread context, or with
+   everything else stopped. returns 0 on success */
+int plog_flush(void);
+/* record a crash and flush, for exception_handler */
+void plog_crash(u32_t type, u32_t address);
+
+#endif /* _PLOG_H */
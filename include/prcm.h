@@ -10,7 +10,19 @@
 #define CM_PER_EMIF_CLKCTRL     (CM_PER_BASE + 0x28)
 #define CM_PER_EMIF_FW_CLKCTRL  (CM_PER_BASE + 0xD0)
 #define CM_PER_GPIO1_CLKCTRL    (CM_PER_BASE + 0xAC)
+#define CM_PER_GPIO2_CLKCTRL    (CM_PER_BASE + 0xB0)
+#define CM_PER_GPIO3_CLKCTRL    (CM_PER_BASE + 0xB4)
 #define CM_PER_MMC0_CLKCTRL     (CM_PER_BASE + 0x3C)
+#define CM_PER_TIMER2_CLKCTRL   (CM_PER_BASE + 0x80)
+#define CM_PER_TIMER3_CLKCTRL   (CM_PER_BASE + 0x84)
+#define CM_PER_TIMER4_CLKCTRL   (CM_PER_BASE + 0x88)
+#define CM_PER_PRU_ICSS_CLKCTRL (CM_PER_BASE + 0xE8)
+#define CM_PER_PRU_ICSS_CLKSTCTRL (CM_PER_BASE + 0x140)
+
+#define CM_DPLL_BASE 0x44E00500
+#define CLKSEL_TIMER2_CLK       (CM_DPLL_BASE + 0x08)
+#define CLKSEL_TIMER3_CLK       (CM_DPLL_BASE + 0x0C)
+#define CLKSEL_TIMER4_CLK       (CM_DPLL_BASE + 0x10)
 
 #define CM_WKUP_BASE 0x44E00400
 
@@ -69,6 +81,42 @@
 #define CM_WKUP_WDT1_CLKCTRL        (CM_WKUP_BASE + 0xD4)
 #define CM_DIV_M6_DPLL_CORE         (CM_WKUP_BASE + 0xD8)
 
+/* fields for reg.h. module CLKCTRL registers [AM335x TRM 8.1.12.1] */
+#define CM_MODULEMODE_SHIFT         0
+#define CM_MODULEMODE_WIDTH         2
+#define CM_MODULEMODE_ENABLE        0x2
+#define CM_IDLEST_SHIFT             16
+#define CM_IDLEST_WIDTH             2
+#define CM_IDLEST_FUNC              0x0
+/* DPLL CLKMODE, IDLEST and DIV_Mx [AM335x TRM 8.1.12.2] */
+#define CM_DPLL_EN_SHIFT            0
+#define CM_DPLL_EN_WIDTH            3
+#define CM_DPLL_EN_MN_BYPASS        0x4
+#define CM_DPLL_EN_LOCK             0x7
+#define CM_ST_DPLL_CLK_SHIFT        0
+#define CM_ST_DPLL_CLK_WIDTH        1
+#define CM_ST_MN_BYPASS_SHIFT       8
+#define CM_ST_MN_BYPASS_WIDTH       1
+#define CM_DPLL_DIV_SHIFT           0
+#define CM_DPLL_DIV_WIDTH           5
+#define CM_DPLL_DIV_PER_SHIFT       0 /* CM_DIV_M2_DPLL_PER is 7 bits */
+#define CM_DPLL_DIV_PER_WIDTH       7
+
+#define PRM_PER_BASE 0x44E00C00
+#define RM_PER_RSTCTRL              (PRM_PER_BASE + 0x0)
+#define PRU_ICSS_LRST               (0x1 << 1)
+
+#define PRM_DEVICE_BASE 0x44E00F00
+#define PRM_RSTCTRL                 (PRM_DEVICE_BASE + 0x0)
+/* what caused the last reset, write 1 to clear. bits accumulate until
+   cleared, a warm reset only counts as one if the cold bit is clear */
+#define PRM_RSTST                   (PRM_DEVICE_BASE + 0x8)
+#define PRM_RSTST_GLOBAL_COLD_RST   (0x1 << 0)
+#define PRM_RSTST_GLOBAL_WARM_SW_RST (0x1 << 1)
+#define PRM_RSTST_WDT1_RST          (0x1 << 4)
+#define PRM_RSTST_EXTERNAL_WARM_RST (0x1 << 5)
+#define PRM_RSTST_ICEPICK_RST       (0x1 << 9)
+
 #define CONTROL_MODULE_BASE 0x44E10000
 #define CONTROL_MODULE_UART0_RXD (CONTROL_MODULE_BASE + 0x970)
 #define CONTROL_MODULE_UART0_TXD (CONTROL_MODULE_BASE + 0x974)
@@ -0,0 +1,139 @@
+/* Copyright (c) 2023  Hunter Whyte */
+#ifndef _PRU_H
+#define _PRU_H
+#include <common.h>
+
+/* PRU-ICSS: two 200MHz PRU cores with 8KB of instruction RAM and 8KB of data
+   RAM each, 12KB of shared RAM and an interrupt controller of their own.
+   pru.c loads and runs firmware on them, pru_fw.c is the offload firmware
+   driven through the mailbox below. pru_sim runs the same images on the host */
+int pru_init(void);
+int pru_load(u32_t core, const u32_t* text, u32_t words, const void* data, u32_t len);
+void pru_start(u32_t core, u32_t entry);
+void pru_halt(u32_t core);
+void pru_stop(void);
+u32_t pru_running(u32_t core);
+u32_t pru_cycles(u32_t core);
+int pru_offload_init(void);
+int pru_post(u32_t core, u32_t cmd, u32_t arg0, u32_t arg1, u32_t arg2);
+u32_t pru_call(u32_t core, u32_t cmd, u32_t arg0, u32_t arg1, u32_t arg2, u32_t* result,
+               u32_t timeout_us);
+
+#define PRU_CORES     2
+#define PRU_CLK_MHZ   200
+#define PRU_IRAM_SIZE 0x2000
+#define PRU_DRAM_SIZE 0x2000
+#define PRU_SHARED_RAM_SIZE 0x3000
+
+/* global addresses [AM335x TRM table 4-7] */
+#define PRU_ICSS_BASE 0x4A300000
+#define PRU_DRAM(core)     (PRU_ICSS_BASE + 0x2000 * (core))
+#define PRU_SHARED_RAM     (PRU_ICSS_BASE + 0x10000)
+#define PRU_INTC_BASE      (PRU_ICSS_BASE + 0x20000)
+#define PRU_CTRL_BASE(core) (PRU_ICSS_BASE + 0x22000 + 0x2000 * (core))
+#define PRU_CFG_BASE       (PRU_ICSS_BASE + 0x26000)
+#define PRU_IRAM(core)     (PRU_ICSS_BASE + 0x34000 + 0x4000 * (core))
+
+/* the cores see their own data RAM at 0 and the other one at 0x2000, the rest
+   of the subsystem at the same offsets as above. addresses from 0x80000 up go
+   out over the OCP master port to the rest of the SoC */
+#define PRU_LOCAL_DRAM       0x00000
+#define PRU_LOCAL_SHARED_RAM 0x10000
+#define PRU_LOCAL_INTC       0x20000
+
+/* core control registers [AM335x TRM 4.5.3] */
+#define PRU_CONTROL(core)  (PRU_CTRL_BASE(core) + 0x00)
+#define PRU_STATUS(core)   (PRU_CTRL_BASE(core) + 0x04)
+#define PRU_CYCLE(core)    (PRU_CTRL_BASE(core) + 0x0C)
+#define PRU_CTBIR0(core)   (PRU_CTRL_BASE(core) + 0x20)
+#define PRU_CTPPR0(core)   (PRU_CTRL_BASE(core) + 0x28)
+#define PRU_CTPPR1(core)   (PRU_CTRL_BASE(core) + 0x2C)
+#define PRU_CONTROL_SOFT_RST_N (0x1 << 0)
+#define PRU_CONTROL_EN         (0x1 << 1)
+#define PRU_CONTROL_CTR_EN     (0x1 << 3)
+#define PRU_CONTROL_RUNSTATE   (0x1 << 15)
+
+#define PRU_CFG_SYSCFG (PRU_CFG_BASE + 0x04)
+#define PRU_CFG_STANDBY_INIT (0x1 << 4)
+
+/* PRU INTC [AM335x TRM 4.5.2], offsets shared with pru_sim */
+#define PRU_INTC_GER_OFFSET    0x010
+#define PRU_INTC_SISR_OFFSET   0x020
+#define PRU_INTC_SICR_OFFSET   0x024
+#define PRU_INTC_EISR_OFFSET   0x028
+#define PRU_INTC_HIEISR_OFFSET 0x034
+#define PRU_INTC_SECR0_OFFSET  0x280
+#define PRU_INTC_CMR_OFFSET(n) (0x400 + 4 * (n))
+#define PRU_INTC_HMR_OFFSET(n) (0x800 + 4 * (n))
+#define PRU_INTC_SIPR0_OFFSET  0xD00
+#define PRU_INTC_SITR0_OFFSET  0xD80
+#define PRU_INTC_GER    (PRU_INTC_BASE + PRU_INTC_GER_OFFSET)
+#define PRU_INTC_SISR   (PRU_INTC_BASE + PRU_INTC_SISR_OFFSET)
+#define PRU_INTC_SICR   (PRU_INTC_BASE + PRU_INTC_SICR_OFFSET)
+#define PRU_INTC_EISR   (PRU_INTC_BASE + PRU_INTC_EISR_OFFSET)
+#define PRU_INTC_HIEISR (PRU_INTC_BASE + PRU_INTC_HIEISR_OFFSET)
+#define PRU_INTC_SECR(n) (PRU_INTC_BASE + PRU_INTC_SECR0_OFFSET + 4 * (n))
+#define PRU_INTC_CMR(n)  (PRU_INTC_BASE + PRU_INTC_CMR_OFFSET(n))
+#define PRU_INTC_HMR(n)  (PRU_INTC_BASE + PRU_INTC_HMR_OFFSET(n))
+#define PRU_INTC_SIPR(n) (PRU_INTC_BASE + PRU_INTC_SIPR0_OFFSET + 4 * (n))
+#define PRU_INTC_SITR(n) (PRU_INTC_BASE + PRU_INTC_SITR0_OFFSET + 4 * (n))
+
+/* system events, each on its own channel and host interrupt (event - 16).
+   hosts 0/1 are R31 bits 30/31 of PRU0/1, hosts 2/3 come out as
+   IRQ_PRU_EVTOUT0/1 on the MPU */
+#define PRU_EVT_ARM_TO_PRU(core) (16 + (core))
+#define PRU_EVT_PRU_TO_ARM(core) (18 + (core))
+
+/* constant table entries set up by pru_init */
+#define PRU_C_INTC   0  /* PRU_LOCAL_INTC */
+#define PRU_C_DRAM   24 /* own data RAM, CTBIR0 */
+#define PRU_C_SHARED 28 /* shared RAM, CTPPR0 */
+#define PRU_C_DDR    31 /* DDR, CTPPR1 */
+
+/* the programmable entries take address bits 23:8 from CTPPR0/1, the top
+   byte is fixed: C28 0x00nnnn00 and C29 0x49nnnn00 in CTPPR0, C30
+   0x40nnnn00 and C31 0x80nnnn00 in CTPPR1 [AM335x TRM 4.4.1.2.3] */
+#define PRU_CTPPR_C28(addr) (((addr) >> 8) & 0xFFFF)
+#define PRU_CTPPR_C30(addr) (((addr) >> 8) & 0xFFFF)
+#define PRU_CTPPR_C31(addr) ((((addr) >> 8) & 0xFFFF) << 16)
+#define PRU_C30_OCMC 0x40300000 /* L3 OCMC RAM, unused by the firmware */
+#define PRU_C31_DDR  0x80000000 /* start of DDR */
+
+/* offload mailbox at the start of each core's data RAM. the MPU fills in cmd
+   and args and raises PRU_EVT_ARM_TO_PRU, the firmware sets status to BUSY,
+   does the work, writes result and status and raises PRU_EVT_PRU_TO_ARM.
+   commands that run until the next one (heartbeat) never answer */
+struct pru_mbox {
+  u32_t cmd;
+  u32_t arg[3];
+  u32_t status;
+  u32_t result;
+};
+#define PRU_MBOX(core) ((volatile struct pru_mbox*)PRU_DRAM(core))
+
+#define PRU_MBOX_IDLE  0
+#define PRU_MBOX_BUSY  1
+#define PRU_MBOX_DONE  2
+#define PRU_MBOX_ERROR 3
+
+/* result = arg0 + 1 */
+#define PRU_CMD_ECHO      1
+/* result = CRC-32 of arg1 bytes at arg0, same as crc32_update(0, ...) */
+#define PRU_CMD_CRC32     2
+/* toggle the pins in arg1 of the GPIO module at arg0 every arg2 delay loops
+   until the next command arrives */
+#define PRU_CMD_HEARTBEAT 3
+/* PRU cycles per heartbeat delay loop */
+#define PRU_HB_LOOP_CYCLES 3
+
+/* how long pru_call waits for commands that answer straight away, and for a
+   CRC-32 of len bytes. the bit loop takes ~40 PRU cycles a byte, the DDR
+   reads a few more, so 0.5us a byte leaves a margin */
+#define PRU_CALL_TIMEOUT_US 10000
+#define PRU_CRC32_TIMEOUT_US(len) (PRU_CALL_TIMEOUT_US + (len) / 2)
+
+/* offload firmware, one build per core since the event numbers differ */
+#define PRU_FW_WORDS 62
+extern const u32_t pru_offload_fw[PRU_CORES][PRU_FW_WORDS];
+
+#endif /* _PRU_H */
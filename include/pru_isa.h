@@ -0,0 +1,95 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* PRU instruction encodings. Enough of the PRU ISA to hand assemble the
+   offload firmware in pru_fw.c without TI's PRU toolchain, pru_sim decodes
+   the same formats [PRU-ICSS Reference Guide, section 5].
+
+   ALU, compare and jump operands are register fields: PRU_R(n) is the whole
+   register, PRU_B(n, b) byte b and PRU_W(n, w) the 16 bits starting at byte w.
+   Loads and stores take plain register numbers and always start at byte 0.
+   Branch offsets count instructions from the branch itself, jump targets are
+   instruction indexes into IRAM.
+   Preprocessor only so host tools can include it.
+*/
+#ifndef _PRU_ISA_H
+#define _PRU_ISA_H
+#include <common.h>
+
+/* register fields, 3 bit select over the register number */
+#define PRU_R(n)    ((0x7u << 5) | (n))
+#define PRU_B(n, b) (((u32_t)(b) << 5) | (n))
+#define PRU_W(n, w) (((4u + (w)) << 5) | (n))
+
+/* format 1, ALU: op2 is a register field or an 8 bit immediate */
+#define PRU_ADD 0x0
+#define PRU_ADC 0x1
+#define PRU_SUB 0x2
+#define PRU_SUC 0x3
+#define PRU_LSL 0x4
+#define PRU_LSR 0x5
+#define PRU_RSB 0x6
+#define PRU_RSC 0x7
+#define PRU_AND 0x8
+#define PRU_OR  0x9
+#define PRU_XOR 0xA
+#define PRU_NOT 0xB
+#define PRU_MIN 0xC
+#define PRU_MAX 0xD
+#define PRU_CLR 0xE
+#define PRU_SET 0xF
+#define PRU_ALU(op, rd, rs1, rs2) (((u32_t)(op) << 25) | ((rs2) << 16) | ((rs1) << 8) | (rd))
+#define PRU_ALUI(op, rd, rs1, imm) (((u32_t)(op) << 25) | (0x1u << 24) | \
+                                    (((imm) & 0xFFu) << 16) | ((rs1) << 8) | (rd))
+#define PRU_MOV(rd, rs) PRU_ALUI(PRU_ADD, rd, rs, 0)
+
+/* format 2: jumps, LDI and HALT */
+#define PRU_FMT2 (0x1u << 29)
+#define PRU_JMP(addr) (PRU_FMT2 | (0x1u << 24) | (((addr) & 0xFFFFu) << 8))
+#define PRU_JMPR(rs) (PRU_FMT2 | ((rs) << 16))
+#define PRU_JAL(rd, addr) (PRU_FMT2 | (0x1u << 25) | (0x1u << 24) | \
+                           (((addr) & 0xFFFFu) << 8) | (rd))
+#define PRU_LDI(rd, imm) (PRU_FMT2 | (0x2u << 25) | (((imm) & 0xFFFFu) << 8) | (rd))
+#define PRU_HALT (PRU_FMT2 | (0x5u << 25))
+
+/* 10 bit signed branch offset, split over bits 26:25 and 7:0 */
+#define PRU_BROFF(off) (((((u32_t)(off)) >> 8 & 0x3u) << 25) | ((u32_t)(off) & 0xFFu))
+
+/* format 4, quick branch on compare. the test is "op2 <cmp> rs1", so
+   PRU_QBI(PRU_QB_GT, off, PRU_R(1), 4) branches when 4 > r1 */
+#define PRU_QB_GT 0x1
+#define PRU_QB_EQ 0x2
+#define PRU_QB_GE 0x3
+#define PRU_QB_LT 0x4
+#define PRU_QB_NE 0x5
+#define PRU_QB_LE 0x6
+#define PRU_QB_A  0x7
+#define PRU_QB(cmp, off, rs1, rs2) ((0x1u << 30) | ((u32_t)(cmp) << 27) | PRU_BROFF(off) | \
+                                    ((rs2) << 16) | ((rs1) << 8))
+#define PRU_QBI(cmp, off, rs1, imm) ((0x1u << 30) | ((u32_t)(cmp) << 27) | PRU_BROFF(off) | \
+                                     (0x1u << 24) | (((imm) & 0xFFu) << 16) | ((rs1) << 8))
+
+/* format 5, quick branch on a bit of rs1 */
+#define PRU_QBBC(off, rs1, bit) ((0x6u << 29) | (0x1u << 27) | PRU_BROFF(off) | \
+                                 (0x1u << 24) | ((u32_t)(bit) << 16) | ((rs1) << 8))
+#define PRU_QBBS(off, rs1, bit) ((0x6u << 29) | (0x2u << 27) | PRU_BROFF(off) | \
+                                 (0x1u << 24) | ((u32_t)(bit) << 16) | ((rs1) << 8))
+
+/* format 6, burst load/store of len (1-124) bytes between registers starting
+   at rd and memory at rs1 + off, or constant table entry c + off */
+#define PRU_BURST(len) (((((u32_t)(len) - 1) >> 4 & 0x7u) << 25) | \
+                        ((((u32_t)(len) - 1) >> 1 & 0x7u) << 13) | \
+                        ((((u32_t)(len) - 1) & 0x1u) << 7))
+#define PRU_XBBO(op, ld, rd, rs1, off, len) (((u32_t)(op) << 29) | ((u32_t)(ld) << 28) | \
+                                             PRU_BURST(len) | (0x1u << 24) | \
+                                             (((off) & 0xFFu) << 16) | ((rs1) << 8) | (rd))
+#define PRU_LBBO(rd, rs1, off, len) PRU_XBBO(0x7, 1, rd, rs1, off, len)
+#define PRU_SBBO(rd, rs1, off, len) PRU_XBBO(0x7, 0, rd, rs1, off, len)
+#define PRU_LBCO(rd, c, off, len) PRU_XBBO(0x4, 1, rd, c, off, len)
+#define PRU_SBCO(rd, c, off, len) PRU_XBBO(0x4, 0, rd, c, off, len)
+
+/* R31 reads back the host interrupt lines in bits 30 and 31, writing it with
+   bit 5 set raises system event 16 + the low 4 bits in the PRU INTC */
+#define PRU_R31_HOST0 30
+#define PRU_R31_HOST1 31
+#define PRU_R31_EVENT(evt) (0x20 | ((evt) - 16))
+
+#endif /* _PRU_ISA_H */
@@ -0,0 +1,101 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Register fields and coalesced read-modify-write.
+   A field FOO of a register is FOO_SHIFT and FOO_WIDTH, defined next to the
+   register address. The macros take the name without the suffix:
+     REG_MASK(FOO)     the field's bits
+     REG_VAL(FOO, v)   constant v moved into the field, for writing whole
+                       registers and for reg_batch_set
+     REG_PREP(FOO, v)  run time v moved into the field, cut to its width
+     REG_GET(FOO, r)   the field out of the register value r
+   A field that has no width or runs past bit 31 doesn't compile, neither
+   does a REG_VAL that doesn't fit or isn't a constant. REG_SET, REG_RMW and
+   REG_STAGE go through REG_VAL, values only known at run time take
+   reg_update or reg_batch_set with REG_PREP.
+
+   Several fields of a register rarely have to change one at a time, and
+   every read-modify-write is two trips over the L4 interconnect. A struct
+   reg_batch collects field changes per register; reg_batch_commit then
+   reads each register once (not at all when every bit is given) and writes
+   it once, in the order the registers were first staged. A field staged
+   twice keeps the last value, so anything that has to reach the hardware in
+   between (power off before on, a status poll) needs a commit first.
+
+   reg_read/reg_write/reg_update and the batches record every access in
+   the trace buffer with REG_TRACE=1. They end up in .text at -O0, SRAM_TEXT
+   code that runs before the relocation uses REG_RMW or REG() with the macros
+   instead, which are never traced.
+*/
+#ifndef _REG_H
+#define _REG_H
+
+#include <common.h>
+#if REG_TRACE
+#include <trace.h>
+#endif
+
+#ifndef REG_TRACE
+#define REG_TRACE 0
+#endif
+
+/* 0 if cond is false, a negative bit-field width otherwise. unlike an array
+   size, which turns into a VLA, the width has to be a constant */
+#define REG_BUILD_BUG(cond) (sizeof(struct { int reg_build_bug : (cond) ? -1 : 1; }) * 0)
+
+#define REG_FIELD_BAD(f) ((f##_WIDTH) < 1 || (f##_SHIFT) + (f##_WIDTH) > 32)
+#define REG_FIELD_MAX(f) (0xFFFFFFFFu >> (32 - (f##_WIDTH)))
+
+#define REG_MASK(f) \
+  ((u32_t)(REG_BUILD_BUG(REG_FIELD_BAD(f)) + (REG_FIELD_MAX(f) << (f##_SHIFT))))
+#define REG_VAL(f, v)                                                         \
+  ((u32_t)(REG_BUILD_BUG(REG_FIELD_BAD(f) || (u32_t)(v) > REG_FIELD_MAX(f)) + \
+           ((u32_t)(v) << (f##_SHIFT))))
+#define REG_PREP(f, v) (((u32_t)(v) << (f##_SHIFT)) & REG_MASK(f))
+#define REG_GET(f, r)  (((r) & REG_MASK(f)) >> (f##_SHIFT))
+
+/* field f of the register at addr to constant v, plain REG() for SRAM_TEXT */
+#define REG_RMW(addr, f, v) (REG(addr) = (REG(addr) & ~REG_MASK(f)) | REG_VAL(f, v))
+
+static inline u32_t reg_read(u32_t addr) {
+  u32_t val = REG(addr);
+#if REG_TRACE
+  trace_event(TRACE_REG_READ, addr, val);
+#endif
+  return val;
+}
+
+static inline void reg_write(u32_t addr, u32_t val) {
+#if REG_TRACE
+  trace_event(TRACE_REG_WRITE, addr, val);
+#endif
+  REG(addr) = val;
+}
+
+/* one read-modify-write of the bits in mask */
+static inline void reg_update(u32_t addr, u32_t mask, u32_t val) {
+  reg_write(addr, (reg_read(addr) & ~mask) | (val & mask));
+}
+
+/* write field f of the register at addr, constant v */
+#define REG_SET(addr, f, v) reg_update((addr), REG_MASK(f), REG_VAL(f, v))
+
+#define REG_BATCH_MAX 4 /* registers per batch, a full batch commits itself */
+
+struct reg_staged {
+  u32_t addr;
+  u32_t mask; /* bits staged */
+  u32_t val;
+};
+
+struct reg_batch {
+  u32_t count;
+  struct reg_staged regs[REG_BATCH_MAX];
+};
+
+void reg_batch_init(struct reg_batch* b);
+void reg_batch_set(struct reg_batch* b, u32_t addr, u32_t mask, u32_t val);
+void reg_batch_commit(struct reg_batch* b);
+
+/* stage field f of the register at addr, constant v */
+#define REG_STAGE(b, addr, f, v) reg_batch_set((b), (addr), REG_MASK(f), REG_VAL(f, v))
+
+#endif /* _REG_H */
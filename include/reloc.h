@@ -0,0 +1,35 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* SPL self relocation, see reloc.c */
+#ifndef _RELOC_H
+#define _RELOC_H
+
+#include <common.h>
+
+/* called by init.S, brings up clocks and DDR, moves the loader to DDR and
+   calls main. does not return */
+void reloc_main(void);
+
+/* bring-up in main.c that runs from SRAM before the relocation */
+void mpu_pll_init(void);
+void core_pll_init(void);
+void per_pll_init(void);
+void ddr_pll_init(void);
+void interface_clocks_init(void);
+void ddr_init(void);
+u8_t ddr_check(void);
+
+int main(void);
+
+/* PRM_RSTST (prcm.h) as reloc_main found it, it clears the register */
+extern u32_t reset_status;
+
+/* boot.ld. the DDR part is linked at _ddr_start and loaded by the ROM at
+   _ddr_load_start, the boot stack is right after the load image */
+extern u32_t _ddr_start[];
+extern u32_t _ddr_end[];
+extern u32_t _ddr_load_start[];
+extern u32_t _begin_bss[];
+extern u32_t _end_bss[];
+extern u32_t _stack_limit[];
+
+#endif /* _RELOC_H */
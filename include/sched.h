@@ -0,0 +1,67 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Small preemptive priority scheduler. main becomes the first thread in
+   sched_init, more are started with sched_create and get a stack from a fixed
+   pool. The highest priority ready thread runs, equal priorities share the
+   CPU in SCHED_SLICE_MS slices. Switches only happen on the way out of the
+   outermost IRQ handler (handlers.S), a thread giving up the CPU raises a
+   software interrupt to get there. With nothing to do the idle thread sits
+   in WFI.
+   Blocking calls need IRQs enabled, sem_post can also be used from ISRs.
+   sched_wait_irq is the thread version of WFI for timer_wait: the thread
+   blocks until the next interrupt (other than the scheduler's own) and the
+   rest keep running meanwhile.
+*/
+#ifndef _SCHED_H
+#define _SCHED_H
+
+#include <common.h>
+
+#define SCHED_MAX_THREADS 6 /* including main and idle */
+#ifdef HOST_SIM
+#define SCHED_STACK_SIZE  16384 /* host frames and libc calls need more */
+#else
+#define SCHED_STACK_SIZE  2048
+#endif
+#define SCHED_TICK_HZ     1000
+#define SCHED_SLICE_MS    10
+
+/* 0 is the highest priority */
+#define SCHED_PRIO_HIGH    8
+#define SCHED_PRIO_DEFAULT 16
+#define SCHED_PRIO_LOW     24
+#define SCHED_PRIO_IDLE    31
+
+/* software triggered INTC line used to enter the scheduler from a thread */
+#define IRQ_SCHED 127
+
+struct sem {
+  volatile u32_t count;
+  volatile u32_t waiters; /* bit per thread */
+};
+
+struct mutex {
+  volatile u32_t owner; /* thread id + 1, 0 when free */
+  volatile u32_t waiters;
+};
+
+void sched_init(void);
+int sched_create(const char* name, void (*fn)(u32_t arg), u32_t arg, u32_t prio);
+void sched_yield(void);
+void sched_sleep(u32_t ms);
+u32_t sched_self(void);
+int sched_wait_irq(void);
+u32_t sched_irq_exit(void);
+void sched_irq_wake(void);
+u32_t sched_switch(u32_t sp);
+
+void sem_init(struct sem* s, u32_t count);
+void sem_wait(struct sem* s);
+void sem_post(struct sem* s);
+
+void mutex_init(struct mutex* m);
+void mutex_lock(struct mutex* m);
+void mutex_unlock(struct mutex* m);
+
+extern volatile u32_t sched_ticks;
+
+#endif /* _SCHED_H */
@@ -0,0 +1,49 @@
+/* Copyright (c) 2023  Hunter Whyte */
+#ifndef _SD_IMAGE_H
+#define _SD_IMAGE_H
+
+#include <common.h>
+
+/* SD card layout, written by gen_img.c and read by main.c. In blocks:
+     0                 MBR, one partition after the boot area (optional)
+     SD_MANIFEST_LBA   struct sd_manifest
+     SD_RAW_BOOT_LBA   TOC, then GP header + MLO in the blocks after it
+     kernel_lba        kernel, from an allocation unit boundary
+     log_lba           persistent log (plog.h), from the next one
+     part_lba          partition, from the next allocation unit boundary
+   The ROM looks for a TOC at 0x0, 0x20000, 0x40000 and 0x60000 in raw mode
+   (see AM335x TRM 26.1.8.5), sector 0 holds the MBR so the loader goes at
+   0x20000. Payloads start on allocation unit (erase block) boundaries so the
+   card doesn't split multi-block reads across them. */
+#define SD_BLOCK_SIZE   512
+#define SD_MANIFEST_LBA 1
+#define SD_RAW_BOOT_LBA (0x20000 / SD_BLOCK_SIZE)
+/* where the ROM looks next, the MLO has to end before it */
+#define SD_RAW_BOOT_END (0x40000 / SD_BLOCK_SIZE)
+
+/* 4MB, the usual AU of SDHC cards up to 32GB */
+#define SD_AU_BLOCKS_DEFAULT 8192
+
+#define SD_MANIFEST_MAGIC   0x54534D4C /* "LMST" */
+#define SD_MANIFEST_VERSION 2
+
+/* all little endian, one block */
+struct sd_manifest {
+  u32_t magic;
+  u32_t version;
+  u32_t au_blocks;   /* allocation unit the layout is aligned to */
+  u32_t mlo_lba;     /* TOC block, the GP header is the block after it */
+  u32_t mlo_size;    /* bytes, without TOC and GP header */
+  u32_t kernel_lba;
+  u32_t kernel_size; /* bytes, 0 if there is no kernel on the card */
+  u32_t kernel_load; /* where the kernel goes and is entered, e_entry for ELF */
+  u32_t kernel_crc;  /* crc32 (crc32.h) of kernel_size bytes, for an ELF kernel
+                        of the file bytes of its PT_LOAD segments (elf.h) */
+  u32_t part_lba;
+  u32_t part_blocks; /* 0 if there is no partition */
+  u32_t log_lba;
+  u32_t log_blocks;  /* 0 if there is no log region */
+  u32_t crc;         /* crc32 of everything before it */
+};
+
+#endif /* _SD_IMAGE_H */
@@ -0,0 +1,58 @@
+/* Copyright (c) 2023  Hunter Whyte */
+#ifndef _SERIAL_LOAD_H
+#define _SERIAL_LOAD_H
+
+#include <common.h>
+
+/* how long main waits for sload (or the monitor key) before booting from the
+   SD card, override at build time with BOOT_WAIT_MS=... */
+#ifndef BOOT_WAIT_MS
+#define BOOT_WAIT_MS 100
+#endif
+
+int serial_load(u32_t dest, u32_t max_size, u32_t* size);
+
+/* Protocol, the host side is sload.c and has to match.
+   Host sends SL_SYNC repeatedly while the board boots, the target answers
+   with SL_READY and after that everything from the host is a packet:
+     SL_SOF, type, seq (u16), len (u16), payload[len], crc32 (u32)
+   crc32 covers type through the end of the payload, all little endian.
+   The target answers each packet with a response:
+     SL_RESP, code, arg (u32)
+   Data packets are numbered from 0 and carry SL_DATA_LEN bytes except the
+   last one, payload goes straight to dest + seq * SL_DATA_LEN. The host keeps
+   a window of packets in flight, the target only accepts them in order and
+   acks with the next packet number it expects (go-back-N).
+   The baud rate changes in two steps, so a lost response can't leave the
+   ends at different rates: the target acks SL_START at the old rate and
+   switches, the host switches once it has the ack and sends SL_PING at the
+   new rate until one is acked. Until the first data packet arrives the
+   target goes back to the old rate and drops the start when it hears no
+   good packet for SL_SWITCH_TIMEOUT_US, the host goes back when its pings
+   go unanswered and sends SL_START again after that much time. */
+#define SL_SYNC 0x16
+#define SL_SOF  0xA7
+#define SL_RESP 0xA6
+
+#define SL_VERSION 1
+#define SL_DATA_LEN 1024
+#define SL_SWITCH_TIMEOUT_US 500000
+
+/* packet types */
+#define SL_START 1 /* payload: image size, baud rate, image crc32 */
+#define SL_PING  2 /* no payload, confirms the new baud rate */
+#define SL_DATA  3
+#define SL_END   4 /* no payload */
+
+/* response codes */
+#define SL_READY 'R' /* arg: protocol version */
+#define SL_ACK   'A' /* arg: next packet number expected */
+#define SL_NAK   'N' /* arg: next packet number expected */
+#define SL_DONE  'D' /* arg: crc32 of the received image */
+#define SL_FAIL  'F' /* arg: SL_ERR_* */
+
+#define SL_ERR_SIZE 1 /* image too big */
+#define SL_ERR_BAUD 2 /* baud rate can't be generated */
+#define SL_ERR_CRC  3 /* image crc or size mismatch at SL_END */
+
+#endif /* _SERIAL_LOAD_H */
@@ -0,0 +1,84 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* CPU side of the host simulation (boot_sim.c), pulled in by cpu.h when
+   HOST_SIM is defined. The loader runs natively on the host, peripheral
+   registers are trapped and answered by models, IRQs are delivered into the
+   running code the way the exception would be. Interrupts can only be taken
+   at a register access or at one of the calls below, so the CPSR I bit is
+   just a flag.
+*/
+#ifndef _SIM_H
+#define _SIM_H
+
+#include <common.h>
+
+#define SIM_CPSR_I 0x80
+
+u32_t sim_cycles(void);
+u32_t sim_irq_save(void);
+void sim_irq_restore(u32_t cpsr);
+void sim_wfi(void);
+/* build a thread's first context on its stack, like sched_create does for
+   the exception return. fn(arg) returns into ret. returns the saved sp */
+u32_t sim_thread_frame(u32_t stack_top, void (*fn)(u32_t), u32_t arg, void (*ret)(void));
+
+static inline void cpu_cycles_init(void) {}
+
+/* modelled time in 1GHz core cycles */
+static inline u32_t cpu_cycles(void) {
+  return sim_cycles();
+}
+
+/* no FIQ handling on the host, everything runs in system mode */
+static inline u32_t cpu_mode(void) {
+  return CPU_MODE_SYS;
+}
+
+static inline u32_t cpu_irq_save(void) {
+  return sim_irq_save();
+}
+
+static inline void cpu_irq_restore(u32_t cpsr) {
+  sim_irq_restore(cpsr);
+}
+
+static inline void cpu_irq_enable(void) {
+  sim_irq_restore(CPU_MODE_SYS);
+}
+
+static inline void cpu_irq_disable(void) {
+  sim_irq_save();
+}
+
+static inline void cpu_irq_fiq_enable(void) {
+  sim_irq_restore(CPU_MODE_SYS);
+}
+
+static inline void cpu_irq_fiq_disable(void) {
+  sim_irq_save();
+}
+
+static inline void cpu_wfi(void) {
+  sim_wfi();
+}
+
+static inline void cpu_dsb(void) {
+  asm volatile("" : : : "memory");
+}
+
+/* nothing can interrupt between the load and the store, neither touches a
+   peripheral */
+static inline u32_t cpu_atomic_add(volatile u32_t* addr, u32_t val) {
+  u32_t old = *addr;
+  *addr = old + val;
+  return old;
+}
+
+static inline u32_t cpu_atomic_cas(volatile u32_t* addr, u32_t old, u32_t new) {
+  u32_t cur = *addr;
+  if (cur == old) {
+    *addr = new;
+  }
+  return cur;
+}
+
+#endif /* _SIM_H */
@@ -1,9 +1,24 @@
 /* Copyright (c) 2023  Hunter Whyte */
 #ifndef _TIMER_H
 #define _TIMER_H
+#include <common.h>
 
 void timer_init(void (*callback)(void));
 void timer_isr(void);
+void timer_clock_init(void);
+u32_t timer_now(void);
+void timer_alarm(u32_t when, void (*callback)(u32_t late));
+void timer_alarm_cancel(void);
+void timer2_isr(void);
+void timer_tick_init(u32_t hz, void (*callback)(void));
+void timer3_isr(void);
+int timer_wait(int (*done)(u32_t arg), u32_t arg, u32_t timeout_us);
+void timer_delay_us(u32_t us);
+void timer4_isr(void);
+void timer_stop(void);
+
+/* TIMER2 runs free from the 24MHz oscillator, wraps every ~179s */
+#define TIMER_TICKS_PER_US 24
 
 #define TIDR_OFFSET 0x0
 #define TIOCP_CFG_OFFSET 0x10
@@ -49,5 +64,28 @@ void timer_isr(void);
 #define TIMER0_TSICR (DMTIMER0_BASE + TSICR_OFFSET)
 #define TIMER0_TCAR (DMTIMER0_BASE + TCAR_OFFSET)
 
+#define TIMER2_IRQSTATUS (DMTIMER2_BASE + IRQSTATUS_OFFSET)
+#define TIMER2_IRQENABLE_SET (DMTIMER2_BASE + IRQENABLE_SET_OFFSET)
+#define TIMER2_IRQENABLE_CLEAR (DMTIMER2_BASE + IRQENABLE_CLEAR_OFFSET)
+#define TIMER2_TCLR (DMTIMER2_BASE + TCLR_OFFSET)
+#define TIMER2_TCRR (DMTIMER2_BASE + TCRR_OFFSET)
+#define TIMER2_TLDR (DMTIMER2_BASE + TLDR_OFFSET)
+#define TIMER2_TWPS (DMTIMER2_BASE + TWPS_OFFSET)
+#define TIMER2_TMAR (DMTIMER2_BASE + TMAR_OFFSET)
+
+#define TIMER3_IRQSTATUS (DMTIMER3_BASE + IRQSTATUS_OFFSET)
+#define TIMER3_IRQENABLE_SET (DMTIMER3_BASE + IRQENABLE_SET_OFFSET)
+#define TIMER3_IRQENABLE_CLEAR (DMTIMER3_BASE + IRQENABLE_CLEAR_OFFSET)
+#define TIMER3_TCLR (DMTIMER3_BASE + TCLR_OFFSET)
+#define TIMER3_TCRR (DMTIMER3_BASE + TCRR_OFFSET)
+#define TIMER3_TLDR (DMTIMER3_BASE + TLDR_OFFSET)
+#define TIMER3_TTGR (DMTIMER3_BASE + TTGR_OFFSET)
+#define TIMER3_TWPS (DMTIMER3_BASE + TWPS_OFFSET)
+
+#define TIMER4_IRQSTATUS (DMTIMER4_BASE + IRQSTATUS_OFFSET)
+#define TIMER4_IRQENABLE_SET (DMTIMER4_BASE + IRQENABLE_SET_OFFSET)
+#define TIMER4_TCLR (DMTIMER4_BASE + TCLR_OFFSET)
+#define TIMER4_TCRR (DMTIMER4_BASE + TCRR_OFFSET)
+#define TIMER4_TWPS (DMTIMER4_BASE + TWPS_OFFSET)
 
 #endif /* _TIMER_H */
@@ -0,0 +1,63 @@
+/* Copyright (c) 2023  Hunter Whyte */
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <common.h>
+#include <cpu.h>
+#include <interrupt.h>
+#include <memlayout.h>
+#include <trace_events.h>
+
+#define TRACE_ID(name, fmt) TRACE_##name,
+enum trace_id { TRACE_EVENTS(TRACE_ID) TRACE_NUM_EVENTS };
+#undef TRACE_ID
+
+/* boot phases passed as the argument of TRACE_BOOT_PHASE. recording only
+   starts once DDR is up so there are no phases for clock and DDR setup */
+#define TRACE_PHASE_MMC    0
+#define TRACE_PHASE_KERNEL 1
+
+/* one record in the DDR ring buffer, 16 bytes */
+struct trace_rec {
+  u32_t ts;  /* PMU cycle count */
+  u32_t tag; /* [15:0] event id, [16] recorded in an ISR */
+  u32_t arg0;
+  u32_t arg1;
+};
+
+#define TRACE_TAG_IRQ (0x1 << 16)
+
+#define TRACE_NUM_RECS (TRACE_BUF_SIZE / sizeof(struct trace_rec))
+
+/* dump stream header, followed by up to TRACE_NUM_RECS records oldest
+   first. the stream goes out in LOG_FRAME_SYNC_TRACE frames (log.h) */
+#define TRACE_DUMP_MAGIC 0x31435254 /* "TRC1" */
+
+/* control character that requests a dump from the console */
+#define TRACE_DUMP_KEY 0x14 /* ctrl-T */
+
+extern volatile u32_t trace_head;
+extern volatile u32_t trace_enabled;
+
+void trace_init(void);
+void trace_dump(void);
+
+/* record an event. callable from IRQ and main context, costs one exclusive
+   increment and five stores. does nothing until trace_init has run since the
+   buffer lives in DDR */
+static inline void trace_event(u32_t id, u32_t arg0, u32_t arg1) {
+  struct trace_rec* rec;
+  u32_t idx;
+
+  if (!trace_enabled) {
+    return;
+  }
+  idx = cpu_atomic_add(&trace_head, 1) & (TRACE_NUM_RECS - 1);
+  rec = (struct trace_rec*)TRACE_BUF_BASE + idx;
+  rec->ts = cpu_cycles();
+  rec->tag = id | (irq_context() ? TRACE_TAG_IRQ : 0);
+  rec->arg0 = arg0;
+  rec->arg1 = arg1;
+}
+
+#endif /* _TRACE_H */
@@ -0,0 +1,34 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* List of trace event IDs. Shared between the target (trace.h) and the host
+   side trace_decode tool, so only preprocessor definitions belong in here.
+   X(name, format) - format is printf style and gets the two u32 arguments.
+   Only ever append to this list, the IDs are the position in it.
+*/
+#ifndef _TRACE_EVENTS_H
+#define _TRACE_EVENTS_H
+
+#define TRACE_EVENTS(X)                                   \
+  X(NONE, "")                                             \
+  X(BOOT_PHASE, "boot phase %u")                          \
+  X(IRQ_TIMER, "timer0 tick")                             \
+  X(IRQ_UART, "uart0 rx char 0x%02x")                     \
+  X(MMC_CMD, "mmc cmd %u arg 0x%08x")                     \
+  X(MMC_CMD_ERR, "mmc cmd error SD_STAT 0x%08x")          \
+  X(MMC_READ, "mmc read block %u")                        \
+  X(MMC_READ_DONE, "mmc read block %u done")              \
+  X(MMC_READ_ERR, "mmc read block %u error 0x%08x")       \
+  X(KERNEL_JUMP, "jump to kernel at 0x%08x")              \
+  X(SERIAL_NAK, "serial nak, expected %u got seq %u")      \
+  X(SERIAL_LOAD, "serial load %u bytes crc 0x%08x")      \
+  X(MMC_READ_MULTI, "mmc read from block %u, %u blocks")  \
+  X(ELF_SEGMENT, "elf segment at 0x%08x, %u bytes")       \
+  X(MMC_WRITE, "mmc write from block %u, %u blocks")      \
+  X(MMC_WRITE_DONE, "mmc write block %u done")            \
+  X(MMC_WRITE_ERR, "mmc write block %u error 0x%08x")     \
+  X(PLOG_FLUSH, "plog batch %u, %u bytes")                \
+  X(BLK_XFER_READ, "blk read from block %u, %u blocks")   \
+  X(BLK_XFER_WRITE, "blk write from block %u, %u blocks") \
+  X(REG_READ, "reg read 0x%08x = 0x%08x")                 \
+  X(REG_WRITE, "reg write 0x%08x = 0x%08x")
+
+#endif /* _TRACE_EVENTS_H */
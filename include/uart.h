@@ -6,11 +6,27 @@
 
 void uart_init(void (*callback)(char));
 void uart_putc(char c);
+void uart_flush(void);
 void uart_puts(char* c);
 void uart_hexdump(u32_t val);
+void uart_putdec(u32_t val);
+int uart_set_baud(u32_t baud, s32_t* err_ppm);
+int uart_check_baud(u32_t baud, s32_t* err_ppm);
+u32_t uart_get_baud(s32_t* err_ppm);
 char uart_getc(void);
+int uart_getc_timeout(char* c, u32_t timeout_us);
+void uart_rx_irq(u32_t enable);
 void uart_isr(void);
 
+/* baud rate used from uart_init, override at build time with UART_BAUD=...
+   anything up to 3686400 can be generated from the 48MHz functional clock */
+#ifndef UART_BAUD
+#define UART_BAUD 115200
+#endif
+
+#define UART_FCLK 48000000 /* PER PLL CLKOUT M2 / 4 */
+#define UART_BAUD_MAX_ERR 20000 /* ppm, 2% */
+
 #define UART0_BASE  0x44E09000
 
 #define THR_OFFSET          0x00000000
@@ -0,0 +1,48 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Lazy VFP/NEON context switching.
+   init.S turns on CP10/CP11 and FPEXC.EN, so the boot code can use VFP and
+   NEON from the start. After that the register bank belongs to one context
+   at a time, vfp_owner, and is only saved and reloaded when another context
+   actually uses it:
+   - irq_handler (handlers.S) saves vfp_current in the IRQ frame, sets it to
+     NULL and clears FPEXC.EN, so ISRs that don't touch VFP pay nothing more.
+   - the first VFP instruction of an ISR, deferred work or a thread that
+     doesn't own the bank traps to undef_handler. vfp_trap saves the owner's
+     registers, loads the current context's and retries the instruction.
+     ISRs and deferred work get a context per IRQ nesting level.
+   - on the way out irq_handler puts back the vfp_current of the code it
+     returns to, which after a thread switch is the new thread's, and only
+     sets FPEXC.EN again if that context still owns the bank. What an ISR
+     left in the registers is dropped when it returns.
+   FIQ handlers run without any of this and must not use VFP or NEON.
+*/
+#ifndef _VFP_H
+#define _VFP_H
+
+#include <common.h>
+
+#define FPEXC_EN (1 << 30)
+
+/* IRQ nesting levels that can use VFP, level 0 is deferred work */
+#define VFP_IRQ_LEVELS 8
+
+struct vfp_state {
+  u64_t d[32];
+  u32_t fpscr;
+  u32_t valid; /* d and fpscr hold a saved state */
+};
+
+/* context of the running code, NULL in an ISR that hasn't used VFP yet */
+extern struct vfp_state* vfp_current;
+/* context whose state is in the registers, NULL for nobody's */
+extern struct vfp_state* vfp_owner;
+/* thread 0, main, from boot */
+extern struct vfp_state vfp_main;
+
+/* make s a fresh context, for a new thread */
+void vfp_state_init(struct vfp_state* s);
+/* called by undef_handler with the SPSR, returns 0 if the trap was a VFP or
+   NEON instruction that can now be retried */
+u32_t vfp_trap(u32_t spsr);
+
+#endif /* _VFP_H */
@@ -0,0 +1,56 @@
+/* Copyright (c) 2023  Hunter Whyte */
+#ifndef _WARM_H
+#define _WARM_H
+
+#include <common.h>
+#include <memlayout.h>
+
+/* Warm boot. After loading a kernel the loader leaves a record at
+   WARM_REC_BASE with where the kernel was put and the crc32 of its image.
+   After a warm reset (watchdog, software or external, see PRM_RSTST) DDR
+   still holds both, and if the image still verifies main boots it again
+   without bringing up the SD card or reading anything from it. reloc_main
+   skips the destructive ddr_check after a warm reset, and PLL and EMIF setup
+   are skipped when they are still configured.
+   Only what was loaded from the card is checked. A kernel that writes to its
+   own image (initialised data, say) won't verify and gets loaded again.
+   Zero filled parts are zeroed again. */
+
+#define WARM_MAGIC 0x4D524157 /* "WARM" */
+/* warm boots in a row before loading from the card again, so a kernel that
+   keeps crashing without touching its image doesn't lock out sload and the
+   monitor for good */
+#define WARM_MAX_BOOTS 3
+/* regions of the image, one per ELF segment */
+#define WARM_MAX_REGIONS 16
+
+struct warm_region {
+  u32_t addr;
+  u32_t len;  /* checked bytes from addr */
+  u32_t zero; /* zeroed bytes after them */
+};
+
+struct warm_rec {
+  u32_t magic;
+  u32_t entry;
+  u32_t size;  /* kernel file size, for boot_kernel */
+  u32_t crc;   /* crc32 over the regions in order */
+  u32_t boots; /* warm boots since the kernel was loaded */
+  u32_t num_regions;
+  struct warm_region regions[WARM_MAX_REGIONS];
+  u32_t rec_crc; /* crc32 of everything before it */
+};
+
+/* the last reset kept DDR contents, from reset_status (reloc.h) */
+int warm_reset(void);
+/* forget the record, before the kernel area gets overwritten */
+void warm_clear(void);
+/* a loaded region and the zeroed bytes after it, in load order */
+void warm_add(u32_t addr, u32_t len, u32_t zero);
+/* make the record valid for the kernel loaded since warm_clear */
+void warm_commit(u32_t entry, u32_t size, u32_t crc);
+/* after a warm reset, returns 0 with entry and size set if the kernel in DDR
+   can be entered again */
+int warm_check(u32_t* entry, u32_t* size);
+
+#endif /* _WARM_H */
@@ -0,0 +1,25 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Deferred work. ISRs post a function and an argument with work_post and
+   return, the work runs later in order with IRQs enabled when the outermost
+   ISR returns (irq_dispatch). Keeps slow things like printing out of the
+   ISRs themselves.
+   Work still runs on the stack of the interrupted thread, so irq_context()
+   is true in it and it must not block: timer_wait and sched_sleep poll,
+   sem_wait and mutex_lock spin until an ISR releases them. Anything that
+   waits on a thread or takes long belongs in a thread woken by the work.
+   No thread switch happens until the queue is empty.
+*/
+#ifndef _WORK_H
+#define _WORK_H
+
+#include <common.h>
+
+#define WORK_QUEUE_SIZE 64 /* power of 2 */
+
+int work_post(void (*fn)(u32_t arg), u32_t arg);
+void work_run(void);
+
+/* items lost because the queue was full */
+extern volatile u32_t work_dropped;
+
+#endif /* _WORK_H */
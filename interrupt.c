@@ -1,11 +1,71 @@
 /* Copyright (c) 2023  Hunter Whyte */
 #include <common.h>
+#include <cpu.h>
 #include <interrupt.h>
-
-u32_t isr_offset = 0x48200040;
+#include <log.h>
+#include <plog.h>
+#include <sched.h>
+#include <uart.h>
+#include <work.h>
 
 #define NUM_INTERRUPTS (128u)
-void (*isr_vectors[NUM_INTERRUPTS])(void);
+/* also used directly by fiq_handler in handlers.S. the IRQ entry path is
+   kept in SRAM, see boot.ld */
+SRAM_DATA void (*isr_vectors[NUM_INTERRUPTS])(void) = {0};
+
+SRAM_DATA volatile u32_t irq_nesting = 0;
+
+#if IRQ_STATS
+static struct irq_stats irq_stats[IRQ_STATS_SLOTS];
+/* statistics slot + 1 for each line, 0 while it has none */
+static u8_t irq_stats_slot[NUM_INTERRUPTS];
+static u32_t irq_stats_used = 0;
+/* cycles spent in ISRs that preempted the one currently running */
+static u32_t irq_preempted = 0;
+
+static u32_t irq_stats_bucket(u32_t val) {
+  u32_t b;
+
+  if (val == 0) {
+    return 0;
+  }
+  b = 31 - __builtin_clz(val);
+  return (b < IRQ_STATS_BUCKETS) ? b : IRQ_STATS_BUCKETS - 1;
+}
+
+/* called with IRQs masked */
+static void irq_stats_record(u32_t irq, u32_t lat, u32_t dur) {
+  struct irq_stats* st;
+  u32_t slot;
+
+  slot = irq_stats_slot[irq];
+  if (slot == 0) {
+    if (irq_stats_used == IRQ_STATS_SLOTS) {
+      return;
+    }
+    slot = ++irq_stats_used;
+    irq_stats_slot[irq] = slot;
+  }
+  st = &irq_stats[slot - 1];
+  if (st->count == 0 || lat < st->lat_min) {
+    st->lat_min = lat;
+  }
+  if (st->count == 0 || dur < st->dur_min) {
+    st->dur_min = dur;
+  }
+  if (lat > st->lat_max) {
+    st->lat_max = lat;
+  }
+  if (dur > st->dur_max) {
+    st->dur_max = dur;
+  }
+  st->count++;
+  st->lat_sum += lat;
+  st->dur_sum += dur;
+  st->lat_hist[irq_stats_bucket(lat)]++;
+  st->dur_hist[irq_stats_bucket(dur)]++;
+}
+#endif /* IRQ_STATS */
 
 /* Used when there is no isr defined for interrupt */
 static void default_int_handler(void) {}
@@ -16,16 +76,205 @@ void irq_register(u32_t irq_number, void (*isr)(void)){
   }
 }
 
-/* Enable interrupts */
+/* lower priority number wins, 0 is reserved for FIQ (see interrupt.h) */
+void irq_set_priority(u32_t irq_number, u32_t priority) {
+  if (irq_number >= NUM_INTERRUPTS) {
+    return;
+  }
+  if (priority == IRQ_PRIO_FIQ) {
+    priority = IRQ_PRIO_FIQ + 1;
+  } else if (priority > IRQ_PRIO_LOWEST) {
+    priority = IRQ_PRIO_LOWEST;
+  }
+  REG(INTC_ILR(irq_number)) = (REG(INTC_ILR(irq_number)) & INTC_ILR_FIQNIRQ) | (priority << 2);
+}
+
+/* route a line to FIQ (fiq non zero) or back to IRQ. the FIQ path calls the
+   registered ISR in FIQ mode, straight from handlers.S. FIQ handlers can
+   interrupt cpu_irq_save() sections so must not share data with them */
+void irq_set_fiq(u32_t irq_number, u32_t fiq) {
+  if (irq_number >= NUM_INTERRUPTS) {
+    return;
+  }
+  if (fiq) {
+    REG(INTC_ILR(irq_number)) = (IRQ_PRIO_FIQ << 2) | INTC_ILR_FIQNIRQ;
+  } else {
+    REG(INTC_ILR(irq_number)) = IRQ_PRIO_DEFAULT << 2;
+  }
+}
+
+void irq_mask(u32_t irq_number) {
+  if (irq_number < NUM_INTERRUPTS) {
+    REG(INTC_MIR_SET(irq_number >> 5)) = 0x1 << (irq_number & 0x1F);
+  }
+}
+
+void irq_unmask(u32_t irq_number) {
+  if (irq_number < NUM_INTERRUPTS) {
+    REG(INTC_MIR_CLEAR(irq_number >> 5)) = 0x1 << (irq_number & 0x1F);
+  }
+}
+
+/* Enable interrupts, call after resetting the INTC */
 void irq_enable(void) {
   u32_t i;
 
   /* Register default handler for all interrupts */
   for (i = 0; i < NUM_INTERRUPTS; i++) {
     isr_vectors[i] = default_int_handler;
+    REG(INTC_ILR(i)) = IRQ_PRIO_DEFAULT << 2;
   }
+  REG(INTC_THRESHOLD) = INTC_THRESHOLD_OFF;
+
+  cpu_irq_fiq_enable();
+}
+
+/* called from irq_handler in handlers.S in system mode with IRQs masked,
+   entry is the cycle count taken on exception entry.
+   raises the INTC threshold to the priority of the active line and runs its
+   ISR with IRQs enabled, so only higher priority lines can preempt it. the
+   ISR only has to clear its peripheral's status, the INTC is acknowledged
+   here before it runs. the outermost handler runs deferred work before
+   returning, and returns non zero if the scheduler wants to switch threads */
+SRAM_TEXT u32_t irq_dispatch(u32_t entry) {
+  u32_t irq, threshold;
+#if IRQ_STATS
+  u32_t start, end, outer;
+#endif
 
-  asm(" mrs r1, cpsr\n\t"
-      " bic r1, #0x80\n\t"
-      " msr cpsr_c, r1\n\t");
-}
\ No newline at end of file
+  irq = REG(INTC_SIR_IRQ);
+  if (irq & INTC_SIR_SPURIOUS) {
+    REG(INTC_CONTROL) = INTC_CONTROL_NEWIRQAGR;
+    return 0;
+  }
+  irq &= 0x7F;
+  threshold = REG(INTC_THRESHOLD);
+  REG(INTC_THRESHOLD) = REG(INTC_IRQ_PRIORITY) & 0x7F;
+  REG(INTC_CONTROL) = INTC_CONTROL_NEWIRQAGR;
+  /* threshold has to be in place before the next IRQ can be taken */
+  cpu_dsb();
+
+  irq_nesting++;
+#if IRQ_STATS
+  outer = irq_preempted;
+  irq_preempted = 0;
+  start = cpu_cycles();
+#endif
+  cpu_irq_enable();
+  isr_vectors[irq]();
+  cpu_irq_disable();
+  if (irq != IRQ_SCHED) {
+    sched_irq_wake();
+  }
+#if IRQ_STATS
+  end = cpu_cycles();
+  irq_stats_record(irq, start - entry, end - start - irq_preempted);
+  /* all of this handler counts as preemption for the one it interrupted */
+  irq_preempted = outer + (end - entry);
+#else
+  (void)entry;
+#endif
+  irq_nesting--;
+
+  REG(INTC_THRESHOLD) = threshold;
+
+  if (irq_nesting != 0) {
+    return 0;
+  }
+  /* deferred work runs on the interrupted thread's stack and counts as
+     interrupt context: blocking calls poll instead of blocking that thread,
+     and handlers that preempt it leave the switch to this one */
+  irq_nesting++;
+  cpu_irq_enable();
+  work_run();
+  cpu_irq_disable();
+  irq_nesting--;
+  return sched_irq_exit();
+}
+
+/* copy the statistics of a line, returns 1 if it has none */
+int irq_stats_get(u32_t irq_number, struct irq_stats* stats) {
+#if IRQ_STATS
+  u32_t flags, slot;
+
+  if (irq_number >= NUM_INTERRUPTS || irq_stats_slot[irq_number] == 0) {
+    return 1;
+  }
+  slot = irq_stats_slot[irq_number] - 1;
+  flags = cpu_irq_save();
+  *stats = irq_stats[slot];
+  cpu_irq_restore(flags);
+  return 0;
+#else
+  (void)irq_number;
+  (void)stats;
+  return 1;
+#endif
+}
+
+void irq_stats_reset(void) {
+#if IRQ_STATS
+  u32_t flags, i;
+  u8_t* p;
+
+  flags = cpu_irq_save();
+  p = (u8_t*)irq_stats;
+  for (i = 0; i < sizeof(irq_stats); i++) {
+    p[i] = 0;
+  }
+  for (i = 0; i < NUM_INTERRUPTS; i++) {
+    irq_stats_slot[i] = 0;
+  }
+  irq_stats_used = 0;
+  cpu_irq_restore(flags);
+#endif
+}
+
+static void irq_stats_print_one(u32_t irq, const struct irq_stats* st) {
+  u32_t b;
+
+  LOG2("irq %u: %u interrupts, cycles min/avg/max\r\n", irq, st->count);
+  LOG3("  latency  %u / %u / %u\r\n", st->lat_min, (u32_t)(st->lat_sum / st->count),
+       st->lat_max);
+  LOG3("  duration %u / %u / %u\r\n", st->dur_min, (u32_t)(st->dur_sum / st->count),
+       st->dur_max);
+  for (b = 0; b < IRQ_STATS_BUCKETS; b++) {
+    if (st->lat_hist[b] != 0 || st->dur_hist[b] != 0) {
+      LOG3("  >= %8u: latency %8u duration %8u\r\n", 0x1 << b, st->lat_hist[b],
+           st->dur_hist[b]);
+    }
+  }
+}
+
+/* print statistics and histograms of every line that has interrupted */
+void irq_stats_print(void) {
+  struct irq_stats st;
+  u32_t i;
+
+  if (!IRQ_STATS) {
+    LOG0("built without IRQ_STATS\r\n");
+    return;
+  }
+  for (i = 0; i < NUM_INTERRUPTS; i++) {
+    if (!irq_stats_get(i, &st) && st.count != 0) {
+      irq_stats_print_one(i, &st);
+    }
+  }
+}
+
+static const char* exception_names[] = {"undefined instruction", "supervisor call",
+                                        "prefetch abort", "data abort"};
+
+/* called from handlers.S for unexpected exceptions, IRQs are masked. reports
+   the exception over UART, flushing by polling, and stops */
+void exception_handler(u32_t type, u32_t address) {
+  uart_puts("\r\n!!! ");
+  uart_puts((char*)exception_names[type & 0x3]);
+  uart_puts(" at ");
+  uart_hexdump(address);
+  uart_puts("\r\n");
+  uart_flush();
+  /* the card may be mid transfer, it's a best effort */
+  plog_crash(type, address);
+  while (1) {}
+}
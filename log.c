@@ -0,0 +1,168 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Back end of the LOGn() macros, see log.h */
+#include <common.h>
+#include <cpu.h>
+#include <log.h>
+#include <plog.h>
+#include <uart.h>
+
+#if LOG_BINARY
+
+/* fmt is the address of the string inside the non-loaded .logfmt section,
+   which boot.ld links at 0, so it doubles as the message ID */
+void log_emit(const char* fmt, u32_t nargs, u32_t a0, u32_t a1, u32_t a2) {
+  u32_t args[LOG_MAX_ARGS];
+  /* the plog frame, the UART gets it without the timestamp */
+  u8_t frame[8 + 4 * LOG_MAX_ARGS];
+  u32_t id, i, time, flags;
+
+  id = (u32_t)fmt;
+  args[0] = a0;
+  args[1] = a1;
+  args[2] = a2;
+  time = cpu_cycles();
+
+  frame[0] = LOG_FRAME_SYNC;
+  frame[1] = nargs;
+  frame[2] = id & 0xFF;
+  frame[3] = (id >> 8) & 0xFF;
+  for (i = 0; i < 4; i++) {
+    frame[4 + i] = (time >> (8 * i)) & 0xFF;
+  }
+  for (i = 0; i < 4 * nargs; i++) {
+    frame[8 + i] = (args[i / 4] >> (8 * (i % 4))) & 0xFF;
+  }
+
+  /* frames from different threads or ISRs must not interleave */
+  flags = cpu_irq_save();
+  for (i = 0; i < 4; i++) {
+    uart_putc(frame[i]);
+  }
+  for (i = 0; i < 4 * nargs; i++) {
+    uart_putc(frame[8 + i]);
+  }
+  frame[0] = LOG_FRAME_SYNC_TIME;
+  plog_write(frame, 8 + 4 * nargs);
+  cpu_irq_restore(flags);
+}
+
+/* the string isn't in .logfmt, it goes out in a frame of its own */
+void log_str(const char* s) {
+  u8_t frame[2 + LOG_STR_MAX];
+  u32_t len, i, flags;
+
+  for (len = 0; len < LOG_STR_MAX && s[len] != '\0'; len++) {
+    frame[2 + len] = s[len];
+  }
+  frame[0] = LOG_FRAME_SYNC_STR;
+  frame[1] = len;
+
+  flags = cpu_irq_save();
+  for (i = 0; i < 2 + len; i++) {
+    uart_putc(frame[i]);
+  }
+  plog_write(frame, 2 + len);
+  cpu_irq_restore(flags);
+}
+
+#else
+
+/* the formatted text goes to the persistent log as is */
+static void log_putc(char c) {
+  uart_putc(c);
+  plog_write((const u8_t*)&c, 1);
+}
+
+static const char hexchars[] = {'0', '1', '2', '3', '4', '5', '6', '7',
+                                '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
+
+/* print val in base 10 or 16, padded to width with pad */
+static void log_number(u32_t val, u32_t base, u32_t width, char pad) {
+  char digits[10];
+  u32_t n = 0;
+
+  do {
+    digits[n++] = hexchars[(base == 16) ? (val & 0xF) : (val % 10)];
+    val = (base == 16) ? (val >> 4) : (val / 10);
+  } while (val != 0);
+  while (width > n) {
+    log_putc(pad);
+    width--;
+  }
+  while (n > 0) {
+    log_putc(digits[--n]);
+  }
+}
+
+/* minimal printf for the formats used with LOGn() */
+void log_emit(const char* fmt, u32_t nargs, u32_t a0, u32_t a1, u32_t a2) {
+  u32_t args[LOG_MAX_ARGS];
+  u32_t next, width, val, flags;
+  char pad;
+
+  args[0] = a0;
+  args[1] = a1;
+  args[2] = a2;
+  next = 0;
+
+  /* keep messages from different threads or ISRs in one piece */
+  flags = cpu_irq_save();
+  for (; *fmt != '\0'; fmt++) {
+    if (*fmt != '%') {
+      log_putc(*fmt);
+      continue;
+    }
+    fmt++;
+    pad = ' ';
+    width = 0;
+    if (*fmt == '0') {
+      pad = '0';
+      fmt++;
+    }
+    while (*fmt >= '0' && *fmt <= '9') {
+      width = width * 10 + (*fmt - '0');
+      fmt++;
+    }
+    if (*fmt == '%') {
+      log_putc('%');
+      continue;
+    }
+    if (*fmt == '\0') {
+      break;
+    }
+    val = (next < nargs) ? args[next] : 0;
+    next++;
+    switch (*fmt) {
+      case 'x':
+        log_number(val, 16, width, pad);
+        break;
+      case 'd':
+        if ((s32_t)val < 0) {
+          log_putc('-');
+          val = -(s32_t)val;
+        }
+        log_number(val, 10, width, pad);
+        break;
+      case 'c':
+        log_putc(val);
+        break;
+      case 'u':
+      default:
+        log_number(val, 10, width, pad);
+        break;
+    }
+  }
+  cpu_irq_restore(flags);
+}
+
+void log_str(const char* s) {
+  u32_t flags;
+
+  flags = cpu_irq_save();
+  while (*s != '\0') {
+    log_putc(*s++);
+  }
+  cpu_irq_restore(flags);
+}
+
+#endif /* LOG_BINARY */
@@ -0,0 +1,223 @@
+/* Copyright (c) 2023  Hunter Whyte
+  Host side decoder for the binary log frames sent by LOGn() on the target
+  (see include/log.h). Needs the format strings that were stripped from the
+  image, extract them from the matching boot.elf with "make boot.logfmt".
+  Regular text in the capture is passed through unchanged, frames are
+  replaced with the formatted message and trace dumps are left out.
+  Reads the capture from a file, or from stdin when it is "-", so it can sit
+  at the end of a pipe from the serial port.
+  A copy of the persistent log region off the SD card (include/plog.h) is
+  recognised by its superblock and its batches are printed oldest first,
+  with the time of each message.
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/log.h"
+#include "include/plog.h"
+#include "include/sd_image.h"
+
+static const char* exception_names[] = {"undefined instruction", "supervisor call",
+                                        "prefetch abort", "data abort"};
+
+static char* fmts;
+static long fmt_size;
+
+/* cycle counter timestamps wrap every ~4.3s, count up from the first one of
+   a batch assuming messages are closer together than that */
+static uint64_t time_now;
+static uint32_t time_last;
+static int time_valid;
+
+static uint32_t get_word(const uint8_t* b) {
+  return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static double log_time(uint32_t t) {
+  if (!time_valid) {
+    time_now = 0;
+    time_valid = 1;
+  } else {
+    time_now += (uint32_t)(t - time_last);
+  }
+  time_last = t;
+  return time_now / 1e9; /* 1GHz core clock */
+}
+
+/* the target only formats %u %d %x %c and %%, anything else (%s in
+   particular) would hand printf a target address */
+static int log_fmt_ok(const char* fmt) {
+  while ((fmt = strchr(fmt, '%')) != NULL) {
+    fmt++;
+    fmt += strspn(fmt, "0123456789");
+    if (*fmt == '\0' || strchr("udxc%", *fmt) == NULL) {
+      return 0;
+    }
+    fmt++;
+  }
+  return 1;
+}
+
+/* print a capture or a plog batch, text passed through and frames decoded */
+static void decode(FILE* fin) {
+  int c;
+  while ((c = fgetc(fin)) != EOF) {
+    if (c == PLOG_CRASH_SYNC) {
+      uint8_t b[12];
+      if (fread(b, 1, 12, fin) != 12) {
+        break;
+      }
+      printf("[%10.6f] !!! %s at 0x%08X\n", log_time(get_word(&b[8])),
+             exception_names[get_word(b) & 0x3], get_word(&b[4]));
+      continue;
+    }
+    if (c == LOG_FRAME_SYNC_TRACE) {
+      /* part of a trace dump, that's for trace_decode */
+      int len = fgetc(fin);
+      if (len == EOF) {
+        break;
+      }
+      while (len-- > 0 && fgetc(fin) != EOF) {}
+      continue;
+    }
+    if (c == LOG_FRAME_SYNC_STR) {
+      /* log_str: length and the characters */
+      uint8_t s[256];
+      int len = fgetc(fin);
+      if (len == EOF || fread(s, 1, len, fin) != (size_t)len) {
+        break;
+      }
+      fwrite(s, 1, len, stdout);
+      continue;
+    }
+    if (c != LOG_FRAME_SYNC && c != LOG_FRAME_SYNC_TIME) {
+      putchar(c);
+      continue;
+    }
+    /* frame: nargs, 16 bit format offset, [time,] arguments */
+    uint8_t hdr[3];
+    uint32_t args[LOG_MAX_ARGS] = {0, 0, 0};
+    if (fread(hdr, 1, 3, fin) != 3) {
+      break;
+    }
+    uint32_t nargs = hdr[0];
+    uint32_t id = hdr[1] | (hdr[2] << 8);
+    if (nargs > LOG_MAX_ARGS) {
+      printf("<bad log frame, %u args>", nargs);
+      continue;
+    }
+    if (c == LOG_FRAME_SYNC_TIME) {
+      uint8_t b[4];
+      if (fread(b, 1, 4, fin) != 4) {
+        break;
+      }
+      printf("[%10.6f] ", log_time(get_word(b)));
+    }
+    for (uint32_t i = 0; i < nargs; i++) {
+      uint8_t b[4];
+      if (fread(b, 1, 4, fin) != 4) {
+        break;
+      }
+      args[i] = get_word(b);
+    }
+    if (id >= fmt_size) {
+      printf("<unknown log message 0x%04x>", id);
+      continue;
+    }
+    if (!log_fmt_ok(fmts + id)) {
+      printf("<unsupported log format 0x%04x>", id);
+      continue;
+    }
+    printf(fmts + id, args[0], args[1], args[2]);
+    fflush(stdout);
+  }
+}
+
+/* region is the whole log region starting with its superblock */
+static void decode_plog(const uint8_t* region, long size) {
+  uint32_t seq = get_word(&region[8]);
+  uint32_t slots = (size / SD_BLOCK_SIZE - 1) / PLOG_SLOT_BLOCKS;
+  if (slots == 0) {
+    printf("log region cut short\n");
+    return;
+  }
+  /* the batches still there are the last slots written, in sequence order */
+  for (uint32_t s = seq > slots ? seq - slots : 0; s < seq; s++) {
+    const uint8_t* b = region + (1 + (uint64_t)(s % slots) * PLOG_SLOT_BLOCKS) * SD_BLOCK_SIZE;
+    uint32_t len = get_word(&b[12]);
+    if (get_word(b) != PLOG_BATCH_MAGIC || get_word(&b[4]) != s || len > PLOG_DATA_SIZE) {
+      printf("--- batch %u missing ---\n", s);
+      continue;
+    }
+    printf("--- boot %u, batch %u, %u bytes", get_word(&b[8]), s, len);
+    if (get_word(&b[16]) != 0) {
+      printf(", %u bytes dropped", get_word(&b[16]));
+    }
+    printf(" ---\n");
+    FILE* f = fmemopen((void*)(b + sizeof(struct plog_batch)), len, "rb");
+    if (f != NULL) {
+      time_valid = 0;
+      decode(f);
+      fclose(f);
+    }
+    printf("\n");
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    printf("argument of format strings and serial capture required\n");
+    printf("usage: ./log_decode <boot.logfmt> <capture.bin | plog.bin | ->\n");
+    return 0;
+  }
+
+  FILE* ffmt = fopen(argv[1], "rb");
+  if (ffmt == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  fseek(ffmt, 0L, SEEK_END);
+  fmt_size = ftell(ffmt);
+  fseek(ffmt, 0, SEEK_SET);
+  /* extra terminator in case the last string got cut off */
+  fmts = (char*)calloc(fmt_size + 1, 1);
+  if (fread(fmts, 1, fmt_size, ffmt) != (size_t)fmt_size) {
+    printf("failed to read %s\n", argv[1]);
+    return 1;
+  }
+  fclose(ffmt);
+
+  FILE* fin = strcmp(argv[2], "-") ? fopen(argv[2], "rb") : stdin;
+  if (fin == NULL) {
+    perror(argv[2]);
+    return 1;
+  }
+
+  /* a plog region is read whole, anything else is streamed */
+  uint8_t magic[4];
+  if (fin != stdin && fread(magic, 1, 4, fin) == 4 && get_word(magic) == PLOG_SUPER_MAGIC) {
+    fseek(fin, 0L, SEEK_END);
+    long size = ftell(fin);
+    fseek(fin, 0, SEEK_SET);
+    uint8_t* region = (uint8_t*)malloc(size);
+    if (region == NULL || fread(region, 1, size, fin) != (size_t)size) {
+      printf("failed to read %s\n", argv[2]);
+      return 1;
+    }
+    decode_plog(region, size);
+    free(region);
+  } else {
+    if (fin != stdin) {
+      fseek(fin, 0, SEEK_SET);
+    }
+    decode(fin);
+  }
+
+  if (fin != stdin) {
+    fclose(fin);
+  }
+  free(fmts);
+  return 0;
+}
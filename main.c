@@ -1,146 +1,192 @@
 /* Copyright (c) 2023  Hunter Whyte */
+#include <blk.h>
 #include <common.h>
 #include <control.h>
+#include <cpu.h>
+#include <crc32.h>
+#include <elf.h>
 #include <emif.h>
 #include <gpio.h>
 #include <interrupt.h>
+#include <log.h>
+#include <mem.h>
+#include <memlayout.h>
 #include <mmc.h>
+#include <mmu.h>
+#include <monitor.h>
+#include <plog.h>
 #include <prcm.h>
+#include <pru.h>
+#include <reg.h>
+#include <reloc.h>
+#include <sched.h>
+#include <sd_image.h>
+#include <serial_load.h>
 #include <timer.h>
+#include <trace.h>
 #include <uart.h>
+#include <warm.h>
 
-/* external memory mapped to EMIF0 SDRAM starting at 0x80000000 */
-#define DDR_START 0x80000000
+/* raw kernel images are read in chunks of this many blocks, a progress dot
+   each */
+#define KERNEL_READ_BLOCKS 128
+
+/* LED toggle period if the kernel ever returns */
+#define BLINK_US 250000
+
+/* the bring-up up to ddr_check runs from SRAM before the relocation, called
+   by reloc_main */
+
+/* a DPLL still locked at the multiplier and divider we want, as after a warm
+   reset, doesn't have to go through bypass again. dividers are set either
+   way with a single write, they can change while locked */
+SRAM_TEXT static u32_t dpll_locked_at(u32_t idlest, u32_t clksel, u32_t val) {
+  return REG_GET(CM_ST_DPLL_CLK, REG(idlest)) && (REG(clksel) & 0x7FF7F) == val;
+}
 
 /* MPU PLL Configuration based on AM335x TRM 8.1.6.9.1 */
 /* 1GHz clock based on AM335x datasheet table 3.1 AM3358BZCZ100 */
-void mpu_pll_init(void) {
+SRAM_TEXT void mpu_pll_init(void) {
   u32_t x;
-  /* Switch PLL to bypass mode */
-  x = REG(CM_CLKMODE_DPLL_MPU);
-  x &= ~0x7;
-  x |= 0x4;
-  REG(CM_CLKMODE_DPLL_MPU) = x;
-  /* wait for bypass status */
-  while (!(REG(CM_IDLEST_DPLL_MPU) & 0x100)) {}
-
-  /* configure divider and multipler */
-  /* DPLL_MULT = 1000, DPLL_DIV = 23 (actual division factor is N+1) */
-  /* 24MHz*1000/24 = 1GHz */
-  REG(CM_CLKSEL_DPLL_MPU) = (1000 << 8) | (23);
+  u32_t locked = dpll_locked_at(CM_IDLEST_DPLL_MPU, CM_CLKSEL_DPLL_MPU, (1000 << 8) | (23));
+
+  if (!locked) {
+    /* Switch PLL to bypass mode */
+    x = REG(CM_CLKMODE_DPLL_MPU);
+    x = (x & ~REG_MASK(CM_DPLL_EN)) | REG_VAL(CM_DPLL_EN, CM_DPLL_EN_MN_BYPASS);
+    REG(CM_CLKMODE_DPLL_MPU) = x;
+    /* wait for bypass status */
+    while (!REG_GET(CM_ST_MN_BYPASS, REG(CM_IDLEST_DPLL_MPU))) {}
+
+    /* configure divider and multipler */
+    /* DPLL_MULT = 1000, DPLL_DIV = 23 (actual division factor is N+1) */
+    /* 24MHz*1000/24 = 1GHz */
+    REG(CM_CLKSEL_DPLL_MPU) = (1000 << 8) | (23);
+  }
 
   /* Set M2 Divider */
-  REG(CM_DIV_M2_DPLL_MPU) &= ~0x1F;
-  REG(CM_DIV_M2_DPLL_MPU) |= 1;
-
-  /* Enable, locking PLL */
-  x = REG(CM_CLKMODE_DPLL_MPU);
-  x |= 0x7;
-  REG(CM_CLKMODE_DPLL_MPU) = x;
-  /* wait for locking to finish */
-  while (!(REG(CM_IDLEST_DPLL_MPU) & 0x1)) {}
+  REG_RMW(CM_DIV_M2_DPLL_MPU, CM_DPLL_DIV, 1);
+
+  if (!locked) {
+    /* Enable, locking PLL */
+    x = REG(CM_CLKMODE_DPLL_MPU);
+    x |= REG_VAL(CM_DPLL_EN, CM_DPLL_EN_LOCK);
+    REG(CM_CLKMODE_DPLL_MPU) = x;
+    /* wait for locking to finish */
+    while (!REG_GET(CM_ST_DPLL_CLK, REG(CM_IDLEST_DPLL_MPU))) {}
+  }
 }
 
 /* Core PLL Configuration based on AM335x TRM 8.1.6.7.1 */
 /* All values based on AM335x TRM Table 8-22 Core PLL Typical Frequencies OPP100 */
 /* clock source is 24MHz crystal on OSC0-IN (BBB schematic page 3) */
-void core_pll_init(void) {
+SRAM_TEXT void core_pll_init(void) {
   u32_t x;
-  /* Switch PLL to bypass mode */
-  x = REG(CM_CLKMODE_DPLL_CORE);
-  x &= ~0x7;
-  x |= 0x4;
-  REG(CM_CLKMODE_DPLL_CORE) = x;
-  /* wait for bypass status */
-  while (!(REG(CM_IDLEST_DPLL_CORE) & 0x100)) {}
-
-  /* configure divider and multipler */
-  /* DPLL_MULT = 1000, DPLL_DIV = 23 (actual division factor is N+1) */
-  /* 24MHz*1000/24 = 1GHz */
-  REG(CM_CLKSEL_DPLL_CORE) = (500 << 8) | (23);
+  u32_t locked = dpll_locked_at(CM_IDLEST_DPLL_CORE, CM_CLKSEL_DPLL_CORE, (500 << 8) | (23));
+
+  if (!locked) {
+    /* Switch PLL to bypass mode */
+    x = REG(CM_CLKMODE_DPLL_CORE);
+    x = (x & ~REG_MASK(CM_DPLL_EN)) | REG_VAL(CM_DPLL_EN, CM_DPLL_EN_MN_BYPASS);
+    REG(CM_CLKMODE_DPLL_CORE) = x;
+    /* wait for bypass status */
+    while (!REG_GET(CM_ST_MN_BYPASS, REG(CM_IDLEST_DPLL_CORE))) {}
+
+    /* configure divider and multipler */
+    /* DPLL_MULT = 1000, DPLL_DIV = 23 (actual division factor is N+1) */
+    /* 24MHz*1000/24 = 1GHz */
+    REG(CM_CLKSEL_DPLL_CORE) = (500 << 8) | (23);
+  }
 
   /* Set M4 Divider */
-  REG(CM_DIV_M4_DPLL_CORE) &= ~0x1F;
-  REG(CM_DIV_M4_DPLL_CORE) |= 10;
+  REG_RMW(CM_DIV_M4_DPLL_CORE, CM_DPLL_DIV, 10);
 
   /* Set the M5 Divider */
-  REG(CM_DIV_M5_DPLL_CORE) &= ~0x1F;
-  REG(CM_DIV_M5_DPLL_CORE) |= 8;
+  REG_RMW(CM_DIV_M5_DPLL_CORE, CM_DPLL_DIV, 8);
 
   /* Set the M6 Divider */
-  REG(CM_DIV_M6_DPLL_CORE) &= ~0x1F;
-  REG(CM_DIV_M6_DPLL_CORE) |= 4;
-
-  /* Enable, locking PLL */
-  x = REG(CM_CLKMODE_DPLL_CORE);
-  x |= 0x7;
-  REG(CM_CLKMODE_DPLL_CORE) = x;
-  /* wait for locking to finish */
-  while (!(REG(CM_IDLEST_DPLL_CORE) & 0x1)) {}
+  REG_RMW(CM_DIV_M6_DPLL_CORE, CM_DPLL_DIV, 4);
+
+  if (!locked) {
+    /* Enable, locking PLL */
+    x = REG(CM_CLKMODE_DPLL_CORE);
+    x |= REG_VAL(CM_DPLL_EN, CM_DPLL_EN_LOCK);
+    REG(CM_CLKMODE_DPLL_CORE) = x;
+    /* wait for locking to finish */
+    while (!REG_GET(CM_ST_DPLL_CLK, REG(CM_IDLEST_DPLL_CORE))) {}
+  }
 }
 
 /* PER PLL Configuration based on AM335x TRM 8.1.6.8.1 */
 /* All values based on AM335x TRM Table 8-24 PER PLL Typical Frequencies OPP100 */
 /* clock source is 24MHz crystal on OSC0-IN (BBB schematic page 3) */
-void per_pll_init(void) {
+SRAM_TEXT void per_pll_init(void) {
   u32_t x;
-  /* Switch PLL to bypass mode */
-  x = REG(CM_CLKMODE_DPLL_PER);
-  x &= ~0x7;
-  x |= 0x4;
-  REG(CM_CLKMODE_DPLL_PER) = x;
-  /* wait for bypass status */
-  while (!(REG(CM_IDLEST_DPLL_PER) & 0x100)) {}
-
-  /* configure divider and multipler */
-  /* DPLL_MULT = 960, DPLL_DIV = 23 (actual division factor is N+1) */
-  /* 24MHz*960/24 = 960MHz */
-  REG(CM_CLKSEL_DPLL_PER) = (960 << 8) | (23);
+  u32_t locked = dpll_locked_at(CM_IDLEST_DPLL_PER, CM_CLKSEL_DPLL_PER, (960 << 8) | (23));
+
+  if (!locked) {
+    /* Switch PLL to bypass mode */
+    x = REG(CM_CLKMODE_DPLL_PER);
+    x = (x & ~REG_MASK(CM_DPLL_EN)) | REG_VAL(CM_DPLL_EN, CM_DPLL_EN_MN_BYPASS);
+    REG(CM_CLKMODE_DPLL_PER) = x;
+    /* wait for bypass status */
+    while (!REG_GET(CM_ST_MN_BYPASS, REG(CM_IDLEST_DPLL_PER))) {}
+
+    /* configure divider and multipler */
+    /* DPLL_MULT = 960, DPLL_DIV = 23 (actual division factor is N+1) */
+    /* 24MHz*960/24 = 960MHz */
+    REG(CM_CLKSEL_DPLL_PER) = (960 << 8) | (23);
+  }
 
   /* Set M2 Divider */
-  REG(CM_DIV_M2_DPLL_PER) &= ~0x7F;
-  REG(CM_DIV_M2_DPLL_PER) |= 5;
-
-  /* Enable, locking PLL */
-  x = REG(CM_CLKMODE_DPLL_PER);
-  x |= 0x7;
-  REG(CM_CLKMODE_DPLL_PER) = x;
-  /* wait for locking to finish */
-  while (!(REG(CM_IDLEST_DPLL_PER) & 0x1)) {}
+  REG_RMW(CM_DIV_M2_DPLL_PER, CM_DPLL_DIV_PER, 5);
+
+  if (!locked) {
+    /* Enable, locking PLL */
+    x = REG(CM_CLKMODE_DPLL_PER);
+    x |= REG_VAL(CM_DPLL_EN, CM_DPLL_EN_LOCK);
+    REG(CM_CLKMODE_DPLL_PER) = x;
+    /* wait for locking to finish */
+    while (!REG_GET(CM_ST_DPLL_CLK, REG(CM_IDLEST_DPLL_PER))) {}
+  }
 }
 
 /* DDR PLL Configuration based on AM335x TRM 8.1.6.11.1 */
 /* 400MHz based on Table 5-5 of AM335x datasheet DDR3L max frequency */
 /* clock source is 24MHz crystal on OSC0-IN (BBB schematic page 3) */
-void ddr_pll_init(void) {
+SRAM_TEXT void ddr_pll_init(void) {
   u32_t x;
-  /* Switch PLL to bypass mode */
-  x = REG(CM_CLKMODE_DPLL_DDR);
-  x &= ~0x7;
-  x |= 0x4;
-  REG(CM_CLKMODE_DPLL_DDR) = x;
-  /* wait for bypass status */
-  while (!(REG(CM_IDLEST_DPLL_DDR) & 0x100)) {}
-
-  /* configure divider and multipler */
-  /* DPLL_MULT = 400, DPLL_DIV = 23 (actual division factor is N+1) */
-  /* 24MHz*400/24 = 400MHz */
-  REG(CM_CLKSEL_DPLL_DDR) = (400 << 8) | (23);
+  u32_t locked = dpll_locked_at(CM_IDLEST_DPLL_DDR, CM_CLKSEL_DPLL_DDR, (400 << 8) | (23));
+
+  if (!locked) {
+    /* Switch PLL to bypass mode */
+    x = REG(CM_CLKMODE_DPLL_DDR);
+    x = (x & ~REG_MASK(CM_DPLL_EN)) | REG_VAL(CM_DPLL_EN, CM_DPLL_EN_MN_BYPASS);
+    REG(CM_CLKMODE_DPLL_DDR) = x;
+    /* wait for bypass status */
+    while (!REG_GET(CM_ST_MN_BYPASS, REG(CM_IDLEST_DPLL_DDR))) {}
+
+    /* configure divider and multipler */
+    /* DPLL_MULT = 400, DPLL_DIV = 23 (actual division factor is N+1) */
+    /* 24MHz*400/24 = 400MHz */
+    REG(CM_CLKSEL_DPLL_DDR) = (400 << 8) | (23);
+  }
 
   /* Set M2 Divider */
-  REG(CM_DIV_M2_DPLL_DDR) &= ~0x1F;
-  REG(CM_DIV_M2_DPLL_DDR) |= 1;
-
-  /* Enable, locking PLL */
-  x = REG(CM_CLKMODE_DPLL_DDR);
-  x |= 0x7;
-  REG(CM_CLKMODE_DPLL_DDR) = x;
-  /* wait for locking to finish */
-  while (!(REG(CM_IDLEST_DPLL_DDR) & 0x1)) {}
+  REG_RMW(CM_DIV_M2_DPLL_DDR, CM_DPLL_DIV, 1);
+
+  if (!locked) {
+    /* Enable, locking PLL */
+    x = REG(CM_CLKMODE_DPLL_DDR);
+    x |= REG_VAL(CM_DPLL_EN, CM_DPLL_EN_LOCK);
+    REG(CM_CLKMODE_DPLL_DDR) = x;
+    /* wait for locking to finish */
+    while (!REG_GET(CM_ST_DPLL_CLK, REG(CM_IDLEST_DPLL_DDR))) {}
+  }
 }
 
 /* initialize all the interface clocks and prcm domains we will be using */
-void interface_clocks_init(void) {
+SRAM_TEXT void interface_clocks_init(void) {
   /* WKUP domain enable */
   REG(CM_WKUP_CONTROL_CLKCTRL) = 0x2;
   /* PER domain enable */
@@ -156,7 +202,7 @@ void interface_clocks_init(void) {
   REG(CM_PER_L3_CLKSTCTRL) = 0x2;
 }
 
-void ddr_init(void) {
+SRAM_TEXT void ddr_init(void) {
   /* enable functional clock PD_PER_EMIF_GCLK */
   REG(CM_PER_EMIF_CLKCTRL) = 0x2;
   REG(CM_PER_EMIF_FW_CLKCTRL) = 0x2;
@@ -164,6 +210,12 @@ void ddr_init(void) {
   /* wait for clocks to be enabled */
   while (!((REG(CM_PER_L3_CLKSTCTRL) & 0x4) && (REG(CM_PER_L3_CLKSTCTRL) & 0x8))) {}
 
+  /* EMIF kept running through a warm reset, reprogramming the PHY under it
+     would only drop what is in DDR */
+  if (REG(EMIF0_SDRAM_CONFIG) == DDR3_SDRAM_CONFIG && (REG(EMIF0_STATUS) & 0x4)) {
+    return;
+  }
+
   /* Note beaglebone black does not have VTT termination */
   /* initialize virtual temperature process compensation */
   REG(CONTROL_MODULE_VTP_CTRL) |= 0x40;
@@ -225,14 +277,14 @@ void ddr_init(void) {
 }
 
 /* read and write to some addresses in DDR, returns 0 on sucess */
-u8_t ddr_check(void) {
+SRAM_TEXT u8_t ddr_check(void) {
   u32_t i;
   /* write to a bunch of addresses */
-  for (i = 0; i < 0x20000000; i += 0x2000) {
+  for (i = 0; i < DDR_SIZE; i += 0x2000) {
     REG(DDR_START + i) = i;
   }
   /* read from the same addresses and compare with expected value */
-  for (i = 0; i < 0x20000000; i += 0x2000) {
+  for (i = 0; i < DDR_SIZE; i += 0x2000) {
     if (REG(DDR_START + i) != i) {
       return 1;
     }
@@ -240,7 +292,103 @@ u8_t ddr_check(void) {
   return 0;
 }
 
+static struct sem bringup_done;
+
+void mmc_task(u32_t arg) {
+  (void)arg;
+  if (!mmc_init()) {
+    LOG0("MMC controller initialized\n\r");
+  } else {
+    LOG0("MMC controller initialization failed...\n\r");
+  }
+  sem_post(&bringup_done);
+}
+
+/* posted for each TRACE_DUMP_KEY, the dump is far too long for the work
+   queue the key comes in on */
+static struct sem trace_request;
+
+static void trace_task(u32_t arg) {
+  (void)arg;
+  while (1) {
+    sem_wait(&trace_request);
+    trace_dump();
+  }
+}
+
+/* hand over to a kernel image in memory, does not return */
+void boot_kernel(u32_t entry, u32_t size) {
+  u32_t i;
+
+  LOG0("\n\rstarting kernel\n\r\n\r\n\r");
+  trace_event(TRACE_KERNEL_JUMP, entry, size);
+  /* the boot log goes to the card in one batch, nothing before this waited
+     for it */
+  plog_flush();
+  /* kernel takes over UART0, make sure the log made it out */
+  uart_flush();
+  /* and the CPU, no more ISRs or thread switches from here */
+  cpu_irq_fiq_disable();
+  /* nothing the loader started may interrupt the kernel before it sets up
+     the INTC: stop the timers, PRUs and GPIO edges, mask every line and
+     drop anything pending, including the scheduler's software interrupt */
+  timer_stop();
+  pru_stop();
+  for (i = 0; i < GPIO_BANKS; i++) {
+    gpio_irq_disable(i, 0xFFFFFFFF);
+  }
+  for (i = 0; i < 4; i++) {
+    REG(INTC_MIR_SET(i)) = 0xFFFFFFFF;
+    REG(INTC_ISR_CLEAR(i)) = 0xFFFFFFFF;
+  }
+  REG(INTC_CONTROL) = INTC_CONTROL_NEWIRQAGR | INTC_CONTROL_NEWFIQAGR;
+  cpu_dsb();
+  /* kernel image has to be in memory, and kernels expect the MMU off. only
+     main runs on a stack that allows that */
+  if (mmu_disable()) {
+    /* uart_flush sleeps with IRQs masked and needs TINT4 to wake it */
+    irq_unmask(IRQ_TINT4);
+    LOG0("can't turn the MMU off from a thread stack\n\r");
+    uart_flush();
+  } else {
+    /* jump to kernel */
+    ((void (*)(void))entry)();
+  }
+
+  /* only gets here if the kernel returns or never started. blink with the
+     core asleep, IRQs stay masked and nothing but the timeout may wake it up */
+  for (i = 0; i < 4; i++) {
+    REG(INTC_MIR_SET(i)) = 0xFFFFFFFF;
+  }
+  irq_unmask(IRQ_TINT4);
+  while (1) {
+    gpio_led_toggle(1);
+    timer_delay_us(BLINK_US);
+  }
+}
+
+/* boot window: wait up to wait_ms for a key, returns it or 0 if there was
+   none. RX interrupts are left disabled when a key arrived, so whatever
+   handles it can keep polling */
+char boot_wait_key(u32_t wait_ms) {
+  u32_t i;
+  char c;
+
+  uart_rx_irq(false);
+  for (i = 0; i < wait_ms; i++) {
+    if (!uart_getc_timeout(&c, 1000) && (c == SL_SYNC || c == MONITOR_KEY)) {
+      return c;
+    }
+  }
+  uart_rx_irq(true);
+  return 0;
+}
+
 void input_callback(char c) {
+  if (c == TRACE_DUMP_KEY) {
+    sem_post(&trace_request);
+    return;
+  }
   /* echo input back out */
   uart_putc(c);
 }
@@ -250,16 +398,74 @@ void timer_callback(void) {
   gpio_led_toggle(2);
 }
 
+/* load the kernel the manifest on dev points to, checking it against the
+   manifest crc. buf is a block of scratch. returns 0 with entry and size set */
+static int load_kernel_sd(struct blk_dev* dev, struct sd_manifest* man, u32_t* buf,
+                          u32_t* entry, u32_t* size) {
+  u32_t i, kernel_start, kernel_size, kernel_load, kernel_blocks, kernel_crc, crc, n;
+
+  kernel_start = man->kernel_lba;
+  kernel_size = man->kernel_size;
+  kernel_load = man->kernel_load;
+  kernel_crc = man->kernel_crc;
+  LOG3("kernel block: %u, size: 0x%08x, load: 0x%08x\n\r", kernel_start, kernel_size,
+       kernel_load);
+  if (kernel_size == 0) {
+    LOG0("no kernel on SD card\n\r");
+    return 1;
+  }
+
+  /* an ELF kernel goes where its program headers say, anything else is a raw
+     image for kernel_load. both start on a block boundary */
+  trace_event(TRACE_BOOT_PHASE, TRACE_PHASE_KERNEL, 0);
+  if (blk_read(dev, kernel_start, 1, buf)) {
+    return 1;
+  }
+  if (!elf_check((struct elf32_ehdr*)buf)) {
+    LOG0("loading ELF kernel\n\r");
+    if (elf_load_sd(dev, kernel_start, kernel_size, &kernel_load, &crc)) {
+      return 1;
+    }
+  } else {
+    if (kernel_load < KERNEL_LOAD_ADDR ||
+        kernel_load - KERNEL_LOAD_ADDR + kernel_size > KERNEL_MAX_SIZE) {
+      LOG0("kernel doesn't fit the load area\n\r");
+      return 1;
+    }
+    /* read it straight into place, a multi-block read per chunk */
+    LOG0("copying kernel...");
+    kernel_blocks = (kernel_size + SD_BLOCK_SIZE - 1) / SD_BLOCK_SIZE;
+    for (i = 0; i < kernel_blocks; i += n) {
+      n = kernel_blocks - i > KERNEL_READ_BLOCKS ? KERNEL_READ_BLOCKS : kernel_blocks - i;
+      if (blk_read(dev, kernel_start + i, n, (u32_t*)(kernel_load + i * SD_BLOCK_SIZE))) {
+        return 1;
+      }
+      uart_putc('.');
+    }
+    crc = crc32_update(0, (const u8_t*)kernel_load, kernel_size);
+    warm_add(kernel_load, kernel_size, 0);
+  }
+  if (crc != kernel_crc) {
+    LOG0("\n\rkernel crc mismatch\n\r");
+    return 1;
+  }
+  warm_commit(kernel_load, kernel_size, crc);
+  *entry = kernel_load;
+  *size = kernel_size;
+  return 0;
+}
+
 int main(void) {
-  u32_t i, j;
-  u32_t buf[128];
-  u32_t kernel_start, kernel_size, kernel_writer;
+  struct blk_dev* sd;
+  u32_t* buf;
+  struct sd_manifest* man;
+  u32_t kernel_size, kernel_load;
+  u32_t baud;
+  s32_t baud_err;
+  char key;
 
-  mpu_pll_init();
-  core_pll_init();
-  per_pll_init();
-  ddr_pll_init();
-  interface_clocks_init();
+  /* timeouts count core cycles, start the counter once the MPU PLL is up */
+  cpu_cycles_init();
 
   REG(INTC_SYSCONFIG) |= (0x2);           /* trigger reset of INTC */
   while (!(REG(INTC_SYSSTATUS) & 0x1)) {} /* wait until INTC is reset.*/
@@ -268,101 +474,80 @@ int main(void) {
   irq_enable();
 
   gpio_led_init();
+  sem_init(&trace_request, 0);
   uart_init(input_callback);
   timer_init(timer_callback);
+  timer_clock_init();
 
   gpio_led_on(0);
-  uart_puts("\r\n\r\bootloader started\r\n");
-  uart_puts("UART initialized\r\n");
-
-  uart_hexdump(0x01234567);
-  uart_puts("\n\r");
-  uart_hexdump(0x89ABCDEF);
-  uart_puts("\n\r");
-
-  /* initialize DDR3L, values hardcoded for D2516EC4BXGGB */
-  ddr_init();
-  if (REG(EMIF0_STATUS) & 0x4) {
-    uart_puts("DDR3L initialized\n\r");
-  } else {
-    uart_puts("DDR3L initialization failed...\n\r");
+  LOG0("\r\n\r\nbootloader started\r\n");
+  baud = uart_get_baud(&baud_err);
+  LOG2("UART initialized, %u baud, error %d ppm\r\n", baud, baud_err);
+  /* reloc_main only gets here with DDR up, and checked after a cold reset */
+  LOG1("DDR3L initialized, running from 0x%08x\n\r", (u32_t)_ddr_start);
+
+  trace_init();
+  if (mem_init()) {
+    LOG0("page allocator setup failed\n\r");
     return 0;
   }
-  /* check reading and writing to external DRAM before continuing */
-  if (!ddr_check()) {
-    uart_puts("DDR3L read/write check passed\n\r");
-  } else {
-    uart_puts("DDR3L read/write check failed...\n\r");
-    return 0;
+  if (blk_init()) {
+    LOG0("block request pool setup failed\n\r");
   }
 
-  if (!mmc_init()) {
-    uart_puts("MMC controller initialized\n\r");
-  } else {
-    uart_puts("MMC controller initialization failed...\n\r");
+  /* after a watchdog or other warm reset the last kernel may still be in DDR
+     as it was loaded, boot it again without the SD card (warm.h) */
+  if (!warm_check(&kernel_load, &kernel_size)) {
+    LOG1("warm reset 0x%08x, kernel in DDR verified\n\r", reset_status);
+    boot_kernel(kernel_load, kernel_size);
+  }
+  /* whatever gets loaded from here on replaces it */
+  warm_clear();
+
+  /* bring up the SD card during the boot window, which gives sload a chance
+     to send a kernel before booting from the SD card, or enter the monitor */
+  sched_init();
+  sem_init(&bringup_done, 0);
+  trace_event(TRACE_BOOT_PHASE, TRACE_PHASE_MMC, 0);
+  sched_create("mmc", mmc_task, 0, SCHED_PRIO_DEFAULT);
+  sched_create("trace", trace_task, 0, SCHED_PRIO_LOW);
+  key = boot_wait_key(BOOT_WAIT_MS);
+  sem_wait(&bringup_done);
+  if (key == MONITOR_KEY) {
+    monitor_run();
+  } else if (key == SL_SYNC) {
+    LOG0("serial load requested\n\r");
+    if (!serial_load(KERNEL_LOAD_ADDR, KERNEL_MAX_SIZE, &kernel_size)) {
+      warm_add(KERNEL_LOAD_ADDR, kernel_size, 0);
+      warm_commit(KERNEL_LOAD_ADDR, kernel_size,
+                  crc32_update(0, (const u8_t*)KERNEL_LOAD_ADDR, kernel_size));
+      boot_kernel(KERNEL_LOAD_ADDR, kernel_size);
+    }
+    LOG0("serial load failed, booting from SD card\n\r");
   }
 
-  /* get length of bootloader section from header */
-  if (mmc_read_block(buf, 1)) {
+  /* gen_img puts the layout of the card in one block, see sd_image.h.
+     mmc_task registered the card if it came up */
+  sd = blk_find("mmc0");
+  buf = arena_alloc(&sram_arena, SD_BLOCK_SIZE, 4);
+  if (sd == NULL || buf == NULL || blk_read(sd, SD_MANIFEST_LBA, 1, buf)) {
     return 0;
   }
-  /* using GP header from MLO, add 512 to account for mandatory first sector */
-  kernel_start = (buf[0] + 512);
-  uart_puts("bootloader size: ");
-  uart_hexdump(kernel_start);
-  uart_puts("\n\r");
-
-  /* offset rounds up to nearest block */
-  kernel_start = (kernel_start / 512) + 1;
-  uart_puts("kernel block: ");
-  uart_hexdump(kernel_start);
-  uart_puts("\n\r");
-
-  if (mmc_read_block(buf, kernel_start)) {
+  man = (struct sd_manifest*)buf;
+  if (man->magic != SD_MANIFEST_MAGIC || man->version != SD_MANIFEST_VERSION ||
+      crc32_update(0, (const u8_t*)man, (u32_t)&man->crc - (u32_t)man) != man->crc) {
+    LOG0("no image manifest on SD card, write it with gen_img\n\r");
     return 0;
   }
-  kernel_size = buf[0];
-  uart_puts("kernel size: ");
-  uart_hexdump(kernel_size);
-  uart_puts("\n\r");
-
-  /* start from end of bootloader blocks and copy into external memory */
-  /* first block is special case due to header */
-  kernel_writer = DDR_START;
-  for (i = 2; i < 128; i++) {
-    REG(kernel_writer) = buf[i];
-    kernel_writer += 4;
+  if (man->log_blocks != 0 && plog_init(sd, man->log_lba, man->log_blocks)) {
+    LOG0("can't read the log region, no persistent log\n\r");
   }
-
-  uart_puts("copying kernel...");
-  for (i = 1; i < ((kernel_size / 512) + 1); i++) {
-    if (mmc_read_block(buf, kernel_start + i)) {
-      return 0;
-    }
-    for (j = 0; j < 128; j++) {
-      REG(kernel_writer) = buf[j];
-      kernel_writer += 4;
-    }
-    uart_puts(".");
-  }
-
-  uart_puts("\n\rstarting kernel\n\r\n\r\n\r");
-  /* jump to kernel */
-  asm(" ldr	r3, =0x80000000\n\t"
-      " blx	r3\n\t");
-
-  i = 0;
-  /* infinite loop toggling LEDs */
-  while (1) {
-    i++;
-    if (i == 50000) {
-      gpio_led_toggle(1);
-    }
-    if (i == 100000) {
-      gpio_led_toggle(1);
-      i = 0;
-    }
+  if (load_kernel_sd(sd, man, buf, &kernel_load, &kernel_size)) {
+    /* keep the log of what went wrong */
+    plog_flush();
+    return 0;
   }
+  boot_kernel(kernel_load, kernel_size);
 
   return 0;
 }
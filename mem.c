@@ -0,0 +1,408 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Page, pool and arena allocators, see mem.h.
+   The page allocator keeps a byte per page in DDR at PAGE_META_BASE, set on
+   the first page of each block: PAGE_META_FREE or PAGE_META_USED plus its
+   order. Free blocks hold their own list links.
+*/
+#include <common.h>
+#include <cpu.h>
+#include <log.h>
+#include <mem.h>
+#include <reloc.h>
+
+#define PAGE_META_FREE  0x80
+#define PAGE_META_USED  0x40
+#define PAGE_META_ORDER 0x3F
+
+struct page_link {
+  u32_t next;
+  u32_t prev;
+};
+
+#define PAGE_INDEX(addr) (((addr) - page_base) >> PAGE_SHIFT)
+#define PAGE_LINK(addr)  ((struct page_link*)(addr))
+
+static u32_t page_base;
+static u32_t page_count;
+static u8_t* const page_meta = (u8_t*)PAGE_META_BASE;
+static u32_t page_heads[PAGE_ORDERS];
+static u32_t page_mask; /* bit n set when page_heads[n] isn't empty */
+static struct page_stats page_st;
+
+struct arena boot_arena;
+struct arena sram_arena;
+
+static struct pool* mem_pools[MEM_MAX_POOLS];
+static u32_t mem_num_pools = 0;
+
+static void page_push(u32_t addr, u32_t order) {
+  struct page_link* l = PAGE_LINK(addr);
+
+  l->prev = 0;
+  l->next = page_heads[order];
+  if (l->next != 0) {
+    PAGE_LINK(l->next)->prev = addr;
+  }
+  page_heads[order] = addr;
+  page_mask |= 0x1 << order;
+  page_meta[PAGE_INDEX(addr)] = PAGE_META_FREE | order;
+  page_st.blocks[order]++;
+}
+
+static void page_unlink(u32_t addr, u32_t order) {
+  struct page_link* l = PAGE_LINK(addr);
+
+  if (l->prev != 0) {
+    PAGE_LINK(l->prev)->next = l->next;
+  } else {
+    page_heads[order] = l->next;
+  }
+  if (l->next != 0) {
+    PAGE_LINK(l->next)->prev = l->prev;
+  }
+  if (page_heads[order] == 0) {
+    page_mask &= ~(0x1 << order);
+  }
+  page_meta[PAGE_INDEX(addr)] = 0;
+  page_st.blocks[order]--;
+}
+
+/* put a block on the free lists, merging it with its buddy for as long as
+   that is free and the same size */
+static void page_release(u32_t addr, u32_t order) {
+  u32_t buddy;
+
+  while (order < PAGE_ORDERS - 1) {
+    buddy = page_base + ((addr - page_base) ^ (PAGE_SIZE << order));
+    if (PAGE_INDEX(buddy) >= page_count ||
+        page_meta[PAGE_INDEX(buddy)] != (PAGE_META_FREE | order)) {
+      break;
+    }
+    page_unlink(buddy, order);
+    if (buddy < addr) {
+      addr = buddy;
+    }
+    order++;
+  }
+  page_push(addr, order);
+}
+
+/* set up an empty allocator for size bytes from base, pages are handed to it
+   with page_add. base has to be aligned to the largest block */
+void page_init(u32_t base, u32_t size) {
+  u32_t i;
+
+  page_base = base;
+  page_count = size >> PAGE_SHIFT;
+  if (page_count > PAGE_META_SIZE) {
+    page_count = PAGE_META_SIZE;
+  }
+  for (i = 0; i < page_count; i++) {
+    page_meta[i] = 0;
+  }
+  for (i = 0; i < PAGE_ORDERS; i++) {
+    page_heads[i] = 0;
+    page_st.blocks[i] = 0;
+  }
+  page_mask = 0;
+  page_st.pages = 0;
+  page_st.free = 0;
+  page_st.min_free = 0;
+  page_st.allocs = 0;
+  page_st.frees = 0;
+  page_st.fails = 0;
+}
+
+/* make the whole pages in a range available, as the largest aligned blocks
+   that fit */
+void page_add(u32_t addr, u32_t size) {
+  u32_t end, order, flags;
+
+  end = (addr + size) & ~(PAGE_SIZE - 1);
+  addr = (addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  flags = cpu_irq_save();
+  while (addr < end) {
+    order = 0;
+    while (order < PAGE_ORDERS - 1 && ((addr - page_base) & (PAGE_SIZE << order)) == 0 &&
+           addr + (PAGE_SIZE << (order + 1)) <= end) {
+      order++;
+    }
+    page_release(addr, order);
+    page_st.pages += 0x1 << order;
+    page_st.free += 0x1 << order;
+    addr += PAGE_SIZE << order;
+  }
+  page_st.min_free = page_st.free;
+  cpu_irq_restore(flags);
+}
+
+/* smallest order that holds bytes */
+u32_t page_order(u32_t bytes) {
+  u32_t order = 0;
+
+  while (order < PAGE_ORDERS - 1 && (PAGE_SIZE << order) < bytes) {
+    order++;
+  }
+  return order;
+}
+
+/* 2^order contiguous pages, aligned to their size. NULL when out of memory */
+void* page_alloc(u32_t order) {
+  u32_t flags, avail, o, addr;
+
+  flags = cpu_irq_save();
+  avail = order < PAGE_ORDERS ? page_mask & ~((0x1 << order) - 1) : 0;
+  if (avail == 0) {
+    page_st.fails++;
+    cpu_irq_restore(flags);
+    return NULL;
+  }
+  /* smallest free block that is big enough, split down to size */
+  o = 31 - __builtin_clz(avail & -avail);
+  addr = page_heads[o];
+  page_unlink(addr, o);
+  while (o > order) {
+    o--;
+    page_push(addr + (PAGE_SIZE << o), o);
+  }
+  page_meta[PAGE_INDEX(addr)] = PAGE_META_USED | order;
+  page_st.free -= 0x1 << order;
+  if (page_st.free < page_st.min_free) {
+    page_st.min_free = page_st.free;
+  }
+  page_st.allocs++;
+  cpu_irq_restore(flags);
+  return (void*)addr;
+}
+
+void page_free(void* p) {
+  u32_t flags, addr = (u32_t)p, order;
+
+  flags = cpu_irq_save();
+  if (addr < page_base || PAGE_INDEX(addr) >= page_count || (addr & (PAGE_SIZE - 1)) ||
+      !(page_meta[PAGE_INDEX(addr)] & PAGE_META_USED)) {
+    cpu_irq_restore(flags);
+    LOG1("page_free: 0x%08x wasn't allocated\r\n", addr);
+    return;
+  }
+  order = page_meta[PAGE_INDEX(addr)] & PAGE_META_ORDER;
+  /* page_release only marks the start of the merged block, which is the
+     buddy's when that is lower, so a second free has to find this clear */
+  page_meta[PAGE_INDEX(addr)] = 0;
+  page_st.free += 0x1 << order;
+  page_st.frees++;
+  page_release(addr, order);
+  cpu_irq_restore(flags);
+}
+
+void page_stats_get(struct page_stats* stats) {
+  u32_t flags;
+
+  flags = cpu_irq_save();
+  *stats = page_st;
+  cpu_irq_restore(flags);
+}
+
+/* split bytes of mem into objects of size. returns non zero if not even one
+   fits */
+int pool_init(struct pool* p, const char* name, u32_t size, void* mem, u32_t bytes) {
+  u32_t i;
+
+  size = (size + 3) & ~0x3;
+  if (size == 0 || mem == NULL || bytes < size) {
+    return 1;
+  }
+  p->name = name;
+  p->size = size;
+  p->count = bytes / size;
+  p->base = (u32_t)mem;
+  p->free = NULL;
+  for (i = p->count; i > 0; i--) {
+    *(void**)(p->base + (i - 1) * size) = p->free;
+    p->free = (void*)(p->base + (i - 1) * size);
+  }
+  p->used = 0;
+  p->peak = 0;
+  p->fails = 0;
+  if (mem_num_pools < MEM_MAX_POOLS) {
+    mem_pools[mem_num_pools++] = p;
+  }
+  return 0;
+}
+
+void* pool_alloc(struct pool* p) {
+  u32_t flags;
+  void* obj;
+
+  flags = cpu_irq_save();
+  obj = p->free;
+  if (obj == NULL) {
+    p->fails++;
+  } else {
+    p->free = *(void**)obj;
+    if (++p->used > p->peak) {
+      p->peak = p->used;
+    }
+  }
+  cpu_irq_restore(flags);
+  return obj;
+}
+
+/* a second free of an object is caught by finding it on the free list, at
+   most count steps. freeing it again would link the list into a loop */
+void pool_free(struct pool* p, void* obj) {
+  u32_t flags, off = (u32_t)obj - p->base;
+  void* f;
+
+  if (off >= p->count * p->size || off % p->size) {
+    LOG0("pool ");
+    log_str(p->name);
+    LOG1(": 0x%08x isn't one of its objects\r\n", (u32_t)obj);
+    return;
+  }
+  flags = cpu_irq_save();
+  for (f = p->free; f != NULL; f = *(void**)f) {
+    if (f == obj) {
+      cpu_irq_restore(flags);
+      LOG0("pool ");
+      log_str(p->name);
+      LOG1(": 0x%08x freed twice\r\n", (u32_t)obj);
+      return;
+    }
+  }
+  *(void**)obj = p->free;
+  p->free = obj;
+  p->used--;
+  cpu_irq_restore(flags);
+}
+
+void arena_init(struct arena* a, const char* name, void* mem, u32_t size) {
+  a->name = name;
+  a->base = (u32_t)mem;
+  a->size = mem == NULL ? 0 : size;
+  a->used = 0;
+  a->peak = 0;
+  a->allocs = 0;
+  a->fails = 0;
+}
+
+/* size bytes aligned to align (a power of 2, 0 means a word) */
+void* arena_alloc(struct arena* a, u32_t size, u32_t align) {
+  u32_t flags, start;
+
+  if (align < 4) {
+    align = 4;
+  }
+  flags = cpu_irq_save();
+  start = (a->base + a->used + align - 1) & ~(align - 1);
+  if (start - a->base > a->size || size > a->size - (start - a->base)) {
+    a->fails++;
+    cpu_irq_restore(flags);
+    return NULL;
+  }
+  a->used = start + size - a->base;
+  if (a->used > a->peak) {
+    a->peak = a->used;
+  }
+  a->allocs++;
+  cpu_irq_restore(flags);
+  return (void*)start;
+}
+
+/* drop everything allocated from the arena */
+void arena_reset(struct arena* a) {
+  a->used = 0;
+}
+
+/* zero len bytes, 32 bytes per store once aligned */
+void mem_zero(void* mem, u32_t len) {
+  u8_t* dst = mem;
+  u32_t n;
+
+  while (len != 0 && ((u32_t)dst & 0x3) != 0) {
+    *dst++ = 0;
+    len--;
+  }
+  while (len >= 4 && ((u32_t)dst & 0x1F) != 0) {
+    *(u32_t*)dst = 0;
+    dst += 4;
+    len -= 4;
+  }
+  n = len & ~0x1F;
+  if (n != 0) {
+#ifdef HOST_SIM
+    u32_t i;
+    for (i = 0; i < n; i += 4) {
+      *(u32_t*)(dst + i) = 0;
+    }
+    dst += n;
+#else
+    asm volatile(" mov r3, #0\n\t"
+                 " mov r4, #0\n\t"
+                 " mov r5, #0\n\t"
+                 " mov r6, #0\n\t"
+                 " mov r7, #0\n\t"
+                 " mov r8, #0\n\t"
+                 " mov r9, #0\n\t"
+                 " mov r10, #0\n\t"
+                 "1:\n\t"
+                 " stmia %0!, {r3-r10}\n\t"
+                 " subs %1, %1, #32\n\t"
+                 " bne 1b\n\t"
+                 : "+r"(dst), "+r"(n)
+                 :
+                 : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "cc", "memory");
+#endif
+    len &= 0x1F;
+  }
+  while (len != 0) {
+    *dst++ = 0;
+    len--;
+  }
+}
+
+/* hand DDR between the warm boot record and the relocated loader to the page
+   allocator and take the boot arena from it. SRAM from where the ROM loaded
+   the DDR part of the loader up to the boot stack becomes sram_arena */
+int mem_init(void) {
+  void* mem;
+
+  arena_init(&sram_arena, "sram", _ddr_load_start,
+             (u32_t)_stack_limit - (u32_t)_ddr_load_start);
+
+  page_init(DDR_START, DDR_SIZE);
+  page_add(WARM_REC_BASE + PAGE_SIZE, SPL_DDR_BASE - (WARM_REC_BASE + PAGE_SIZE));
+  mem = page_alloc(BOOT_ARENA_ORDER);
+  arena_init(&boot_arena, "boot", mem, PAGE_SIZE << BOOT_ARENA_ORDER);
+  return mem == NULL;
+}
+
+static void arena_print(struct arena* a) {
+  LOG0("arena ");
+  log_str(a->name);
+  LOG2(": %u of %u bytes", a->used, a->size);
+  LOG3(", peak %u, %u allocs, %u failed\r\n", a->peak, a->allocs, a->fails);
+}
+
+void mem_print(void) {
+  struct page_stats st;
+  u32_t i;
+
+  page_stats_get(&st);
+  LOG3("pages: %u of %u free, low water %u\r\n", st.free, st.pages, st.min_free);
+  LOG3("  %u allocs, %u frees, %u failed\r\n", st.allocs, st.frees, st.fails);
+  for (i = 0; i < PAGE_ORDERS; i++) {
+    if (st.blocks[i] != 0) {
+      LOG3("  order %u (%u KB): %u free\r\n", i, (PAGE_SIZE << i) >> 10, st.blocks[i]);
+    }
+  }
+  arena_print(&boot_arena);
+  arena_print(&sram_arena);
+  for (i = 0; i < mem_num_pools; i++) {
+    LOG0("pool ");
+    log_str(mem_pools[i]->name);
+    LOG2(": %u of %u", mem_pools[i]->used, mem_pools[i]->count);
+    LOG3(" x %u bytes, peak %u, %u failed\r\n", mem_pools[i]->size, mem_pools[i]->peak,
+         mem_pools[i]->fails);
+  }
+}
@@ -0,0 +1,396 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* DDR benchmarks, see membench.h.
+   The loops that get timed are inline assembly, the rest of the loader is
+   built without optimization and a C loop would mostly measure that. The
+   simulator gets the same arithmetic in C.
+*/
+#include <common.h>
+#include <cpu.h>
+#include <emif.h>
+#include <log.h>
+#include <membench.h>
+#include <memlayout.h>
+#include <mmu.h>
+
+#define STREAM_SCALAR 3
+
+struct stream_kernel {
+  const char* name;
+  u32_t arrays; /* touched per element, for the byte count */
+  void (*scalar)(u32_t* a, const u32_t* b, const u32_t* c, u32_t len);
+  void (*neon)(u32_t* a, const u32_t* b, const u32_t* c, u32_t len);
+};
+
+#ifdef HOST_SIM
+static void stream_copy(u32_t* a, const u32_t* b, const u32_t* c, u32_t len) {
+  u32_t i;
+
+  (void)c;
+  for (i = 0; i < len / 4; i++) {
+    a[i] = b[i];
+  }
+}
+
+static void stream_scale(u32_t* a, const u32_t* b, const u32_t* c, u32_t len) {
+  u32_t i;
+
+  (void)c;
+  for (i = 0; i < len / 4; i++) {
+    a[i] = STREAM_SCALAR * b[i];
+  }
+}
+
+static void stream_add(u32_t* a, const u32_t* b, const u32_t* c, u32_t len) {
+  u32_t i;
+
+  for (i = 0; i < len / 4; i++) {
+    a[i] = b[i] + c[i];
+  }
+}
+
+static void stream_triad(u32_t* a, const u32_t* b, const u32_t* c, u32_t len) {
+  u32_t i;
+
+  for (i = 0; i < len / 4; i++) {
+    a[i] = b[i] + STREAM_SCALAR * c[i];
+  }
+}
+
+#define stream_copy_neon  stream_copy
+#define stream_scale_neon stream_scale
+#define stream_add_neon   stream_add
+#define stream_triad_neon stream_triad
+
+static u32_t* chase(u32_t* p, u32_t loads) {
+  while (loads-- != 0) {
+    p = (u32_t*)*p;
+  }
+  return p;
+}
+
+static void stride_read(const u32_t* p, u32_t count, u32_t stride) {
+  volatile u32_t sink;
+
+  while (count-- != 0) {
+    sink = *p;
+    p += stride / 4;
+  }
+  (void)sink;
+}
+
+#else
+
+/* a = b, len a multiple of 32 bytes here and below. STREAM_SCALAR is 3 in
+   the shifts */
+static void stream_copy(u32_t* a, const u32_t* b, const u32_t* c, u32_t len) {
+  (void)c;
+  asm volatile("1:\n\t"
+               " ldmia %1!, {r3-r10}\n\t"
+               " stmia %0!, {r3-r10}\n\t"
+               " subs %2, %2, #32\n\t"
+               " bne 1b\n\t"
+               : "+r"(a), "+r"(b), "+r"(len)
+               :
+               : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "cc", "memory");
+}
+
+/* a = 3b */
+static void stream_scale(u32_t* a, const u32_t* b, const u32_t* c, u32_t len) {
+  (void)c;
+  asm volatile("1:\n\t"
+               " ldmia %1!, {r3-r10}\n\t"
+               " add r3, r3, r3, lsl #1\n\t"
+               " add r4, r4, r4, lsl #1\n\t"
+               " add r5, r5, r5, lsl #1\n\t"
+               " add r6, r6, r6, lsl #1\n\t"
+               " add r7, r7, r7, lsl #1\n\t"
+               " add r8, r8, r8, lsl #1\n\t"
+               " add r9, r9, r9, lsl #1\n\t"
+               " add r10, r10, r10, lsl #1\n\t"
+               " stmia %0!, {r3-r10}\n\t"
+               " subs %2, %2, #32\n\t"
+               " bne 1b\n\t"
+               : "+r"(a), "+r"(b), "+r"(len)
+               :
+               : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "cc", "memory");
+}
+
+/* a = b + c, 16 bytes of each per loop */
+static void stream_add(u32_t* a, const u32_t* b, const u32_t* c, u32_t len) {
+  asm volatile("1:\n\t"
+               " ldmia %1!, {r3-r6}\n\t"
+               " ldmia %2!, {r7-r10}\n\t"
+               " add r3, r3, r7\n\t"
+               " add r4, r4, r8\n\t"
+               " add r5, r5, r9\n\t"
+               " add r6, r6, r10\n\t"
+               " stmia %0!, {r3-r6}\n\t"
+               " subs %3, %3, #16\n\t"
+               " bne 1b\n\t"
+               : "+r"(a), "+r"(b), "+r"(c), "+r"(len)
+               :
+               : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "cc", "memory");
+}
+
+/* a = b + 3c */
+static void stream_triad(u32_t* a, const u32_t* b, const u32_t* c, u32_t len) {
+  asm volatile("1:\n\t"
+               " ldmia %1!, {r3-r6}\n\t"
+               " ldmia %2!, {r7-r10}\n\t"
+               " add r7, r7, r7, lsl #1\n\t"
+               " add r8, r8, r8, lsl #1\n\t"
+               " add r9, r9, r9, lsl #1\n\t"
+               " add r10, r10, r10, lsl #1\n\t"
+               " add r3, r3, r7\n\t"
+               " add r4, r4, r8\n\t"
+               " add r5, r5, r9\n\t"
+               " add r6, r6, r10\n\t"
+               " stmia %0!, {r3-r6}\n\t"
+               " subs %3, %3, #16\n\t"
+               " bne 1b\n\t"
+               : "+r"(a), "+r"(b), "+r"(c), "+r"(len)
+               :
+               : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "cc", "memory");
+}
+
+/* NEON versions, 32 bytes of each array per loop. the main thread owns the
+   register bank (vfp.h), nothing to save */
+static void stream_copy_neon(u32_t* a, const u32_t* b, const u32_t* c, u32_t len) {
+  (void)c;
+  asm volatile("1:\n\t"
+               " vld1.32 {d0-d3}, [%1]!\n\t"
+               " vst1.32 {d0-d3}, [%0]!\n\t"
+               " subs %2, %2, #32\n\t"
+               " bne 1b\n\t"
+               : "+r"(a), "+r"(b), "+r"(len)
+               :
+               : "d0", "d1", "d2", "d3", "cc", "memory");
+}
+
+static void stream_scale_neon(u32_t* a, const u32_t* b, const u32_t* c, u32_t len) {
+  (void)c;
+  asm volatile(" vmov.i32 q8, #3\n\t"
+               "1:\n\t"
+               " vld1.32 {d0-d3}, [%1]!\n\t"
+               " vmul.i32 q0, q0, q8\n\t"
+               " vmul.i32 q1, q1, q8\n\t"
+               " vst1.32 {d0-d3}, [%0]!\n\t"
+               " subs %2, %2, #32\n\t"
+               " bne 1b\n\t"
+               : "+r"(a), "+r"(b), "+r"(len)
+               :
+               : "d0", "d1", "d2", "d3", "d16", "d17", "cc", "memory");
+}
+
+static void stream_add_neon(u32_t* a, const u32_t* b, const u32_t* c, u32_t len) {
+  asm volatile("1:\n\t"
+               " vld1.32 {d0-d3}, [%1]!\n\t"
+               " vld1.32 {d4-d7}, [%2]!\n\t"
+               " vadd.i32 q0, q0, q2\n\t"
+               " vadd.i32 q1, q1, q3\n\t"
+               " vst1.32 {d0-d3}, [%0]!\n\t"
+               " subs %3, %3, #32\n\t"
+               " bne 1b\n\t"
+               : "+r"(a), "+r"(b), "+r"(c), "+r"(len)
+               :
+               : "d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7", "cc", "memory");
+}
+
+static void stream_triad_neon(u32_t* a, const u32_t* b, const u32_t* c, u32_t len) {
+  asm volatile(" vmov.i32 q8, #3\n\t"
+               "1:\n\t"
+               " vld1.32 {d0-d3}, [%1]!\n\t"
+               " vld1.32 {d4-d7}, [%2]!\n\t"
+               " vmla.i32 q0, q2, q8\n\t"
+               " vmla.i32 q1, q3, q8\n\t"
+               " vst1.32 {d0-d3}, [%0]!\n\t"
+               " subs %3, %3, #32\n\t"
+               " bne 1b\n\t"
+               : "+r"(a), "+r"(b), "+r"(c), "+r"(len)
+               :
+               : "d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7", "d16", "d17", "cc", "memory");
+}
+
+/* follow the chain loads times, each load waits for the one before */
+static u32_t* chase(u32_t* p, u32_t loads) {
+  asm volatile("1:\n\t"
+               " ldr %0, [%0]\n\t"
+               " subs %1, %1, #1\n\t"
+               " bne 1b\n\t"
+               : "+r"(p), "+r"(loads)
+               :
+               : "cc", "memory");
+  return p;
+}
+
+/* count independent loads stride bytes apart */
+static void stride_read(const u32_t* p, u32_t count, u32_t stride) {
+  asm volatile("1:\n\t"
+               " ldr r3, [%0], %2\n\t"
+               " subs %1, %1, #1\n\t"
+               " bne 1b\n\t"
+               : "+r"(p), "+r"(count)
+               : "r"(stride)
+               : "r3", "cc", "memory");
+}
+
+#endif /* HOST_SIM */
+
+static const struct stream_kernel stream_kernels[] = {
+    {"  copy   ", 2, stream_copy, stream_copy_neon},
+    {"  scale  ", 2, stream_scale, stream_scale_neon},
+    {"  add    ", 3, stream_add, stream_add_neon},
+    {"  triad  ", 3, stream_triad, stream_triad_neon},
+};
+#define STREAM_NUM_KERNELS (sizeof(stream_kernels) / sizeof(stream_kernels[0]))
+
+/* MB/s from bytes and elapsed core cycles */
+static u32_t membench_mbps(u32_t bytes, u32_t cycles) {
+  if (cycles == 0) {
+    return 0;
+  }
+  return (u32_t)((u64_t)bytes * CPU_CYCLES_PER_US / cycles);
+}
+
+/* tenths of a nanosecond per access */
+static u32_t membench_ns10(u32_t cycles, u32_t count) {
+  return (u32_t)((u64_t)cycles * 10000 / CPU_CYCLES_PER_US / count);
+}
+
+/* what the numbers below depend on */
+static void membench_config(void) {
+  LOG2("EMIF SDRAM_CONFIG 0x%08x, REF_CTRL 0x%08x\r\n", REG(EMIF0_SDRAM_CONFIG),
+       REG(EMIF0_SDRAM_REF_CTRL));
+  LOG3("  TIM_1 0x%08x, TIM_2 0x%08x, TIM_3 0x%08x\r\n", REG(EMIF0_SDRAM_TIM_1),
+       REG(EMIF0_SDRAM_TIM_2), REG(EMIF0_SDRAM_TIM_3));
+}
+
+/* best of MEMBENCH_REPS runs of fn, in cycles */
+static u32_t stream_time(void (*fn)(u32_t*, const u32_t*, const u32_t*, u32_t), u32_t* a,
+                         const u32_t* b, const u32_t* c, u32_t bytes) {
+  u32_t i, start, t, best = 0xFFFFFFFF;
+
+  for (i = 0; i < MEMBENCH_REPS; i++) {
+    start = cpu_cycles();
+    fn(a, b, c, bytes);
+    t = cpu_cycles() - start;
+    if (t < best) {
+      best = t;
+    }
+  }
+  return best;
+}
+
+int membench_stream(u32_t bytes) {
+  const struct stream_kernel* k;
+  u32_t *a, *b, *c;
+  u32_t i, scalar, neon;
+
+  bytes &= ~0x3F;
+  if (bytes == 0 || bytes > SCRATCH_SIZE / 3) {
+    return 1;
+  }
+  a = (u32_t*)SCRATCH_BASE;
+  b = a + bytes / 4;
+  c = b + bytes / 4;
+  for (i = 0; i < bytes / 4; i++) {
+    a[i] = 0;
+    b[i] = i;
+    c[i] = 2 * i;
+  }
+
+  membench_config();
+  LOG2("STREAM, 3 arrays of %u bytes, best of %u\r\n", bytes, MEMBENCH_REPS);
+  LOG0("  kernel  ldm/stm MB/s  NEON MB/s\r\n");
+  for (i = 0; i < STREAM_NUM_KERNELS; i++) {
+    k = &stream_kernels[i];
+    scalar = stream_time(k->scalar, a, b, c, bytes);
+    neon = stream_time(k->neon, a, b, c, bytes);
+    log_str(k->name);
+    LOG2(" %12u %10u\r\n", membench_mbps(k->arrays * bytes, scalar),
+         membench_mbps(k->arrays * bytes, neon));
+  }
+  return 0;
+}
+
+static u32_t membench_seed = 0x12345678;
+
+/* xorshift32 */
+static u32_t membench_rand(void) {
+  membench_seed ^= membench_seed << 13;
+  membench_seed ^= membench_seed >> 17;
+  membench_seed ^= membench_seed << 5;
+  return membench_seed;
+}
+
+/* link the cache lines of bytes at base into one random cycle, the first
+   word of each line pointing at the next line. Sattolo's shuffle of the line
+   numbers in place, then numbers to addresses */
+static void chase_build(u32_t* base, u32_t bytes) {
+  u32_t n, i, j, t;
+  u32_t step = CACHE_LINE_SIZE / 4;
+
+  n = bytes / CACHE_LINE_SIZE;
+  for (i = 0; i < n; i++) {
+    base[i * step] = i;
+  }
+  for (i = n - 1; i > 0; i--) {
+    j = membench_rand() % i;
+    t = base[i * step];
+    base[i * step] = base[j * step];
+    base[j * step] = t;
+  }
+  for (i = 0; i < n; i++) {
+    base[i * step] = (u32_t)(base + base[i * step] * step);
+  }
+}
+
+int membench_latency(u32_t max_bytes) {
+  u32_t* base = (u32_t*)SCRATCH_BASE;
+  u32_t* p;
+  u32_t bytes, start, t, ns10;
+
+  if (max_bytes < MEMBENCH_CHASE_MIN || max_bytes > SCRATCH_SIZE) {
+    return 1;
+  }
+  membench_config();
+  LOG1("load to use latency, %u dependent loads per working set\r\n", MEMBENCH_CHASE_LOADS);
+  LOG0("  working set KB   ns/load\r\n");
+  for (bytes = MEMBENCH_CHASE_MIN; bytes <= max_bytes; bytes *= 2) {
+    chase_build(base, bytes);
+    /* once around to start from whatever of it fits the caches */
+    p = chase(base, bytes / CACHE_LINE_SIZE);
+    start = cpu_cycles();
+    chase(p, MEMBENCH_CHASE_LOADS);
+    t = cpu_cycles() - start;
+    ns10 = membench_ns10(t, MEMBENCH_CHASE_LOADS);
+    LOG3("  %14u %7u.%u\r\n", bytes / 1024, ns10 / 10, ns10 % 10);
+  }
+  return 0;
+}
+
+int membench_stride(u32_t bytes) {
+  u32_t stride, count, start, t, ns10, line;
+
+  bytes &= ~(MEMBENCH_STRIDE_MAX - 1);
+  if (bytes == 0 || bytes > SCRATCH_SIZE) {
+    return 1;
+  }
+  membench_config();
+  LOG1("one load per stride over %u bytes\r\n", bytes);
+  LOG0("  stride   ns/load  line MB/s\r\n");
+  for (stride = 4; stride <= MEMBENCH_STRIDE_MAX; stride *= 2) {
+    /* start from DDR every time */
+    dcache_invalidate_range(SCRATCH_BASE, bytes);
+    count = bytes / stride;
+    start = cpu_cycles();
+    stride_read((const u32_t*)SCRATCH_BASE, count, stride);
+    t = cpu_cycles() - start;
+    ns10 = membench_ns10(t, count);
+    /* what came over from DDR, a whole line per load once stride >= a line */
+    line = stride < CACHE_LINE_SIZE ? stride : CACHE_LINE_SIZE;
+    LOG3("  %6u %7u.%u", stride, ns10 / 10, ns10 % 10);
+    LOG1(" %10u\r\n", membench_mbps(count * line, t));
+  }
+  return 0;
+}
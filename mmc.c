@@ -5,25 +5,61 @@
    Recommended control flow for identifying SD card type is mostly skipped.
 */
 
+#include <blk.h>
 #include <common.h>
 #include <control.h>
+#include <interrupt.h>
 #include <mmc.h>
+#include <log.h>
 #include <prcm.h>
+#include <reg.h>
+#include <sched.h>
+#include <timer.h>
+#include <trace.h>
 #include <uart.h>
 
 u32_t rca;
+/* what mmc_set_bus last set up */
+static u32_t mmc_width = 1;
+static u32_t mmc_clkd = MMC_CLKD_INIT;
+
+/* MMC0 only interrupts to wake up mmc_wait_stat. the ISR turns the signal
+   off again and leaves SD_STAT to the code waiting on it */
+void mmc_isr(void) {
+  REG(MMC0_SD_ISE) = 0;
+}
+
+static int mmc_stat_any(u32_t mask) {
+  return (REG(MMC0_SD_STAT) & mask) != 0;
+}
+
+/* sleep until one of the SD_STAT events in mask or an error is flagged,
+   returns 1 on timeout. the status bits stay set for the caller to check */
+static int mmc_wait_stat(u32_t mask, u32_t timeout_us) {
+  int ret;
+
+  REG(MMC0_SD_ISE) = mask | MMC_STAT_ERRORS;
+  ret = timer_wait(mmc_stat_any, mask | MMC_STAT_ERRI, timeout_us);
+  REG(MMC0_SD_ISE) = 0;
+  return ret;
+}
 
 /* returns 0 on success */
 int mmc_send_command(u32_t command, u32_t response_type, u32_t flags, u32_t arg) {
+  trace_event(TRACE_MMC_CMD, command, arg);
   REG(MMC0_SD_ARG) = arg;
   REG(MMC0_SD_CMD) = (command << 24) | (response_type << 16) | flags;
   /* wait for command complete or an error to be raised */
-  while (!(REG(MMC0_SD_STAT))) {}
+  if (mmc_wait_stat(MMC_STAT_CC, MMC_CMD_TIMEOUT_US)) {
+    trace_event(TRACE_MMC_CMD_ERR, REG(MMC0_SD_STAT), 0);
+    LOG1("timeout on MMC command %u\r\n", command);
+    REG(MMC0_SD_STAT) = 0xFFFFFFFF;
+    return 1;
+  }
   /* check if an error was raised */
   if (REG(MMC0_SD_STAT) & (0x1 << 15)) {
-    uart_puts("error on MMC command. SD_STAT: ");
-    uart_hexdump(REG(MMC0_SD_STAT));
-    uart_puts("\r\n");
+    trace_event(TRACE_MMC_CMD_ERR, REG(MMC0_SD_STAT), 0);
+    LOG1("error on MMC command. SD_STAT: 0x%08x\r\n", REG(MMC0_SD_STAT));
     /* clear all status */
     REG(MMC0_SD_STAT) = 0xFFFFFFFF;
     return 1;
@@ -31,7 +67,11 @@ int mmc_send_command(u32_t command, u32_t response_type, u32_t flags, u32_t arg)
 
   /* if its a busy type command, have to wait for transfer complete bit as well */
   if (response_type == MMC_RSP_48_BUSY) {
-    while (!(REG(MMC0_SD_STAT) & 0x2)) {}
+    if (mmc_wait_stat(MMC_STAT_TC, MMC_BUSY_TIMEOUT_MS * 1000)) {
+      LOG1("card still busy after MMC command %u\r\n", command);
+      REG(MMC0_SD_STAT) = 0xFFFFFFFF;
+      return 1;
+    }
     /* clear TC status */
     REG(MMC0_SD_STAT) = 0x2;
   }
@@ -43,8 +83,9 @@ int mmc_send_command(u32_t command, u32_t response_type, u32_t flags, u32_t arg)
 
 /* blocking read data into buffer returns 0 on success */
 int mmc_read_block(u32_t* buf, u32_t block) {
-  u32_t i, timeout;
+  u32_t i;
 
+  trace_event(TRACE_MMC_READ, block, 0);
   /* set block size to 512 */
   REG(MMC0_SD_IE) |= (0x1 << 5);
   /* set block size to 512 */
@@ -55,23 +96,17 @@ int mmc_read_block(u32_t* buf, u32_t block) {
     return 1;
   }
 
-  timeout = 0;
-  /* poll waiting for buffer read ready event or error */
-  while (!(REG(MMC0_SD_STAT) & ((0x1 << 5) | (0x1 << 15)))) {
-    timeout++;
-    if (timeout > 100000) {
-      uart_puts("\r\ntimeout on MMC block read. SD_STAT: ");
-      uart_hexdump(REG(MMC0_SD_STAT));
-      uart_puts("\r\n");
-      REG(MMC0_SD_STAT) = 0xFFFFFFFF;
-      return 1;
-    }
+  /* wait for buffer read ready event or error */
+  if (mmc_wait_stat(MMC_STAT_BRR, MMC_READ_TIMEOUT_US)) {
+    trace_event(TRACE_MMC_READ_ERR, block, REG(MMC0_SD_STAT));
+    LOG1("\r\ntimeout on MMC block read. SD_STAT: 0x%08x\r\n", REG(MMC0_SD_STAT));
+    REG(MMC0_SD_STAT) = 0xFFFFFFFF;
+    return 1;
   }
 
   if (REG(MMC0_SD_STAT) & (0x1 << 15)) {
-    uart_puts("\r\nerror on MMC block read. SD_STAT: ");
-    uart_hexdump(REG(MMC0_SD_STAT));
-    uart_puts("\r\n");
+    trace_event(TRACE_MMC_READ_ERR, block, REG(MMC0_SD_STAT));
+    LOG1("\r\nerror on MMC block read. SD_STAT: 0x%08x\r\n", REG(MMC0_SD_STAT));
     REG(MMC0_SD_STAT) = 0xFFFFFFFF;
     return 1;
   }
@@ -81,27 +116,224 @@ int mmc_read_block(u32_t* buf, u32_t block) {
   }
 
   /* wait for TC or error */
-  while (!(REG(MMC0_SD_STAT) & ((0x1 << 15) | (0x1 << 1)))) {
-  }
-  if (REG(MMC0_SD_STAT) & (0x1 << 15)) {
-    /* error */
-    uart_puts("error on MMC data transfer. SD_STAT: ");
-    uart_hexdump(REG(MMC0_SD_STAT));
-    uart_puts("\r\n");
+  if (mmc_wait_stat(MMC_STAT_TC, MMC_READ_TIMEOUT_US) || (REG(MMC0_SD_STAT) & (0x1 << 15))) {
+    trace_event(TRACE_MMC_READ_ERR, block, REG(MMC0_SD_STAT));
+    LOG1("error on MMC data transfer. SD_STAT: 0x%08x\r\n", REG(MMC0_SD_STAT));
     /* clear all status */
     REG(MMC0_SD_STAT) = 0xFFFFFFFF;
+    return 1;
   }
 
   /* clear buffer read ready event */
   REG(MMC0_SD_STAT) = (0x1 << 5) | (0x1 << 1);
+  trace_event(TRACE_MMC_READ_DONE, block, 0);
+  return 0;
+}
+
+/* blocking read of count consecutive blocks with CMD18, the card streams
+   them without a command per block and the controller sends CMD12 after the
+   last one (auto CMD12). returns 0 on success */
+int mmc_read_blocks(u32_t* buf, u32_t block, u32_t count) {
+  u32_t i, j, n;
+
+  while (count != 0) {
+    n = count > MMC_MAX_BLOCKS ? MMC_MAX_BLOCKS : count;
+    trace_event(TRACE_MMC_READ_MULTI, block, n);
+    REG(MMC0_SD_IE) |= (0x1 << 5);
+    /* block count and size 512 */
+    REG(MMC0_SD_BLK) = (n << 16) | 0x200;
+
+    /* data present, multi block, read, auto CMD12, block count enable */
+    if (mmc_send_command(MMC_CMD18_READ_MULTIPLE_BLOCK, MMC_RSP_48,
+                         (0x1 << 21) | (0x1 << 5) | (0x1 << 4) | (0x1 << 2) | (0x1 << 1),
+                         block)) {
+      return 1;
+    }
+
+    for (i = 0; i < n; i++) {
+      /* wait for buffer read ready event or error */
+      if (mmc_wait_stat(MMC_STAT_BRR, MMC_READ_TIMEOUT_US) || !(REG(MMC0_SD_STAT) & (0x1 << 5)) ||
+          (REG(MMC0_SD_STAT) & (0x1 << 15))) {
+        trace_event(TRACE_MMC_READ_ERR, block + i, REG(MMC0_SD_STAT));
+        LOG2("\r\nerror on MMC read at block %u. SD_STAT: 0x%08x\r\n", block + i,
+             REG(MMC0_SD_STAT));
+        REG(MMC0_SD_STAT) = 0xFFFFFFFF;
+        /* auto CMD12 only comes after the last block, stop the card here */
+        mmc_send_command(MMC_CMD12_STOP_TRANSMISSION, MMC_RSP_48_BUSY, 0, 0);
+        return 1;
+      }
+      /* clear buffer read ready before draining it, the next block can come
+         in behind this one */
+      REG(MMC0_SD_STAT) = (0x1 << 5);
+      for (j = 0; j < 128; j++) {
+        buf[j] = REG(MMC0_SD_DATA);
+      }
+      buf += 128;
+    }
+
+    /* wait for TC or error, after the auto CMD12 */
+    if (mmc_wait_stat(MMC_STAT_TC, MMC_READ_TIMEOUT_US) || (REG(MMC0_SD_STAT) & (0x1 << 15))) {
+      LOG1("error on MMC data transfer. SD_STAT: 0x%08x\r\n", REG(MMC0_SD_STAT));
+      REG(MMC0_SD_STAT) = 0xFFFFFFFF;
+      return 1;
+    }
+    REG(MMC0_SD_STAT) = (0x1 << 1);
+    trace_event(TRACE_MMC_READ_DONE, block, 0);
+    block += n;
+    count -= n;
+  }
+  return 0;
+}
+
+/* wait for the card to finish programming, CMD13 until it's back in the
+   transfer state and ready for data. returns 0 on success */
+static int mmc_wait_ready(void) {
+  u32_t start, status;
+
+  start = timer_now();
+  while (1) {
+    if (mmc_send_command(MMC_CMD13_SEND_STATUS, MMC_RSP_48, 0, (rca << 16))) {
+      return 1;
+    }
+    status = REG(MMC0_SD_RSP10);
+    if (status & MMC_R1_ERRORS) {
+      LOG1("card error after write. status: 0x%08x\r\n", status);
+      return 1;
+    }
+    if ((status & MMC_R1_READY_FOR_DATA) && MMC_R1_STATE(status) == MMC_R1_STATE_TRAN) {
+      return 0;
+    }
+    if (timer_now() - start > MMC_BUSY_TIMEOUT_MS * 1000 * TIMER_TICKS_PER_US) {
+      LOG1("card still busy after write. status: 0x%08x\r\n", status);
+      return 1;
+    }
+  }
+}
+
+/* blocking write of count consecutive blocks, CMD24 for a single block and
+   CMD25 with auto CMD12 for more. multi-block writes are announced with
+   ACMD23 first so the card can pre-erase the whole range instead of erasing
+   as the blocks come in. waits until the card has programmed the data.
+   returns 0 on success */
+int mmc_write_blocks(const u32_t* buf, u32_t block, u32_t count) {
+  u32_t i, j, n, command, flags;
+
+  while (count != 0) {
+    n = count > MMC_MAX_BLOCKS ? MMC_MAX_BLOCKS : count;
+    trace_event(TRACE_MMC_WRITE, block, n);
+    if (n > 1) {
+      if (mmc_send_command(MMC_CMD55_APP_CMD, MMC_RSP_48, 0, (rca << 16)) ||
+          mmc_send_command(MMC_ACMD23_SET_WR_BLK_ERASE_COUNT, MMC_RSP_48, 0, n)) {
+        return 1;
+      }
+      command = MMC_CMD25_WRITE_MULTIPLE_BLOCK;
+      /* data present, multi block, write, auto CMD12, block count enable */
+      flags = (0x1 << 21) | (0x1 << 5) | (0x1 << 2) | (0x1 << 1);
+    } else {
+      command = MMC_CMD24_WRITE_SINGLE_BLOCK;
+      flags = (0x1 << 21);
+    }
+    REG(MMC0_SD_IE) |= (0x1 << 4);
+    /* block count and size 512 */
+    REG(MMC0_SD_BLK) = (n << 16) | 0x200;
+    if (mmc_send_command(command, MMC_RSP_48, flags, block)) {
+      return 1;
+    }
+
+    for (i = 0; i < n; i++) {
+      /* wait for buffer write ready event or error */
+      if (mmc_wait_stat(MMC_STAT_BWR, MMC_WRITE_TIMEOUT_US) || !(REG(MMC0_SD_STAT) & (0x1 << 4)) ||
+          (REG(MMC0_SD_STAT) & (0x1 << 15))) {
+        trace_event(TRACE_MMC_WRITE_ERR, block + i, REG(MMC0_SD_STAT));
+        LOG2("\r\nerror on MMC write at block %u. SD_STAT: 0x%08x\r\n", block + i,
+             REG(MMC0_SD_STAT));
+        REG(MMC0_SD_STAT) = 0xFFFFFFFF;
+        if (n > 1) {
+          mmc_send_command(MMC_CMD12_STOP_TRANSMISSION, MMC_RSP_48_BUSY, 0, 0);
+        }
+        return 1;
+      }
+      /* clear buffer write ready before filling it, the event for the next
+         block comes once this one has gone out */
+      REG(MMC0_SD_STAT) = (0x1 << 4);
+      for (j = 0; j < 128; j++) {
+        REG(MMC0_SD_DATA) = buf[j];
+      }
+      buf += 128;
+    }
+
+    /* wait for TC or error, the card holds DAT0 low while it programs */
+    if (mmc_wait_stat(MMC_STAT_TC, MMC_BUSY_TIMEOUT_MS * 1000) ||
+        (REG(MMC0_SD_STAT) & (0x1 << 15))) {
+      trace_event(TRACE_MMC_WRITE_ERR, block, REG(MMC0_SD_STAT));
+      LOG1("error on MMC data transfer. SD_STAT: 0x%08x\r\n", REG(MMC0_SD_STAT));
+      REG(MMC0_SD_STAT) = 0xFFFFFFFF;
+      return 1;
+    }
+    REG(MMC0_SD_STAT) = (0x1 << 1);
+    if (mmc_wait_ready()) {
+      trace_event(TRACE_MMC_WRITE_ERR, block, 0);
+      return 1;
+    }
+    trace_event(TRACE_MMC_WRITE_DONE, block, 0);
+    block += n;
+    count -= n;
+  }
   return 0;
 }
 
+/* block layer backend. CMD17 for a single block saves the stop command */
+static int mmc_blk_read(struct blk_dev* dev, u32_t lba, u32_t count, u32_t* buf) {
+  (void)dev;
+  return count == 1 ? mmc_read_block(buf, lba) : mmc_read_blocks(buf, lba, count);
+}
+
+static int mmc_blk_write(struct blk_dev* dev, u32_t lba, u32_t count, const u32_t* buf) {
+  (void)dev;
+  return mmc_write_blocks(buf, lba, count);
+}
+
+static const struct blk_ops mmc_blk_ops = {mmc_blk_read, mmc_blk_write, NULL};
+
+/* blocks is filled in from the CSD by mmc_init */
+static struct blk_dev mmc_blk = {"mmc0", &mmc_blk_ops, 0, MMC_MAX_BLOCKS, NULL, NULL,
+                                 0, 0, 0, 0, 0};
+
+/* bits hi..lo of the CSD from the last CMD9. the controller leaves out the
+   CRC byte of an R2 response, so CSD bit n sits at bit n - 8 of RSP10..RSP76 */
+static u32_t mmc_csd_bits(u32_t hi, u32_t lo) {
+  u32_t val = 0;
+  u32_t bit;
+
+  for (bit = hi + 1; bit-- > lo;) {
+    val = (val << 1) | ((REG(MMC0_SD_RSP10 + 4 * ((bit - 8) / 32)) >> ((bit - 8) % 32)) & 1);
+  }
+  return val;
+}
+
+/* card capacity in 512 byte blocks from the CSD [1] 5.3 */
+static u32_t mmc_csd_blocks(void) {
+  u32_t c_size, mult, read_bl_len;
+
+  if (mmc_csd_bits(127, 126) == 1) {
+    /* CSD version 2.0, SDHC and SDXC, C_SIZE counts 512KB units */
+    c_size = mmc_csd_bits(69, 48);
+    return (c_size + 1) * 1024;
+  }
+  /* version 1.0, (C_SIZE + 1) * 2^(C_SIZE_MULT + 2) blocks of READ_BL_LEN */
+  c_size = mmc_csd_bits(73, 62);
+  mult = mmc_csd_bits(49, 47);
+  read_bl_len = mmc_csd_bits(83, 80);
+  return (c_size + 1) << (mult + 2 + read_bl_len - 9);
+}
+
 /* returns 0 on success */
 /* initialize MMC0 module for SD card */
 int mmc_init(void) {
+  struct reg_batch batch;
+
   /* enable functional clock for mmc0 */
-  REG(CM_PER_MMC0_CLKCTRL) |= 0x2;
+  REG_SET(CM_PER_MMC0_CLKCTRL, CM_MODULEMODE, CM_MODULEMODE_ENABLE);
 
   /* pinmuxing, uses data pins 0-3 */
   /* mmode 0, puden pullup/down enabled, typesel pullup selected, receiver enabled*/
@@ -115,48 +347,53 @@ int mmc_init(void) {
   /* software reset of controller */
   REG(MMC0_SD_SYSCONFIG) |= (0x2);           /* trigger reset of MMC0 */
   while (!(REG(MMC0_SD_SYSSTATUS) & 0x1)) {} /* wait until MMC0 is reset.*/
-  uart_puts("MMC0 clock and pinmuxing...");
+  /* the interrupt is only signalled while mmc_wait_stat sleeps */
+  REG(MMC0_SD_ISE) = 0;
+  irq_register(IRQ_MMCSD0, mmc_isr);
+  irq_set_priority(IRQ_MMCSD0, IRQ_PRIO_DEFAULT);
+  irq_unmask(IRQ_MMCSD0);
+  LOG0("MMC0 clock and pinmuxing...");
 
   /* set 3.3V as supported voltage */
   REG(MMC0_SD_CAPA) |= (7 << 24);
 
   REG(MMC0_SD_SYSCONFIG) |= (0x1) | (0x1 << 2) | (0x2 << 3) | (0x2 << 12);
-  /* intterupt wakeup enable */
-  REG(MMC0_SD_HCTL) |= (1 << 24);
 
   /* Write SD_CON register DW8 to configure specific data and
     command transfer */
   /* DW8 1-bit transfer mode for initialization required */
-  REG(MMC0_SD_CON) &= ~(0x1 << 5);
-
-  /*Write SD_HCTL register (SDVS, SDBP, DTW) to configure the card voltage
-    value and power mode and data bus width*/
-  /* SDBP SD bus power off */
-  REG(MMC0_SD_HCTL) &= ~(0x1 << 8);
-  /* SDVS SD bus voltage select 3.3V */
-  REG(MMC0_SD_HCTL) |= (0x6 << 9);
-  /* DTW data transfer width, 1 bit */
-  REG(MMC0_SD_HCTL) &= ~(0x1 << 1);
+  REG_SET(MMC0_SD_CON, MMC_CON_DW8, 0);
+
+  /* SD_HCTL in one write: interrupt wakeup enable, SD bus power off, bus
+    voltage select and 1 bit data transfer width. power only goes on once
+    the voltage is set, so SDBP gets its own write after that */
+  reg_batch_init(&batch);
+  REG_STAGE(&batch, MMC0_SD_HCTL, MMC_HCTL_IWE, 1);
+  REG_STAGE(&batch, MMC0_SD_HCTL, MMC_HCTL_SDBP, 0);
+  REG_STAGE(&batch, MMC0_SD_HCTL, MMC_HCTL_SDVS, MMC_HCTL_SDVS_3V0);
+  REG_STAGE(&batch, MMC0_SD_HCTL, MMC_HCTL_DTW, 0);
+  reg_batch_commit(&batch);
+  mmc_width = 1;
+  mmc_clkd = MMC_CLKD_INIT;
 
   /* SDBP SD bus power on */
-  REG(MMC0_SD_HCTL) |= (0x1 << 8);
-  while (!(REG(MMC0_SD_HCTL) & (0x1 << 8))) {
+  REG_SET(MMC0_SD_HCTL, MMC_HCTL_SDBP, 1);
+  while (!REG_GET(MMC_HCTL_SDBP, REG(MMC0_SD_HCTL))) {
     uart_putc('.');
   }
 
-  /* Enable internal clock */
-  REG(MMC0_SD_SYSCTL) |= 0x1;
-  /* Set the initialization frequency CLKD. 96MHz functional clock input */
-  /* intialization clock speed is as slow as possible, 96MHz/1024 = ~93Khz */
-  REG(MMC0_SD_SYSCTL) &= ~(0x3FF << 6);
-  REG(MMC0_SD_SYSCTL) |= (0x240 << 6);
-  /* external clock enable */
-  REG(MMC0_SD_SYSCTL) |= (0x1 << 2);
+  /* Enable internal clock and set the initialization frequency CLKD
+     together. 96MHz functional clock input */
+  REG_STAGE(&batch, MMC0_SD_SYSCTL, MMC_SYSCTL_ICE, 1);
+  REG_STAGE(&batch, MMC0_SD_SYSCTL, MMC_SYSCTL_CLKD, MMC_CLKD_INIT);
+  reg_batch_commit(&batch);
   /* wait for internal clock to be stable */
-  while (!(REG(MMC0_SD_SYSCTL) & 0x2)) {
+  while (!REG_GET(MMC_SYSCTL_ICS, REG(MMC0_SD_SYSCTL))) {
     uart_putc('.');
   }
-  uart_puts("MMC0 host control setup...");
+  /* external clock enable */
+  REG_SET(MMC0_SD_SYSCTL, MMC_SYSCTL_CEN, 1);
+  LOG0("MMC0 host control setup...");
 
   /* enable all the interrupt event flags */
   REG(MMC0_SD_IE) |= 0xFFFFFFFF;
@@ -166,8 +403,9 @@ int mmc_init(void) {
   REG(MMC0_SD_CON) |= 0x2;
   REG(MMC0_SD_CMD) = 0x0;
   /* wait for command complete flag to be set */
-  while (!(REG(MMC0_SD_STAT) & 0x1)) {
-    uart_putc('.');
+  if (mmc_wait_stat(MMC_STAT_CC, MMC_CMD_TIMEOUT_US)) {
+    LOG0("!!! MMC0 initialization stream timed out\r\n");
+    return 1;
   }
   /* clear SD stat */
   REG(MMC0_SD_STAT) = 0xFFFFFFFF;
@@ -176,10 +414,10 @@ int mmc_init(void) {
 
   /* Check CINS to test if card inserted */
   if (!(REG(MMC0_SD_PSTATE) & (0x1 << 16))) {
-    uart_puts("!!! no card detected on MMC0\r\n");
+    LOG0("!!! no card detected on MMC0\r\n");
     return 1;
   }
-  uart_puts("card detected on MMC0\r\n");
+  LOG0("card detected on MMC0\r\n");
 
   /* reset back to idle state */
   mmc_send_command(0x00, 0x00, 0x00, 0x00);
@@ -195,14 +433,12 @@ int mmc_init(void) {
   /* response should have same check pattern echoed and voltage accpeted high */
   if (REG(MMC0_SD_RSP10) != ((0x1 << 8) | (0x55))) {
     /* echo out response for debugging purposes */
-    uart_puts("\r\nRSP10: ");
-    uart_hexdump(REG(MMC0_SD_RSP10));
-    uart_puts("\r\n");
-    uart_puts("card on MMC0 is NOT SD spec v2.0 compliant");
+    LOG1("\r\nRSP10: 0x%08x\r\n", REG(MMC0_SD_RSP10));
+    LOG0("card on MMC0 is NOT SD spec v2.0 compliant");
     return 1;
   }
 
-  uart_puts("card on MMC0 is SD spec v2.0 compliant\r\n");
+  LOG0("card on MMC0 is SD spec v2.0 compliant\r\n");
 
   /* poll OCR register on card [2] 5.1 waiting for powerup routine to finish */
   while (1) {
@@ -221,9 +457,11 @@ int mmc_init(void) {
     if (REG(MMC0_SD_RSP10) & (0x1 << 31)) {
       break;
     }
-    uart_puts(".");
+    uart_putc('.');
+    /* powerup takes up to a second, let other threads run meanwhile */
+    sched_sleep(1);
   }
-  uart_puts("SD card powerup completed\r\n");
+  LOG0("SD card powerup completed\r\n");
 
   /* to get relative card address for all cards, alternate CMD2 and CMD3 for
     each card in the system, we only have 1 card so just do it once */
@@ -237,22 +475,60 @@ int mmc_init(void) {
   }
   /* RCA is bits [31:16] of response */
   rca = REG(MMC0_SD_RSP10) >> 16;
-  uart_puts("relative card address: ");
-  uart_hexdump(rca);
-  uart_puts("\r\n");
+  LOG1("relative card address: 0x%08x\r\n", rca);
 
   /* card csd */
   if (mmc_send_command(MMC_CMD9_SEND_CSD, MMC_RSP_136, 0, (rca << 16))) {
     return 1;
   }
+  /* lets blk_submit refuse requests past the end of the card */
+  mmc_blk.blocks = mmc_csd_blocks();
+  LOG1("card capacity: %u blocks\r\n", mmc_blk.blocks);
 
   /* card select */
   if (mmc_send_command(MMC_CMD7_SELECT_CARD, MMC_RSP_48_BUSY, 0, (rca << 16))) {
     return 1;
   }
-  uart_puts("Select card completed\r\n");
+  LOG0("Select card completed\r\n");
 
   /* TODO: set clock frequency back to operating rate */
 
+  /* everything past the bring-up gets to the card through the block layer */
+  if (blk_find(mmc_blk.name) == NULL) {
+    blk_register(&mmc_blk);
+  }
   return 0;
 }
+
+/* switch the selected card and the controller to width data lines (1 or 4)
+   and a card clock of MMC_FCLK_HZ / clkd, at most 25MHz. returns 0 on
+   success */
+int mmc_set_bus(u32_t width, u32_t clkd) {
+  if ((width != 1 && width != 4) || clkd < MMC_CLKD_24MHZ || clkd > 0x3FF) {
+    return 1;
+  }
+  if (width != mmc_width) {
+    /* ACMD6 argument 0 is 1 bit, 2 is 4 bit [1] 4.7.4 */
+    if (mmc_send_command(MMC_CMD55_APP_CMD, MMC_RSP_48, 0, (rca << 16)) ||
+        mmc_send_command(MMC_ACMD6_SET_BUS_WIDTH, MMC_RSP_48, 0, width == 4 ? 0x2 : 0x0)) {
+      return 1;
+    }
+    reg_update(MMC0_SD_HCTL, REG_MASK(MMC_HCTL_DTW), REG_PREP(MMC_HCTL_DTW, width == 4));
+    mmc_width = width;
+  }
+  if (clkd != mmc_clkd) {
+    /* CLKD only changes with the card clock off, then wait for the internal
+       clock to be stable again */
+    REG_SET(MMC0_SD_SYSCTL, MMC_SYSCTL_CEN, 0);
+    reg_update(MMC0_SD_SYSCTL, REG_MASK(MMC_SYSCTL_CLKD), REG_PREP(MMC_SYSCTL_CLKD, clkd));
+    while (!REG_GET(MMC_SYSCTL_ICS, REG(MMC0_SD_SYSCTL))) {}
+    REG_SET(MMC0_SD_SYSCTL, MMC_SYSCTL_CEN, 1);
+    mmc_clkd = clkd;
+  }
+  return 0;
+}
+
+void mmc_get_bus(u32_t* width, u32_t* clkd) {
+  *width = mmc_width;
+  *clkd = mmc_clkd;
+}
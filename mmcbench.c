@@ -0,0 +1,129 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* SD card read benchmark, see mmcbench.h */
+#include <common.h>
+#include <log.h>
+#include <memlayout.h>
+#include <mmc.h>
+#include <mmcbench.h>
+#include <timer.h>
+
+struct mmcbench_bus {
+  u32_t width;
+  u32_t clkd;
+};
+
+/* what mmc_set_bus can do with a default speed card */
+static const struct mmcbench_bus mmcbench_buses[] = {
+    {1, MMC_CLKD_12MHZ},
+    {1, MMC_CLKD_24MHZ},
+    {4, MMC_CLKD_12MHZ},
+    {4, MMC_CLKD_24MHZ},
+};
+#define MMCBENCH_NUM_BUSES (sizeof(mmcbench_buses) / sizeof(mmcbench_buses[0]))
+
+/* request sizes in blocks, 1 is CMD17 and the rest CMD18 */
+static const u32_t mmcbench_sizes[] = {1, 8, 64};
+#define MMCBENCH_NUM_SIZES (sizeof(mmcbench_sizes) / sizeof(mmcbench_sizes[0]))
+#define MMCBENCH_MAX_SIZE 64
+
+/* TIMER2 ticks per request of the current test */
+static u32_t mmcbench_lat[MMCBENCH_OPS];
+static u32_t mmcbench_seed = 0x2545F491;
+
+/* xorshift32 */
+static u32_t mmcbench_rand(void) {
+  mmcbench_seed ^= mmcbench_seed << 13;
+  mmcbench_seed ^= mmcbench_seed >> 17;
+  mmcbench_seed ^= mmcbench_seed << 5;
+  return mmcbench_seed;
+}
+
+static void mmcbench_sort(u32_t* v, u32_t n) {
+  u32_t i, j, t;
+
+  for (i = 1; i < n; i++) {
+    t = v[i];
+    for (j = i; j > 0 && v[j - 1] > t; j--) {
+      v[j] = v[j - 1];
+    }
+    v[j] = t;
+  }
+}
+
+/* us of the pct percentile of the sorted latencies */
+static u32_t mmcbench_pct(u32_t pct) {
+  return mmcbench_lat[(MMCBENCH_OPS * pct - 1) / 100] / TIMER_TICKS_PER_US;
+}
+
+/* MMCBENCH_OPS reads of size blocks, one after the other or at random.
+   returns 0 on success */
+static int mmcbench_test(u32_t start, u32_t span, u32_t size, u32_t random) {
+  u32_t* buf = (u32_t*)SCRATCH_BASE;
+  u32_t i, block, t, total = 0, us;
+  int err;
+
+  for (i = 0; i < MMCBENCH_OPS; i++) {
+    if (random) {
+      block = start + mmcbench_rand() % (span / size) * size;
+    } else {
+      block = start + (i * size) % (span - span % size);
+    }
+    t = timer_now();
+    err = size == 1 ? mmc_read_block(buf, block) : mmc_read_blocks(buf, block, size);
+    t = timer_now() - t;
+    if (err) {
+      LOG1("read failed at block %u\r\n", block);
+      return 1;
+    }
+    mmcbench_lat[i] = t;
+    total += t;
+  }
+
+  us = total / TIMER_TICKS_PER_US;
+  if (us == 0) {
+    us = 1;
+  }
+  mmcbench_sort(mmcbench_lat, MMCBENCH_OPS);
+  if (random) {
+    LOG1("  rand %3u", size);
+  } else {
+    LOG1("  seq  %3u", size);
+  }
+  /* bytes / us * 1000000 / 1024 */
+  LOG1(" %7u", (u32_t)((u64_t)MMCBENCH_OPS * size * 500000 / us));
+  LOG3(" %6u %8u %8u", (u32_t)((u64_t)MMCBENCH_OPS * 1000000 / us), mmcbench_pct(50),
+       mmcbench_pct(90));
+  LOG2(" %8u %8u\r\n", mmcbench_pct(99), mmcbench_lat[MMCBENCH_OPS - 1] / TIMER_TICKS_PER_US);
+  return 0;
+}
+
+int mmcbench_run(u32_t start, u32_t span) {
+  u32_t width, clkd, b, s, random;
+  int err = 0;
+
+  if (span < MMCBENCH_MAX_SIZE) {
+    return 1;
+  }
+  mmc_get_bus(&width, &clkd);
+  LOG3("%u requests per test over blocks %u to %u\r\n", MMCBENCH_OPS, start, start + span - 1);
+  for (b = 0; b < MMCBENCH_NUM_BUSES && !err; b++) {
+    if (mmc_set_bus(mmcbench_buses[b].width, mmcbench_buses[b].clkd)) {
+      LOG0("bus setup failed\r\n");
+      err = 1;
+      break;
+    }
+    LOG2("%u bit, %u kHz\r\n", mmcbench_buses[b].width,
+         MMC_FCLK_HZ / 1000 / mmcbench_buses[b].clkd);
+    LOG0("  test blocks   KB/s   IOPS   p50 us   p90 us   p99 us   max us\r\n");
+    for (random = 0; random < 2 && !err; random++) {
+      for (s = 0; s < MMCBENCH_NUM_SIZES && !err; s++) {
+        err = mmcbench_test(start, span, mmcbench_sizes[s], random);
+      }
+    }
+  }
+  if (mmc_set_bus(width, clkd)) {
+    LOG0("can't restore the bus setup\r\n");
+    err = 1;
+  }
+  return err;
+}
@@ -0,0 +1,184 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* MMU and caches, see mmu.h. One level of 1MB sections mapping every address
+   to itself [ARMv7 ARM B3.5]:
+     DDR              normal, write-back write-allocate
+     SRAM and OCMC    normal, write-through. main's stack and the SRAM
+                      arena live there, so memory is always up to date for
+                      DMA and for the cache maintenance below, which runs
+                      with the data cache off. other threads' stacks are in
+                      DDR
+     the rest         device, never executable
+   L2 is left the way the ROM set it up. When it is on, CLIDR lists it and
+   the set/way loop covers it along with L1.
+*/
+#include <common.h>
+#include <cpu.h>
+#include <memlayout.h>
+#include <mmu.h>
+
+#define MMU_SECTION (0x2)
+#define MMU_B       (0x1 << 2)
+#define MMU_C       (0x1 << 3)
+#define MMU_XN      (0x1 << 4)
+#define MMU_AP_RW   (0x3 << 10)
+#define MMU_TEX(x)  ((x) << 12)
+
+/* memory types [ARMv7 ARM table B3-10] */
+#define MMU_DEVICE    (MMU_B | MMU_XN)
+#define MMU_NORMAL_WT (MMU_C)
+#define MMU_NORMAL_WB (MMU_TEX(1) | MMU_C | MMU_B)
+
+/* SCTLR bits [Cortex-A8 TRM 3.2.25] */
+#define SCTLR_M (0x1 << 0)
+#define SCTLR_C (0x1 << 2)
+#define SCTLR_Z (0x1 << 11)
+#define SCTLR_I (0x1 << 12)
+
+/* SRAM at 0x402F0000 and OCMC at 0x40300000 */
+#define ONCHIP_RAM_SECTION0 0x402
+#define ONCHIP_RAM_SECTION1 0x403
+
+static u32_t mmu_table[4096] __attribute__((aligned(16384)));
+
+static u32_t sctlr_read(void) {
+  u32_t v;
+  asm volatile(" mrc p15, 0, %0, c1, c0, 0\n\t" : "=r"(v));
+  return v;
+}
+
+static void sctlr_write(u32_t v) {
+  asm volatile(" mcr p15, 0, %0, c1, c0, 0\n\t"
+               " isb\n\t"
+               :
+               : "r"(v)
+               : "memory");
+}
+
+/* invalidate (clean = 0) or clean and invalidate every data/unified cache
+   line up to the point of coherency, by set/way [ARMv7 ARM B4.2.1] */
+static void dcache_all(u32_t clean) {
+  u32_t clidr, loc, level, ccsidr, line, ways, sets, wshift, way, set, sw;
+
+  asm volatile(" mrc p15, 1, %0, c0, c0, 1\n\t" : "=r"(clidr));
+  loc = (clidr >> 24) & 0x7;
+  for (level = 0; level < loc; level++) {
+    /* skip levels with no cache or only an instruction cache */
+    if (((clidr >> (level * 3)) & 0x7) < 2) {
+      continue;
+    }
+    /* CSSELR selects the level CCSIDR describes */
+    asm volatile(" mcr p15, 2, %0, c0, c0, 0\n\t"
+                 " isb\n\t"
+                 :
+                 : "r"(level << 1)
+                 : "memory");
+    asm volatile(" mrc p15, 1, %0, c0, c0, 0\n\t" : "=r"(ccsidr));
+    line = (ccsidr & 0x7) + 4;
+    ways = (ccsidr >> 3) & 0x3FF;
+    sets = (ccsidr >> 13) & 0x7FFF;
+    wshift = ways ? __builtin_clz(ways) : 0;
+    for (way = 0; way <= ways; way++) {
+      for (set = 0; set <= sets; set++) {
+        sw = (way << wshift) | (set << line) | (level << 1);
+        if (clean) {
+          asm volatile(" mcr p15, 0, %0, c7, c14, 2\n\t" : : "r"(sw) : "memory");
+        } else {
+          asm volatile(" mcr p15, 0, %0, c7, c6, 2\n\t" : : "r"(sw) : "memory");
+        }
+      }
+    }
+  }
+  asm volatile(" dsb\n\t"
+               " isb\n\t"
+               :
+               :
+               : "memory");
+}
+
+/* I-cache, branch predictor and TLB */
+static void mmu_invalidate(void) {
+  asm volatile(" mcr p15, 0, %0, c7, c5, 0\n\t"
+               " mcr p15, 0, %0, c7, c5, 6\n\t"
+               " mcr p15, 0, %0, c8, c7, 0\n\t"
+               " dsb\n\t"
+               " isb\n\t"
+               :
+               : "r"(0)
+               : "memory");
+}
+
+void mmu_init(void) {
+  u32_t i, attr;
+
+  for (i = 0; i < 4096; i++) {
+    if (i >= (DDR_START >> 20) && i < ((DDR_START + DDR_SIZE) >> 20)) {
+      attr = MMU_NORMAL_WB;
+    } else if (i == ONCHIP_RAM_SECTION0 || i == ONCHIP_RAM_SECTION1) {
+      attr = MMU_NORMAL_WT;
+    } else {
+      attr = MMU_DEVICE;
+    }
+    mmu_table[i] = (i << 20) | MMU_AP_RW | attr | MMU_SECTION;
+  }
+
+  dcache_all(0);
+  mmu_invalidate();
+  /* TTBCR: TTBR0 only. DACR: domain 0 client, permissions are checked */
+  asm volatile(" mcr p15, 0, %0, c2, c0, 2\n\t"
+               " mcr p15, 0, %1, c2, c0, 0\n\t"
+               " mcr p15, 0, %2, c3, c0, 0\n\t"
+               " isb\n\t"
+               :
+               : "r"(0), "r"((u32_t)mmu_table), "r"(0x1)
+               : "memory");
+  sctlr_write(sctlr_read() | SCTLR_M | SCTLR_C | SCTLR_Z | SCTLR_I);
+}
+
+/* returns 1 without touching anything unless the stack is on-chip RAM */
+int mmu_disable(void) {
+  u32_t sp;
+
+  /* the cache is turned off before it is cleaned, and from then on the
+     stack is read from memory. main's boot stack is in write-through SRAM
+     so memory is up to date, the other threads' stacks are write-back DDR
+     and would come back stale */
+  asm volatile(" mov %0, sp\n\t" : "=r"(sp));
+  if ((sp >> 20) != ONCHIP_RAM_SECTION0 && (sp >> 20) != ONCHIP_RAM_SECTION1) {
+    return 1;
+  }
+  /* stop allocating first, dirty DDR lines stay in the cache until the
+     clean below */
+  sctlr_write(sctlr_read() & ~SCTLR_C);
+  dcache_all(1);
+  sctlr_write(sctlr_read() & ~(SCTLR_M | SCTLR_I | SCTLR_Z));
+  mmu_invalidate();
+  return 0;
+}
+
+/* write dirty lines covering a range back to memory */
+void dcache_clean_range(u32_t addr, u32_t len) {
+  u32_t end = addr + len;
+
+  for (addr &= ~(CACHE_LINE_SIZE - 1); addr < end; addr += CACHE_LINE_SIZE) {
+    asm volatile(" mcr p15, 0, %0, c7, c10, 1\n\t" : : "r"(addr) : "memory");
+  }
+  cpu_dsb();
+}
+
+/* drop cached lines covering a range, e.g. before reading what DMA wrote.
+   lines wholly inside it are invalidated, dirty data in them is thrown
+   away. a partial line at either end also holds data outside the range, it
+   is cleaned on the way out so that isn't lost */
+void dcache_invalidate_range(u32_t addr, u32_t len) {
+  u32_t end = addr + len;
+  u32_t line;
+
+  for (line = addr & ~(CACHE_LINE_SIZE - 1); line < end; line += CACHE_LINE_SIZE) {
+    if (line < addr || line + CACHE_LINE_SIZE > end) {
+      asm volatile(" mcr p15, 0, %0, c7, c14, 1\n\t" : : "r"(line) : "memory");
+    } else {
+      asm volatile(" mcr p15, 0, %0, c7, c6, 1\n\t" : : "r"(line) : "memory");
+    }
+  }
+  cpu_dsb();
+}
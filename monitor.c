@@ -0,0 +1,563 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Boot monitor: a small command line on UART0 for poking at memory and the SD
+   card and for measuring the board, entered by pressing MONITOR_KEY during the
+   boot window. "help" lists the commands, "boot" continues booting.
+   Numbers are decimal or hex with 0x. RX is polled while the monitor runs.
+*/
+#include <blk.h>
+#include <common.h>
+#include <cpu.h>
+#include <crc32.h>
+#include <gpio.h>
+#include <interrupt.h>
+#include <log.h>
+#include <mem.h>
+#include <membench.h>
+#include <memlayout.h>
+#include <mmc.h>
+#include <mmcbench.h>
+#include <mmu.h>
+#include <monitor.h>
+#include <pru.h>
+#include <timer.h>
+#include <trace.h>
+#include <uart.h>
+
+#define MON_LINE_LEN 64
+#define MON_MAX_ARGS 4
+
+struct mon_cmd {
+  const char* name;
+  int (*fn)(u32_t argc, char** argv);
+  const char* args;
+  const char* help;
+};
+
+static int mon_help(u32_t argc, char** argv);
+
+/* parse a decimal or 0x prefixed hex number, returns 0 on success */
+static int mon_number(const char* s, u32_t* val) {
+  u32_t v = 0, base = 10, d;
+
+  if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+    base = 16;
+    s += 2;
+  }
+  if (*s == '\0') {
+    return 1;
+  }
+  for (; *s != '\0'; s++) {
+    if (*s >= '0' && *s <= '9') {
+      d = *s - '0';
+    } else if (base == 16 && *s >= 'a' && *s <= 'f') {
+      d = *s - 'a' + 10;
+    } else if (base == 16 && *s >= 'A' && *s <= 'F') {
+      d = *s - 'A' + 10;
+    } else {
+      return 1;
+    }
+    v = v * base + d;
+  }
+  *val = v;
+  return 0;
+}
+
+/* argument n as a number, def if it wasn't given. returns 0 on success */
+static int mon_arg(u32_t argc, char** argv, u32_t n, u32_t def, u32_t* val) {
+  if (n >= argc) {
+    *val = def;
+    return 0;
+  }
+  if (mon_number(argv[n], val)) {
+    LOG0("bad number\r\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int mon_streq(const char* a, const char* b) {
+  while (*a != '\0' && *a == *b) {
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
+/* md <addr> [words] */
+static int mon_md(u32_t argc, char** argv) {
+  u32_t addr, count, i;
+
+  if (argc < 2 || mon_arg(argc, argv, 1, 0, &addr) || mon_arg(argc, argv, 2, 16, &count)) {
+    return 1;
+  }
+  addr &= ~0x3;
+  for (i = 0; i < count; i++) {
+    if ((i & 0x3) == 0) {
+      LOG1("%08x:", addr);
+    }
+    LOG1(" %08x", REG(addr));
+    addr += 4;
+    if ((i & 0x3) == 0x3 || i == count - 1) {
+      LOG0("\r\n");
+    }
+  }
+  return 0;
+}
+
+/* mw <addr> <value> */
+static int mon_mw(u32_t argc, char** argv) {
+  u32_t addr, val;
+
+  if (argc != 3 || mon_arg(argc, argv, 1, 0, &addr) || mon_arg(argc, argv, 2, 0, &val)) {
+    return 1;
+  }
+  REG(addr & ~0x3) = val;
+  return 0;
+}
+
+/* mmc <block> [count] [dest] */
+static int mon_mmc(u32_t argc, char** argv) {
+  u32_t block, count, dest, i;
+
+  if (argc < 2 || mon_arg(argc, argv, 1, 0, &block) || mon_arg(argc, argv, 2, 1, &count) ||
+      mon_arg(argc, argv, 3, SCRATCH_BASE, &dest)) {
+    return 1;
+  }
+  for (i = 0; i < count; i++) {
+    if (mmc_read_block((u32_t*)(dest + i * 512), block + i)) {
+      LOG1("read failed at block %u\r\n", block + i);
+      return 0;
+    }
+  }
+  LOG3("read %u blocks from %u to 0x%08x\r\n", count, block, dest);
+  return 0;
+}
+
+/* copy len bytes a word at a time */
+static void mon_copy_word(u32_t* dst, const u32_t* src, u32_t len) {
+  u32_t i;
+
+  for (i = 0; i < len / 4; i++) {
+    dst[i] = src[i];
+  }
+}
+
+/* copy len bytes (multiple of 32) with 8 word bursts */
+static void mon_copy_burst(u32_t* dst, const u32_t* src, u32_t len) {
+#ifdef HOST_SIM
+  mon_copy_word(dst, src, len);
+#else
+  asm volatile("1:\n\t"
+               " ldmia %1!, {r3-r10}\n\t"
+               " stmia %0!, {r3-r10}\n\t"
+               " subs %2, %2, #32\n\t"
+               " bne 1b\n\t"
+               : "+r"(dst), "+r"(src), "+r"(len)
+               :
+               : "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "cc", "memory");
+#endif
+}
+
+/* MB/s from bytes and elapsed core cycles */
+static u32_t mon_mbps(u32_t bytes, u32_t cycles) {
+  if (cycles == 0) {
+    return 0;
+  }
+  return (u32_t)((u64_t)bytes * CPU_CYCLES_PER_US / cycles);
+}
+
+/* bw [bytes] - DDR to DDR copy bandwidth inside the scratch area */
+static int mon_bw(u32_t argc, char** argv) {
+  u32_t len, start, word, burst;
+  u32_t* src;
+  u32_t* dst;
+
+  if (mon_arg(argc, argv, 1, 0x100000, &len)) {
+    return 1;
+  }
+  len &= ~0x1F;
+  if (len == 0 || len > SCRATCH_SIZE / 2) {
+    LOG1("size has to be 32 to %u bytes\r\n", SCRATCH_SIZE / 2);
+    return 0;
+  }
+  src = (u32_t*)SCRATCH_BASE;
+  dst = (u32_t*)(SCRATCH_BASE + SCRATCH_SIZE / 2);
+
+  start = cpu_cycles();
+  mon_copy_word(dst, src, len);
+  word = cpu_cycles() - start;
+
+  start = cpu_cycles();
+  mon_copy_burst(dst, src, len);
+  burst = cpu_cycles() - start;
+
+  LOG1("DDR copy %u bytes\r\n", len);
+  LOG2("  word:   %u cycles, %u MB/s\r\n", word, mon_mbps(len, word));
+  LOG2("  ldm/stm: %u cycles, %u MB/s\r\n", burst, mon_mbps(len, burst));
+  return 0;
+}
+
+/* membench stream [bytes] | membench lat [bytes] | membench stride [bytes] -
+   the DDR benchmarks in membench.h. bytes is per array for stream, the
+   largest working set for lat and the buffer for stride */
+static int mon_membench(u32_t argc, char** argv) {
+  u32_t n;
+
+  if (argc < 2) {
+    return 1;
+  }
+  if (mon_streq(argv[1], "stream")) {
+    if (mon_arg(argc, argv, 2, 0x200000, &n)) {
+      return 1;
+    }
+    if (membench_stream(n)) {
+      LOG1("size has to be 64 to %u bytes\r\n", SCRATCH_SIZE / 3);
+    }
+    return 0;
+  }
+  if (mon_streq(argv[1], "lat")) {
+    if (mon_arg(argc, argv, 2, SCRATCH_SIZE, &n)) {
+      return 1;
+    }
+    if (membench_latency(n)) {
+      LOG2("size has to be %u to %u bytes\r\n", MEMBENCH_CHASE_MIN, SCRATCH_SIZE);
+    }
+    return 0;
+  }
+  if (mon_streq(argv[1], "stride")) {
+    if (mon_arg(argc, argv, 2, 0x400000, &n)) {
+      return 1;
+    }
+    if (membench_stride(n)) {
+      LOG2("size has to be %u to %u bytes\r\n", MEMBENCH_STRIDE_MAX, SCRATCH_SIZE);
+    }
+    return 0;
+  }
+  return 1;
+}
+
+/* mmcbench [start] [span] - SD read throughput, IOPS and latency for each
+   bus setup, see mmcbench.h */
+static int mon_mmcbench(u32_t argc, char** argv) {
+  u32_t start, span;
+
+  if (mon_arg(argc, argv, 1, 0, &start) || mon_arg(argc, argv, 2, 0x4000, &span)) {
+    return 1;
+  }
+  if (mmcbench_run(start, span)) {
+    LOG0("benchmark failed\r\n");
+  }
+  return 0;
+}
+
+static volatile u32_t mon_irq_late;
+static volatile u32_t mon_irq_done;
+
+static void mon_irqlat_alarm(u32_t late) {
+  mon_irq_late = late;
+  mon_irq_done = 1;
+}
+
+/* take count alarms and print the latency statistics, returns 0 on success */
+static int mon_irqlat_run(u32_t count, u32_t fiq) {
+  u32_t i, start, late, min, max;
+  u64_t sum;
+
+  min = 0xFFFFFFFF;
+  max = 0;
+  sum = 0;
+  for (i = 0; i < count; i++) {
+    mon_irq_done = 0;
+    timer_alarm(timer_now() + 100 * TIMER_TICKS_PER_US, mon_irqlat_alarm);
+    start = timer_now();
+    while (!mon_irq_done) {
+      if (timer_now() - start > 10000 * TIMER_TICKS_PER_US) {
+        timer_alarm_cancel();
+        LOG0("timer interrupt never arrived\r\n");
+        return 1;
+      }
+    }
+    late = mon_irq_late;
+    sum += late;
+    if (late < min) {
+      min = late;
+    }
+    if (late > max) {
+      max = late;
+    }
+  }
+  /* one tick is 1000/24 ns */
+  LOG2("%cIQ latency over %u interrupts\r\n", fiq ? 'F' : 'I', count);
+  LOG3("  min %u ns, avg %u ns, max %u ns\r\n", min * 1000 / TIMER_TICKS_PER_US,
+       (u32_t)(sum * 1000 / TIMER_TICKS_PER_US / count), max * 1000 / TIMER_TICKS_PER_US);
+  return 0;
+}
+
+/* irqlat [count] - time from the TIMER2 match event to its ISR running,
+   as a regular IRQ and routed to FIQ */
+static int mon_irqlat(u32_t argc, char** argv) {
+  u32_t count;
+
+  if (mon_arg(argc, argv, 1, 1000, &count)) {
+    return 1;
+  }
+  if (count == 0 || mon_irqlat_run(count, 0)) {
+    return 0;
+  }
+  irq_set_fiq(IRQ_TINT2, 1);
+  mon_irqlat_run(count, 1);
+  irq_set_fiq(IRQ_TINT2, 0);
+  irq_set_priority(IRQ_TINT2, IRQ_PRIO_HIGH);
+  return 0;
+}
+
+/* irqstats [reset] */
+static int mon_irqstats(u32_t argc, char** argv) {
+  if (argc > 1) {
+    if (!mon_streq(argv[1], "reset")) {
+      return 1;
+    }
+    irq_stats_reset();
+    return 0;
+  }
+  irq_stats_print();
+  return 0;
+}
+
+static int mon_mem(u32_t argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  mem_print();
+  return 0;
+}
+
+static int mon_blk(u32_t argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  blk_print();
+  return 0;
+}
+
+static u32_t mon_pru_up = 0;
+
+/* gpio <bank> [pin] [0|1] - a bank's input levels, one pin read as an input
+   or driven as an output. sets the bank up on first use, the pin has to be
+   muxed to GPIO already */
+static int mon_gpio(u32_t argc, char** argv) {
+  u32_t bank, pin, val;
+
+  if (argc < 2 || argc > 4 || mon_arg(argc, argv, 1, 0, &bank) ||
+      mon_arg(argc, argv, 2, 0, &pin) || mon_arg(argc, argv, 3, 0, &val)) {
+    return 1;
+  }
+  if (bank >= GPIO_BANKS || pin > 31 || val > 1) {
+    return 1;
+  }
+  gpio_init(bank);
+  if (argc == 2) {
+    LOG2("GPIO%u: 0x%08x\r\n", bank, gpio_read(bank));
+    return 0;
+  }
+  if (argc == 4) {
+    /* level first so the pin doesn't glitch when it becomes an output */
+    gpio_write(bank, 0x1 << pin, val ? 0xFFFFFFFF : 0);
+    gpio_output(bank, 0x1 << pin);
+  } else {
+    gpio_input(bank, 0x1 << pin);
+  }
+  LOG3("GPIO%u_%u: %u\r\n", bank, pin, (gpio_read(bank) >> pin) & 0x1);
+  return 0;
+}
+
+/* pru crc [bytes] | pru hb [ms] - CRC of the scratch area on PRU0 against the
+   ARM, or blink USR3 from PRU0 with a period of ms (0 stops it) */
+static int mon_pru(u32_t argc, char** argv) {
+  u32_t n, st, res, ref, start, pru, arm;
+
+  if (argc < 2) {
+    return 1;
+  }
+  if (!mon_pru_up) {
+    if (pru_offload_init()) {
+      LOG0("PRU firmware load failed\r\n");
+      return 0;
+    }
+    mon_pru_up = 1;
+  }
+  if (mon_streq(argv[1], "crc")) {
+    if (mon_arg(argc, argv, 2, 0x10000, &n)) {
+      return 1;
+    }
+    if (n > SCRATCH_SIZE) {
+      LOG1("size has to be at most %u bytes\r\n", SCRATCH_SIZE);
+      return 0;
+    }
+    /* the PRU reads DDR behind the data cache */
+    dcache_clean_range(SCRATCH_BASE, n);
+    start = cpu_cycles();
+    st = pru_call(0, PRU_CMD_CRC32, SCRATCH_BASE, n, 0, &res, PRU_CRC32_TIMEOUT_US(n));
+    pru = cpu_cycles() - start;
+    if (st != PRU_MBOX_DONE) {
+      LOG1("PRU0 failed, status %u\r\n", st);
+      return 0;
+    }
+    start = cpu_cycles();
+    ref = crc32_update(0, (const u8_t*)SCRATCH_BASE, n);
+    arm = cpu_cycles() - start;
+    LOG1("CRC-32 of %u bytes\r\n", n);
+    LOG3("  PRU0: 0x%08x in %u us, %u PRU cycles\r\n", res, pru / CPU_CYCLES_PER_US,
+         pru_cycles(0));
+    LOG2("  ARM:  0x%08x in %u us", ref, arm / CPU_CYCLES_PER_US);
+    if (ref != res) {
+      LOG0(", MISMATCH");
+    }
+    LOG0("\r\n");
+    return 0;
+  }
+  if (mon_streq(argv[1], "hb")) {
+    if (mon_arg(argc, argv, 2, 500, &n)) {
+      return 1;
+    }
+    if (n == 0) {
+      /* any command ends the heartbeat */
+      pru_call(0, PRU_CMD_ECHO, 0, 0, 0, &res, PRU_CALL_TIMEOUT_US);
+      return 0;
+    }
+    /* delay loops per half period */
+    n = n * 1000 / 2 * PRU_CLK_MHZ / PRU_HB_LOOP_CYCLES;
+    pru_post(0, PRU_CMD_HEARTBEAT, GPIO1_BASE, 0x1 << USR3, n);
+    return 0;
+  }
+  return 1;
+}
+
+static int mon_trace(u32_t argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  trace_dump();
+  return 0;
+}
+
+static const struct mon_cmd mon_cmds[] = {
+    {"help", mon_help, "", "list commands"},
+    {"md", mon_md, "<addr> [words]", "display memory"},
+    {"mw", mon_mw, "<addr> <value>", "write a word"},
+    {"mmc", mon_mmc, "<block> [n] [dest]", "read SD blocks, dest defaults to scratch DDR"},
+    {"bw", mon_bw, "[bytes]", "DDR copy bandwidth"},
+    {"membench", mon_membench, "stream|lat|stride [n]", "DDR bandwidth/latency tables"},
+    {"mmcbench", mon_mmcbench, "[start] [span]", "SD read KB/s, IOPS, latency per bus"},
+    {"irqlat", mon_irqlat, "[count]", "timer IRQ and FIQ latency"},
+    {"irqstats", mon_irqstats, "[reset]", "per IRQ latency/duration histograms"},
+    {"mem", mon_mem, "", "page allocator, arena and pool usage"},
+    {"blk", mon_blk, "", "block devices and request statistics"},
+    {"gpio", mon_gpio, "<bank> [pin] [0|1]", "read a GPIO bank or pin, or drive a pin"},
+    {"pru", mon_pru, "<crc|hb> [n]", "CRC offload to PRU0 / PRU0 heartbeat on USR3"},
+    {"trace", mon_trace, "", "dump the event trace"},
+    {"boot", NULL, "", "continue booting"},
+};
+#define MON_NUM_CMDS (sizeof(mon_cmds) / sizeof(mon_cmds[0]))
+
+/* name and arguments, padded so the descriptions line up */
+static void mon_usage(const struct mon_cmd* cmd) {
+  const char* p;
+  u32_t n = 0;
+
+  for (p = cmd->name; *p != '\0'; p++, n++) {
+    uart_putc(*p);
+  }
+  uart_putc(' ');
+  n++;
+  for (p = cmd->args; *p != '\0'; p++, n++) {
+    uart_putc(*p);
+  }
+  do {
+    uart_putc(' ');
+  } while (++n < 30);
+  uart_puts((char*)cmd->help);
+  uart_puts("\r\n");
+}
+
+static int mon_help(u32_t argc, char** argv) {
+  u32_t i;
+
+  (void)argc;
+  (void)argv;
+  for (i = 0; i < MON_NUM_CMDS; i++) {
+    mon_usage(&mon_cmds[i]);
+  }
+  return 0;
+}
+
+/* read a line with echo and backspace, returns its length */
+static u32_t mon_readline(char* line) {
+  u32_t n = 0;
+  char c;
+
+  while (1) {
+    if (uart_getc_timeout(&c, 1000000)) {
+      continue;
+    }
+    if (c == '\r' || c == '\n') {
+      uart_puts("\r\n");
+      line[n] = '\0';
+      return n;
+    }
+    if ((c == '\b' || c == 0x7F) && n > 0) {
+      n--;
+      uart_puts("\b \b");
+    } else if (c >= ' ' && c < 0x7F && n < MON_LINE_LEN - 1) {
+      line[n++] = c;
+      uart_putc(c);
+    }
+  }
+}
+
+/* split line in place on spaces, returns the number of arguments */
+static u32_t mon_split(char* line, char** argv) {
+  u32_t argc = 0;
+
+  while (*line != '\0' && argc < MON_MAX_ARGS) {
+    while (*line == ' ') {
+      *line++ = '\0';
+    }
+    if (*line == '\0') {
+      break;
+    }
+    argv[argc++] = line;
+    while (*line != ' ' && *line != '\0') {
+      line++;
+    }
+  }
+  return argc;
+}
+
+/* run commands until "boot" */
+void monitor_run(void) {
+  char line[MON_LINE_LEN];
+  char* argv[MON_MAX_ARGS];
+  u32_t argc, i;
+
+  uart_rx_irq(false);
+  LOG0("\r\nboot monitor, \"help\" for commands\r\n");
+  while (1) {
+    uart_puts("> ");
+    mon_readline(line);
+    argc = mon_split(line, argv);
+    if (argc == 0) {
+      continue;
+    }
+    for (i = 0; i < MON_NUM_CMDS; i++) {
+      if (mon_streq(argv[0], mon_cmds[i].name)) {
+        break;
+      }
+    }
+    if (i == MON_NUM_CMDS) {
+      LOG0("unknown command\r\n");
+    } else if (mon_cmds[i].fn == NULL) {
+      break;
+    } else if (mon_cmds[i].fn(argc, argv)) {
+      mon_usage(&mon_cmds[i]);
+    }
+  }
+  uart_rx_irq(true);
+}
@@ -0,0 +1,133 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Persistent log on the SD card, see plog.h.
+   The batch is built in place behind its header so a flush is a single
+   write straight from the buffer. Messages logged while a flush is going on
+   land after the part being written and are moved to the front once it is
+   done. */
+#include <blk.h>
+#include <common.h>
+#include <cpu.h>
+#include <crc32.h>
+#include <log.h>
+#include <plog.h>
+#include <sd_image.h>
+#include <trace.h>
+
+static u32_t plog_buf[PLOG_SLOT_BLOCKS * SD_BLOCK_SIZE / 4];
+static struct plog_batch* const plog_hdr = (struct plog_batch*)plog_buf;
+static u8_t* const plog_data = (u8_t*)plog_buf + sizeof(struct plog_batch);
+static u32_t plog_len = 0;
+static u32_t plog_dropped = 0;
+
+static u32_t plog_super_buf[SD_BLOCK_SIZE / 4];
+static struct blk_dev* plog_dev = NULL;
+static u32_t plog_lba = 0;
+static u32_t plog_slots = 0; /* 0 until plog_init found a region */
+static u32_t plog_boots, plog_seq, plog_next;
+static u32_t plog_busy = 0;
+
+void plog_write(const u8_t* data, u32_t len) {
+  u32_t flags, i;
+
+  flags = cpu_irq_save();
+  if (len > PLOG_DATA_SIZE - plog_len) {
+    plog_dropped += len;
+  } else {
+    for (i = 0; i < len; i++) {
+      plog_data[plog_len + i] = data[i];
+    }
+    plog_len += len;
+  }
+  cpu_irq_restore(flags);
+}
+
+/* picks up where the last boot left the region, anything unreadable starts
+   it over. returns 0 on success */
+int plog_init(struct blk_dev* dev, u32_t lba, u32_t blocks) {
+  struct plog_super* super = (struct plog_super*)plog_super_buf;
+
+  if (blocks < 1 + PLOG_SLOT_BLOCKS || blk_read(dev, lba, 1, plog_super_buf)) {
+    return 1;
+  }
+  plog_dev = dev;
+  plog_lba = lba;
+  plog_slots = (blocks - 1) / PLOG_SLOT_BLOCKS;
+  if (super->magic == PLOG_SUPER_MAGIC &&
+      crc32_update(0, (const u8_t*)super, (u32_t)&super->crc - (u32_t)super) == super->crc) {
+    plog_boots = super->boots + 1;
+    plog_seq = super->seq;
+    plog_next = super->next % plog_slots;
+  } else {
+    plog_boots = 1;
+    plog_seq = 0;
+    plog_next = 0;
+  }
+  return 0;
+}
+
+int plog_flush(void) {
+  struct plog_super* super = (struct plog_super*)plog_super_buf;
+  u32_t flags, len, dropped, blocks, i;
+  int err;
+
+  if (plog_slots == 0 || plog_busy) {
+    return 1;
+  }
+  plog_busy = 1;
+  flags = cpu_irq_save();
+  len = plog_len;
+  dropped = plog_dropped;
+  cpu_irq_restore(flags);
+  if (len == 0 && dropped == 0) {
+    plog_busy = 0;
+    return 0;
+  }
+
+  plog_hdr->magic = PLOG_BATCH_MAGIC;
+  plog_hdr->seq = plog_seq;
+  plog_hdr->boot = plog_boots;
+  plog_hdr->len = len;
+  plog_hdr->dropped = dropped;
+  plog_hdr->crc = crc32_update(0, plog_data, len);
+  blocks = (sizeof(struct plog_batch) + len + SD_BLOCK_SIZE - 1) / SD_BLOCK_SIZE;
+  trace_event(TRACE_PLOG_FLUSH, plog_seq, len);
+  err = blk_write(plog_dev, plog_lba + 1 + plog_next * PLOG_SLOT_BLOCKS, blocks, plog_buf);
+  if (!err) {
+    plog_seq++;
+    plog_next = (plog_next + 1) % plog_slots;
+    super->magic = PLOG_SUPER_MAGIC;
+    super->boots = plog_boots;
+    super->seq = plog_seq;
+    super->next = plog_next;
+    super->crc = crc32_update(0, (const u8_t*)super, (u32_t)&super->crc - (u32_t)super);
+    /* a lost update only means the next boot overwrites this batch */
+    err = blk_write(plog_dev, plog_lba, 1, plog_super_buf);
+  }
+
+  /* keep what came in meanwhile, a failed batch is dropped rather than
+     retried into the same failure */
+  flags = cpu_irq_save();
+  for (i = len; i < plog_len; i++) {
+    plog_data[i - len] = plog_data[i];
+  }
+  plog_len -= len;
+  plog_dropped -= dropped;
+  cpu_irq_restore(flags);
+  plog_busy = 0;
+  return err;
+}
+
+void plog_crash(u32_t type, u32_t address) {
+  u8_t rec[13];
+  u32_t words[3], i;
+
+  words[0] = type;
+  words[1] = address;
+  words[2] = cpu_cycles();
+  rec[0] = PLOG_CRASH_SYNC;
+  for (i = 0; i < 12; i++) {
+    rec[1 + i] = (words[i / 4] >> (8 * (i % 4))) & 0xFF;
+  }
+  plog_write(rec, sizeof(rec));
+  plog_flush();
+}
@@ -0,0 +1,211 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* PRU-ICSS bring-up, firmware loading and the MPU side of the offload
+   mailbox, see pru.h. Events from the PRUs come in on IRQ_PRU_EVTOUT0/1 and
+   end the timer_wait in pru_call.
+*/
+#include <common.h>
+#include <cpu.h>
+#include <interrupt.h>
+#include <log.h>
+#include <prcm.h>
+#include <pru.h>
+#include <timer.h>
+
+static u32_t pru_powered = 0;
+/* set by the ISR when the core raised its answer event */
+static volatile u32_t pru_answered[PRU_CORES];
+
+static void pru_isr(u32_t core) {
+  REG(PRU_INTC_SICR) = PRU_EVT_PRU_TO_ARM(core);
+  pru_answered[core] = 1;
+}
+
+static void pru0_isr(void) {
+  pru_isr(0);
+}
+
+static void pru1_isr(void) {
+  pru_isr(1);
+}
+
+/* route event -> channel -> host interrupt, channel and host numbers are
+   both event - 16 */
+static void pru_intc_route(u32_t event) {
+  u32_t ch = event - 16;
+
+  REG(PRU_INTC_CMR(event >> 2)) &= ~(0xF << ((event & 0x3) * 8));
+  REG(PRU_INTC_CMR(event >> 2)) |= ch << ((event & 0x3) * 8);
+  REG(PRU_INTC_HMR(ch >> 2)) &= ~(0xF << ((ch & 0x3) * 8));
+  REG(PRU_INTC_HMR(ch >> 2)) |= ch << ((ch & 0x3) * 8);
+  REG(PRU_INTC_EISR) = event;
+  REG(PRU_INTC_HIEISR) = ch;
+}
+
+/* power up and reset the subsystem, leaves both cores halted */
+int pru_init(void) {
+  u32_t core;
+
+  /* clocks [AM335x TRM 8.1.12.1] */
+  REG(CM_PER_PRU_ICSS_CLKSTCTRL) = 0x2; /* SW_WKUP */
+  REG(CM_PER_PRU_ICSS_CLKCTRL) = 0x2;   /* MODULEMODE = enable */
+  while (REG(CM_PER_PRU_ICSS_CLKCTRL) & (0x3 << 16)) {}
+
+  REG(RM_PER_RSTCTRL) |= PRU_ICSS_LRST;
+  REG(RM_PER_RSTCTRL) &= ~PRU_ICSS_LRST;
+
+  /* let the cores master the L3/L4 interconnect */
+  REG(PRU_CFG_SYSCFG) &= ~PRU_CFG_STANDBY_INIT;
+
+  for (core = 0; core < PRU_CORES; core++) {
+    pru_halt(core);
+    REG(PRU_CTBIR0(core)) = 0; /* C24: own data RAM */
+    REG(PRU_CTPPR0(core)) = PRU_CTPPR_C28(PRU_LOCAL_SHARED_RAM);
+    REG(PRU_CTPPR1(core)) = PRU_CTPPR_C30(PRU_C30_OCMC) | PRU_CTPPR_C31(PRU_C31_DDR);
+    pru_answered[core] = 0;
+  }
+
+  /* all events active high and level triggered, then the four used by the
+     mailboxes [AM335x TRM 4.4.2.3] */
+  REG(PRU_INTC_SIPR(0)) = 0xFFFFFFFF;
+  REG(PRU_INTC_SIPR(1)) = 0xFFFFFFFF;
+  REG(PRU_INTC_SITR(0)) = 0;
+  REG(PRU_INTC_SITR(1)) = 0;
+  REG(PRU_INTC_SECR(0)) = 0xFFFFFFFF;
+  REG(PRU_INTC_SECR(1)) = 0xFFFFFFFF;
+  for (core = 0; core < PRU_CORES; core++) {
+    pru_intc_route(PRU_EVT_ARM_TO_PRU(core));
+    pru_intc_route(PRU_EVT_PRU_TO_ARM(core));
+  }
+  REG(PRU_INTC_GER) = 0x1;
+  pru_powered = 1;
+
+  irq_register(IRQ_PRU_EVTOUT0, pru0_isr);
+  irq_register(IRQ_PRU_EVTOUT1, pru1_isr);
+  irq_unmask(IRQ_PRU_EVTOUT0);
+  irq_unmask(IRQ_PRU_EVTOUT1);
+  return 0;
+}
+
+/* copy words of instructions to IRAM and len bytes to the data RAM of a
+   halted core. returns non zero if they don't fit */
+int pru_load(u32_t core, const u32_t* text, u32_t words, const void* data, u32_t len) {
+  volatile u32_t* iram;
+  volatile u8_t* dram;
+  u32_t i;
+
+  if (core >= PRU_CORES || words * 4 > PRU_IRAM_SIZE || len > PRU_DRAM_SIZE) {
+    return 1;
+  }
+  pru_halt(core);
+  iram = (volatile u32_t*)PRU_IRAM(core);
+  for (i = 0; i < words; i++) {
+    iram[i] = text[i];
+  }
+  dram = (volatile u8_t*)PRU_DRAM(core);
+  for (i = 0; i < len; i++) {
+    dram[i] = ((const u8_t*)data)[i];
+  }
+  return 0;
+}
+
+/* reset the core's PC to entry (an instruction index) and run it */
+void pru_start(u32_t core, u32_t entry) {
+  REG(PRU_CONTROL(core)) = entry << 16;
+  REG(PRU_CYCLE(core)) = 0;
+  REG(PRU_CONTROL(core)) =
+      (entry << 16) | PRU_CONTROL_CTR_EN | PRU_CONTROL_EN | PRU_CONTROL_SOFT_RST_N;
+}
+
+void pru_halt(u32_t core) {
+  REG(PRU_CONTROL(core)) &= ~PRU_CONTROL_EN;
+  while (REG(PRU_CONTROL(core)) & PRU_CONTROL_RUNSTATE) {}
+}
+
+/* halt both cores and turn their events off, for handing the board over.
+   nothing to do if pru_init never ran, the subsystem isn't clocked then */
+void pru_stop(void) {
+  u32_t core;
+
+  if (!pru_powered) {
+    return;
+  }
+  for (core = 0; core < PRU_CORES; core++) {
+    pru_halt(core);
+  }
+  REG(PRU_INTC_GER) = 0;
+  REG(PRU_INTC_SECR(0)) = 0xFFFFFFFF;
+  REG(PRU_INTC_SECR(1)) = 0xFFFFFFFF;
+}
+
+u32_t pru_running(u32_t core) {
+  return (REG(PRU_CONTROL(core)) & PRU_CONTROL_RUNSTATE) != 0;
+}
+
+/* cycles the core has run since pru_start, stops counting at 0xFFFFFFFF */
+u32_t pru_cycles(u32_t core) {
+  return REG(PRU_CYCLE(core));
+}
+
+/* bring the subsystem up with the offload firmware on both cores */
+int pru_offload_init(void) {
+  u32_t core, i;
+
+  pru_init();
+  for (core = 0; core < PRU_CORES; core++) {
+    /* zeroed data RAM is an idle mailbox */
+    if (pru_load(core, pru_offload_fw[core], PRU_FW_WORDS, NULL, 0)) {
+      return 1;
+    }
+    for (i = 0; i < sizeof(struct pru_mbox) / 4; i++) {
+      ((volatile u32_t*)PRU_MBOX(core))[i] = 0;
+    }
+    pru_start(core, 0);
+  }
+  LOG1("PRU offload firmware running, %u words\r\n", PRU_FW_WORDS);
+  return 0;
+}
+
+/* hand a command to a core without waiting for the answer */
+int pru_post(u32_t core, u32_t cmd, u32_t arg0, u32_t arg1, u32_t arg2) {
+  volatile struct pru_mbox* mbox;
+
+  if (core >= PRU_CORES || !pru_running(core)) {
+    return 1;
+  }
+  mbox = PRU_MBOX(core);
+  mbox->cmd = cmd;
+  mbox->arg[0] = arg0;
+  mbox->arg[1] = arg1;
+  mbox->arg[2] = arg2;
+  mbox->status = PRU_MBOX_IDLE;
+  /* mailbox writes have to land before the event */
+  cpu_dsb();
+  REG(PRU_INTC_SISR) = PRU_EVT_ARM_TO_PRU(core);
+  return 0;
+}
+
+static int pru_has_answered(u32_t core) {
+  return pru_answered[core];
+}
+
+/* run a command and sleep until the core answers or timeout_us has passed.
+   returns the mailbox status, PRU_MBOX_ERROR if the core isn't running or
+   didn't answer in time. the mailbox is left idle after a timeout, a late
+   answer to it lands before the next command is posted and is dropped */
+u32_t pru_call(u32_t core, u32_t cmd, u32_t arg0, u32_t arg1, u32_t arg2, u32_t* result,
+               u32_t timeout_us) {
+  if (core >= PRU_CORES) {
+    return PRU_MBOX_ERROR;
+  }
+  pru_answered[core] = 0;
+  if (pru_post(core, cmd, arg0, arg1, arg2)) {
+    return PRU_MBOX_ERROR;
+  }
+  if (timer_wait(pru_has_answered, core, timeout_us)) {
+    PRU_MBOX(core)->status = PRU_MBOX_IDLE;
+    LOG2("PRU%u: no answer to command %u\r\n", core, cmd);
+    return PRU_MBOX_ERROR;
+  }
+  *result = PRU_MBOX(core)->result;
+  return PRU_MBOX(core)->status;
+}
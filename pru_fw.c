@@ -0,0 +1,118 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Offload firmware for the PRUs, hand assembled with pru_isa.h. Serves the
+   mailbox protocol in pru.h:
+     r1  mailbox (data RAM 0)      r2-r5  cmd and args, r5 also the result
+     r10 CRC-32 polynomial         r9.w0  return address for crc_bits
+   The CRC runs a word at a time while it can, xoring the little endian word
+   into the register and shifting 32 bits, then finishes the tail bytewise.
+   Loads from DDR go over the OCP master and dominate, so one burst per word
+   matters more than the bit loop. Run pru_sim after changing anything here,
+   branch offsets are counted by hand from the index comments.
+*/
+#include <common.h>
+#include <pru.h>
+#include <pru_isa.h>
+
+/* instruction indexes of the branch targets */
+#define L_WAIT       3
+#define L_ECHO      14
+#define L_CRC       16
+#define L_CRC_WORD  18
+#define L_CRC_BYTE  25
+#define L_CRC_BITS  33
+#define L_CRC_BIT   34
+#define L_CRC_SHIFT 38
+#define L_CRC_NEXT  39
+#define L_CRC_DONE  42
+#define L_HB        44
+#define L_HB_LOOP   46
+#define L_HB_D1     48
+#define L_HB_D2     53
+#define L_REPLY     57
+#define L_REPLY_ST  58
+
+/* GPIO_CLEARDATAOUT, GPIO_SETDATAOUT follows it */
+#define FW_GPIO_CLEAR 0x190
+
+#define PRU_FW(core) {                                                                     \
+  /*  0 */ PRU_LDI(PRU_R(1), PRU_LOCAL_DRAM),                                              \
+  /*  1 */ PRU_LDI(PRU_W(10, 0), 0x8320),                                                  \
+  /*  2 */ PRU_LDI(PRU_W(10, 2), 0xEDB8),                                                  \
+  /* wait: sleep on our host interrupt, then clear its event */                            \
+  /*  3 */ PRU_QBBC(L_WAIT - 3, PRU_R(31), PRU_R31_HOST0 + (core)),                         \
+  /*  4 */ PRU_LDI(PRU_R(0), PRU_EVT_ARM_TO_PRU(core)),                                    \
+  /*  5 */ PRU_SBCO(0, PRU_C_INTC, PRU_INTC_SICR_OFFSET, 4),                               \
+  /*  6 */ PRU_LBBO(2, 1, 0, 16),                                                          \
+  /*  7 */ PRU_LDI(PRU_R(0), PRU_MBOX_BUSY),                                               \
+  /*  8 */ PRU_SBBO(0, 1, 16, 4),                                                          \
+  /*  9 */ PRU_QBI(PRU_QB_EQ, L_ECHO - 9, PRU_R(2), PRU_CMD_ECHO),                         \
+  /* 10 */ PRU_QBI(PRU_QB_EQ, L_CRC - 10, PRU_R(2), PRU_CMD_CRC32),                        \
+  /* 11 */ PRU_QBI(PRU_QB_EQ, L_HB - 11, PRU_R(2), PRU_CMD_HEARTBEAT),                     \
+  /* 12 */ PRU_LDI(PRU_R(0), PRU_MBOX_ERROR),                                              \
+  /* 13 */ PRU_JMP(L_REPLY_ST),                                                            \
+  /* echo: */                                                                              \
+  /* 14 */ PRU_ALUI(PRU_ADD, PRU_R(5), PRU_R(3), 1),                                       \
+  /* 15 */ PRU_JMP(L_REPLY),                                                               \
+  /* crc: r3 address, r4 length */                                                         \
+  /* 16 */ PRU_LDI(PRU_W(5, 0), 0xFFFF),                                                   \
+  /* 17 */ PRU_LDI(PRU_W(5, 2), 0xFFFF),                                                   \
+  /* crc_word: */                                                                          \
+  /* 18 */ PRU_QBI(PRU_QB_GT, L_CRC_BYTE - 18, PRU_R(4), 4),                               \
+  /* 19 */ PRU_LBBO(6, 3, 0, 4),                                                           \
+  /* 20 */ PRU_ALUI(PRU_ADD, PRU_R(3), PRU_R(3), 4),                                       \
+  /* 21 */ PRU_ALUI(PRU_SUB, PRU_R(4), PRU_R(4), 4),                                       \
+  /* 22 */ PRU_LDI(PRU_R(7), 32),                                                          \
+  /* 23 */ PRU_JAL(PRU_W(9, 0), L_CRC_BITS),                                               \
+  /* 24 */ PRU_JMP(L_CRC_WORD),                                                            \
+  /* crc_byte: */                                                                          \
+  /* 25 */ PRU_QBI(PRU_QB_EQ, L_CRC_DONE - 25, PRU_R(4), 0),                               \
+  /* 26 */ PRU_LDI(PRU_R(6), 0),                                                           \
+  /* 27 */ PRU_LBBO(6, 3, 0, 1),                                                           \
+  /* 28 */ PRU_ALUI(PRU_ADD, PRU_R(3), PRU_R(3), 1),                                       \
+  /* 29 */ PRU_ALUI(PRU_SUB, PRU_R(4), PRU_R(4), 1),                                       \
+  /* 30 */ PRU_LDI(PRU_R(7), 8),                                                           \
+  /* 31 */ PRU_JAL(PRU_W(9, 0), L_CRC_BITS),                                               \
+  /* 32 */ PRU_JMP(L_CRC_BYTE),                                                            \
+  /* crc_bits: fold r6 in and shift r7 bits */                                             \
+  /* 33 */ PRU_ALU(PRU_XOR, PRU_R(5), PRU_R(5), PRU_R(6)),                                  \
+  /* crc_bit: */                                                                           \
+  /* 34 */ PRU_QBBC(L_CRC_SHIFT - 34, PRU_R(5), 0),                                        \
+  /* 35 */ PRU_ALUI(PRU_LSR, PRU_R(5), PRU_R(5), 1),                                       \
+  /* 36 */ PRU_ALU(PRU_XOR, PRU_R(5), PRU_R(5), PRU_R(10)),                                 \
+  /* 37 */ PRU_JMP(L_CRC_NEXT),                                                            \
+  /* crc_shift: */                                                                         \
+  /* 38 */ PRU_ALUI(PRU_LSR, PRU_R(5), PRU_R(5), 1),                                       \
+  /* crc_next: */                                                                          \
+  /* 39 */ PRU_ALUI(PRU_SUB, PRU_R(7), PRU_R(7), 1),                                       \
+  /* 40 */ PRU_QBI(PRU_QB_NE, L_CRC_BIT - 40, PRU_R(7), 0),                                \
+  /* 41 */ PRU_JMPR(PRU_W(9, 0)),                                                          \
+  /* crc_done: */                                                                          \
+  /* 42 */ PRU_ALU(PRU_NOT, PRU_R(5), PRU_R(5), PRU_R(5)),                                  \
+  /* 43 */ PRU_JMP(L_REPLY),                                                               \
+  /* hb: r3 GPIO module, r4 pin mask, r5 half period. no reply, a new command    */       \
+  /* ends it and goes straight back to wait where the host interrupt is still set */       \
+  /* 44 */ PRU_LDI(PRU_R(6), FW_GPIO_CLEAR),                                               \
+  /* 45 */ PRU_ALU(PRU_ADD, PRU_R(3), PRU_R(3), PRU_R(6)),                                  \
+  /* hb_loop: */                                                                           \
+  /* 46 */ PRU_SBBO(4, 3, 4, 4),                                                           \
+  /* 47 */ PRU_MOV(PRU_R(7), PRU_R(5)),                                                    \
+  /* hb_d1: */                                                                             \
+  /* 48 */ PRU_QBBS(L_WAIT - 48, PRU_R(31), PRU_R31_HOST0 + (core)),                        \
+  /* 49 */ PRU_ALUI(PRU_SUB, PRU_R(7), PRU_R(7), 1),                                       \
+  /* 50 */ PRU_QBI(PRU_QB_NE, L_HB_D1 - 50, PRU_R(7), 0),                                  \
+  /* 51 */ PRU_SBBO(4, 3, 0, 4),                                                           \
+  /* 52 */ PRU_MOV(PRU_R(7), PRU_R(5)),                                                    \
+  /* hb_d2: */                                                                             \
+  /* 53 */ PRU_QBBS(L_WAIT - 53, PRU_R(31), PRU_R31_HOST0 + (core)),                        \
+  /* 54 */ PRU_ALUI(PRU_SUB, PRU_R(7), PRU_R(7), 1),                                       \
+  /* 55 */ PRU_QBI(PRU_QB_NE, L_HB_D2 - 55, PRU_R(7), 0),                                  \
+  /* 56 */ PRU_JMP(L_HB_LOOP),                                                             \
+  /* reply: result in r5, status in r0 from reply_st */                                    \
+  /* 57 */ PRU_LDI(PRU_R(0), PRU_MBOX_DONE),                                               \
+  /* 58 */ PRU_SBBO(5, 1, 20, 4),                                                          \
+  /* 59 */ PRU_SBBO(0, 1, 16, 4),                                                          \
+  /* 60 */ PRU_LDI(PRU_R(31), PRU_R31_EVENT(PRU_EVT_PRU_TO_ARM(core))),                    \
+  /* 61 */ PRU_JMP(L_WAIT),                                                                \
+}
+
+const u32_t pru_offload_fw[PRU_CORES][PRU_FW_WORDS] = {PRU_FW(0), PRU_FW(1)};
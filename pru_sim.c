@@ -0,0 +1,546 @@
+/* Copyright (c) 2023  Hunter Whyte
+  Host side PRU instruction simulator (see include/pru_isa.h for the subset).
+  With no arguments it runs the self tests: a few instruction checks and then
+  the offload firmware from pru_fw.c on both cores, driven through the same
+  mailbox and events pru.c uses, against a model of the subsystem, 1MB of DDR
+  and the GPIO set/clear registers.
+  With a file it loads a raw little endian IRAM image, runs it on PRU0 until
+  HALT and dumps the registers.
+  Cycle counts assume one cycle per instruction plus one per extra word of a
+  burst. Real OCP accesses to DDR and peripherals stall far longer.
+
+  usage: ./pru_sim [-t] [image.bin]    -t traces every instruction
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <common.h>
+#include <pru.h>
+#include <pru_isa.h>
+
+#define SIM_DDR_BASE 0x80000000u
+#define SIM_DDR_SIZE 0x100000u
+#define SIM_GPIO_CLEAR 0x190
+#define SIM_GPIO_SET   0x194
+
+struct sim {
+  uint32_t iram[PRU_CORES][PRU_IRAM_SIZE / 4];
+  uint8_t dram[PRU_CORES][PRU_DRAM_SIZE];
+  uint8_t shared[PRU_SHARED_RAM_SIZE];
+  uint8_t* ddr;
+  uint64_t events;     /* PRU INTC system event status */
+  uint32_t gpio_base;  /* GPIO module the tests watch */
+  uint32_t gpio_sets, gpio_clears, gpio_mask;
+};
+
+struct pru {
+  struct sim* sim;
+  uint32_t core;
+  uint32_t r[32];
+  uint32_t pc;
+  uint32_t carry;
+  uint64_t cycles;
+  int halted;
+  int fault;
+};
+
+static int trace;
+
+static void fault(struct pru* p, const char* what, uint32_t val) {
+  printf("PRU%u fault at pc %u: %s 0x%08x\n", p->core, p->pc, what, val);
+  p->fault = 1;
+}
+
+/* host interrupt status as seen in R31 bits 30/31, events are routed one to
+   one the way pru_init sets them up */
+static uint32_t r31_read(struct pru* p) {
+  uint32_t v = p->r[31] & 0x3FFFFFFF;
+
+  if (p->sim->events & (1ull << PRU_EVT_ARM_TO_PRU(0))) {
+    v |= 1u << PRU_R31_HOST0;
+  }
+  if (p->sim->events & (1ull << PRU_EVT_ARM_TO_PRU(1))) {
+    v |= 1u << PRU_R31_HOST1;
+  }
+  return v;
+}
+
+static uint32_t reg_full(struct pru* p, uint32_t n) {
+  return n == 31 ? r31_read(p) : p->r[n];
+}
+
+/* value of a register field and its width mask */
+static uint32_t field_get(struct pru* p, uint32_t f, uint32_t* mask) {
+  uint32_t sel = f >> 5, v = reg_full(p, f & 0x1F);
+
+  if (sel < 4) {
+    *mask = 0xFF;
+    return (v >> (8 * sel)) & 0xFF;
+  }
+  if (sel < 7) {
+    *mask = 0xFFFF;
+    return (v >> (8 * (sel - 4))) & 0xFFFF;
+  }
+  *mask = 0xFFFFFFFF;
+  return v;
+}
+
+static void field_set(struct pru* p, uint32_t f, uint32_t val) {
+  uint32_t sel = f >> 5, n = f & 0x1F, shift, mask;
+
+  if (sel < 4) {
+    shift = 8 * sel;
+    mask = 0xFF;
+  } else if (sel < 7) {
+    shift = 8 * (sel - 4);
+    mask = 0xFFFF;
+  } else {
+    shift = 0;
+    mask = 0xFFFFFFFF;
+  }
+  if (n == 31) {
+    /* writes with bit 5 set pulse a system event */
+    if (shift == 0 && (val & 0x20)) {
+      p->sim->events |= 1ull << (16 + (val & 0xF));
+    }
+    return;
+  }
+  p->r[n] = (p->r[n] & ~(mask << shift)) | ((val & mask) << shift);
+}
+
+/* memory as one of the cores sees it, NULL if nothing is mapped there */
+static uint8_t* mem_map(struct pru* p, uint32_t addr, uint32_t len) {
+  struct sim* s = p->sim;
+
+  if (addr + len <= PRU_DRAM_SIZE) {
+    return s->dram[p->core] + addr;
+  }
+  if (addr >= 0x2000 && addr + len <= 0x2000 + PRU_DRAM_SIZE) {
+    return s->dram[p->core ^ 1] + addr - 0x2000;
+  }
+  if (addr >= PRU_LOCAL_SHARED_RAM &&
+      addr + len <= PRU_LOCAL_SHARED_RAM + PRU_SHARED_RAM_SIZE) {
+    return s->shared + addr - PRU_LOCAL_SHARED_RAM;
+  }
+  if (addr >= SIM_DDR_BASE && addr - SIM_DDR_BASE + len <= SIM_DDR_SIZE) {
+    return s->ddr + addr - SIM_DDR_BASE;
+  }
+  return NULL;
+}
+
+/* the few registers the firmware writes outside of RAM */
+static int mmio_write(struct pru* p, uint32_t addr, uint32_t val) {
+  struct sim* s = p->sim;
+
+  if (addr == PRU_LOCAL_INTC + PRU_INTC_SICR_OFFSET) {
+    s->events &= ~(1ull << (val & 0x3F));
+  } else if (addr == PRU_LOCAL_INTC + PRU_INTC_SISR_OFFSET) {
+    s->events |= 1ull << (val & 0x3F);
+  } else if (addr == s->gpio_base + SIM_GPIO_SET) {
+    s->gpio_sets++;
+    s->gpio_mask = val;
+  } else if (addr == s->gpio_base + SIM_GPIO_CLEAR) {
+    s->gpio_clears++;
+    s->gpio_mask = val;
+  } else {
+    return 1;
+  }
+  return 0;
+}
+
+static uint32_t const_table(struct pru* p, uint32_t c) {
+  switch (c) {
+    case PRU_C_INTC: return PRU_LOCAL_INTC;
+    case PRU_C_DRAM: return PRU_LOCAL_DRAM;
+    case PRU_C_SHARED: return PRU_LOCAL_SHARED_RAM;
+    case PRU_C_DDR: return SIM_DDR_BASE;
+    default:
+      fault(p, "constant table entry not modelled", c);
+      return 0;
+  }
+}
+
+/* LBBO/SBBO/LBCO/SBCO */
+static void exec_burst(struct pru* p, uint32_t w) {
+  uint32_t len, base, off, addr, rd, i, mask;
+  uint8_t* mem;
+  uint8_t regs[128];
+
+  len = ((w >> 25) & 0x7) << 4 | ((w >> 13) & 0x7) << 1 | ((w >> 7) & 0x1);
+  len = len < 124 ? len + 1 : (p->r[0] >> (8 * (len - 124))) & 0xFF;
+  if ((w >> 29) == 0x4) {
+    base = const_table(p, (w >> 8) & 0x1F);
+  } else {
+    base = p->r[(w >> 8) & 0x1F];
+  }
+  off = (w & (1u << 24)) ? (w >> 16) & 0xFF : field_get(p, (w >> 16) & 0xFF, &mask);
+  addr = base + off;
+  rd = (w & 0x1F) * 4 + ((w >> 5) & 0x3);
+  if (rd + len > 128) {
+    fault(p, "burst past r31", len);
+    return;
+  }
+  for (i = 0; i < 32; i++) {
+    regs[4 * i] = p->r[i];
+    regs[4 * i + 1] = p->r[i] >> 8;
+    regs[4 * i + 2] = p->r[i] >> 16;
+    regs[4 * i + 3] = p->r[i] >> 24;
+  }
+  mem = mem_map(p, addr, len);
+  if (w & (1u << 28)) {
+    if (mem == NULL) {
+      fault(p, "load from unmapped address", addr);
+      return;
+    }
+    memcpy(regs + rd, mem, len);
+    for (i = 0; i < 32; i++) {
+      p->r[i] = regs[4 * i] | regs[4 * i + 1] << 8 | regs[4 * i + 2] << 16 |
+                (uint32_t)regs[4 * i + 3] << 24;
+    }
+  } else if (mem != NULL) {
+    memcpy(mem, regs + rd, len);
+  } else if (len != 4 || mmio_write(p, addr, p->r[rd / 4])) {
+    fault(p, "store to unmapped address", addr);
+    return;
+  }
+  p->cycles += (len - 1) / 4;
+}
+
+static void exec_alu(struct pru* p, uint32_t w) {
+  uint32_t op = (w >> 25) & 0xF, a, b, rmask, amask, bmask;
+  uint64_t r;
+
+  a = field_get(p, (w >> 8) & 0xFF, &amask);
+  if (w & (1u << 24)) {
+    b = (w >> 16) & 0xFF;
+  } else {
+    b = field_get(p, (w >> 16) & 0xFF, &bmask);
+  }
+  field_get(p, w & 0xFF, &rmask);
+  switch (op) {
+    case PRU_ADD: r = (uint64_t)a + b; break;
+    case PRU_ADC: r = (uint64_t)a + b + p->carry; break;
+    case PRU_SUB: r = (uint64_t)a - b; break;
+    case PRU_SUC: r = (uint64_t)a - b - p->carry; break;
+    case PRU_RSB: r = (uint64_t)b - a; break;
+    case PRU_RSC: r = (uint64_t)b - a - p->carry; break;
+    case PRU_LSL: r = (uint64_t)a << (b & 0x1F); break;
+    case PRU_LSR: r = a >> (b & 0x1F); break;
+    case PRU_AND: r = a & b; break;
+    case PRU_OR:  r = a | b; break;
+    case PRU_XOR: r = a ^ b; break;
+    case PRU_NOT: r = ~a; break;
+    case PRU_MIN: r = a < b ? a : b; break;
+    case PRU_MAX: r = a > b ? a : b; break;
+    case PRU_CLR: r = a & ~(1u << (b & 0x1F)); break;
+    default:      r = a | (1u << (b & 0x1F)); break;
+  }
+  /* carry out of the destination width for adds, borrow for subtracts */
+  if (op == PRU_ADD || op == PRU_ADC) {
+    p->carry = (r & ~(uint64_t)rmask) != 0;
+  } else if (op == PRU_SUB || op == PRU_SUC || op == PRU_RSB || op == PRU_RSC) {
+    p->carry = r >> 63;
+  }
+  field_set(p, w & 0xFF, (uint32_t)r);
+}
+
+/* branch offset of formats 4 and 5, 10 bit signed */
+static int32_t broff(uint32_t w) {
+  int32_t off = ((w >> 25) & 0x3) << 8 | (w & 0xFF);
+
+  return off & 0x200 ? off - 0x400 : off;
+}
+
+static void step(struct pru* p) {
+  uint32_t w, a, b, mask, next, cmp;
+
+  if (p->pc >= PRU_IRAM_SIZE / 4) {
+    fault(p, "pc outside IRAM", p->pc);
+    return;
+  }
+  w = p->sim->iram[p->core][p->pc];
+  if (trace) {
+    printf("PRU%u %4u: %08x\n", p->core, p->pc, w);
+  }
+  next = p->pc + 1;
+  p->cycles++;
+
+  if ((w >> 29) == 0x0) {
+    exec_alu(p, w);
+  } else if ((w >> 29) == 0x1) {
+    switch ((w >> 25) & 0xF) {
+      case 0x0: /* JMP */
+      case 0x1: /* JAL */
+        next = (w & (1u << 24)) ? (w >> 8) & 0xFFFF : field_get(p, (w >> 16) & 0xFF, &mask);
+        if (w & (1u << 25)) {
+          field_set(p, w & 0xFF, p->pc + 1);
+        }
+        break;
+      case 0x2: /* LDI */
+        field_set(p, w & 0xFF, (w >> 8) & 0xFFFF);
+        break;
+      case 0x5: /* HALT */
+        p->halted = 1;
+        return;
+      default:
+        fault(p, "unsupported format 2 instruction", w);
+        return;
+    }
+  } else if ((w >> 30) == 0x1) {
+    /* QBxx: compare op2 with rs1 */
+    a = field_get(p, (w >> 8) & 0xFF, &mask);
+    b = (w & (1u << 24)) ? (w >> 16) & 0xFF : field_get(p, (w >> 16) & 0xFF, &mask);
+    cmp = (w >> 27) & 0x7;
+    if (((cmp & PRU_QB_GT) && b > a) || ((cmp & PRU_QB_EQ) && b == a) ||
+        ((cmp & PRU_QB_LT) && b < a)) {
+      next = p->pc + broff(w);
+    }
+  } else if ((w >> 29) == 0x6) {
+    /* QBBC/QBBS */
+    a = field_get(p, (w >> 8) & 0xFF, &mask);
+    b = (w & (1u << 24)) ? (w >> 16) & 0xFF : field_get(p, (w >> 16) & 0xFF, &mask);
+    if (((a >> (b & 0x1F)) & 1) == ((w >> 28) & 1)) {
+      next = p->pc + broff(w);
+    }
+  } else if ((w >> 29) == 0x7 || (w >> 29) == 0x4) {
+    exec_burst(p, w);
+  } else {
+    fault(p, "unsupported instruction", w);
+    return;
+  }
+  p->pc = next;
+}
+
+/* run until HALT, a fault or max instructions. returns instructions run */
+static uint32_t run(struct pru* p, uint32_t max) {
+  uint32_t n;
+
+  for (n = 0; n < max && !p->halted && !p->fault; n++) {
+    step(p);
+  }
+  return n;
+}
+
+static void pru_reset(struct pru* p, struct sim* s, uint32_t core) {
+  memset(p, 0, sizeof(*p));
+  p->sim = s;
+  p->core = core;
+}
+
+static int failures;
+
+static void check(const char* name, uint32_t got, uint32_t expect) {
+  if (got != expect) {
+    printf("FAIL %s: got 0x%08x expected 0x%08x\n", name, got, expect);
+    failures++;
+  }
+}
+
+/* run a short program on PRU0 to HALT */
+static void run_prog(struct sim* s, struct pru* p, const uint32_t* prog, uint32_t words) {
+  pru_reset(p, s, 0);
+  memcpy(s->iram[0], prog, words * 4);
+  run(p, 10000);
+  check("program halted", p->halted, 1);
+}
+
+static void test_isa(struct sim* s) {
+  struct pru p;
+  static const uint32_t alu[] = {
+      PRU_LDI(PRU_W(1, 0), 0x5678),
+      PRU_LDI(PRU_W(1, 2), 0x1234),
+      PRU_ALUI(PRU_ADD, PRU_B(2, 1), PRU_B(1, 0), 0x90), /* 0x78 + 0x90, carry out */
+      PRU_ALUI(PRU_ADC, PRU_B(2, 2), PRU_B(1, 3), 0),
+      PRU_ALU(PRU_SUB, PRU_R(3), PRU_W(1, 0), PRU_W(1, 2)),
+      PRU_ALUI(PRU_LSL, PRU_R(4), PRU_R(1), 4),
+      PRU_ALU(PRU_NOT, PRU_W(5, 1), PRU_W(1, 1), PRU_W(1, 1)),
+      PRU_ALUI(PRU_SET, PRU_R(6), PRU_R(6), 31),
+      PRU_ALUI(PRU_CLR, PRU_R(7), PRU_R(1), 2),
+      PRU_HALT,
+  };
+  static const uint32_t branch[] = {
+      /* 0 */ PRU_LDI(PRU_R(1), 5),
+      /* 1 */ PRU_LDI(PRU_R(2), 0),
+      /* 2 */ PRU_ALUI(PRU_ADD, PRU_R(2), PRU_R(2), 3),
+      /* 3 */ PRU_ALUI(PRU_SUB, PRU_R(1), PRU_R(1), 1),
+      /* 4 */ PRU_QBI(PRU_QB_NE, -2, PRU_R(1), 0),
+      /* 5 */ PRU_JAL(PRU_W(9, 0), 9),
+      /* 6 */ PRU_QBI(PRU_QB_GT, 2, PRU_R(2), 16),  /* 16 > 15 */
+      /* 7 */ PRU_HALT,
+      /* 8 */ PRU_QBBS(-1, PRU_R(2), 0),             /* 15 has bit 0 set */
+      /* 9 */ PRU_QBBC(2, PRU_R(2), 4),
+      /* 10 */ PRU_HALT,
+      /* 11 */ PRU_LDI(PRU_R(3), 0xAA),
+      /* 12 */ PRU_JMPR(PRU_W(9, 0)),
+  };
+  static const uint32_t mem[] = {
+      PRU_LDI(PRU_R(1), 0x100),
+      PRU_LDI(PRU_W(2, 0), 0x2211),
+      PRU_LDI(PRU_W(2, 2), 0x4433),
+      PRU_LDI(PRU_R(3), 0x55),
+      PRU_SBBO(2, 1, 8, 5),
+      PRU_LBBO(4, 1, 9, 4),
+      PRU_SBCO(2, PRU_C_SHARED, 0, 4),
+      PRU_LBCO(5, PRU_C_SHARED, 2, 2),
+      PRU_HALT,
+  };
+
+  run_prog(s, &p, alu, sizeof(alu) / 4);
+  check("add byte", p.r[2] & 0xFF00, 0x0800);
+  check("adc byte", (p.r[2] >> 16) & 0xFF, 0x13);
+  check("sub word", p.r[3], 0x5678 - 0x1234);
+  check("lsl", p.r[4], 0x23456780);
+  check("not word", p.r[5], 0x00CBA900);
+  check("set", p.r[6], 0x80000000);
+  check("clr", p.r[7], 0x12345678 & ~4u);
+
+  run_prog(s, &p, branch, sizeof(branch) / 4);
+  check("loop", p.r[2], 15);
+  check("jal/jmp", p.r[3], 0xAA);
+  check("qbgt", p.pc, 7);
+
+  run_prog(s, &p, mem, sizeof(mem) / 4);
+  check("sbbo/lbbo", p.r[4], 0x55443322);
+  check("lbco", p.r[5], 0x4433);
+}
+
+/* MPU side of a mailbox call: post, run the core until it raises its event
+   back, returns the status */
+static uint32_t sim_call(struct pru* p, uint32_t cmd, uint32_t a0, uint32_t a1, uint32_t a2,
+                         uint32_t* result, uint32_t max) {
+  struct sim* s = p->sim;
+  uint32_t mbox[6] = {cmd, a0, a1, a2, PRU_MBOX_IDLE, 0};
+  uint64_t done = 1ull << PRU_EVT_PRU_TO_ARM(p->core);
+  uint32_t n;
+
+  memcpy(s->dram[p->core], mbox, sizeof(mbox));
+  s->events |= 1ull << PRU_EVT_ARM_TO_PRU(p->core);
+  for (n = 0; n < max && !(s->events & done) && !p->fault; n++) {
+    step(p);
+  }
+  if (!(s->events & done)) {
+    return PRU_MBOX_IDLE;
+  }
+  s->events &= ~done;
+  memcpy(mbox, s->dram[p->core], sizeof(mbox));
+  *result = mbox[5];
+  return mbox[4];
+}
+
+static uint32_t crc_ref(const uint8_t* buf, uint32_t len) {
+  uint32_t crc = 0xFFFFFFFF, i, j;
+
+  for (i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (j = 0; j < 8; j++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+    }
+  }
+  return ~crc;
+}
+
+static void test_offload(struct sim* s, uint32_t core) {
+  static const uint32_t lens[] = {0, 1, 3, 4, 7, 64, 1001, 65536};
+  struct pru p;
+  uint32_t i, st, res, start, loops;
+  uint64_t cycles;
+  char name[64];
+
+  pru_reset(&p, s, core);
+  memcpy(s->iram[core], pru_offload_fw[core], sizeof(pru_offload_fw[core]));
+  memset(s->dram[core], 0, PRU_DRAM_SIZE);
+  s->events = 0;
+  run(&p, 100);
+  check("firmware idles in wait", p.pc, 3);
+
+  st = sim_call(&p, PRU_CMD_ECHO, 41, 0, 0, &res, 1000);
+  check("echo status", st, PRU_MBOX_DONE);
+  check("echo result", res, 42);
+  check("host event cleared", (uint32_t)(s->events >> PRU_EVT_ARM_TO_PRU(core)) & 1, 0);
+
+  st = sim_call(&p, 99, 0, 0, 0, &res, 1000);
+  check("bad command status", st, PRU_MBOX_ERROR);
+
+  for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+    start = 0x1000 + i; /* unaligned too */
+    cycles = p.cycles;
+    st = sim_call(&p, PRU_CMD_CRC32, SIM_DDR_BASE + start, lens[i], 0, &res, 100000000);
+    sprintf(name, "PRU%u crc32 of %u bytes", core, lens[i]);
+    check(name, st, PRU_MBOX_DONE);
+    check(name, res, crc_ref(s->ddr + start, lens[i]));
+    if (core == 0 && lens[i] >= 1000) {
+      printf("PRU%u crc32 %u bytes: %llu cycles, %.1f cycles/byte\n", core, lens[i],
+             (unsigned long long)(p.cycles - cycles), (double)(p.cycles - cycles) / lens[i]);
+    }
+  }
+
+  /* heartbeat: 2 delay loops per half period, a few periods then a new
+     command has to stop it */
+  s->gpio_base = 0x4804C000;
+  s->gpio_sets = s->gpio_clears = 0;
+  st = sim_call(&p, PRU_CMD_HEARTBEAT, s->gpio_base, 1u << 24, 20, &res, 2000);
+  check("heartbeat doesn't answer", st, PRU_MBOX_IDLE);
+  check("heartbeat toggles", s->gpio_sets >= 10 && s->gpio_clears >= 10, 1);
+  check("heartbeat pin", s->gpio_mask, 1u << 24);
+  check("heartbeat busy", ((uint32_t*)s->dram[core])[4], PRU_MBOX_BUSY);
+  /* one half period is 2 + 20 loops */
+  loops = 2000 / (s->gpio_sets + s->gpio_clears);
+  check("heartbeat half period", loops >= 20 * PRU_HB_LOOP_CYCLES &&
+        loops <= 22 * PRU_HB_LOOP_CYCLES, 1);
+  st = sim_call(&p, PRU_CMD_ECHO, 7, 0, 0, &res, 1000);
+  check("echo after heartbeat", res, 8);
+  res = s->gpio_sets;
+  run(&p, 1000);
+  check("heartbeat stopped", s->gpio_sets, res);
+  check("offload fault", p.fault, 0);
+}
+
+static int run_image(struct sim* s, const char* path) {
+  struct pru p;
+  FILE* f;
+  uint32_t words, i;
+
+  f = fopen(path, "rb");
+  if (f == NULL) {
+    perror(path);
+    return 1;
+  }
+  words = fread(s->iram[0], 4, PRU_IRAM_SIZE / 4, f);
+  fclose(f);
+  pru_reset(&p, s, 0);
+  run(&p, 100000000);
+  printf("%u words, %s at pc %u after %llu cycles\n", words,
+         p.halted ? "halted" : "stopped", p.pc, (unsigned long long)p.cycles);
+  for (i = 0; i < 32; i++) {
+    printf("r%-2u %08x%s", i, reg_full(&p, i), (i & 3) == 3 ? "\n" : "  ");
+  }
+  return !p.halted;
+}
+
+int main(int argc, char** argv) {
+  static struct sim s;
+  uint32_t i;
+  int arg = 1;
+
+  if (arg < argc && strcmp(argv[arg], "-t") == 0) {
+    trace = 1;
+    arg++;
+  }
+  s.ddr = malloc(SIM_DDR_SIZE);
+  srand(1);
+  for (i = 0; i < SIM_DDR_SIZE; i++) {
+    s.ddr[i] = rand();
+  }
+  if (arg < argc) {
+    return run_image(&s, argv[arg]);
+  }
+
+  test_isa(&s);
+  for (i = 0; i < PRU_CORES; i++) {
+    test_offload(&s, i);
+  }
+  printf("%s, %d failures\n", failures ? "FAIL" : "PASS", failures);
+  return failures != 0;
+}
@@ -0,0 +1,45 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* batched register read-modify-write, see reg.h */
+#include <common.h>
+#include <reg.h>
+
+void reg_batch_init(struct reg_batch* b) {
+  b->count = 0;
+}
+
+/* merge into the entry for addr, or start a new one */
+void reg_batch_set(struct reg_batch* b, u32_t addr, u32_t mask, u32_t val) {
+  struct reg_staged* r;
+  u32_t i;
+
+  for (i = 0; i < b->count; i++) {
+    r = &b->regs[i];
+    if (r->addr == addr) {
+      r->val = (r->val & ~mask) | (val & mask);
+      r->mask |= mask;
+      return;
+    }
+  }
+  if (b->count == REG_BATCH_MAX) {
+    reg_batch_commit(b);
+  }
+  r = &b->regs[b->count++];
+  r->addr = addr;
+  r->mask = mask;
+  r->val = val & mask;
+}
+
+void reg_batch_commit(struct reg_batch* b) {
+  struct reg_staged* r;
+  u32_t i;
+
+  for (i = 0; i < b->count; i++) {
+    r = &b->regs[i];
+    if (r->mask == 0xFFFFFFFF) {
+      reg_write(r->addr, r->val);
+    } else {
+      reg_update(r->addr, r->mask, r->val);
+    }
+  }
+  b->count = 0;
+}
@@ -0,0 +1,60 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* SPL self relocation.
+   The ROM loads the whole image into on-chip SRAM. Only init.S, handlers.S,
+   this file and what is marked SRAM_TEXT/SRAM_DATA runs from there, the rest
+   is linked to run from SPL_DDR_BASE (see boot.ld). reloc_main brings up the
+   clocks and DDR from SRAM, copies the DDR part over, turns on the MMU and
+   caches and calls main. The SRAM the copy came from is left to
+   sram_arena (mem_init).
+   After a warm reset DDR may still hold a kernel to boot again (warm.h), so
+   the DDR check, which writes all over it, only runs after a cold one.
+   Everything here runs before DDR, so no string literals, library calls or
+   divides, those are linked into the DDR part.
+*/
+#include <common.h>
+#include <cpu.h>
+#include <emif.h>
+#include <mmu.h>
+#include <prcm.h>
+#include <reloc.h>
+
+u32_t reset_status;
+
+void reloc_main(void) {
+  u32_t *src, *dst;
+  u32_t rst, cold;
+
+  rst = REG(PRM_RSTST);
+  REG(PRM_RSTST) = rst;
+  /* no cause recorded counts as cold */
+  cold = rst == 0 || (rst & PRM_RSTST_GLOBAL_COLD_RST);
+
+  mpu_pll_init();
+  core_pll_init();
+  per_pll_init();
+  ddr_pll_init();
+  interface_clocks_init();
+  ddr_init();
+  /* nowhere to run main from, and no UART to say so */
+  if (!(REG(EMIF0_STATUS) & 0x4) || (cold && ddr_check())) {
+    while (1) {}
+  }
+
+  src = _ddr_load_start;
+  for (dst = _ddr_start; dst < _ddr_end; dst++) {
+    *dst = *src++;
+  }
+  for (dst = _begin_bss; dst < _end_bss; dst++) {
+    *dst = 0;
+  }
+  reset_status = rst;
+
+  /* D-cache is still off, the copy is in memory already. mmu_init
+     invalidates the I-cache before anything is fetched from DDR */
+  mmu_init();
+  main();
+  /* nothing left to do, ISRs and threads still run between the WFIs */
+  while (1) {
+    cpu_wfi();
+  }
+}
@@ -0,0 +1,332 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Preemptive priority scheduler, see sched.h.
+   A thread's saved context is the frame irq_handler builds on its stack:
+     r4-r11, vfp context, r0-r3, r12, lr, return address, cpsr
+   with the saved sp pointing at r4. sched_create builds the same frame by
+   hand so a new thread starts through the normal IRQ return path. The VFP
+   registers themselves are only switched when a thread uses them (vfp.h).
+*/
+#include <common.h>
+#include <cpu.h>
+#include <interrupt.h>
+#include <sched.h>
+#include <timer.h>
+#include <vfp.h>
+
+#define THREAD_FREE    0
+#define THREAD_READY   1
+#define THREAD_BLOCKED 2
+#define THREAD_SLEEP   3
+#define THREAD_IRQ     4 /* waiting for any interrupt, see sched_wait_irq */
+
+struct thread {
+  u32_t sp;
+  u32_t prio;
+  u32_t state;
+  u32_t wake; /* sched_ticks to wake at when sleeping */
+  const char* name;
+};
+
+static struct thread threads[SCHED_MAX_THREADS];
+/* thread 0 is main on the boot stack, thread n gets stack n - 1 */
+static u64_t sched_stacks[SCHED_MAX_THREADS - 1][SCHED_STACK_SIZE / 8];
+#ifndef HOST_SIM
+static struct vfp_state sched_vfp[SCHED_MAX_THREADS - 1];
+#endif
+static u32_t sched_current = 0;
+static u32_t sched_running = 0;
+static volatile u32_t sched_resched = 0;
+static u32_t sched_slice = 0;
+volatile u32_t sched_ticks = 0;
+
+/* ask for a switch at the next outermost IRQ exit. from thread context
+   raise the scheduler's software interrupt to get one straight away */
+static void sched_request(void) {
+  sched_resched = 1;
+  if (!irq_context()) {
+    REG(INTC_ISR_SET(IRQ_SCHED >> 5)) = 0x1 << (IRQ_SCHED & 0x1F);
+    cpu_dsb();
+  }
+}
+
+static void sched_wake(u32_t id) {
+  threads[id].state = THREAD_READY;
+  if (threads[id].prio < threads[sched_current].prio) {
+    sched_request();
+  }
+}
+
+/* mark the current thread blocked and leave it. call with IRQs masked, the
+   switch happens once the caller restores them. ISRs and deferred work run
+   on the stack of the thread they interrupted and can't block it, there the
+   callers go round their loops until the condition is met */
+static void sched_block(u32_t state) {
+  if (irq_context()) {
+    return;
+  }
+  threads[sched_current].state = state;
+  sched_request();
+}
+
+/* highest priority ready thread. the search starts after the current one so
+   equal priorities take turns */
+static SRAM_TEXT u32_t sched_pick(void) {
+  u32_t i, id, best;
+
+  best = sched_current;
+  for (i = 1; i <= SCHED_MAX_THREADS; i++) {
+    id = (sched_current + i) % SCHED_MAX_THREADS;
+    if (threads[id].state != THREAD_READY) {
+      continue;
+    }
+    if (threads[best].state != THREAD_READY || threads[id].prio < threads[best].prio ||
+        (best == sched_current && threads[id].prio == threads[best].prio)) {
+      best = id;
+    }
+  }
+  return best;
+}
+
+/* called by irq_dispatch after every ISR but the scheduler's own, with IRQs
+   masked. the threads waiting for an interrupt check for themselves whether
+   it was theirs, one at the same priority gets the CPU straight away */
+SRAM_TEXT void sched_irq_wake(void) {
+  u32_t i;
+
+  if (!sched_running) {
+    return;
+  }
+  for (i = 0; i < SCHED_MAX_THREADS; i++) {
+    if (threads[i].state == THREAD_IRQ) {
+      threads[i].state = THREAD_READY;
+      if (threads[i].prio <= threads[sched_current].prio) {
+        sched_resched = 1;
+      }
+    }
+  }
+}
+
+/* called by irq_dispatch on the way out of the outermost handler, returns
+   non zero if irq_handler should call sched_switch */
+SRAM_TEXT u32_t sched_irq_exit(void) {
+  return sched_running && sched_resched;
+}
+
+/* called from irq_handler with IRQs masked. saves the stack pointer of the
+   current thread and returns the one of the thread to run */
+SRAM_TEXT u32_t sched_switch(u32_t sp) {
+  threads[sched_current].sp = sp;
+  sched_resched = 0;
+  sched_current = sched_pick();
+  return threads[sched_current].sp;
+}
+
+static void sched_soft_isr(void) {
+  REG(INTC_ISR_CLEAR(IRQ_SCHED >> 5)) = 0x1 << (IRQ_SCHED & 0x1F);
+}
+
+static void sched_tick(void) {
+  u32_t i;
+
+  sched_ticks++;
+  for (i = 0; i < SCHED_MAX_THREADS; i++) {
+    if (threads[i].state == THREAD_SLEEP && (s32_t)(sched_ticks - threads[i].wake) >= 0) {
+      sched_wake(i);
+    }
+  }
+  if (++sched_slice >= SCHED_SLICE_MS * SCHED_TICK_HZ / 1000) {
+    sched_slice = 0;
+    sched_resched = 1;
+  }
+}
+
+/* where threads go when their function returns */
+static void sched_exit(void) {
+  cpu_irq_disable();
+  sched_block(THREAD_FREE);
+  cpu_irq_enable();
+  while (1) {}
+}
+
+static void sched_idle(u32_t arg) {
+  (void)arg;
+  while (1) {
+    cpu_wfi();
+  }
+}
+
+/* start a thread running fn(arg), returns its id or -1 when out of slots */
+int sched_create(const char* name, void (*fn)(u32_t arg), u32_t arg, u32_t prio) {
+  u32_t flags, id, i;
+  u32_t* sp;
+
+  flags = cpu_irq_save();
+  for (id = 1; id < SCHED_MAX_THREADS; id++) {
+    if (threads[id].state == THREAD_FREE) {
+      break;
+    }
+  }
+  if (id == SCHED_MAX_THREADS) {
+    cpu_irq_restore(flags);
+    return -1;
+  }
+
+#ifdef HOST_SIM
+  sp = (u32_t*)sim_thread_frame((u32_t)&sched_stacks[id - 1][SCHED_STACK_SIZE / 8], fn, arg,
+                                sched_exit);
+  (void)i;
+#else
+  sp = (u32_t*)&sched_stacks[id - 1][SCHED_STACK_SIZE / 8];
+  *--sp = CPU_MODE_SYS;         /* cpsr: IRQ and FIQ enabled */
+  *--sp = (u32_t)fn;            /* return address */
+  *--sp = (u32_t)sched_exit;    /* lr */
+  *--sp = 0;                    /* r12 */
+  for (i = 3; i > 0; i--) {
+    *--sp = 0;                  /* r3-r1 */
+  }
+  *--sp = arg;                  /* r0 */
+  vfp_state_init(&sched_vfp[id - 1]);
+  *--sp = (u32_t)&sched_vfp[id - 1]; /* vfp context */
+  for (i = 0; i < 8; i++) {
+    *--sp = 0;                  /* r11-r4 */
+  }
+#endif
+
+  threads[id].sp = (u32_t)sp;
+  threads[id].prio = prio;
+  threads[id].name = name;
+  sched_wake(id);
+  cpu_irq_restore(flags);
+  return id;
+}
+
+/* turn main into thread 0 and start the scheduler tick */
+void sched_init(void) {
+  threads[0].prio = SCHED_PRIO_DEFAULT;
+  threads[0].state = THREAD_READY;
+  threads[0].name = "main";
+  sched_current = 0;
+
+  irq_register(IRQ_SCHED, sched_soft_isr);
+  irq_set_priority(IRQ_SCHED, IRQ_PRIO_LOWEST);
+  irq_unmask(IRQ_SCHED);
+  sched_create("idle", sched_idle, 0, SCHED_PRIO_IDLE);
+  sched_running = 1;
+  timer_tick_init(SCHED_TICK_HZ, sched_tick);
+}
+
+u32_t sched_self(void) {
+  return sched_current;
+}
+
+void sched_yield(void) {
+  if (sched_running) {
+    sched_request();
+  }
+}
+
+/* sleep for at least ms milliseconds. until sched_init and in interrupt
+   context the core waits instead of the thread */
+void sched_sleep(u32_t ms) {
+  u32_t flags;
+
+  if (!sched_running || irq_context()) {
+    timer_delay_us(ms * 1000);
+    return;
+  }
+  flags = cpu_irq_save();
+  threads[sched_current].wake = sched_ticks + ms * SCHED_TICK_HZ / 1000 + 1;
+  sched_block(THREAD_SLEEP);
+  cpu_irq_restore(flags);
+}
+
+/* block the current thread until the next interrupt, for waits whose end
+   an ISR signals without knowing who waits. call with IRQs masked, the
+   switch happens once the caller restores them. returns 1 without blocking
+   before sched_init and in interrupt context, the caller sleeps in WFI
+   instead */
+int sched_wait_irq(void) {
+  if (!sched_running || irq_context()) {
+    return 1;
+  }
+  sched_block(THREAD_IRQ);
+  return 0;
+}
+
+/* wake the highest priority thread in a waiters mask and remove it */
+static void sched_wake_one(volatile u32_t* waiters) {
+  u32_t i, best = SCHED_MAX_THREADS;
+
+  for (i = 0; i < SCHED_MAX_THREADS; i++) {
+    if (!(*waiters & (0x1 << i))) {
+      continue;
+    }
+    if (best == SCHED_MAX_THREADS || threads[i].prio < threads[best].prio) {
+      best = i;
+    }
+  }
+  if (best != SCHED_MAX_THREADS) {
+    *waiters &= ~(0x1 << best);
+    sched_wake(best);
+  }
+}
+
+void sem_init(struct sem* s, u32_t count) {
+  s->count = count;
+  s->waiters = 0;
+}
+
+void sem_wait(struct sem* s) {
+  u32_t flags;
+
+  flags = cpu_irq_save();
+  /* the block only takes effect once IRQs are back on, so check again each
+     time around */
+  while (s->count == 0) {
+    s->waiters |= 0x1 << sched_current;
+    sched_block(THREAD_BLOCKED);
+    cpu_irq_restore(flags);
+    flags = cpu_irq_save();
+  }
+  s->count--;
+  cpu_irq_restore(flags);
+}
+
+/* also callable from ISRs */
+void sem_post(struct sem* s) {
+  u32_t flags;
+
+  flags = cpu_irq_save();
+  s->count++;
+  sched_wake_one(&s->waiters);
+  cpu_irq_restore(flags);
+}
+
+void mutex_init(struct mutex* m) {
+  m->owner = 0;
+  m->waiters = 0;
+}
+
+void mutex_lock(struct mutex* m) {
+  u32_t flags;
+
+  flags = cpu_irq_save();
+  while (m->owner != 0) {
+    m->waiters |= 0x1 << sched_current;
+    sched_block(THREAD_BLOCKED);
+    cpu_irq_restore(flags);
+    flags = cpu_irq_save();
+  }
+  m->owner = sched_current + 1;
+  cpu_irq_restore(flags);
+}
+
+/* only from the thread holding it */
+void mutex_unlock(struct mutex* m) {
+  u32_t flags;
+
+  flags = cpu_irq_save();
+  m->owner = 0;
+  sched_wake_one(&m->waiters);
+  cpu_irq_restore(flags);
+}
@@ -0,0 +1,206 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Serial boot: receive a kernel image over UART0 straight into DDR, so it
+   can be tested without rewriting the SD card. See serial_load.h for the
+   protocol and sload.c for the host side.
+*/
+#include <common.h>
+#include <crc32.h>
+#include <log.h>
+#include <serial_load.h>
+#include <timer.h>
+#include <trace.h>
+#include <uart.h>
+
+/* longest gap allowed between bytes of one packet */
+#define SL_BYTE_TIMEOUT_US 20000
+/* give up when the host has been quiet for this many 100ms periods */
+#define SL_IDLE_LIMIT 100
+
+static void sl_respond(u32_t code, u32_t arg) {
+  uart_putc((char)SL_RESP);
+  uart_putc(code);
+  uart_putc(arg & 0xFF);
+  uart_putc((arg >> 8) & 0xFF);
+  uart_putc((arg >> 16) & 0xFF);
+  uart_putc((arg >> 24) & 0xFF);
+}
+
+/* receive len bytes into buf (discard if NULL) while updating the raw CRC
+   register. returns 0 on success, 1 on timeout */
+static int sl_receive(u8_t* buf, u32_t len, u32_t* crc) {
+  u32_t i;
+  char c;
+
+  for (i = 0; i < len; i++) {
+    if (uart_getc_timeout(&c, SL_BYTE_TIMEOUT_US)) {
+      return 1;
+    }
+    *crc = CRC32_BYTE(*crc, (u8_t)c);
+    if (buf != NULL) {
+      buf[i] = c;
+    }
+  }
+  return 0;
+}
+
+static u32_t sl_word(const u8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32_t)p[3] << 24);
+}
+
+/* receive an image to dest, at most max_size bytes. returns 0 and the image
+   size in size on success. the link runs at the baud rate requested by the
+   host during the transfer and goes back to the original rate afterwards */
+int serial_load(u32_t dest, u32_t max_size, u32_t* size) {
+  u8_t hdr[5], buf[12], crc_buf[4];
+  u32_t crc, type, seq, len, idle;
+  u32_t started, expected, received, nak_sent, switching, switch_time;
+  u32_t image_size, image_crc, image_crc_expected, baud, old_baud, unused;
+  int ret;
+  char c;
+
+  crc32_init();
+  uart_rx_irq(false);
+  old_baud = uart_get_baud(NULL);
+  started = 0;
+  expected = 0;
+  received = 0;
+  image_size = 0;
+  image_crc = 0;
+  image_crc_expected = 0;
+  nak_sent = 0xFFFFFFFF;
+  switching = 0;
+  switch_time = 0;
+  idle = 0;
+  ret = 1;
+
+  sl_respond(SL_READY, SL_VERSION);
+  while (1) {
+    /* the host never got to the new rate, wait for its next start at the
+       old one */
+    if (switching &&
+        timer_now() - switch_time > SL_SWITCH_TIMEOUT_US * TIMER_TICKS_PER_US) {
+      uart_set_baud(old_baud, NULL);
+      switching = 0;
+      started = 0;
+    }
+    if (uart_getc_timeout(&c, 100000)) {
+      if (++idle > SL_IDLE_LIMIT) {
+        LOG0("serial load: host timed out\r\n");
+        goto done;
+      }
+      continue;
+    }
+    idle = 0;
+    /* the host keeps sending sync until it has seen our ready */
+    if ((u8_t)c == SL_SYNC && !started) {
+      sl_respond(SL_READY, SL_VERSION);
+      continue;
+    }
+    if ((u8_t)c != SL_SOF) {
+      continue;
+    }
+
+    crc = CRC32_INIT;
+    if (sl_receive(hdr, 5, &crc)) {
+      continue;
+    }
+    type = hdr[0];
+    seq = hdr[1] | (hdr[2] << 8);
+    len = hdr[3] | (hdr[4] << 8);
+    if (len > SL_DATA_LEN) {
+      continue; /* not a real header, resync on the next SOF */
+    }
+
+    if (type == SL_DATA) {
+      /* only in order packets are accepted, everything else in flight is
+         dropped until the host goes back to the one we expect */
+      if (!started || seq != (expected & 0xFFFF) ||
+          expected * SL_DATA_LEN + len > image_size) {
+        sl_receive(NULL, len + 4, &crc);
+        if (nak_sent != expected) {
+          trace_event(TRACE_SERIAL_NAK, expected, seq);
+          sl_respond(SL_NAK, expected);
+          nak_sent = expected;
+        }
+        continue;
+      }
+      /* payload goes straight to its place in DDR */
+      if (sl_receive((u8_t*)(dest + expected * SL_DATA_LEN), len, &crc)) {
+        continue;
+      }
+    } else if (len > sizeof(buf) || sl_receive(buf, len, &crc)) {
+      continue;
+    }
+
+    /* packet crc itself isn't part of the checked data */
+    if (sl_receive(crc_buf, 4, &unused)) {
+      continue;
+    }
+    if (sl_word(crc_buf) != ~crc) {
+      trace_event(TRACE_SERIAL_NAK, expected, seq);
+      sl_respond(SL_NAK, expected);
+      nak_sent = expected;
+      continue;
+    }
+
+    switch (type) {
+      case SL_START:
+        image_size = sl_word(buf);
+        baud = sl_word(buf + 4);
+        image_crc_expected = sl_word(buf + 8);
+        if (len != 12 || image_size > max_size) {
+          sl_respond(SL_FAIL, SL_ERR_SIZE);
+          break;
+        }
+        if (uart_check_baud(baud, NULL)) {
+          sl_respond(SL_FAIL, SL_ERR_BAUD);
+          break;
+        }
+        started = 1;
+        expected = 0;
+        received = 0;
+        image_crc = 0;
+        nak_sent = 0xFFFFFFFF;
+        sl_respond(SL_ACK, expected);
+        /* ack goes out at the old rate, then both sides switch */
+        uart_set_baud(baud, NULL);
+        switching = 1;
+        switch_time = timer_now();
+        break;
+      case SL_PING:
+        /* heard at the new rate, give the host time to see the ack */
+        switch_time = timer_now();
+        sl_respond(SL_ACK, expected);
+        break;
+      case SL_DATA:
+        switching = 0;
+        /* read back from DDR, so this also checks what actually landed */
+        image_crc = crc32_update(image_crc,
+                                 (u8_t*)(dest + expected * SL_DATA_LEN), len);
+        expected++;
+        received += len;
+        sl_respond(SL_ACK, expected);
+        break;
+      case SL_END:
+        if (!started) {
+          break;
+        }
+        if (received == image_size && image_crc == image_crc_expected) {
+          sl_respond(SL_DONE, image_crc);
+          *size = image_size;
+          ret = 0;
+        } else {
+          sl_respond(SL_FAIL, SL_ERR_CRC);
+        }
+        goto done;
+      default:
+        break;
+    }
+  }
+
+done:
+  trace_event(TRACE_SERIAL_LOAD, received, image_crc);
+  uart_set_baud(old_baud, NULL);
+  uart_rx_irq(true);
+  return ret;
+}
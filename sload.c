@@ -0,0 +1,341 @@
+/* Copyright (c) 2023  Hunter Whyte
+  Host side of the serial kernel loader (see include/serial_load.h and
+  serial_load.c). Start it before resetting the board, it keeps sending sync
+  bytes until the bootloader answers during its boot window, then sends the
+  image at the requested baud rate and switches the port back afterwards.
+  Board output before the handshake is passed through to stdout.
+  Works on anything termios can open, including a pty for testing.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "include/serial_load.h"
+
+/* the rate uart_init sets up, the Makefile passes the same UART_BAUD */
+#ifndef UART_BAUD
+#define UART_BAUD 115200
+#endif
+#define CONSOLE_BAUD UART_BAUD
+#define WINDOW 8          /* data packets in flight */
+#define RESP_TIMEOUT_MS 200
+#define MAX_RETRIES 20
+#define SWITCH_RETRIES 3  /* tries at SL_START and the baud switch */
+
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int j = 0; j < 8; j++) {
+      c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+    }
+    crc_table[i] = c;
+  }
+}
+
+/* same as zlib crc32() and crc32_update() on the target */
+static uint32_t crc_update(uint32_t crc, const uint8_t* buf, size_t len) {
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc = crc_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static void put_word(uint8_t* p, uint32_t val) {
+  p[0] = val & 0xFF;
+  p[1] = (val >> 8) & 0xFF;
+  p[2] = (val >> 16) & 0xFF;
+  p[3] = (val >> 24) & 0xFF;
+}
+
+static speed_t baud_to_speed(uint32_t baud) {
+  switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+#ifdef B460800
+    case 460800: return B460800;
+    case 500000: return B500000;
+    case 576000: return B576000;
+    case 921600: return B921600;
+    case 1000000: return B1000000;
+    case 1152000: return B1152000;
+    case 1500000: return B1500000;
+    case 2000000: return B2000000;
+    case 2500000: return B2500000;
+    case 3000000: return B3000000;
+#endif
+    default: return 0;
+  }
+}
+
+static int set_baud(int fd, uint32_t baud) {
+  struct termios tio;
+
+  /* anything still queued goes out at the old rate */
+  tcdrain(fd);
+  if (tcgetattr(fd, &tio)) {
+    return -1;
+  }
+  cfsetispeed(&tio, baud_to_speed(baud));
+  cfsetospeed(&tio, baud_to_speed(baud));
+  return tcsetattr(fd, TCSANOW, &tio);
+}
+
+static int write_all(int fd, const uint8_t* buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* read one byte, waiting at most timeout_ms. returns -1 on timeout, -2 when
+   the port has gone away */
+static int read_byte(int fd, int timeout_ms) {
+  fd_set fds;
+  struct timeval tv;
+  uint8_t c;
+
+  FD_ZERO(&fds);
+  FD_SET(fd, &fds);
+  tv.tv_sec = timeout_ms / 1000;
+  tv.tv_usec = (timeout_ms % 1000) * 1000;
+  if (select(fd + 1, &fds, NULL, NULL, &tv) <= 0) {
+    return -1;
+  }
+  if (read(fd, &c, 1) != 1) {
+    return -2;
+  }
+  return c;
+}
+
+/* wait for a response frame, other bytes are printed when echo is set.
+   returns the response code or -1 on timeout */
+static int read_resp(int fd, int timeout_ms, uint32_t* arg, int echo) {
+  int c, i;
+  uint8_t b[5];
+
+  while ((c = read_byte(fd, timeout_ms)) >= 0) {
+    if (c != SL_RESP) {
+      if (echo) {
+        putchar(c);
+        fflush(stdout);
+      }
+      continue;
+    }
+    for (i = 0; i < 5; i++) {
+      if ((c = read_byte(fd, timeout_ms)) < 0) {
+        return -1;
+      }
+      b[i] = c;
+    }
+    *arg = b[1] | (b[2] << 8) | (b[3] << 16) | ((uint32_t)b[4] << 24);
+    return b[0];
+  }
+  return -1;
+}
+
+static int send_packet(int fd, uint8_t type, uint16_t seq, const uint8_t* payload,
+                       uint16_t len) {
+  static uint8_t pkt[6 + SL_DATA_LEN + 4];
+
+  pkt[0] = SL_SOF;
+  pkt[1] = type;
+  pkt[2] = seq & 0xFF;
+  pkt[3] = seq >> 8;
+  pkt[4] = len & 0xFF;
+  pkt[5] = len >> 8;
+  if (len > 0) {
+    memcpy(pkt + 6, payload, len);
+  }
+  put_word(pkt + 6 + len, crc_update(0, pkt + 1, 5 + len));
+  return write_all(fd, pkt, 6 + len + 4);
+}
+
+/* send a control packet until it gets an answer other than NAK */
+static int transact(int fd, uint8_t type, const uint8_t* payload, uint16_t len,
+                    int timeout_ms, uint32_t* arg) {
+  for (int i = 0; i < MAX_RETRIES; i++) {
+    if (send_packet(fd, type, 0, payload, len)) {
+      return -1;
+    }
+    int r = read_resp(fd, timeout_ms, arg, 0);
+    if (r >= 0 && r != SL_NAK) {
+      return r;
+    }
+  }
+  return -1;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3 && argc != 4) {
+    printf("argument of serial port and kernel binary required\n");
+    printf("usage: ./sload <tty> <kernel.bin> [baud]\n");
+    return 0;
+  }
+  uint32_t baud = (argc == 4) ? strtoul(argv[3], NULL, 0) : CONSOLE_BAUD;
+  if (baud_to_speed(baud) == 0) {
+    printf("unsupported baud rate %u\n", baud);
+    return 1;
+  }
+  if (baud_to_speed(CONSOLE_BAUD) == 0) {
+    printf("console baud rate %u isn't supported on the host\n", CONSOLE_BAUD);
+    return 1;
+  }
+
+  FILE* fin = fopen(argv[2], "rb");
+  if (fin == NULL) {
+    perror(argv[2]);
+    return 1;
+  }
+  fseek(fin, 0L, SEEK_END);
+  long image_size = ftell(fin);
+  fseek(fin, 0, SEEK_SET);
+  uint8_t* image = (uint8_t*)malloc(image_size + 1);
+  if (fread(image, 1, image_size, fin) != (size_t)image_size) {
+    printf("failed to read %s\n", argv[2]);
+    return 1;
+  }
+  fclose(fin);
+  crc_init();
+  uint32_t image_crc = crc_update(0, image, image_size);
+  uint32_t npackets = (image_size + SL_DATA_LEN - 1) / SL_DATA_LEN;
+
+  int fd = open(argv[1], O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    perror(argv[1]);
+    return 1;
+  }
+  struct termios tio;
+  if (tcgetattr(fd, &tio)) {
+    perror("tcgetattr");
+    return 1;
+  }
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  tcsetattr(fd, TCSANOW, &tio);
+  set_baud(fd, CONSOLE_BAUD);
+  tcflush(fd, TCIOFLUSH);
+
+  /* sync until the bootloader notices us */
+  printf("waiting for board on %s, reset it now\n", argv[1]);
+  uint32_t arg;
+  int r;
+  do {
+    uint8_t sync = SL_SYNC;
+    write_all(fd, &sync, 1);
+    r = read_resp(fd, 10, &arg, 1);
+  } while (r != SL_READY);
+  printf("\nboard ready, protocol version %u\n", arg);
+  if (arg != SL_VERSION) {
+    printf("expected protocol version %u\n", SL_VERSION);
+    return 1;
+  }
+  /* drain the ready responses to the rest of the syncs */
+  while (read_resp(fd, 50, &arg, 0) >= 0) {}
+
+  uint8_t start[12];
+  put_word(start, image_size);
+  put_word(start + 4, baud);
+  put_word(start + 8, image_crc);
+  /* the target acks the start at the console rate, the first acked ping
+     confirms the new one. without that both ends fall back and try again */
+  for (int i = 0;; i++) {
+    r = transact(fd, SL_START, start, sizeof(start), RESP_TIMEOUT_MS, &arg);
+    if (r != SL_ACK) {
+      printf("start failed (%c, %u)\n", r < 0 ? '-' : r, arg);
+      return 1;
+    }
+    set_baud(fd, baud);
+    r = transact(fd, SL_PING, NULL, 0, 50, &arg);
+    if (r == SL_ACK) {
+      break;
+    }
+    set_baud(fd, CONSOLE_BAUD);
+    if (i + 1 == SWITCH_RETRIES) {
+      printf("no answer at %u baud\n", baud);
+      return 1;
+    }
+    printf("no answer at %u baud, retrying\n", baud);
+    /* until the target has given up on the switch too */
+    usleep(SL_SWITCH_TIMEOUT_US + 100000);
+    tcflush(fd, TCIFLUSH);
+  }
+
+  /* go-back-N: keep WINDOW packets in flight, on NAK or timeout restart
+     from the first unacknowledged one */
+  struct timeval t0, t1;
+  gettimeofday(&t0, NULL);
+  uint32_t base = 0, next = 0, retries = 0, resent = 0;
+  while (base < npackets) {
+    while (next < npackets && next < base + WINDOW) {
+      uint32_t off = next * SL_DATA_LEN;
+      uint32_t len = (image_size - off < SL_DATA_LEN) ? image_size - off : SL_DATA_LEN;
+      send_packet(fd, SL_DATA, next & 0xFFFF, image + off, len);
+      next++;
+    }
+    r = read_resp(fd, RESP_TIMEOUT_MS, &arg, 0);
+    if (r == SL_ACK && arg > base) {
+      base = arg;
+      retries = 0;
+      if ((base & 0x3F) == 0) {
+        printf("\r%u/%u", base, npackets);
+        fflush(stdout);
+      }
+    } else if (r == SL_NAK || r < 0) {
+      if (++retries > MAX_RETRIES) {
+        printf("\ntoo many retries at packet %u\n", base);
+        return 1;
+      }
+      if (r == SL_NAK && arg > base) {
+        base = arg;
+      }
+      resent += next - base;
+      next = base;
+    }
+  }
+  gettimeofday(&t1, NULL);
+  double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+  printf("\r%u/%u packets, %u resent, %.1f KB/s\n", npackets, npackets, resent,
+         image_size / 1024.0 / secs);
+
+  r = transact(fd, SL_END, NULL, 0, 1000, &arg);
+  set_baud(fd, CONSOLE_BAUD);
+  if (r != SL_DONE) {
+    printf("load failed (%c, %u)\n", r < 0 ? '-' : r, arg);
+    return 1;
+  }
+  printf("done, crc 0x%08x\n", arg);
+
+  /* stay attached as a console until killed or the port goes away */
+  int c;
+  while ((c = read_byte(fd, 1000)) != -2) {
+    if (c >= 0) {
+      putchar(c);
+      fflush(stdout);
+    }
+  }
+  return 0;
+}
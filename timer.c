@@ -1,12 +1,22 @@
 /* Copyright (c) 2023  Hunter Whyte */
 
 #include <common.h>
+#include <cpu.h>
 #include <gpio.h>
 #include <interrupt.h>
 #include <prcm.h>
+#include <sched.h>
 #include <timer.h>
+#include <trace.h>
+#include <work.h>
 
 static void (*timer_callback)(void) = NULL;
+static void (*alarm_callback)(u32_t late) = NULL;
+static void (*tick_callback)(void) = NULL;
+/* TIMER4 one-shot that ends a timer_wait, wake_at is only valid while armed */
+static u32_t wake_ready = 0;
+static volatile u32_t wake_armed = 0;
+static u32_t wake_at;
 
 /* initialize TIMER0 peripheral and set it for periodic interrupts */
 void timer_init(void (*callback)(void)) {
@@ -38,18 +48,236 @@ void timer_init(void (*callback)(void)) {
   timer_callback = callback;
 
   /* register timer ISR */
-  irq_register(66, timer_isr);
+  irq_register(IRQ_TINT0, timer_isr);
+  irq_set_priority(IRQ_TINT0, IRQ_PRIO_DEFAULT);
+  irq_unmask(IRQ_TINT0);
+}
 
-  /* unmask TIMER0 interrupt 66 TIMER0 */
-  REG(INTC_MIR_CLEAR2) = (0x1 << 2);
+static void timer_work(u32_t arg) {
+  (void)arg;
+  timer_callback();
 }
 
-/* Interrupt service for TIMER 0 */
+/* Interrupt service for TIMER 0, the callback runs as deferred work */
 void timer_isr(void) {
   REG(TIMER0_IRQSTATUS) = 0x2;
-  REG(INTC_ISR_CLEAR2) = (0x1 << 2);
+  trace_event(TRACE_IRQ_TIMER, 0, 0);
+  if (timer_callback != NULL) {
+    work_post(timer_work, 0);
+  }
+}
+
+/* start TIMER2 as a free running 24MHz counter, used as the time base for
+   timeouts and measurements and for one-shot alarms */
+void timer_clock_init(void) {
+  /* CLK_M_OSC (24MHz) as functional clock, module enable */
+  REG(CLKSEL_TIMER2_CLK) = 0x1;
+  REG(CM_PER_TIMER2_CLKCTRL) = 0x2;
+  while (REG(CM_PER_TIMER2_CLKCTRL) & (0x3 << 16)) {}
+
+  REG(TIMER2_TLDR) = 0;
+  while (REG(TIMER2_TWPS) & 0x4) {}
+  REG(TIMER2_TCRR) = 0;
+  while (REG(TIMER2_TWPS) & 0x2) {}
+  /* start with auto-reload, so it wraps to 0 after 0xFFFFFFFF */
+  REG(TIMER2_TCLR) = 0x3;
+  while (REG(TIMER2_TWPS) & 0x1) {}
+
+  /* alarms are for latency sensitive work, let them preempt other ISRs */
+  irq_register(IRQ_TINT2, timer2_isr);
+  irq_set_priority(IRQ_TINT2, IRQ_PRIO_HIGH);
+  irq_unmask(IRQ_TINT2);
+
+  /* TIMER4 from the same clock for timer_wait timeouts, only loaded and
+     started when a wait needs it */
+  REG(CLKSEL_TIMER4_CLK) = 0x1;
+  REG(CM_PER_TIMER4_CLKCTRL) = 0x2;
+  while (REG(CM_PER_TIMER4_CLKCTRL) & (0x3 << 16)) {}
+  REG(TIMER4_IRQENABLE_SET) = 0x2;
+  irq_register(IRQ_TINT4, timer4_isr);
+  irq_set_priority(IRQ_TINT4, IRQ_PRIO_DEFAULT);
+  irq_unmask(IRQ_TINT4);
+  wake_ready = 1;
+}
+
+/* current TIMER2 count, TIMER_TICKS_PER_US ticks per microsecond */
+u32_t timer_now(void) {
+  return REG(TIMER2_TCRR);
+}
+
+/* call callback from the TIMER2 interrupt once the counter reaches when.
+   late is how many ticks after when the interrupt handler started running.
+   callback runs in the ISR (or FIQ) itself, keep it short.
+   only one alarm at a time, setting a new one replaces the old one */
+void timer_alarm(u32_t when, void (*callback)(u32_t late)) {
+  alarm_callback = callback;
+  REG(TIMER2_TMAR) = when;
+  while (REG(TIMER2_TWPS) & 0x10) {}
+  REG(TIMER2_IRQSTATUS) = 0x1;
+  REG(TIMER2_IRQENABLE_SET) = 0x1;
+  /* compare enable */
+  REG(TIMER2_TCLR) |= (0x1 << 6);
+  while (REG(TIMER2_TWPS) & 0x1) {}
+}
+
+void timer_alarm_cancel(void) {
+  REG(TIMER2_IRQENABLE_CLEAR) = 0x1;
+  REG(TIMER2_TCLR) &= ~(0x1 << 6);
+  while (REG(TIMER2_TWPS) & 0x1) {}
+  REG(TIMER2_IRQSTATUS) = 0x1;
+}
+
+/* Interrupt service for TIMER 2, match event for the alarm. also works when
+   routed to FIQ */
+void timer2_isr(void) {
+  u32_t late;
+
+  /* read first, this is what timer_alarm reports as latency */
+  late = REG(TIMER2_TCRR) - REG(TIMER2_TMAR);
+  timer_alarm_cancel();
+  if (alarm_callback != NULL) {
+    alarm_callback(late);
+  }
+}
+
+/* periodic interrupt at hz from TIMER3 (24MHz), callback runs in the ISR.
+   used for the scheduler tick */
+void timer_tick_init(u32_t hz, void (*callback)(void)) {
+  REG(CLKSEL_TIMER3_CLK) = 0x1;
+  REG(CM_PER_TIMER3_CLKCTRL) = 0x2;
+  while (REG(CM_PER_TIMER3_CLKCTRL) & (0x3 << 16)) {}
+
+  tick_callback = callback;
+  /* overflow every 24MHz / hz ticks */
+  REG(TIMER3_TLDR) = 0xFFFFFFFF - (TIMER_TICKS_PER_US * 1000000 / hz) + 1;
+  while (REG(TIMER3_TWPS) & 0x4) {}
+  REG(TIMER3_TTGR) = 0x1;
+  while (REG(TIMER3_TWPS) & 0x8) {}
+  REG(TIMER3_IRQENABLE_SET) = 0x2;
+
+  irq_register(IRQ_TINT3, timer3_isr);
+  irq_set_priority(IRQ_TINT3, IRQ_PRIO_DEFAULT);
+  irq_unmask(IRQ_TINT3);
+
+  /* start with auto-reload */
+  REG(TIMER3_TCLR) = 0x3;
+  while (REG(TIMER3_TWPS) & 0x1) {}
+}
+
+/* Interrupt service for TIMER 3, overflow */
+void timer3_isr(void) {
+  REG(TIMER3_IRQSTATUS) = 0x2;
+  if (tick_callback != NULL) {
+    tick_callback();
+  }
+}
+
+/* stop everything that interrupts: the TIMER0 and TIMER3 periodic
+   interrupts, the TIMER2 alarm and a pending TIMER4 wake. TIMER2 keeps
+   counting, timer_wait still works with IRQs masked afterwards. timers that
+   were never clocked are left alone, touching them would abort */
+void timer_stop(void) {
   if (timer_callback != NULL) {
-    timer_callback();
+    REG(TIMER0_IRQENABLE_CLEAR) = 0x2;
+    REG(TIMER0_TCLR) &= ~0x1;
+    while (REG(TIMER0_TWPS) & 0x1) {}
+    REG(TIMER0_IRQSTATUS) = 0x2;
+  }
+  if (tick_callback != NULL) {
+    REG(TIMER3_IRQENABLE_CLEAR) = 0x2;
+    REG(TIMER3_TCLR) &= ~0x1;
+    while (REG(TIMER3_TWPS) & 0x1) {}
+    REG(TIMER3_IRQSTATUS) = 0x2;
+  }
+  if (wake_ready) {
+    timer_alarm_cancel();
+    REG(TIMER4_TCLR) = 0;
+    while (REG(TIMER4_TWPS) & 0x1) {}
+    REG(TIMER4_IRQSTATUS) = 0x2;
+    wake_armed = 0;
+  }
+}
+
+/* make sure TIMER4 fires by when. an earlier deadline already set is kept,
+   the waiter it doesn't belong to just wakes up once for nothing. call with
+   IRQs masked */
+static void timer_wake(u32_t when) {
+  u32_t left;
+
+  if (wake_armed && (s32_t)(when - wake_at) >= 0) {
+    return;
+  }
+  left = when - timer_now();
+  if ((s32_t)left <= 0) {
+    left = 1;
   }
-  REG(INTC_CONTROL) = 0x1;
+  REG(TIMER4_TCLR) = 0;
+  while (REG(TIMER4_TWPS) & 0x1) {}
+  REG(TIMER4_IRQSTATUS) = 0x2;
+  /* counts up to the overflow, one-shot */
+  REG(TIMER4_TCRR) = 0 - left;
+  while (REG(TIMER4_TWPS) & 0x2) {}
+  REG(TIMER4_TCLR) = 0x1;
+  while (REG(TIMER4_TWPS) & 0x1) {}
+  wake_at = when;
+  wake_armed = 1;
+}
+
+/* Interrupt service for TIMER 4, its only job was waking the core up */
+void timer4_isr(void) {
+  REG(TIMER4_IRQSTATUS) = 0x2;
+  wake_armed = 0;
+}
+
+/* sleep until done(arg) returns non zero or timeout_us has passed, returns
+   0 when done and 1 on timeout. something has to interrupt when done can
+   become true: its ISR runs between the checks, or with IRQs masked by the
+   caller the pending line alone ends the WFI. done is checked with IRQs
+   masked. NULL just sleeps for timeout_us, up to ~4s.
+   a thread blocks (sched_wait_irq) and leaves the CPU to the others, the
+   core only goes into WFI with IRQs masked or before sched_init. before
+   timer_clock_init and in ISRs, where lower priority lines can't wake the
+   core, it polls instead */
+int timer_wait(int (*done)(u32_t arg), u32_t arg, u32_t timeout_us) {
+  u32_t start, ticks, flags;
+  int ret;
+
+  if (!wake_ready || irq_context()) {
+    start = cpu_cycles();
+    while (done == NULL || !done(arg)) {
+      if (cpu_cycles() - start > timeout_us * CPU_CYCLES_PER_US) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+  start = timer_now();
+  ticks = timeout_us * TIMER_TICKS_PER_US;
+  while (1) {
+    flags = cpu_irq_save();
+    if (done != NULL && done(arg)) {
+      ret = 0;
+      break;
+    }
+    if (timer_now() - start >= ticks) {
+      ret = 1;
+      break;
+    }
+    timer_wake(start + ticks);
+    if ((flags & CPU_IRQ_MASKED) || sched_wait_irq()) {
+      cpu_wfi();
+      /* timer4_isr doesn't get to run while the caller has IRQs masked */
+      if ((flags & CPU_IRQ_MASKED) && (REG(TIMER4_IRQSTATUS) & 0x2)) {
+        timer4_isr();
+      }
+    }
+    /* a blocked thread switches out here and comes back after an IRQ */
+    cpu_irq_restore(flags);
+  }
+  cpu_irq_restore(flags);
+  return ret;
+}
+
+void timer_delay_us(u32_t us) {
+  timer_wait(NULL, 0, us);
 }
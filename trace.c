@@ -0,0 +1,70 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Binary event trace. Events are written as fixed size records into a ring
+   buffer at the end of DDR so that tracing doesn't change the timing being
+   measured the way printing over UART does. The buffer is dumped over UART
+   on demand in frames of its own, which log_decode skips and trace_decode
+   turns into a timeline on the host.
+*/
+#include <common.h>
+#include <cpu.h>
+#include <log.h>
+#include <memlayout.h>
+#include <trace.h>
+#include <uart.h>
+
+/* total number of events recorded, the ring index is this modulo the size */
+volatile u32_t trace_head = 0;
+volatile u32_t trace_enabled = 0;
+
+/* must be called after DDR is initialized and checked, the DDR check
+   overwrites the region the ring buffer lives in. timestamps need the cycle
+   counter, main starts it right after the PLLs */
+void trace_init(void) {
+  trace_head = 0;
+  trace_enabled = 1;
+}
+
+static void trace_put_word(u32_t w) {
+  uart_putc(w & 0xFF);
+  uart_putc((w >> 8) & 0xFF);
+  uart_putc((w >> 16) & 0xFF);
+  uart_putc((w >> 24) & 0xFF);
+}
+
+/* one frame of the dump (log.h), sent with IRQs masked so log frames only
+   ever go out between two of them */
+static void trace_frame(const u32_t* words, u32_t n) {
+  u32_t flags, i;
+
+  flags = cpu_irq_save();
+  uart_putc((char)LOG_FRAME_SYNC_TRACE);
+  uart_putc(4 * n);
+  for (i = 0; i < n; i++) {
+    trace_put_word(words[i]);
+  }
+  cpu_irq_restore(flags);
+}
+
+/* write out the contents of the ring buffer oldest record first, a frame for
+   the header (magic, record count, cycle counter frequency) and one for each
+   record. takes seconds at the console rate, call it from a thread */
+void trace_dump(void) {
+  struct trace_rec* rec;
+  u32_t head, count, i;
+  u32_t hdr[3];
+
+  /* stop recording so the records don't change under us */
+  trace_enabled = 0;
+  head = trace_head;
+  count = (head < TRACE_NUM_RECS) ? head : TRACE_NUM_RECS;
+
+  hdr[0] = TRACE_DUMP_MAGIC;
+  hdr[1] = count;
+  hdr[2] = 1000000000; /* MPU clock, see mpu_pll_init */
+  trace_frame(hdr, 3);
+  for (i = head - count; i != head; i++) {
+    rec = (struct trace_rec*)TRACE_BUF_BASE + (i & (TRACE_NUM_RECS - 1));
+    trace_frame(&rec->ts, 4);
+  }
+  trace_enabled = 1;
+}
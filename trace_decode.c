@@ -0,0 +1,127 @@
+/* Copyright (c) 2023  Hunter Whyte
+  Host side decoder for the binary trace dumped by trace_dump() on the target.
+  Takes a raw capture of the serial console (which may contain regular text
+  and log frames around and between the dump frames), puts the dump back
+  together from its frames (see include/log.h), finds the dump header and
+  prints a timeline of the recorded events. Timestamps are the 32 bit PMU
+  cycle counter, wraps are unrolled assuming no two consecutive events are
+  more than one counter period (~4.3s at 1GHz) apart.
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/log.h"
+#include "include/trace_events.h"
+
+#define TRACE_DUMP_MAGIC 0x31435254
+#define TRACE_TAG_IRQ (0x1 << 16)
+
+#define TRACE_NAME(name, fmt) #name,
+#define TRACE_FMT(name, fmt) fmt,
+static const char* event_names[] = {TRACE_EVENTS(TRACE_NAME)};
+static const char* event_fmts[] = {TRACE_EVENTS(TRACE_FMT)};
+#define NUM_EVENTS (sizeof(event_names) / sizeof(event_names[0]))
+
+static uint32_t get_word(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* move the payload of the dump frames in capture to the front, stepping
+   over log frames whose contents could look like a sync byte. returns the
+   length of the dump stream */
+static long unframe(uint8_t* data, long size) {
+  long i = 0, out = 0;
+
+  while (i < size) {
+    uint8_t c = data[i++];
+    if (c == LOG_FRAME_SYNC && i + 3 <= size) {
+      i += 3 + 4 * (data[i] <= LOG_MAX_ARGS ? data[i] : 0);
+    } else if (c == LOG_FRAME_SYNC_STR && i < size) {
+      i += 1 + data[i];
+    } else if (c == LOG_FRAME_SYNC_TRACE && i < size) {
+      long len = data[i++];
+      if (len > size - i) {
+        len = size - i;
+      }
+      memmove(data + out, data + i, len);
+      out += len;
+      i += len;
+    }
+  }
+  return out;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    printf("argument of serial capture file required\n");
+    printf("usage: ./trace_decode <capture.bin>\n");
+    return 0;
+  }
+
+  FILE* fin = fopen(argv[1], "rb");
+  if (fin == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  fseek(fin, 0L, SEEK_END);
+  long size = ftell(fin);
+  fseek(fin, 0, SEEK_SET);
+  uint8_t* data = (uint8_t*)malloc(size);
+  if (fread(data, 1, size, fin) != (size_t)size) {
+    printf("failed to read %s\n", argv[1]);
+    return 1;
+  }
+  fclose(fin);
+  size = unframe(data, size);
+
+  /* find the last dump in the capture */
+  long start = -1;
+  for (long i = 0; i + 12 <= size; i++) {
+    if (get_word(data + i) == TRACE_DUMP_MAGIC) {
+      start = i;
+    }
+  }
+  if (start < 0) {
+    printf("no trace dump found in %s\n", argv[1]);
+    return 1;
+  }
+
+  uint32_t count = get_word(data + start + 4);
+  uint32_t hz = get_word(data + start + 8);
+  const uint8_t* rec = data + start + 12;
+  if ((size - start - 12) / 16 < count) {
+    printf("capture truncated, %ld of %u records present\n", (size - start - 12) / 16, count);
+    count = (size - start - 12) / 16;
+  }
+  printf("%u records, counter at %u Hz\n", count, hz);
+  printf("%14s %12s %4s  %-16s\n", "time (us)", "delta (us)", "ctx", "event");
+
+  uint64_t now = 0;
+  uint32_t last_ts = 0;
+  for (uint32_t i = 0; i < count; i++, rec += 16) {
+    uint32_t ts = get_word(rec);
+    uint32_t tag = get_word(rec + 4);
+    uint32_t arg0 = get_word(rec + 8);
+    uint32_t arg1 = get_word(rec + 12);
+    uint32_t id = tag & 0xFFFF;
+    /* unsigned subtraction handles one counter wrap between events */
+    uint32_t delta = (i == 0) ? 0 : ts - last_ts;
+    now += delta;
+    last_ts = ts;
+
+    printf("%14.3f %12.3f %4s  ", now * 1e6 / hz, delta * 1e6 / hz,
+           (tag & TRACE_TAG_IRQ) ? "irq" : "main");
+    if (id < NUM_EVENTS) {
+      printf("%-16s ", event_names[id]);
+      printf(event_fmts[id], arg0, arg1);
+    } else {
+      printf("unknown event %u 0x%08x 0x%08x", id, arg0, arg1);
+    }
+    printf("\n");
+  }
+
+  free(data);
+  return 0;
+}
@@ -3,29 +3,113 @@
   Beaglebone Black. Could be expanded upon in the future to be more general.
 */
 #include <common.h>
+#include <cpu.h>
 #include <gpio.h>
 #include <interrupt.h>
 #include <prcm.h>
+#include <reg.h>
+#include <timer.h>
+#include <trace.h>
 #include <uart.h>
+#include <work.h>
 
 /* J1 Header on BBB board uses UART0_TX and UART0_RX */
 /* hardware flow control (CTS/RTS) not connected */
 
 void (*uart_callback)(char) = NULL;
 
-/* initialize UART0 peripheral and set it up for polling I/O */
+/* TX ring buffer drained into the 64 byte TX FIFO by the THR interrupt.
+   head and tail are free running, size has to be a power of 2 */
+#define UART_TX_BUF_SIZE 1024
+static volatile char uart_tx_buf[UART_TX_BUF_SIZE];
+static volatile u32_t uart_tx_head = 0;
+static volatile u32_t uart_tx_tail = 0;
+
+/* IER bits */
+#define UART_IER_RHR 0x1
+#define UART_IER_THR 0x2
+
+/* IIR IT_TYPE values [AM335x TRM table 19-37] */
+#define UART_IIR_THR        0x1
+#define UART_IIR_RHR        0x2
+#define UART_IIR_LINE_STS   0x3
+#define UART_IIR_RX_TIMEOUT 0x6
+
+/* RHR interrupt enable, cleared while RX is polled (serial loader) except
+   while uart_getc_timeout sleeps, then it only wakes the core up */
+static volatile u32_t uart_ier_rx = UART_IER_RHR;
+static volatile u32_t uart_rx_polled = 0;
+
+/* current baud rate and its error from the requested rate in ppm */
+static u32_t uart_baud = 0;
+static s32_t uart_baud_err = 0;
+
+/* compute the divisor for a baud rate, picking whichever of 16x and 13x
+   oversampling gets closer [AM335x TRM 19.3.8.1.3]. mode is the MDR1 value.
+   returns 0 if the rate can be generated within UART_BAUD_MAX_ERR */
+static int uart_baud_divisor(u32_t baud, u32_t* div, u32_t* mode, s32_t* err_ppm) {
+  u32_t i, d, actual, diff;
+  s32_t err;
+  static const u32_t oversample[] = {16, 13};
+  static const u32_t mdr1[] = {0x0, 0x3};
+
+  if (baud == 0) {
+    return 1;
+  }
+  *div = 0;
+  *err_ppm = 0x7FFFFFFF;
+  for (i = 0; i < 2; i++) {
+    /* round to nearest divisor, 14 bits available over DLL/DLH */
+    d = (UART_FCLK + (oversample[i] * baud) / 2) / (oversample[i] * baud);
+    if (d == 0 || d > 0x3FFF) {
+      continue;
+    }
+    actual = UART_FCLK / (oversample[i] * d);
+    diff = (actual > baud) ? actual - baud : baud - actual;
+    err = (s32_t)(((u64_t)diff * 1000000) / baud);
+    if (actual < baud) {
+      err = -err;
+    }
+    /* ties go to 16x, it samples each bit more often */
+    if (*div == 0 || (err < 0 ? -err : err) < (*err_ppm < 0 ? -*err_ppm : *err_ppm)) {
+      *div = d;
+      *mode = mdr1[i];
+      *err_ppm = err;
+    }
+  }
+  if (*div == 0 || *err_ppm > UART_BAUD_MAX_ERR || *err_ppm < -UART_BAUD_MAX_ERR) {
+    return 1;
+  }
+  return 0;
+}
+
+/* write divisor and oversampling mode. the UART is disabled while the
+   divisor changes and the line format in LCR is kept */
+static void uart_load_divisor(u32_t div, u32_t mode) {
+  u32_t lcr;
+
+  REG(UART0_MDR1) = 0x7; /* disable UART */
+  lcr = REG(UART0_LCR);
+  REG(UART0_LCR) = 0x0080; /* register configuration mode A for DLL/DLH */
+  REG(UART0_DLL) = div & 0xFF;
+  REG(UART0_DLH) = (div >> 8) & 0x3F;
+  REG(UART0_LCR) = lcr;
+  REG(UART0_MDR1) = mode;
+}
+
+/* initialize UART0 peripheral and set it up for interrupt driven I/O */
 void uart_init(void (*callback)(char)) {
+  u32_t div, mode;
+
   /* Enable UART0 functional clock [AM335x TRM 1284] */
-  REG(CM_WKUP_UART0_CLKCTRL) &= ~0x3; /* clear MODULEMODE */
-  REG(CM_WKUP_UART0_CLKCTRL) |= 0x2;  /* MODULEMODE = enable */
+  REG_SET(CM_WKUP_UART0_CLKCTRL, CM_MODULEMODE, CM_MODULEMODE_ENABLE);
   /* poll idle status waiting for fully enabled */
-  while (REG(CM_WKUP_UART0_CLKCTRL) & (0x3 << 16)) {}
+  while (REG_GET(CM_IDLEST, REG(CM_WKUP_UART0_CLKCTRL)) != CM_IDLEST_FUNC) {}
 
   /* Enable UART0 interface clock l4_wkup */
-  REG(CM_WKUP_L4WKUP_CLKCTRL) &= ~0x3; /* clear MODULEMODE */
-  REG(CM_WKUP_L4WKUP_CLKCTRL) |= 0x2;  /* MODULEMODE = enable */
+  REG_SET(CM_WKUP_L4WKUP_CLKCTRL, CM_MODULEMODE, CM_MODULEMODE_ENABLE);
   /* poll idle status waiting for fully enabled */
-  while (REG(CM_WKUP_L4WKUP_CLKCTRL) & (0x3 << 16)) {}
+  while (REG_GET(CM_IDLEST, REG(CM_WKUP_L4WKUP_CLKCTRL)) != CM_IDLEST_FUNC) {}
 
   /* Control module pin muxing */
   REG(CONTROL_MODULE_UART0_RXD) = 0x30; /* pullup, receiver enabled */
@@ -39,42 +123,154 @@ void uart_init(void (*callback)(char)) {
   /* Disable UART to access protocol, baud rate, interrupt settings */
   REG(UART0_MDR1) |= 0x7;
 
+  /* switch to register configuration mode B, enhanced functions are needed
+     to be able to write the FIFO trigger levels in FCR */
+  REG(UART0_LCR) = 0x00BF;
+  REG(UART0_EFR) |= 0x10;
   /* switch to register configuration mode A */
   REG(UART0_LCR) = 0x0080;
   /* disable modem control */
   REG(UART0_MCR) = 0x00;
-  /* enable FIFO */
-  REG(UART0_FCR) = 0x07;
-  /* load divisor values to achieve baud rate of 115200 */
-  /* [AM335x TRM table 19-25] for divisor values */
-  REG(UART0_DLL) = 0x1A;
-  REG(UART0_DLH) = 0x00;
+  /* enable and clear FIFOs, THR interrupt when TX FIFO has 32 spaces,
+     RHR interrupt at 8 characters (single characters come in on timeout) */
+  REG(UART0_FCR) = (0x0 << 6) | (0x2 << 4) | 0x07;
 
   /* set protocol formatting */
   /* no parity, 1 stop bit, 8 bit chars */
   REG(UART0_LCR) = 0x000B;
-  /* enable RHR interrupt */
-  REG(UART0_IER_UART) = 0x1;
-  /* mode select */
-  REG(UART0_MDR1) = 0x0; /* clear all, UART 16x mode */
+  /* enable RHR interrupt, THR interrupt only gets enabled while there is
+     something in the TX ring buffer */
+  REG(UART0_IER_UART) = uart_ier_rx;
+
+  /* load divisor and select 16x/13x mode, this enables the UART again.
+     fall back to 115200 if the configured rate can't be generated */
+  if (uart_baud_divisor(UART_BAUD, &div, &mode, &uart_baud_err)) {
+    uart_baud_divisor(115200, &div, &mode, &uart_baud_err);
+    uart_baud = 115200;
+  } else {
+    uart_baud = UART_BAUD;
+  }
+  uart_load_divisor(div, mode);
 
   REG(UART0_RESUME);
 
   uart_callback = callback;
-  /* register UART ISR */
-  irq_register(72, uart_isr);
+  /* register UART ISR. with a 64 byte FIFO each way the UART can wait the
+     longest, so it runs below everything else */
+  irq_register(IRQ_UART0, uart_isr);
+  irq_set_priority(IRQ_UART0, IRQ_PRIO_LOW);
+  irq_unmask(IRQ_UART0);
+}
 
-  /* unmask UART0 interrupt */
-  /* 72 UART0INT */
-  /* each MIR register has 32 bits, so we are in MIR2. #72-(2*32) = 8 */
-  REG(INTC_MIR_CLEAR2) = (0x1 << 8);
+/* move as much as fits from the ring buffer into the TX FIFO. disables the
+   THR interrupt once the ring is empty. call with IRQs masked */
+static void uart_tx_fill(void) {
+  /* SSR bit 0 is TX FIFO full */
+  while (uart_tx_head != uart_tx_tail && !(REG(UART0_SSR) & 0x1)) {
+    REG(UART0_THR) = uart_tx_buf[uart_tx_tail & (UART_TX_BUF_SIZE - 1)];
+    uart_tx_tail++;
+  }
+  if (uart_tx_head == uart_tx_tail) {
+    REG(UART0_IER_UART) = uart_ier_rx;
+  }
 }
 
-/* write char out to UART. blocks if Tx FIFO is full */
+/* queue char for output. only blocks when the ring buffer is full, in which
+   case the FIFO is fed by polling so this also works with IRQs masked */
 void uart_putc(char c) {
+  u32_t flags;
+
+  flags = cpu_irq_save();
+  /* nothing queued and room in the FIFO, skip the ring buffer */
+  if (uart_tx_head == uart_tx_tail && !(REG(UART0_SSR) & 0x1)) {
+    REG(UART0_THR) = c;
+    cpu_irq_restore(flags);
+    return;
+  }
+  while (uart_tx_head - uart_tx_tail >= UART_TX_BUF_SIZE) {
+    uart_tx_fill();
+  }
+  uart_tx_buf[uart_tx_head & (UART_TX_BUF_SIZE - 1)] = c;
+  uart_tx_head++;
+  REG(UART0_IER_UART) = uart_ier_rx | UART_IER_THR;
+  cpu_irq_restore(flags);
+}
+
+static int uart_tx_empty(u32_t arg) {
+  (void)arg;
+  return uart_tx_head == uart_tx_tail;
+}
+
+/* microseconds to send n characters at the current rate */
+static u32_t uart_chars_us(u32_t n) {
+  return uart_baud < 1000 ? 0 : n * 10000 / (uart_baud / 1000);
+}
+
+/* block until everything queued has been shifted out. doesn't rely on the
+   THR interrupt so it can be used with IRQs masked, e.g. before handing over
+   to the kernel or when reporting a crash */
+void uart_flush(void) {
+  u32_t flags;
+
+  /* with IRQs on the THR interrupt empties the ring, sleep meanwhile */
+  flags = cpu_irq_save();
+  cpu_irq_restore(flags);
+  if (!(flags & CPU_IRQ_MASKED)) {
+    timer_wait(uart_tx_empty, 0, uart_chars_us(UART_TX_BUF_SIZE));
+  }
+  while (uart_tx_head != uart_tx_tail) {
+    flags = cpu_irq_save();
+    uart_tx_fill();
+    cpu_irq_restore(flags);
+  }
+  /* no interrupt for the FIFO running empty, sleep for as long as what's in
+     it takes to send and poll for the shift register after that */
+  timer_delay_us(uart_chars_us(REG(UART0_TXFIFO_LVL)));
   while (!(REG(UART0_LSR_UART) & 0x40)) {}
-  REG(UART0_THR) = c;
-  gpio_led_toggle(3);
+}
+
+/* change the baud rate at runtime, e.g. when a host tool negotiates a faster
+   link. anything queued is sent at the old rate first. returns 0 on success,
+   1 if the rate can't be generated, in which case nothing changes.
+   err_ppm gets the error of the generated rate, can be NULL */
+int uart_set_baud(u32_t baud, s32_t* err_ppm) {
+  u32_t div, mode;
+  s32_t err;
+
+  if (uart_baud_divisor(baud, &div, &mode, &err)) {
+    return 1;
+  }
+  uart_flush();
+  uart_load_divisor(div, mode);
+  uart_baud = baud;
+  uart_baud_err = err;
+  if (err_ppm != NULL) {
+    *err_ppm = err;
+  }
+  return 0;
+}
+
+/* check if a baud rate can be generated without changing anything. returns
+   0 if it can, err_ppm gets the error it would have, can be NULL */
+int uart_check_baud(u32_t baud, s32_t* err_ppm) {
+  u32_t div, mode;
+  s32_t err;
+
+  if (uart_baud_divisor(baud, &div, &mode, &err)) {
+    return 1;
+  }
+  if (err_ppm != NULL) {
+    *err_ppm = err;
+  }
+  return 0;
+}
+
+/* returns the current baud rate, err_ppm gets its error, can be NULL */
+u32_t uart_get_baud(s32_t* err_ppm) {
+  if (err_ppm != NULL) {
+    *err_ppm = uart_baud_err;
+  }
+  return uart_baud;
 }
 
 /* print null terminated string */
@@ -99,6 +295,20 @@ void uart_hexdump(u32_t val) {
   }
 }
 
+/* utility to print out a 32 bit value in decimal */
+void uart_putdec(u32_t val) {
+  char digits[10];
+  s32_t i = 0;
+
+  do {
+    digits[i++] = '0' + (val % 10);
+    val /= 10;
+  } while (val != 0);
+  while (i > 0) {
+    uart_putc(digits[--i]);
+  }
+}
+
 /* poll for new character from UART, returns 0 if Rx FIFO is empty */
 char uart_getc(void) {
   /* check if there is at least one character in Rx FIFO */
@@ -110,14 +320,92 @@ char uart_getc(void) {
   }
 }
 
-/* TODO: assuming interrupt is RHR since its only one enabled */
+static int uart_rx_ready(u32_t arg) {
+  (void)arg;
+  return REG(UART0_LSR_UART) & 0x1;
+}
+
+/* wait for a character for up to timeout_us microseconds, returns 0 and the
+   character in c if one arrived. RX interrupts have to be disabled with
+   uart_rx_irq(false) first or the ISR takes the characters */
+int uart_getc_timeout(char* c, u32_t timeout_us) {
+  u32_t flags;
+  int ret;
+
+  if (!uart_rx_ready(0)) {
+    /* sleep with the RHR interrupt on, uart_isr turns it off again without
+       touching the FIFO while RX is polled */
+    flags = cpu_irq_save();
+    uart_ier_rx = UART_IER_RHR;
+    REG(UART0_IER_UART) = uart_ier_rx | (REG(UART0_IER_UART) & UART_IER_THR);
+    cpu_irq_restore(flags);
+    ret = timer_wait(uart_rx_ready, 0, timeout_us);
+    flags = cpu_irq_save();
+    uart_ier_rx = uart_rx_polled ? 0 : UART_IER_RHR;
+    REG(UART0_IER_UART) = uart_ier_rx | (REG(UART0_IER_UART) & UART_IER_THR);
+    cpu_irq_restore(flags);
+    if (ret) {
+      return 1;
+    }
+  }
+  *c = REG(UART0_RHR) & 0xFF;
+  return 0;
+}
+
+/* enable or disable the RX interrupt, for code that polls RX itself */
+void uart_rx_irq(u32_t enable) {
+  u32_t flags;
+
+  flags = cpu_irq_save();
+  uart_ier_rx = enable ? UART_IER_RHR : 0;
+  uart_rx_polled = !enable;
+  REG(UART0_IER_UART) = uart_ier_rx | (REG(UART0_IER_UART) & UART_IER_THR);
+  cpu_irq_restore(flags);
+}
+
+static void uart_rx_work(u32_t c) {
+  uart_callback((char)c);
+}
+
+/* Interrupt service for UART0, handles RX data and TX FIFO refills. the RX
+   callback runs as deferred work */
 void uart_isr(void) {
+  u32_t iir, flags;
   char received;
 
-  gpio_led_toggle(2);
-  received = REG(UART0_RHR);
-  if (uart_callback != NULL) {
-    uart_callback(received);
+  /* IIR bit 0 low means an interrupt is pending */
+  while (!((iir = REG(UART0_IIR_UART)) & 0x1)) {
+    switch ((iir >> 1) & 0x1F) {
+      case UART_IIR_THR:
+        flags = cpu_irq_save();
+        uart_tx_fill();
+        cpu_irq_restore(flags);
+        break;
+      case UART_IIR_RHR:
+      case UART_IIR_RX_TIMEOUT:
+        if (uart_rx_polled) {
+          /* this only woke up uart_getc_timeout */
+          flags = cpu_irq_save();
+          uart_ier_rx = 0;
+          REG(UART0_IER_UART) &= ~UART_IER_RHR;
+          cpu_irq_restore(flags);
+          break;
+        }
+        gpio_led_toggle(2);
+        /* drain everything in the RX FIFO */
+        while (REG(UART0_LSR_UART) & 0x1) {
+          received = REG(UART0_RHR);
+          trace_event(TRACE_IRQ_UART, received, 0);
+          if (uart_callback != NULL) {
+            work_post(uart_rx_work, (u8_t)received);
+          }
+        }
+        break;
+      case UART_IIR_LINE_STS:
+      default:
+        /* reading LSR clears line status errors */
+        REG(UART0_LSR_UART);
+        break;
+    }
   }
-  REG(INTC_CONTROL) = 0x1;
 }
\ No newline at end of file
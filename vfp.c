@@ -0,0 +1,90 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Lazy VFP/NEON context switching, see vfp.h */
+#include <common.h>
+#include <cpu.h>
+#include <interrupt.h>
+#include <vfp.h>
+
+struct vfp_state vfp_main;
+/* main starts out owning the bank init.S enabled */
+struct vfp_state* vfp_current = &vfp_main;
+struct vfp_state* vfp_owner = &vfp_main;
+
+static struct vfp_state vfp_irq_states[VFP_IRQ_LEVELS];
+
+static u32_t vfp_get_fpexc(void) {
+  u32_t fpexc;
+  asm volatile(" vmrs %0, fpexc\n\t" : "=r"(fpexc));
+  return fpexc;
+}
+
+static void vfp_set_fpexc(u32_t fpexc) {
+  asm volatile(" vmsr fpexc, %0\n\t" : : "r"(fpexc) : "memory");
+}
+
+static void vfp_save(struct vfp_state* s) {
+  u64_t* d = s->d;
+  u32_t fpscr;
+
+  asm volatile(" vstmia %0!, {d0-d15}\n\t"
+               " vstmia %0!, {d16-d31}\n\t"
+               " vmrs %1, fpscr\n\t"
+               : "+r"(d), "=r"(fpscr)
+               :
+               : "memory");
+  s->fpscr = fpscr;
+  s->valid = 1;
+}
+
+static void vfp_load(struct vfp_state* s) {
+  u64_t* d = s->d;
+
+  asm volatile(" vldmia %0!, {d0-d15}\n\t"
+               " vldmia %0!, {d16-d31}\n\t"
+               " vmsr fpscr, %1\n\t"
+               : "+r"(d)
+               : "r"(s->fpscr)
+               : "memory");
+}
+
+/* called with IRQs masked */
+void vfp_state_init(struct vfp_state* s) {
+  if (vfp_owner == s) {
+    vfp_owner = NULL;
+  }
+  s->valid = 0;
+}
+
+/* runs in undefined mode with IRQs masked. an undefined instruction with
+   FPEXC.EN set was not a disabled VFP one and is left to exception_handler */
+u32_t vfp_trap(u32_t spsr) {
+  struct vfp_state* s;
+
+  if ((spsr & CPU_MODE_MASK) == CPU_MODE_FIQ || (vfp_get_fpexc() & FPEXC_EN)) {
+    return 1;
+  }
+  s = vfp_current;
+  if (s == NULL) {
+    if (irq_nesting >= VFP_IRQ_LEVELS) {
+      return 1;
+    }
+    s = &vfp_irq_states[irq_nesting];
+    s->valid = 0;
+    vfp_current = s;
+  }
+
+  vfp_set_fpexc(FPEXC_EN);
+  if (vfp_owner != s) {
+    if (vfp_owner != NULL) {
+      vfp_save(vfp_owner);
+    }
+    if (s->valid) {
+      vfp_load(s);
+    } else {
+      /* default FPSCR, round to nearest with no traps, for a fresh context */
+      asm volatile(" vmsr fpscr, %0\n\t" : : "r"(0) : "memory");
+    }
+    vfp_owner = s;
+  }
+  return 0;
+}
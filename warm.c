@@ -0,0 +1,95 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Warm boot record, see warm.h */
+#include <common.h>
+#include <crc32.h>
+#include <log.h>
+#include <mem.h>
+#include <mmu.h>
+#include <prcm.h>
+#include <reloc.h>
+#include <warm.h>
+
+static struct warm_rec* const warm_rec = (struct warm_rec*)WARM_REC_BASE;
+
+static u32_t warm_rec_crc(void) {
+  return crc32_update(0, (const u8_t*)warm_rec, (u32_t)&warm_rec->rec_crc - (u32_t)warm_rec);
+}
+
+/* DDR is write-back cached, the record has to be in memory when the reset
+   comes */
+static void warm_flush(void) {
+  dcache_clean_range(WARM_REC_BASE, sizeof(struct warm_rec));
+}
+
+int warm_reset(void) {
+  return reset_status != 0 && !(reset_status & PRM_RSTST_GLOBAL_COLD_RST);
+}
+
+void warm_clear(void) {
+  warm_rec->magic = 0;
+  warm_rec->num_regions = 0;
+  warm_flush();
+}
+
+void warm_add(u32_t addr, u32_t len, u32_t zero) {
+  struct warm_region* r;
+
+  /* an image with more regions never verifies, commit leaves it invalid */
+  if (warm_rec->num_regions > WARM_MAX_REGIONS) {
+    return;
+  }
+  if (warm_rec->num_regions == WARM_MAX_REGIONS) {
+    warm_rec->num_regions++;
+    return;
+  }
+  r = &warm_rec->regions[warm_rec->num_regions++];
+  r->addr = addr;
+  r->len = len;
+  r->zero = zero;
+}
+
+void warm_commit(u32_t entry, u32_t size, u32_t crc) {
+  if (warm_rec->num_regions > WARM_MAX_REGIONS) {
+    return;
+  }
+  warm_rec->entry = entry;
+  warm_rec->size = size;
+  warm_rec->crc = crc;
+  warm_rec->boots = 0;
+  warm_rec->magic = WARM_MAGIC;
+  warm_rec->rec_crc = warm_rec_crc();
+  warm_flush();
+}
+
+int warm_check(u32_t* entry, u32_t* size) {
+  struct warm_region* r;
+  u32_t i, crc;
+
+  if (!warm_reset() || warm_rec->magic != WARM_MAGIC ||
+      warm_rec->num_regions > WARM_MAX_REGIONS || warm_rec_crc() != warm_rec->rec_crc) {
+    return 1;
+  }
+  if (warm_rec->boots >= WARM_MAX_BOOTS) {
+    LOG1("%u warm boots in a row, loading the kernel again\n\r", warm_rec->boots);
+    return 1;
+  }
+  crc = 0;
+  for (i = 0; i < warm_rec->num_regions; i++) {
+    r = &warm_rec->regions[i];
+    crc = crc32_update(crc, (const u8_t*)r->addr, r->len);
+  }
+  if (crc != warm_rec->crc) {
+    LOG0("kernel in DDR changed since it was loaded\n\r");
+    return 1;
+  }
+  for (i = 0; i < warm_rec->num_regions; i++) {
+    r = &warm_rec->regions[i];
+    mem_zero((void*)(r->addr + r->len), r->zero);
+  }
+  warm_rec->boots++;
+  warm_rec->rec_crc = warm_rec_crc();
+  warm_flush();
+  *entry = warm_rec->entry;
+  *size = warm_rec->size;
+  return 0;
+}
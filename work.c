@@ -0,0 +1,67 @@
+/* Copyright (c) 2023  Hunter Whyte */
+/* Lock-free work queue. Producers are ISRs which can preempt each other, so a
+   slot is claimed with an exclusive compare and swap on the head and then
+   marked ready once it is filled in. There is only ever one consumer at a
+   time, work_run claims the running flag and anyone else finding it taken
+   leaves the queue to the one already draining it.
+*/
+#include <common.h>
+#include <cpu.h>
+#include <work.h>
+
+struct work_item {
+  void (*fn)(u32_t arg);
+  u32_t arg;
+  volatile u32_t ready;
+};
+
+static struct work_item work_queue[WORK_QUEUE_SIZE];
+static volatile u32_t work_head = 0;
+static volatile u32_t work_tail = 0;
+static volatile u32_t work_running = 0;
+volatile u32_t work_dropped = 0;
+
+/* queue fn(arg) to run with IRQs enabled. callable from any context except
+   FIQ, returns 1 if the queue was full and the work was dropped */
+int work_post(void (*fn)(u32_t arg), u32_t arg) {
+  struct work_item* item;
+  u32_t head;
+
+  do {
+    head = work_head;
+    if (head - work_tail >= WORK_QUEUE_SIZE) {
+      cpu_atomic_add(&work_dropped, 1);
+      return 1;
+    }
+  } while (cpu_atomic_cas(&work_head, head, head + 1) != head);
+
+  item = &work_queue[head & (WORK_QUEUE_SIZE - 1)];
+  item->fn = fn;
+  item->arg = arg;
+  /* fn and arg have to be written before the consumer can see ready */
+  asm volatile("" : : : "memory");
+  item->ready = 1;
+  return 0;
+}
+
+/* run queued work until the queue is empty. returns straight away if it is
+   already being drained further down the stack */
+void work_run(void) {
+  struct work_item* item;
+
+  if (cpu_atomic_cas(&work_running, 0, 1) != 0) {
+    return;
+  }
+  while (1) {
+    item = &work_queue[work_tail & (WORK_QUEUE_SIZE - 1)];
+    /* a slot can be claimed but not filled in yet if its producer got
+       preempted, everything behind it waits until it is done */
+    if (work_tail == work_head || !item->ready) {
+      break;
+    }
+    item->ready = 0;
+    item->fn(item->arg);
+    work_tail++;
+  }
+  work_running = 0;
+}